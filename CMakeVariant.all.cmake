@@ -11,6 +11,11 @@ find_library(EXT_LIB_MX_PATH                "mx")
 find_library(EXT_LIB_SSL_PATH               "ssl")
 find_library(EXT_LIB_CRYPTO_PATH            "crypto")
 find_library(EXT_LIB_DL_PATH                "dl")
+find_library(EXT_LIB_PTHREAD_PATH           "pthread")
+
+if(CMAKE_BUILD_VARIANT STREQUAL "test")
+    find_library(EXT_LIB_CUNIT_PATH         "cunit")
+endif()
 
 
 set(PRJ_LIB_NAME        bombus_lib)
@@ -29,10 +34,20 @@ add_subdirectory("library/bombus")
 set(PRJ_APP_NAME        bombus)
 set(PRJ_APP_OUT_NAME    bombus)
 
+if(CMAKE_BUILD_VARIANT STREQUAL "bench")
+    set(PRJ_APP_OUT_NAME    bombus_bench)
+elseif(CMAKE_BUILD_VARIANT STREQUAL "test")
+    set(PRJ_APP_OUT_NAME    bombus_test)
+endif()
+
 
 # add subdirectories
 add_subdirectory("source")
 
+if(CMAKE_BUILD_VARIANT STREQUAL "test")
+    add_subdirectory("test/cunit")
+endif()
+
 
 # Build executable
 
@@ -65,6 +80,11 @@ target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_MX_PATH})
 target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_SSL_PATH})
 target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_CRYPTO_PATH})
 target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_DL_PATH})
+target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_PTHREAD_PATH})
+
+if(CMAKE_BUILD_VARIANT STREQUAL "test")
+    target_link_libraries(${PRJ_APP_NAME} ${EXT_LIB_CUNIT_PATH})
+endif()
 
 
 # install
@@ -13,6 +13,155 @@
 struct stream;
 struct idler;
 struct ssl;
+struct ssl_session_st;
+struct stream_ssl;
+struct bombus;
+struct bombus_inflight;
+struct bombus_connector;
+struct bombus_reader;
+struct bombus_session;
+struct bombus_aliases;
+
+
+/**
+ * Received message view.
+ *
+ * Topic and payload point directly into stream frame buffer, they are valid
+ * only for the duration of handler call. Topic is not null terminated.
+ */
+struct bombus_msg
+{
+    const char *topic;
+    size_t topic_len;
+    const unsigned char *payload;
+    size_t payload_len;
+
+    unsigned short msg_id;
+    unsigned char qos;
+    bool retain;
+    bool dup;
+};
+
+
+/**
+ * Part of large received message.
+ *
+ * Chunks of one message come in order, the first one has zero offset, the
+ * last one ends at payload length. Topic and data are valid only for the
+ * duration of handler call.
+ */
+struct bombus_chunk
+{
+    const char *topic;
+    size_t topic_len;
+    const unsigned char *data;
+    size_t len;
+    size_t offset;
+    size_t payload_len;
+
+    unsigned short msg_id;
+    unsigned char qos;
+    bool retain;
+    bool dup;
+};
+
+
+/**
+ * Large publish written in pieces as socket drains.
+ *
+ * Payload is not copied, it must stay valid and unchanged until upload is
+ * finished, for QoS 1/2 until it is acknowledged.
+ */
+struct bombus_upload
+{
+    const unsigned char *data;
+    size_t len;
+    size_t offset;              // Payload bytes passed to socket
+    unsigned short msg_id;
+    bool active;
+};
+
+
+/**
+ * Counters of topic published with MQTT 5 aliases.
+ *
+ */
+struct bombus_topic_stats
+{
+    const char *topic;
+    unsigned long long publishes;
+    long long saved;                // Net bytes saved by alias
+};
+
+
+/**
+ * PUBLISH header encoded once for topic published repeatedly.
+ *
+ * Only remaining length and packet id are patched for every message. Handle
+ * does not belong to any client, it may be used by clients of one thread.
+ * QoS 1/2 messages in flight reference its topic, so it must outlive them.
+ */
+struct bombus_prepared
+{
+    char *topic;
+    unsigned char qos;
+    bool retain;
+
+    unsigned char *header;          // Room for fixed header, topic and packet id
+    size_t variable_len;            // Topic and packet id
+};
+
+
+typedef void (*bombus_msg_handler)(void *object, struct bombus *bombus, const struct bombus_msg *msg);
+typedef void (*bombus_conn_handler)(void *object, struct bombus *bombus, bool connected);
+typedef void (*bombus_chunk_handler)(void *object, struct bombus *bombus, const struct bombus_chunk *chunk);
+typedef void (*bombus_timer_handler)(void *object, struct bombus *bombus, unsigned long long deadline);
+
+
+enum bombus_state_e {
+    BOMBUS_STATE_DISCONNECTED = 0,
+    BOMBUS_STATE_CONNECTING,        // Non-blocking socket connect in progress
+    BOMBUS_STATE_HANDSHAKE,         // TLS/WebSocket handshake and CONNACK pending
+    BOMBUS_STATE_CONNECTED,
+    BOMBUS_STATE_BACKOFF,           // Waiting for next connection attempt
+    BOMBUS_STATE_FAILED,            // Reconnection attempts exhausted
+};
+
+
+struct bombus_qos_stats
+{
+    unsigned long long published;
+    unsigned long long acknowledged;    // PUBACK for QoS 1, PUBCOMP for QoS 2
+    unsigned long long retransmitted;
+    unsigned long long rejected;        // In-flight window full
+    unsigned long long refused;         // MQTT 5 PUBACK or PUBREC with failure reason
+};
+
+
+#define BOMBUS_METRICS_TYPES    16     // Indexed by MQTT packet type
+#define BOMBUS_MAX_INFLIGHT     32768  // Half of packet id space
+
+
+/**
+ * Traffic counters.
+ *
+ * Updated only by the thread owning client, without synchronization.
+ */
+struct bombus_metrics
+{
+    unsigned long long packets_in[BOMBUS_METRICS_TYPES];
+    unsigned long long packets_out[BOMBUS_METRICS_TYPES];
+    // Packets encoded by stream are estimated from their fields
+    unsigned long long bytes_in[BOMBUS_METRICS_TYPES];
+    unsigned long long bytes_out[BOMBUS_METRICS_TYPES];
+
+    unsigned long long connects;
+    unsigned long long reconnects;
+    unsigned long long connect_time_ms;     // Sum of times from attempt start to CONNACK
+
+
+    long long alias_saved;                  // Net bytes saved by MQTT 5 aliases, alias properties deducted
+};
 
 
 struct bombus
@@ -23,19 +172,72 @@ struct bombus
     unsigned int port;
 
     struct ssl *ssl;
+    struct stream_ssl *stream_ssl;              // TLS layer of current stream
+    struct ssl_session_st *tls_session;         // Last session, offered on reconnect
     bool websocket;
     char *websocket_uri;
 
     struct stream *stream;
     struct idler *idler;
 
+    void *msg_object;
+    bombus_msg_handler msg_handler;
+    void *conn_object;
+    bombus_conn_handler conn_handler;
+    void *timer_object;
+    bombus_timer_handler timer_handler;
+    void *chunk_object;
+    bombus_chunk_handler chunk_handler;
+
+    struct bombus_reader *reader;   // Frames decoded by library, large payloads streamed
+    struct bombus_chunk chunk;      // Large message being received
+    bool chunk_deliver;
+
     struct mqtt_conf mqtt_conf;
     struct mqtt_msg mqtt_will;
 
-    unsigned int msg_id;
+    bool mqtt5;                     // Protocol 5 encoded by library, otherwise 3.1.1 by stream
+    struct bombus_aliases *aliases; // Outgoing topic aliases, MQTT 5
+    unsigned int receive_max;       // Broker limit of QoS 1/2 in flight, zero if none
+    size_t max_packet_size;         // Broker limit, zero if none
+    unsigned short server_keep_alive;   // Broker override of keep alive, MQTT 5, zero if none
+
+    struct bombus_inflight *inflight;
+    struct bombus_session *session;     // Stored QoS 1/2 state, optional
+    struct bombus_qos_stats qos_stats;
+    struct bombus_metrics metrics;
+
+    struct bombus_upload upload;
+    unsigned int *deferred_acks;    // Packet type and id held back while upload is written
+    unsigned int deferred_len;
+    unsigned int deferred_size;
+
+    unsigned char *cork_buffer;
+    size_t cork_len;
+    size_t cork_size;
+    unsigned long cork_delay_ms;
+    unsigned long long cork_time;
+
     unsigned char wait_msg_type;
     bool connected;
     int reconnection_attempts;
+
+    unsigned char state;
+    struct bombus_connector *connector;     // Socket connections racing
+    bool clean_session;
+    bool session_present;           // Broker kept session, from last CONNACK
+    int attempts;
+    unsigned long long state_deadline;
+    unsigned long long attempt_time;
+    unsigned long long connack_time;        // MQTT 5 retransmits only messages sent before it
+    unsigned long long keep_alive_time;     // Next stream keep alive check
+    unsigned long long ping_time;           // MQTT 5 PINGREQ waiting for PINGRESP, zero if none
+    unsigned long long ping_packets;        // Packets sent at last MQTT 5 keep alive check
+    unsigned long long deadline;            // Earliest pending deadline, zero if none
+    unsigned long connect_timeout_ms;
+    unsigned long backoff_base_ms;
+    unsigned long backoff_max_ms;
+    unsigned int backoff_seed;
 };
 
 
@@ -56,9 +258,25 @@ void bombus_configure_address(struct bombus *self, const char *address, unsigned
 void bombus_configure_ssl(struct bombus *self, struct ssl *ssl);
 void bombus_configure_websocket(struct bombus *self, const char *uri);
 
+void bombus_configure_mqtt5(struct bombus *self, unsigned int topic_aliases);
+void bombus_configure_inflight(struct bombus *self, unsigned int max_inflight, unsigned long timeout_ms);
+bool bombus_configure_session(struct bombus *self, const char *path);
+void bombus_configure_cork(struct bombus *self, size_t max_bytes, unsigned long max_delay_ms);
+
+void bombus_configure_streaming(struct bombus *self, size_t threshold, void *object, bombus_chunk_handler handler);
+void bombus_configure_reconnect(struct bombus *self, int attempts, unsigned long connect_timeout_ms, unsigned long backoff_base_ms, unsigned long backoff_max_ms);
+
+void bombus_set_msg_handler(struct bombus *self, void *object, bombus_msg_handler handler);
+void bombus_set_conn_handler(struct bombus *self, void *object, bombus_conn_handler handler);
+void bombus_set_timer_handler(struct bombus *self, void *object, bombus_timer_handler handler);
+
 bool bombus_connect(struct bombus *self, bool clean_session);
 void bombus_disconnect(struct bombus *self);
 bool bombus_is_connected(struct bombus *self);
+int bombus_get_state(struct bombus *self);
+bool bombus_is_session_present(struct bombus *self);
+bool bombus_has_subscription(struct bombus *self, const char *topic, unsigned char qos);
+unsigned int bombus_get_subscriptions(struct bombus *self, const char **topics, unsigned int max);
 
 int bombus_wait_for_data(struct bombus *self, unsigned long timeout_ms);
 bool bombus_wait_for_msg(struct bombus *self, unsigned char mqtt_msg_type, unsigned long timeout_ms);
@@ -68,10 +286,23 @@ int bombus_read_data(struct bombus *self);
 
 void bombus_subscribe(struct bombus *self, const char *topic, unsigned char qos);
 void bombus_unsubscribe(struct bombus *self, const char *topic);
-void bombus_publish(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len);
+bool bombus_publish(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len);
+bool bombus_publish_prepared(struct bombus *self, struct bombus_prepared *prepared, const void *data, size_t data_len);
+bool bombus_publish_large(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len);
+bool bombus_handle_upload(struct bombus *self);
+bool bombus_is_uploading(struct bombus *self);
+size_t bombus_get_upload_progress(struct bombus *self);
+struct bombus_prepared* bombus_prepared_new(const char *topic, unsigned char qos, bool retain);
+struct bombus_prepared* bombus_prepared_delete(struct bombus_prepared *self);
+
+unsigned int bombus_get_inflight_count(struct bombus *self);
+unsigned int bombus_get_topic_stats(struct bombus *self, struct bombus_topic_stats *stats, unsigned int max);
+size_t bombus_get_outgoing_len(struct bombus *self);
+void bombus_flush(struct bombus *self, bool force);
 
 void bombus_handle_stream(struct bombus *self);
 void bombus_handle_time(struct bombus *self);
+unsigned long long bombus_get_deadline(struct bombus *self);
 
 
 #endif /* __BOMBUS_CLIENT_H_ */
@@ -17,7 +17,7 @@
 enum bombus_dbg_types_e {
     BOMBUS_DBG_MQTT        = (0x1 << 0),
     BOMBUS_DBG_CLIENT      = (0x1 << 1),
-//    BOMBUS_DBG_BROKER      = (0x1 << 2),
+    BOMBUS_DBG_BROKER      = (0x1 << 2),
 };
 
 
@@ -0,0 +1,235 @@
+
+#include "alias.h"
+
+#include "mx/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BOMBUS_ALIAS_TOPICS_INITIAL_SIZE    16
+
+
+
+
+static uint32_t bombus_alias_hash(const char *topic, size_t topic_len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<topic_len; i++)
+        hash = (hash ^ (unsigned char)topic[i]) * 16777619u;
+    return hash;
+}
+
+
+static void bombus_aliases_resize(struct bombus_aliases *self, unsigned int size)
+{
+    struct bombus_alias_topic **topics = xmalloc(size * sizeof(struct bombus_alias_topic*));
+    memset(topics, 0, size * sizeof(struct bombus_alias_topic*));
+
+    for (unsigned int i=0; i<self->topics_size; i++) {
+        struct bombus_alias_topic *topic = self->topics[i];
+        while (topic) {
+            struct bombus_alias_topic *next = topic->next;
+            unsigned int idx = topic->hash & (size - 1);
+            topic->next = topics[idx];
+            topics[idx] = topic;
+            topic = next;
+        }
+    }
+
+    if (self->topics)
+        xfree(self->topics);
+    self->topics = topics;
+    self->topics_size = size;
+}
+
+
+/**
+ * Find counters of topic, add them on first publish.
+ *
+ */
+static struct bombus_alias_topic* bombus_aliases_topic(struct bombus_aliases *self, const char *topic, size_t topic_len)
+{
+    uint32_t hash = bombus_alias_hash(topic, topic_len);
+
+    if (self->topics_num > 0) {
+        struct bombus_alias_topic *entry = self->topics[hash & (self->topics_size - 1)];
+        while (entry) {
+            if (entry->hash == hash && entry->topic_len == topic_len && !memcmp(entry->topic, topic, topic_len))
+                return entry;
+            entry = entry->next;
+        }
+    }
+
+    if (self->topics_num >= self->topics_size)
+        bombus_aliases_resize(self, self->topics_size ? self->topics_size*2 : BOMBUS_ALIAS_TOPICS_INITIAL_SIZE);
+
+    struct bombus_alias_topic *entry = xmalloc(sizeof(struct bombus_alias_topic));
+    memset(entry, 0, sizeof(struct bombus_alias_topic));
+    entry->topic = xmalloc(topic_len + 1);
+    memcpy(entry->topic, topic, topic_len);
+    entry->topic[topic_len] = '\0';
+    entry->topic_len = topic_len;
+    entry->hash = hash;
+
+    unsigned int idx = hash & (self->topics_size - 1);
+    entry->next = self->topics[idx];
+    self->topics[idx] = entry;
+    self->topics_num++;
+
+    return entry;
+}
+
+
+static void bombus_aliases_unlink(struct bombus_aliases *self, struct bombus_alias *slot)
+{
+    if (slot->older)
+        slot->older->newer = slot->newer;
+    else
+        self->oldest = slot->newer;
+    if (slot->newer)
+        slot->newer->older = slot->older;
+    else
+        self->newest = slot->older;
+}
+
+
+static void bombus_aliases_append(struct bombus_aliases *self, struct bombus_alias *slot)
+{
+    slot->older = self->newest;
+    slot->newer = NULL;
+    if (self->newest)
+        self->newest->newer = slot;
+    else
+        self->oldest = slot;
+    self->newest = slot;
+}
+
+
+static int bombus_aliases_compare_used(const void *a, const void *b)
+{
+    unsigned long long used_a = (*(struct bombus_alias* const*)a)->used;
+    unsigned long long used_b = (*(struct bombus_alias* const*)b)->used;
+    return used_a < used_b ? -1 : used_a > used_b;
+}
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct bombus_aliases* bombus_aliases_new(unsigned int size)
+{
+    struct bombus_aliases *self = xmalloc(sizeof(struct bombus_aliases));
+
+    self->slots = xmalloc(size * sizeof(struct bombus_alias));
+    memset(self->slots, 0, size * sizeof(struct bombus_alias));
+    self->size = size;
+    self->max = 0;
+    self->clock = 0;
+    self->oldest = NULL;
+    self->newest = NULL;
+
+    self->topics = NULL;
+    self->topics_size = 0;
+    self->topics_num = 0;
+
+    return self;
+}
+
+
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_aliases* bombus_aliases_delete(struct bombus_aliases *self)
+{
+    for (unsigned int i=0; i<self->topics_size; i++) {
+        struct bombus_alias_topic *topic = self->topics[i];
+        while (topic) {
+            struct bombus_alias_topic *next = topic->next;
+            xfree(topic->topic);
+            xfree(topic);
+            topic = next;
+        }
+    }
+    if (self->topics)
+        xfree(self->topics);
+    xfree(self->slots);
+    return xfree(self);
+}
+
+
+/**
+ * Start new connection, broker knows no aliases.
+ *
+ * Granted slots are chained in order of last use, empty ones first.
+ *
+ */
+void bombus_aliases_reset(struct bombus_aliases *self, unsigned int max)
+{
+    self->max = max < self->size ? max : self->size;
+    for (unsigned int i=0; i<self->size; i++)
+        self->slots[i].assigned = false;
+
+    self->oldest = NULL;
+    self->newest = NULL;
+    if (self->max == 0)
+        return;
+
+    struct bombus_alias **order = xmalloc(self->max * sizeof(struct bombus_alias*));
+    for (unsigned int i=0; i<self->max; i++)
+        order[i] = &self->slots[i];
+    qsort(order, self->max, sizeof(struct bombus_alias*), bombus_aliases_compare_used);
+    for (unsigned int i=0; i<self->max; i++)
+        bombus_aliases_append(self, order[i]);
+    xfree(order);
+}
+
+
+/**
+ * Get alias for topic, assign it if needed.
+ *
+ * Known is set when broker already has mapping and topic may be omitted.
+ * Returns zero when aliases are not granted.
+ *
+ */
+unsigned short bombus_aliases_get(struct bombus_aliases *self, const char *topic, size_t topic_len, bool *known)
+{
+    *known = false;
+    if (self->max == 0)
+        return 0;
+
+    struct bombus_alias_topic *entry = bombus_aliases_topic(self, topic, topic_len);
+    struct bombus_alias *slot;
+
+    if (entry->alias == 0 || entry->alias > self->max) {
+        // Least recently used slot takes new topic
+        slot = self->oldest;
+        if (slot->topic)
+            slot->topic->alias = 0;
+        if (entry->alias != 0)
+            self->slots[entry->alias - 1].topic = NULL;
+        slot->topic = entry;
+        slot->assigned = false;
+        entry->alias = (unsigned short)(slot - self->slots) + 1;
+    }
+    else {
+        slot = &self->slots[entry->alias - 1];
+    }
+
+    *known = slot->assigned;
+    slot->assigned = true;
+    slot->used = ++self->clock;
+    bombus_aliases_unlink(self, slot);
+    bombus_aliases_append(self, slot);
+
+    entry->publishes++;
+    entry->saved += (*known ? (long long)topic_len : 0) - BOMBUS_ALIAS_PROPERTY_LEN;
+
+    return entry->alias;
+}
@@ -0,0 +1,72 @@
+#ifndef __BOMBUS_ALIAS_H_
+#define __BOMBUS_ALIAS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/**
+ * Counters of topic published with aliases, kept when topic loses its slot.
+ *
+ */
+struct bombus_alias_topic
+{
+    char *topic;
+    size_t topic_len;
+    uint32_t hash;
+    struct bombus_alias_topic *next;    // Next topic in bucket
+
+    unsigned short alias;       // Slot index plus one, zero if topic has no slot
+    unsigned long long publishes;
+    long long saved;            // Topic bytes not sent less alias properties
+};
+
+
+struct bombus_alias
+{
+    struct bombus_alias_topic *topic;
+    bool assigned;              // Broker knows mapping on current connection
+
+    unsigned long long used;    // Last use stamp
+    struct bombus_alias *older; // Reuse order of granted slots
+    struct bombus_alias *newer;
+};
+
+
+/**
+ * Outgoing MQTT 5 topic aliases.
+ *
+ * Alias is slot index plus one. Topics are hashed, so known alias is found
+ * in constant time. Slots are reused in least recently used order, only
+ * slots granted by broker on current connection are used. Topics stay in
+ * slots between connections, mappings are sent again.
+ *
+ */
+struct bombus_aliases
+{
+    struct bombus_alias *slots;
+    unsigned int size;
+    unsigned int max;           // Granted by broker
+    unsigned long long clock;
+    struct bombus_alias *oldest;    // Next slot to reuse
+    struct bombus_alias *newest;
+
+    struct bombus_alias_topic **topics;
+    unsigned int topics_size;
+    unsigned int topics_num;
+};
+
+
+#define BOMBUS_ALIAS_PROPERTY_LEN   3   // Topic alias property id and value
+
+
+struct bombus_aliases* bombus_aliases_new(unsigned int size);
+struct bombus_aliases* bombus_aliases_delete(struct bombus_aliases *self);
+
+void bombus_aliases_reset(struct bombus_aliases *self, unsigned int max);
+unsigned short bombus_aliases_get(struct bombus_aliases *self, const char *topic, size_t topic_len, bool *known);
+
+
+#endif /* __BOMBUS_ALIAS_H_ */
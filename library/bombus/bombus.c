@@ -2,6 +2,14 @@
 #include "bombus/client.h"
 #include "bombus/log.h"
 
+#include "inflight.h"
+#include "packet.h"
+#include "connector.h"
+#include "reader.h"
+#include "session.h"
+#include "alias.h"
+#include "clock.h"
+
 #include "mx/memory.h"
 #include "mx/string.h"
 #include "mx/stream.h"
@@ -12,14 +20,118 @@
 #include "mx/idler.h"
 #include "mx/misc.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
 
 
+#define BOMBUS_DEFAULT_MAX_INFLIGHT     32
+#define BOMBUS_DEFAULT_ACK_TIMEOUT      10000
+#define BOMBUS_DEFAULT_CONNECT_TIMEOUT  5000
+#define BOMBUS_DEFAULT_BACKOFF_BASE     500
+#define BOMBUS_DEFAULT_BACKOFF_MAX      30000
+#define BOMBUS_UPLOAD_CHUNK             (256*1024)
+#define BOMBUS_UPLOAD_BURST             16
+#define BOMBUS_READ_SIZE                (16*1024)
 
 
 
 static int bombus_handle_incomming_data(void *parent, struct stream *stream);
+static int bombus_handle_attempt(void *object, struct stream *stream);
 static int bombus_handle_received_msg(void *object, struct stream_mqtt *stream, unsigned char type, unsigned char flags, void *mqtt_msg);
+static void bombus_resend_inflight(struct bombus *self, bool all);
+static void bombus_start_attempt(struct bombus *self);
+static void bombus_close(struct bombus *self);
+static void bombus_schedule_reconnect(struct bombus *self);
+static void bombus_rearm(struct bombus *self);
+static void bombus_send_ack(struct bombus *self, unsigned char type, unsigned short msg_id);
+static size_t bombus_start_upload(struct bombus *self, unsigned short msg_id, bool dup, unsigned char qos, bool retain,
+                                  const char *topic, const void *data, size_t data_len);
+
+
+
+static inline void bombus_count_in(struct bombus *self, unsigned char type, size_t remaining_len)
+{
+    type &= 0x0F;
+    self->metrics.packets_in[type]++;
+    self->metrics.bytes_in[type] += bombus_packet_size(remaining_len);
+}
+
+
+static inline void bombus_count_out(struct bombus *self, unsigned char type, size_t remaining_len)
+{
+    type &= 0x0F;
+    self->metrics.packets_out[type]++;
+    self->metrics.bytes_out[type] += bombus_packet_size(remaining_len);
+}
+
+
+static unsigned long long bombus_packets_out(const struct bombus *self)
+{
+    unsigned long long packets = 0;
+
+    for (unsigned int i=0; i<BOMBUS_METRICS_TYPES; i++)
+        packets += self->metrics.packets_out[i];
+    return packets;
+}
+
+
+/**
+ * Keep alive in use, MQTT 5 broker may override configured one.
+ *
+ */
+static inline unsigned short bombus_keep_alive(const struct bombus *self)
+{
+    return self->server_keep_alive > 0 ? self->server_keep_alive : self->mqtt_conf.keep_alive;
+}
+
+
+/**
+ * Notify timer handler when deadline earlier than armed one appears.
+ *
+ */
+static inline void bombus_arm(struct bombus *self, unsigned long long deadline)
+{
+    if (self->deadline != 0 && self->deadline <= deadline)
+        return;
+
+    self->deadline = deadline;
+    if (self->timer_handler)
+        self->timer_handler(self->timer_object, self, deadline);
+}
+
+
+static inline unsigned long long bombus_min_deadline(unsigned long long a, unsigned long long b)
+{
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+    return a < b ? a : b;
+}
+
+
+static inline size_t bombus_publish_remaining_len(unsigned char qos, size_t topic_len, size_t payload_len)
+{
+    return 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+}
+
+
+static inline bool bombus_window_is_full(struct bombus *self)
+{
+    // MQTT 5 broker may take fewer messages than configured window
+    return bombus_inflight_is_full(self->inflight) || (self->receive_max > 0 && self->inflight->count >= self->receive_max);
+}
+
+
+static inline bool bombus_fits_packet(struct bombus *self, unsigned char qos, size_t topic_len, size_t payload_len)
+{
+    // Topic alias property is counted in, whether used or not
+    return self->max_packet_size == 0 ||
+           bombus_packet_size(bombus_publish_remaining_len(qos, topic_len, payload_len) + 1 + 3) <= self->max_packet_size;
+}
 
 
 
@@ -51,16 +163,67 @@ void bombus_init(struct bombus *self)
     self->stream = NULL;
     self->idler = NULL;
     self->ssl = NULL;
+    self->stream_ssl = NULL;
+    self->tls_session = NULL;
     self->websocket = false;
     self->websocket_uri = NULL;
 
+    self->msg_object = NULL;
+    self->msg_handler = NULL;
+    self->conn_object = NULL;
+    self->conn_handler = NULL;
+    self->timer_object = NULL;
+    self->timer_handler = NULL;
+    self->chunk_object = NULL;
+    self->chunk_handler = NULL;
+
+    self->reader = NULL;
+    memset(&self->chunk, 0, sizeof(self->chunk));
+    self->chunk_deliver = false;
+
     mqtt_conf_init(&self->mqtt_conf);
     mqtt_msg_init(&self->mqtt_will);
 
-    self->msg_id = 1;
+    self->mqtt5 = false;
+    self->aliases = NULL;
+    self->receive_max = 0;
+    self->max_packet_size = 0;
+
+    self->inflight = bombus_inflight_new(BOMBUS_DEFAULT_MAX_INFLIGHT, BOMBUS_DEFAULT_ACK_TIMEOUT);
+    self->session = NULL;
+    memset(&self->qos_stats, 0, sizeof(self->qos_stats));
+    memset(&self->metrics, 0, sizeof(self->metrics));
+
+    memset(&self->upload, 0, sizeof(self->upload));
+    self->deferred_acks = NULL;
+    self->deferred_len = 0;
+    self->deferred_size = 0;
+
+    self->cork_buffer = NULL;
+    self->cork_len = 0;
+    self->cork_size = 0;
+    self->cork_delay_ms = 0;
+    self->cork_time = 0;
+
     self->wait_msg_type = 0;
     self->connected = false;
     self->reconnection_attempts = 3;
+
+    self->state = BOMBUS_STATE_DISCONNECTED;
+    self->connector = bombus_connector_new(self, bombus_handle_attempt);
+    self->clean_session = true;
+    self->session_present = false;
+    self->attempts = 0;
+    self->state_deadline = 0;
+    self->attempt_time = 0;
+    self->keep_alive_time = 0;
+    self->ping_time = 0;
+    self->ping_packets = 0;
+    self->deadline = 0;
+    self->connect_timeout_ms = BOMBUS_DEFAULT_CONNECT_TIMEOUT;
+    self->backoff_base_ms = BOMBUS_DEFAULT_BACKOFF_BASE;
+    self->backoff_max_ms = BOMBUS_DEFAULT_BACKOFF_MAX;
+    self->backoff_seed = (unsigned int)(bombus_clock_ms() ^ (uintptr_t)self);
 }
 
 
@@ -74,11 +237,39 @@ void bombus_clean(struct bombus *self)
         self->stream = stream_delete(self->stream);
     }
 
+    if (self->connector)
+        self->connector = bombus_connector_delete(self->connector);
+
     if (self->websocket_uri)
         self->websocket_uri = xfree(self->websocket_uri);
 
     self->idler = NULL;
     self->ssl = NULL;
+    self->stream_ssl = NULL;
+    if (self->tls_session) {
+        SSL_SESSION_free(self->tls_session);
+        self->tls_session = NULL;
+    }
+
+    if (self->session)
+        self->session = bombus_session_close(self->session);
+    if (self->inflight)
+        self->inflight = bombus_inflight_delete(self->inflight);
+
+    if (self->cork_buffer)
+        self->cork_buffer = xfree(self->cork_buffer);
+    self->cork_len = 0;
+    self->cork_size = 0;
+
+    if (self->deferred_acks)
+        self->deferred_acks = xfree(self->deferred_acks);
+    self->deferred_len = 0;
+    self->deferred_size = 0;
+
+    if (self->reader)
+        self->reader = bombus_reader_delete(self->reader);
+    if (self->aliases)
+        self->aliases = bombus_aliases_delete(self->aliases);
 
     mqtt_conf_clean(&self->mqtt_conf);
     mqtt_msg_clean(&self->mqtt_will);
@@ -148,70 +339,516 @@ void bombus_configure_websocket(struct bombus *self, const char *uri)
 }
 
 
+/**
+ * Speak MQTT 5 instead of 3.1.1.
+ *
+ * Frames are encoded and decoded by library then. Up to topic_aliases
+ * topics published most recently are sent as aliases, within limit granted
+ * by broker. Receive Maximum and Maximum Packet Size from CONNACK limit
+ * publishing.
+ *
+ */
+void bombus_configure_mqtt5(struct bombus *self, unsigned int topic_aliases)
+{
+    self->mqtt5 = true;
+
+    if (self->aliases)
+        self->aliases = bombus_aliases_delete(self->aliases);
+    if (topic_aliases > 0)
+        self->aliases = bombus_aliases_new(topic_aliases < 65535 ? topic_aliases : 65535);
+
+    if (!self->reader)
+        self->reader = bombus_reader_new(BOMBUS_PACKET_MAX_REMAINING_LEN);
+    self->reader->v5 = true;
+}
+
+
+/**
+ * Configure QoS 1/2 in-flight window.
+ *
+ * Messages not acknowledged within timeout are retransmitted, pending
+ * messages are dropped.
+ *
+ */
+void bombus_configure_inflight(struct bombus *self, unsigned int max_inflight, unsigned long timeout_ms)
+{
+    char *session_path = self->session ? xstrdup(self->session->path) : NULL;
+
+    if (self->session)
+        self->session = bombus_session_close(self->session);
+    if (self->inflight)
+        bombus_inflight_delete(self->inflight);
+    self->inflight = bombus_inflight_new(max_inflight, timeout_ms);
+
+    if (session_path) {
+        // Stored state is loaded into new table
+        bombus_configure_session(self, session_path);
+        xfree(session_path);
+    }
+}
+
+
+/**
+ * Keep QoS 1/2 state in file.
+ *
+ * Unacknowledged messages and incoming QoS 2 ids stored by previous run are
+ * restored into in-flight table, so they are resent after connection with
+ * clean_session false.
+ *
+ */
+bool bombus_configure_session(struct bombus *self, const char *path)
+{
+    if (self->session) {
+        self->inflight->session = NULL;
+        self->session = bombus_session_close(self->session);
+    }
+
+    self->session = bombus_session_open(path, self->inflight);
+    self->inflight->session = self->session;
+
+    return self->session != NULL;
+}
+
+
+/**
+ * Configure publish corking.
+ *
+ * Publishes are encoded into one buffer and written with single write when
+ * buffer exceeds max_bytes or on bombus_flush() after max_delay_ms.
+ * Zero max_bytes disables corking.
+ *
+ */
+void bombus_configure_cork(struct bombus *self, size_t max_bytes, unsigned long max_delay_ms)
+{
+    bombus_flush(self, true);
+
+    if (self->cork_buffer)
+        self->cork_buffer = xfree(self->cork_buffer);
+    self->cork_size = max_bytes;
+    self->cork_delay_ms = max_delay_ms;
+    if (max_bytes > 0)
+        self->cork_buffer = xmalloc(max_bytes);
+}
+
+
+/**
+ * Configure streaming of large received messages.
+ *
+ * Frames are decoded by library instead of stream, publishes with more than
+ * threshold bytes are passed to handler in chunks as they arrive and never
+ * kept whole. Zero threshold disables streaming. Takes effect with next
+ * connection.
+ *
+ */
+void bombus_configure_streaming(struct bombus *self, size_t threshold, void *object, bombus_chunk_handler handler)
+{
+    if (self->reader)
+        self->reader = bombus_reader_delete(self->reader);
+
+    self->chunk_object = object;
+    self->chunk_handler = handler;
+    if (threshold > 0 || self->mqtt5) {
+        // MQTT 5 frames are always decoded by library
+        self->reader = bombus_reader_new(threshold > 0 ? threshold : BOMBUS_PACKET_MAX_REMAINING_LEN);
+        self->reader->v5 = self->mqtt5;
+    }
+}
+
+
+/**
+ * Configure reconnection.
+ *
+ * Negative attempts means reconnect forever, delays between attempts grow
+ * exponentially from backoff_base_ms up to backoff_max_ms with random jitter.
+ *
+ */
+void bombus_configure_reconnect(struct bombus *self, int attempts, unsigned long connect_timeout_ms, unsigned long backoff_base_ms, unsigned long backoff_max_ms)
+{
+    self->reconnection_attempts = attempts;
+    self->connect_timeout_ms = connect_timeout_ms;
+    self->backoff_base_ms = backoff_base_ms;
+    self->backoff_max_ms = backoff_max_ms > backoff_base_ms ? backoff_max_ms : backoff_base_ms;
+}
+
+
+void bombus_set_msg_handler(struct bombus *self, void *object, bombus_msg_handler handler)
+{
+    self->msg_object = object;
+    self->msg_handler = handler;
+}
+
+
+void bombus_set_conn_handler(struct bombus *self, void *object, bombus_conn_handler handler)
+{
+    self->conn_object = object;
+    self->conn_handler = handler;
+}
+
+
+/**
+ * Set handler notified about new client deadline.
+ *
+ * Handler is called whenever deadline gets earlier or is recalculated,
+ * bombus_handle_time() is expected to be called at that time. Zero deadline
+ * means nothing is pending.
+ *
+ */
+void bombus_set_timer_handler(struct bombus *self, void *object, bombus_timer_handler handler)
+{
+    self->timer_object = object;
+    self->timer_handler = handler;
+}
+
+
+/**
+ * Start connection.
+ *
+ * Connection is established asynchronously, driven by bombus_handle_time()
+ * and incoming data, connection handler is notified about CONNACK.
+ * Broken connections are reestablished according to reconnect configuration.
+ *
+ */
 bool bombus_connect(struct bombus *self, bool clean_session)
 {
-    bool ret = false;
-    int fd = -1;
+    if (self->state != BOMBUS_STATE_DISCONNECTED && self->state != BOMBUS_STATE_FAILED)
+        return true;    // Already in progress
 
-    if (self->port > 0) {
-        BOMBUS_INFO("Connect to %s:%d", self->address, self->port);
-        fd = socket_connect_inet(self->socket_family, self->address, self->port);
+    self->clean_session = clean_session;
+    self->attempts = 0;
+    bombus_start_attempt(self);
+    bombus_rearm(self);
+
+    return self->state != BOMBUS_STATE_FAILED;
+}
+
+
+/**
+ * Offer last session of this client, server decides whether abbreviated
+ * handshake is done.
+ *
+ */
+static void bombus_resume_tls(struct bombus *self, struct stream_ssl *stream_ssl)
+{
+    if (self->tls_session)
+        SSL_set_session(stream_ssl_get_ssl(stream_ssl), self->tls_session);
+}
+
+
+/**
+ * Keep session of finished handshake for next connection.
+ *
+ */
+static void bombus_store_tls(struct bombus *self)
+{
+    SSL *ssl = stream_ssl_get_ssl(self->stream_ssl);
+    bool resumed = SSL_session_reused(ssl);
+
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d TLS session %s", stream_get_fd(self->stream), resumed ? "resumed" : "established");
+
+    SSL_SESSION *session = SSL_get1_session(ssl);
+    if (!session)
+        return;
+    if (!SSL_SESSION_is_resumable(session)) {
+        SSL_SESSION_free(session);
+        return;
     }
-    else {
-        BOMBUS_INFO("Connect to %s", self->address);
-        fd = socket_connect_unix(self->address);
+
+    if (self->tls_session)
+        SSL_SESSION_free(self->tls_session);
+    self->tls_session = session;
+}
+
+
+static inline size_t bombus_put_data(unsigned char *buffer, const void *data, size_t len)
+{
+    buffer[0] = (len >> 8) & 0xFF;
+    buffer[1] = len & 0xFF;
+    if (len > 0)
+        memcpy(&buffer[2], data, len);
+    return 2 + len;
+}
+
+
+/**
+ * Write length prefixed field, data is not copied on stack.
+ *
+ */
+static void bombus_write_data(struct stream *stream, const void *data, size_t len)
+{
+    unsigned char prefix[2] = { (len >> 8) & 0xFF, len & 0xFF };
+
+    stream_write(stream, prefix, sizeof(prefix));
+    if (len > 0)
+        stream_write(stream, data, len);
+}
+
+
+/**
+ * Encode MQTT 5 CONNECT.
+ *
+ * Persistent session must be given expiry interval, otherwise broker drops
+ * it on disconnection. Topic Alias Maximum is not sent, broker does not use
+ * aliases towards client then.
+ *
+ */
+static void bombus_write_connect_v5(struct bombus *self, struct stream *stream)
+{
+    const struct mqtt_conf *conf = &self->mqtt_conf;
+    const struct mqtt_msg *will = &self->mqtt_will;
+    const char *client_id = conf->client_id ? conf->client_id : "";
+    unsigned char flags = self->clean_session ? 0x02 : 0;
+    size_t properties_len = self->clean_session ? 0 : 5;
+
+    size_t remaining_len = 10 + 1 + properties_len + 2 + strlen(client_id);
+    if (will->topic) {
+        remaining_len += 1 + 2 + strlen(will->topic) + 2 + will->payload_len;
+        flags |= 0x04 | ((will->qos & 0x03) << 3) | (will->retain ? 0x20 : 0);
+    }
+    if (conf->user_name) {
+        remaining_len += 2 + strlen(conf->user_name) + 2 + conf->password_len;
+        flags |= 0x80 | 0x40;
     }
 
-    if (socket_is_valid(fd)) {
-        socket_set_non_blocking(fd, 1);
+    // Fixed header, variable header and properties, payload fields follow
+    unsigned char buffer[1 + 4 + 10 + 1 + 5];
+    size_t pos = 0;
+
+    buffer[pos++] = MQTT_CONNECT << 4;
+    pos += bombus_packet_encode_remaining_len(&buffer[pos], remaining_len);
+    pos += bombus_put_data(&buffer[pos], "MQTT", 4);
+    buffer[pos++] = 5;
+    buffer[pos++] = flags;
+    buffer[pos++] = (conf->keep_alive >> 8) & 0xFF;
+    buffer[pos++] = conf->keep_alive & 0xFF;
+
+    buffer[pos++] = properties_len;
+    if (!self->clean_session) {
+        buffer[pos++] = PROPERTY_SESSION_EXPIRY;
+        memset(&buffer[pos], 0xFF, 4);
+        pos += 4;
+    }
 
-        struct stream *stream = stream_new(fd);
+    stream_write(stream, buffer, pos);
 
-        if (self->ssl) {
-            // Wrap stream with ssl
-            struct stream_ssl *stream_ssl = stream_ssl_new(self->ssl, stream);
-            stream_ssl_connect(stream_ssl);
-            stream = stream_ssl_to_stream(stream_ssl);
-        }
+    bombus_write_data(stream, client_id, strlen(client_id));
+    if (will->topic) {
+        unsigned char will_properties = 0;
+        stream_write(stream, &will_properties, 1);
+        bombus_write_data(stream, will->topic, strlen(will->topic));
+        bombus_write_data(stream, will->payload, will->payload_len);
+    }
+    if (conf->user_name) {
+        bombus_write_data(stream, conf->user_name, strlen(conf->user_name));
+        bombus_write_data(stream, conf->password, conf->password_len);
+    }
 
-        if (self->websocket) {
-            // Wrap stream with websocket
-            struct stream_ws *stream_ws = stream_ws_new(stream);
-            stream_ws_connect(stream_ws, self->websocket_uri, NULL, NULL);
-            stream = stream_ws_to_stream(stream_ws);
-        }
+    bombus_count_out(self, MQTT_CONNECT, remaining_len);
+}
+
+
+/**
+ * Wrap connected socket with streams and send CONNECT.
+ *
+ */
+static void bombus_setup_stream(struct bombus *self, int fd)
+{
+    socket_set_non_blocking(fd, 1);
+
+    struct stream *stream = stream_new(fd);
+
+    if (self->ssl) {
+        // Wrap stream with ssl, previous session is resumed if possible
+        struct stream_ssl *stream_ssl = stream_ssl_new(self->ssl, stream);
+        bombus_resume_tls(self, stream_ssl);
+        stream_ssl_connect(stream_ssl);
+        self->stream_ssl = stream_ssl;
+        stream = stream_ssl_to_stream(stream_ssl);
+    }
 
-        struct stream_mqtt *stream_mqtt = stream_mqtt_new(stream);
-        stream_mqtt_connect(stream_mqtt, clean_session, self->mqtt_conf.keep_alive, self->mqtt_conf.client_id,
+    if (self->websocket) {
+        // Wrap stream with websocket
+        struct stream_ws *stream_ws = stream_ws_new(stream);
+        stream_ws_connect(stream_ws, self->websocket_uri, NULL, NULL);
+        stream = stream_ws_to_stream(stream_ws);
+    }
+
+    struct stream_mqtt *stream_mqtt = stream_mqtt_new(stream);
+    self->receive_max = 0;
+    self->max_packet_size = 0;
+    self->server_keep_alive = 0;
+    self->ping_time = 0;
+
+    if (self->mqtt5) {
+        bombus_write_connect_v5(self, stream_mqtt_to_stream(stream_mqtt));
+        stream_mqtt_set_observer(stream_mqtt, self, bombus_handle_received_msg);
+    }
+    else {
+        stream_mqtt_connect(stream_mqtt, self->clean_session, self->mqtt_conf.keep_alive, self->mqtt_conf.client_id,
                             self->mqtt_will.topic, self->mqtt_will.payload, self->mqtt_will.payload_len,
                             self->mqtt_will.retain, self->mqtt_will.qos,
                             self->mqtt_conf.user_name, self->mqtt_conf.password, self->mqtt_conf.password_len);
         stream_mqtt_set_observer(stream_mqtt, self, bombus_handle_received_msg);
 
-        self->stream = stream_mqtt_to_stream(stream_mqtt);
-        stream_set_observer(self->stream, self, bombus_handle_incomming_data);
-        idler_add_stream(self->idler, self->stream);
+        const char *client_id = self->mqtt_conf.client_id;
+        size_t connect_len = 10 + 2 + (client_id ? strlen(client_id) : 0);
+        if (self->mqtt_will.topic)
+            connect_len += 2 + strlen(self->mqtt_will.topic) + 2 + self->mqtt_will.payload_len;
+        if (self->mqtt_conf.user_name)
+            connect_len += 2 + strlen(self->mqtt_conf.user_name) + 2 + self->mqtt_conf.password_len;
+        bombus_count_out(self, MQTT_CONNECT, connect_len);
+    }
+
+    self->stream = stream_mqtt_to_stream(stream_mqtt);
+    stream_set_observer(self->stream, self, bombus_handle_incomming_data);
+    idler_add_stream(self->idler, self->stream);
+
+    self->state = BOMBUS_STATE_HANDSHAKE;
+    self->state_deadline = bombus_clock_ms() + self->connect_timeout_ms;
+    self->keep_alive_time = self->state_deadline;
+}
+
+
+static void bombus_start_attempt(struct bombus *self)
+{
+    int fd = -1;
 
-        ret = true;
+    if (self->attempts > 0)
+        self->metrics.reconnects++;
+    self->attempt_time = bombus_clock_ms();
+
+    if (self->port > 0) {
+        BOMBUS_INFO("Connect to %s:%d", self->address, self->port);
+        if (bombus_connector_start(self->connector, self->idler, self->socket_family, self->address, self->port)) {
+            self->state = BOMBUS_STATE_CONNECTING;
+            self->state_deadline = bombus_clock_ms() + self->connect_timeout_ms;
+            return;
+        }
+    }
+    else {
+        // Local socket connects immediately
+        BOMBUS_INFO("Connect to %s", self->address);
+        fd = socket_connect_unix(self->address);
+        if (socket_is_valid(fd)) {
+            bombus_setup_stream(self, fd);
+            return;
+        }
     }
 
-    return ret;
+    bombus_schedule_reconnect(self);
 }
 
 
-void bombus_disconnect(struct bombus *self)
+/**
+ * Advance connection state machine.
+ *
+ */
+static void bombus_handle_state(struct bombus *self)
 {
-    if (self->stream) {
-        // Disconnect cleanly
-        stream_mqtt_disconnect(stream_mqtt_from_stream(self->stream));
-        stream_flush(self->stream);
+    uint64_t now = bombus_clock_ms();
+
+    switch (self->state) {
+        case BOMBUS_STATE_CONNECTING: {
+            int fd = -1;
+            int status = bombus_connector_check(self->connector, &fd);
+            if (status == CONNECTOR_CONNECTED) {
+                bombus_setup_stream(self, fd);
+            }
+            else if (status == CONNECTOR_FAILED || now >= self->state_deadline) {
+                BOMBUS_WARN("Connection to %s:%d failed", self->address, self->port);
+                bombus_close(self);
+                bombus_schedule_reconnect(self);
+            }
+        }   break;
+
+        case BOMBUS_STATE_HANDSHAKE:
+            if (now >= self->state_deadline) {
+                BOMBUS_WARN("Connection to %s not acknowledged", self->address);
+                bombus_close(self);
+                bombus_schedule_reconnect(self);
+            }
+            break;
+
+        case BOMBUS_STATE_BACKOFF:
+            if (now >= self->state_deadline)
+                bombus_start_attempt(self);
+            break;
+    }
+}
+
+
+/**
+ * Release connection resources without changing state.
+ *
+ */
+static void bombus_close(struct bombus *self)
+{
+    bool was_connected = self->connected;
 
+    self->cork_len = 0;
+    self->upload.active = false;
+    self->deferred_len = 0;
+    if (self->reader)
+        bombus_reader_reset(self->reader);
+
+    bombus_connector_cancel(self->connector);
+
+    if (self->stream) {
         idler_remove_stream(self->idler, self->stream);
         socket_close(stream_get_fd(self->stream));
         self->stream = stream_delete(self->stream);
     }
+    self->stream_ssl = NULL;
 
     self->connected = false;
+
+    if (was_connected && self->conn_handler)
+        self->conn_handler(self->conn_object, self, false);
+}
+
+
+/**
+ * Wait before next connection attempt.
+ *
+ * Delay doubles with every failed attempt, full delay is randomized to
+ * 50-100% range, so clients dropped together do not reconnect together.
+ *
+ */
+static void bombus_schedule_reconnect(struct bombus *self)
+{
+    self->attempts++;
+    if (self->reconnection_attempts >= 0 && self->attempts > self->reconnection_attempts) {
+        BOMBUS_WARN("Giving up connection to %s after %d attempts", self->address, self->attempts);
+        self->state = BOMBUS_STATE_FAILED;
+        return;
+    }
+
+    unsigned long delay = self->backoff_base_ms;
+    for (int i=1; i<self->attempts && delay < self->backoff_max_ms; i++)
+        delay *= 2;
+    if (delay > self->backoff_max_ms)
+        delay = self->backoff_max_ms;
+    delay = delay/2 + (delay > 1 ? (unsigned long)rand_r(&self->backoff_seed) % (delay/2 + 1) : 0);
+
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Reconnect to %s in %lu ms", self->address, delay);
+    self->state = BOMBUS_STATE_BACKOFF;
+    self->state_deadline = bombus_clock_ms() + delay;
+}
+
+
+void bombus_disconnect(struct bombus *self)
+{
+    bombus_flush(self, true);
+
+    if (self->stream && !self->upload.active) {
+        // Disconnect cleanly, unfinished upload cannot be followed by other packet
+        stream_mqtt_disconnect(stream_mqtt_from_stream(self->stream));
+        bombus_count_out(self, MQTT_DISCONNECT, 0);
+        stream_flush(self->stream);
+    }
+
+    bombus_close(self);
+    self->state = BOMBUS_STATE_DISCONNECTED;
+    bombus_rearm(self);
 }
 
 
@@ -221,6 +858,54 @@ bool bombus_is_connected(struct bombus *self)
 }
 
 
+/**
+ * Check broker resumed session, subscriptions are still in place then.
+ *
+ */
+bool bombus_is_session_present(struct bombus *self)
+{
+    return self->connected && self->session_present;
+}
+
+
+/**
+ * Check broker keeps subscription of filter with same QoS.
+ *
+ * Only persistent session remembers subscriptions, without it broker is
+ * assumed to have none.
+ *
+ */
+bool bombus_has_subscription(struct bombus *self, const char *topic, unsigned char qos)
+{
+    const struct bombus_session_subscription *subscription = self->session ? bombus_session_find_subscription(self->session, topic) : NULL;
+    return subscription && subscription->qos == qos;
+}
+
+
+/**
+ * Get filters broker keeps subscribed in persistent session.
+ *
+ * Returns number of filters, at most max of them are stored into topics.
+ * Pointers are valid until subscriptions change.
+ *
+ */
+unsigned int bombus_get_subscriptions(struct bombus *self, const char **topics, unsigned int max)
+{
+    if (!self->session)
+        return 0;
+
+    for (unsigned int i=0; i<self->session->subscriptions_len && i<max; i++)
+        topics[i] = self->session->subscriptions[i].topic;
+    return self->session->subscriptions_len;
+}
+
+
+int bombus_get_state(struct bombus *self)
+{
+    return self->state;
+}
+
+
 int bombus_wait_for_data(struct bombus *self, unsigned long timeout_ms)
 {
     return idler_wait(self->idler, timeout_ms);
@@ -246,12 +931,32 @@ bool bombus_wait_for_msg(struct bombus *self, unsigned char mqtt_msg_type, unsig
 }
 
 
+/**
+ * Block until connected.
+ *
+ * For simple applications only, other clients sharing idler are not served.
+ *
+ */
 bool bombus_wait_for_connection(struct bombus *self, unsigned long timeout_ms)
 {
-    bool status = bombus_wait_for_msg(self, MQTT_CONNACK, timeout_ms);
-    if (status)
-        status = bombus_is_connected(self);
-    return status;
+    uint64_t deadline = bombus_clock_ms() + timeout_ms;
+
+    while (!bombus_is_connected(self)) {
+        if (self->state == BOMBUS_STATE_DISCONNECTED || self->state == BOMBUS_STATE_FAILED)
+            return false;
+
+        uint64_t now = bombus_clock_ms();
+        if (now >= deadline)
+            return false;
+
+        if (self->state == BOMBUS_STATE_HANDSHAKE)
+            bombus_wait_for_msg(self, MQTT_CONNACK, deadline - now);
+        else
+            bombus_wait_for_data(self, 10);
+        bombus_handle_state(self);
+    }
+
+    return true;
 }
 
 
@@ -263,66 +968,787 @@ int bombus_read_data(struct bombus *self)
 }
 
 
-void bombus_subscribe(struct bombus *self, const char *topic, unsigned char qos)
+/**
+ * Write MQTT 5 SUBSCRIBE or UNSUBSCRIBE with single topic and no properties.
+ *
+ */
+static void bombus_write_subscription_v5(struct bombus *self, unsigned char type, const char *topic, unsigned char qos)
 {
-    stream_mqtt_subscribe(stream_mqtt_from_stream(self->stream), self->msg_id++, topic, qos);
+    unsigned short msg_id = bombus_inflight_next_id(self->inflight);
+    size_t topic_len = strlen(topic);
+    size_t remaining_len = 2 + 1 + 2 + topic_len + (type == MQTT_SUBSCRIBE ? 1 : 0);
+    unsigned char buffer[1 + 4 + 2 + 1];
+    size_t pos = 0;
+
+    buffer[pos++] = (type << 4) | 0x02;
+    pos += bombus_packet_encode_remaining_len(&buffer[pos], remaining_len);
+    buffer[pos++] = (msg_id >> 8) & 0xFF;
+    buffer[pos++] = msg_id & 0xFF;
+    buffer[pos++] = 0;      // Properties
+    stream_write(self->stream, buffer, pos);
+
+    bombus_write_data(self->stream, topic, topic_len);
+    if (type == MQTT_SUBSCRIBE) {
+        unsigned char options = qos & 0x03;
+        stream_write(self->stream, &options, 1);
+    }
+    bombus_count_out(self, type, remaining_len);
 }
 
 
-void bombus_unsubscribe(struct bombus *self, const char *topic)
+void bombus_subscribe(struct bombus *self, const char *topic, unsigned char qos)
 {
-    stream_mqtt_unsubscribe(stream_mqtt_from_stream(self->stream), self->msg_id++, topic);
+    if (self->upload.active) {
+        BOMBUS_WARN("Cannot subscribe %s while upload is in progress", topic);
+        return;
+    }
+
+    bombus_flush(self, true);
+    if (self->mqtt5) {
+        bombus_write_subscription_v5(self, MQTT_SUBSCRIBE, topic, qos);
+    }
+    else {
+        stream_mqtt_subscribe(stream_mqtt_from_stream(self->stream), bombus_inflight_next_id(self->inflight), topic, qos);
+        bombus_count_out(self, MQTT_SUBSCRIBE, 2 + 2 + strlen(topic) + 1);
+    }
+
+    if (self->session)
+        bombus_session_subscribe(self->session, topic, qos);
 }
 
 
-void bombus_publish(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len)
+void bombus_unsubscribe(struct bombus *self, const char *topic)
 {
-    stream_mqtt_publish(stream_mqtt_from_stream(self->stream), retain, false, qos, self->msg_id++, topic, data, data_len);
+    if (self->upload.active) {
+        BOMBUS_WARN("Cannot unsubscribe %s while upload is in progress", topic);
+        return;
+    }
+
+    bombus_flush(self, true);
+    if (self->mqtt5) {
+        bombus_write_subscription_v5(self, MQTT_UNSUBSCRIBE, topic, 0);
+    }
+    else {
+        stream_mqtt_unsubscribe(stream_mqtt_from_stream(self->stream), bombus_inflight_next_id(self->inflight), topic);
+        bombus_count_out(self, MQTT_UNSUBSCRIBE, 2 + 2 + strlen(topic));
+    }
+
+    // Topic may be stored by session itself, it is not used afterwards
+    if (self->session)
+        bombus_session_unsubscribe(self->session, topic);
 }
 
 
-void bombus_handle_stream(struct bombus *self)
+/**
+ * Encode PUBLISH header.
+ *
+ * MQTT 5 topic is replaced by alias once broker knows it. Buffer must have
+ * at least BOMBUS_PACKET_MAX_HEADER_LEN_V5 bytes, remaining length of whole
+ * packet is returned in remaining_len.
+ *
+ */
+static size_t bombus_encode_publish(struct bombus *self, unsigned char *buffer, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                    const char *topic, size_t topic_len, size_t data_len, size_t *remaining_len)
 {
-    unsigned int flags = idler_get_stream_status(self->idler, self->stream);
-    if (flags & STREAM_OUTGOING_READY)
-        stream_handle_outgoing_data(self->stream);
-    if (flags & STREAM_INCOMING_READY)
-        stream_handle_incoming_data(self->stream);
+    if (!self->mqtt5) {
+        *remaining_len = bombus_publish_remaining_len(qos, topic_len, data_len);
+        return bombus_packet_encode_publish_header(buffer, dup, qos, retain, msg_id, topic, topic_len, data_len);
+    }
+
+    bool known = false;
+    unsigned short alias = self->aliases ? bombus_aliases_get(self->aliases, topic, topic_len, &known) : 0;
+    if (alias)
+        self->metrics.alias_saved += (known ? (long long)topic_len : 0) - BOMBUS_ALIAS_PROPERTY_LEN;
+    if (known)
+        topic_len = 0;
+
+    *remaining_len = bombus_publish_remaining_len(qos, topic_len, data_len) + 1 + (alias ? BOMBUS_ALIAS_PROPERTY_LEN : 0);
+    return bombus_packet_encode_publish_header_v5(buffer, dup, qos, retain, msg_id, topic, topic_len, alias, data_len);
 }
 
 
-void bombus_handle_time(struct bombus *self)
+/**
+ * Write publish to stream, returns remaining length for metrics.
+ *
+ * MQTT 3.1.1 messages are encoded by stream.
+ *
+ */
+static size_t bombus_write_publish(struct bombus *self, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                   const char *topic, size_t topic_len, const void *data, size_t data_len)
 {
-    if (self->stream)
-        stream_time(self->stream);
+    if (!self->mqtt5) {
+        stream_mqtt_publish(stream_mqtt_from_stream(self->stream), retain, dup, qos, msg_id, topic, data, data_len);
+        return bombus_publish_remaining_len(qos, topic_len, data_len);
+    }
+
+    unsigned char header[BOMBUS_PACKET_MAX_HEADER_LEN_V5(topic_len)];
+    size_t remaining_len;
+    size_t header_len = bombus_encode_publish(self, header, dup, qos, retain, msg_id, topic, topic_len, data_len, &remaining_len);
+
+    stream_write(self->stream, header, header_len);
+    if (data_len > 0)
+        stream_write(self->stream, data, data_len);
+    return remaining_len;
 }
 
 
-int bombus_handle_received_msg(void *object, struct stream_mqtt *stream, unsigned char type, unsigned char flags, void *mqtt_msg)
+/**
+ * Copy encoded header and payload into cork buffer.
+ *
+ * Messages bigger than whole buffer are written directly.
+ *
+ */
+static void bombus_cork_write(struct bombus *self, const unsigned char *header, size_t header_len, const void *data, size_t data_len)
 {
-    struct bombus *self = (struct bombus*)object;
+    size_t packet_len = header_len + data_len;
+
+    if (self->cork_len + packet_len > self->cork_size)
+        bombus_flush(self, true);
+
+    if (packet_len > self->cork_size) {
+        stream_write(self->stream, header, header_len);
+        if (data_len > 0)
+            stream_write(self->stream, data, data_len);
+        return;
+    }
+
+    if (self->cork_len == 0) {
+        self->cork_time = bombus_clock_ms();
+        bombus_arm(self, self->cork_time + self->cork_delay_ms);
+    }
+
+    memcpy(&self->cork_buffer[self->cork_len], header, header_len);
+    if (data_len > 0)
+        memcpy(&self->cork_buffer[self->cork_len + header_len], data, data_len);
+    self->cork_len += packet_len;
+}
+
+
+/**
+ * Encode publish into cork buffer.
+ *
+ */
+static size_t bombus_cork_publish(struct bombus *self, unsigned char qos, bool retain, unsigned short msg_id,
+                                  const char *topic, size_t topic_len, const void *data, size_t data_len)
+{
+    unsigned char header[BOMBUS_PACKET_MAX_HEADER_LEN_V5(topic_len)];
+    size_t remaining_len;
+    size_t header_len = bombus_encode_publish(self, header, false, qos, retain, msg_id, topic, topic_len, data_len, &remaining_len);
+
+    bombus_cork_write(self, header, header_len, data, data_len);
+    return remaining_len;
+}
+
+
+/**
+ * Keep QoS 1/2 message until acknowledged, allocate its packet id.
+ *
+ * Shared topic belongs to prepared publish and is not copied.
+ *
+ */
+static bool bombus_track_publish(struct bombus *self, unsigned char qos, bool retain, const char *topic, bool shared_topic,
+                                 const void *data, size_t data_len, unsigned short *msg_id)
+{
+    if (bombus_window_is_full(self)) {
+        self->qos_stats.rejected++;
+        return false;
+    }
+
+    *msg_id = bombus_inflight_next_id(self->inflight);
+    struct bombus_inflight_msg *msg = shared_topic ?
+        bombus_inflight_add_shared(self->inflight, *msg_id, qos, retain, topic, data, data_len) :
+        bombus_inflight_add(self->inflight, *msg_id, qos, retain, topic, data, data_len);
+    bombus_arm(self, msg->sent_ms + self->inflight->timeout_ms);
+    return true;
+}
+
+
+static bool bombus_publish_topic(struct bombus *self, const char *topic, bool shared_topic, unsigned char qos, bool retain,
+                                 const void *data, size_t data_len)
+{
+    unsigned short msg_id = 0;
+    size_t topic_len = strlen(topic);
+    size_t remaining_len;
+
+    if (!self->stream || self->upload.active)
+        return false;
+
+    if (!bombus_fits_packet(self, qos, topic_len, data_len)) {
+        BOMBUS_WARN("Message of %zu bytes exceeds broker maximum packet size %zu", data_len, self->max_packet_size);
+        self->qos_stats.rejected++;
+        return false;
+    }
+
+    if (qos > 0 && !bombus_track_publish(self, qos, retain, topic, shared_topic, data, data_len, &msg_id))
+        return false;
+
+    if (self->cork_buffer)
+        remaining_len = bombus_cork_publish(self, qos, retain, msg_id, topic, topic_len, data, data_len);
+    else
+        remaining_len = bombus_write_publish(self, false, qos, retain, msg_id, topic, topic_len, data, data_len);
+    self->qos_stats.published++;
+    bombus_count_out(self, MQTT_PUBLISH, remaining_len);
+
+    return true;
+}
+
+
+/**
+ * Publish message.
+ *
+ * QoS 1/2 messages are kept until acknowledged, false is returned when
+ * in-flight window is full.
+ *
+ */
+bool bombus_publish(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len)
+{
+    return bombus_publish_topic(self, topic, false, qos, retain, data, data_len);
+}
+
+
+/**
+ * Publish message with prepared header.
+ *
+ * Header is only completed with length and packet id, message goes to
+ * stream or cork buffer without encoding. MQTT 5 messages take regular
+ * path, topic aliases save more than header encoding.
+ *
+ */
+bool bombus_publish_prepared(struct bombus *self, struct bombus_prepared *prepared, const void *data, size_t data_len)
+{
+    unsigned short msg_id = 0;
+
+    if (self->mqtt5)
+        return bombus_publish_topic(self, prepared->topic, true, prepared->qos, prepared->retain, data, data_len);
+
+    if (!self->stream || self->upload.active)
+        return false;
+
+    if (prepared->qos > 0 && !bombus_track_publish(self, prepared->qos, prepared->retain, prepared->topic, true, data, data_len, &msg_id))
+        return false;
+
+    size_t start = bombus_packet_complete_publish_header(prepared->header, prepared->variable_len, false, prepared->qos, prepared->retain,
+                                                         msg_id, data_len);
+    const unsigned char *header = &prepared->header[start];
+    size_t header_len = BOMBUS_PACKET_PREPARED_OFFSET + prepared->variable_len - start;
+
+    if (self->cork_buffer) {
+        bombus_cork_write(self, header, header_len, data, data_len);
+    }
+    else {
+        stream_write(self->stream, header, header_len);
+        if (data_len > 0)
+            stream_write(self->stream, data, data_len);
+    }
+    self->qos_stats.published++;
+    bombus_count_out(self, MQTT_PUBLISH, prepared->variable_len + data_len);
+
+    return true;
+}
+
+
+/**
+ * Publish payload too big to be buffered at once.
+ *
+ * Only header is encoded, payload is passed to socket in pieces by
+ * bombus_handle_upload() as outgoing data drains. On plain sockets pieces are
+ * written directly from caller memory, otherwise they go through stream
+ * buffer. No other packet is sent until upload is finished, acknowledges of
+ * received messages are held back.
+ *
+ */
+bool bombus_publish_large(struct bombus *self, const char *topic, unsigned char qos, bool retain, const void *data, size_t data_len)
+{
+    unsigned short msg_id = 0;
+    size_t topic_len = strlen(topic);
+
+    if (!self->connected || self->upload.active)
+        return false;
+
+    if (bombus_publish_remaining_len(qos, topic_len, data_len) > BOMBUS_PACKET_MAX_REMAINING_LEN) {
+        BOMBUS_ERROR("Payload of %zu bytes exceeds MQTT packet limit", data_len);
+        return false;
+    }
+    if (!bombus_fits_packet(self, qos, topic_len, data_len)) {
+        BOMBUS_ERROR("Payload of %zu bytes exceeds broker maximum packet size %zu", data_len, self->max_packet_size);
+        return false;
+    }
+
+    if (qos > 0) {
+        if (bombus_window_is_full(self)) {
+            self->qos_stats.rejected++;
+            return false;
+        }
+        msg_id = bombus_inflight_next_id(self->inflight);
+        bombus_inflight_add_borrowed(self->inflight, msg_id, qos, retain, topic, data, data_len);
+    }
+
+    bombus_flush(self, true);
+    size_t remaining_len = bombus_start_upload(self, msg_id, false, qos, retain, topic, data, data_len);
+    self->qos_stats.published++;
+    bombus_count_out(self, MQTT_PUBLISH, remaining_len);
+
+    return true;
+}
+
+
+static size_t bombus_start_upload(struct bombus *self, unsigned short msg_id, bool dup, unsigned char qos, bool retain,
+                                  const char *topic, const void *data, size_t data_len)
+{
+    size_t topic_len = strlen(topic);
+    unsigned char header[BOMBUS_PACKET_MAX_HEADER_LEN_V5(topic_len)];
+    size_t remaining_len;
+
+    size_t header_len = bombus_encode_publish(self, header, dup, qos, retain, msg_id, topic, topic_len, data_len, &remaining_len);
+    stream_write(self->stream, header, header_len);
+
+    self->upload.data = data;
+    self->upload.len = data_len;
+    self->upload.offset = 0;
+    self->upload.msg_id = msg_id;
+    self->upload.active = true;
+
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d uploads %zu bytes to %s", stream_get_fd(self->stream), data_len, topic);
+    bombus_handle_upload(self);
+
+    return remaining_len;
+}
+
+
+/**
+ * Pass next pieces of upload to socket.
+ *
+ * Returns true when more data can be written right away, otherwise upload
+ * continues after socket drains.
+ *
+ */
+bool bombus_handle_upload(struct bombus *self)
+{
+    struct bombus_upload *upload = &self->upload;
+    bool direct = !self->ssl && !self->websocket;
+    unsigned int burst = BOMBUS_UPLOAD_BURST;
+
+    if (!upload->active)
+        return false;
+
+    while (upload->offset < upload->len) {
+        if (burst-- == 0)
+            return true;
+
+        size_t pending = stream_get_outgoing_len(self->stream);
+        if (pending >= BOMBUS_UPLOAD_CHUNK)
+            return false;
+
+        size_t chunk = upload->len - upload->offset;
+        if (chunk > BOMBUS_UPLOAD_CHUNK)
+            chunk = BOMBUS_UPLOAD_CHUNK;
+
+        if (direct) {
+            // Socket takes data straight from caller memory once header is out
+            if (pending > 0)
+                return false;
+            ssize_t written = write(stream_get_fd(self->stream), &upload->data[upload->offset], chunk);
+            if (written > 0) {
+                upload->offset += written;
+                continue;
+            }
+            if (written < 0 && errno == EINTR)
+                continue;
+            // Idler reports socket writable again, closed connection is noticed by stream
+            return false;
+        }
+
+        // Stream keeps piece until socket is writable again
+        stream_write(self->stream, &upload->data[upload->offset], chunk);
+        upload->offset += chunk;
+    }
+
+    upload->active = false;
+    if (upload->msg_id != 0) {
+        // Acknowledge timeout counts from the end of upload
+        struct bombus_inflight_msg *msg = bombus_inflight_find(self->inflight, upload->msg_id);
+        if (msg) {
+            bombus_inflight_touch(self->inflight, msg);
+            bombus_rearm(self);
+        }
+    }
+
+    for (unsigned int i=0; i<self->deferred_len; i++)
+        bombus_send_ack(self, self->deferred_acks[i] >> 16, self->deferred_acks[i] & 0xFFFF);
+    self->deferred_len = 0;
+
+    return false;
+}
+
+
+bool bombus_is_uploading(struct bombus *self)
+{
+    return self->upload.active;
+}
+
+
+/**
+ * Payload bytes of current or last upload passed to socket.
+ *
+ */
+size_t bombus_get_upload_progress(struct bombus *self)
+{
+    return self->upload.offset;
+}
+
+
+/*
+ * Constructor
+ *
+ */
+struct bombus_prepared* bombus_prepared_new(const char *topic, unsigned char qos, bool retain)
+{
+    struct bombus_prepared *self = xmalloc(sizeof(struct bombus_prepared));
+    size_t topic_len = strlen(topic);
+
+    self->topic = xstrdup(topic);
+    self->qos = qos;
+    self->retain = retain;
+    self->header = xmalloc(BOMBUS_PACKET_PREPARED_OFFSET + 2 + topic_len + 2);
+    self->variable_len = bombus_packet_prepare_publish_header(self->header, topic, topic_len, qos);
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_prepared* bombus_prepared_delete(struct bombus_prepared *self)
+{
+    xfree(self->topic);
+    xfree(self->header);
+    return xfree(self);
+}
+
+
+unsigned int bombus_get_inflight_count(struct bombus *self)
+{
+    return self->inflight->count;
+}
+
+
+/**
+ * Get counters of topics published with MQTT 5 aliases.
+ *
+ * Returns number of topics, only first max of them are stored. Topics are
+ * valid until MQTT 5 is configured again.
+ *
+ */
+unsigned int bombus_get_topic_stats(struct bombus *self, struct bombus_topic_stats *stats, unsigned int max)
+{
+    unsigned int count = 0;
+
+    if (!self->aliases)
+        return 0;
+
+    for (unsigned int i=0; i<self->aliases->topics_size; i++) {
+        for (const struct bombus_alias_topic *topic = self->aliases->topics[i]; topic; topic = topic->next) {
+            if (count < max) {
+                stats[count].topic = topic->topic;
+                stats[count].publishes = topic->publishes;
+                stats[count].saved = topic->saved;
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+/**
+ * Get number of bytes waiting for socket, including corked publishes.
+ *
+ */
+size_t bombus_get_outgoing_len(struct bombus *self)
+{
+    size_t upload_len = self->upload.active ? self->upload.len - self->upload.offset : 0;
+
+    if (!self->stream)
+        return self->cork_len;
+    return self->cork_len + upload_len + stream_get_outgoing_len(self->stream);
+}
+
+
+/**
+ * Write corked publishes.
+ *
+ * Without force, data is written only when cork delay elapsed.
+ *
+ */
+void bombus_flush(struct bombus *self, bool force)
+{
+    if (self->cork_len == 0 || !self->stream)
+        return;
+
+    if (!force && bombus_clock_ms() - self->cork_time < self->cork_delay_ms)
+        return;
+
+    stream_write(self->stream, self->cork_buffer, self->cork_len);
+    self->cork_len = 0;
+}
+
+
+/**
+ * Retransmit unacknowledged messages.
+ *
+ * All messages are sent after reconnection, otherwise only timed out ones.
+ * MQTT 5 forbids retransmission while connected, only messages left over by
+ * upload interrupting reconnection resend are sent then.
+ *
+ */
+static void bombus_resend_inflight(struct bombus *self, bool all)
+{
+    struct bombus_inflight *inflight = self->inflight;
+    struct stream_mqtt *stream_mqtt = stream_mqtt_from_stream(self->stream);
+    uint64_t now = bombus_clock_ms();
+
+    if (inflight->count == 0)
+        return;
+
+    // Corked publishes go first, they may carry topic alias mapping
+    bombus_flush(self, true);
+
+    // Resent messages move to the end, so each one is visited once
+    for (unsigned int left=inflight->count; left>0; left--) {
+        struct bombus_inflight_msg *msg = inflight->oldest;
+        if (!msg || self->upload.active)
+            break;  // Rest is retransmitted after upload
+        if (!all && self->mqtt5 && msg->sent_ms >= self->connack_time)
+            break;  // Sent on this connection
+        if (!all && !self->mqtt5 && now - msg->sent_ms < inflight->timeout_ms)
+            break;  // Oldest first, the rest was sent later
+
+        if (msg->state == INFLIGHT_PUBLISHED && msg->borrowed) {
+            size_t remaining_len = bombus_start_upload(self, msg->msg_id, true, msg->qos, msg->retain, msg->topic, msg->payload, msg->payload_len);
+            bombus_count_out(self, MQTT_PUBLISH, remaining_len);
+        }
+        else if (msg->state == INFLIGHT_PUBLISHED) {
+            size_t remaining_len = bombus_write_publish(self, true, msg->qos, msg->retain, msg->msg_id, msg->topic, strlen(msg->topic),
+                                                        msg->payload, msg->payload_len);
+            bombus_count_out(self, MQTT_PUBLISH, remaining_len);
+        }
+        else {
+            stream_mqtt_pubrel(stream_mqtt, msg->msg_id);
+            bombus_count_out(self, MQTT_PUBREL, 2);
+        }
+
+        bombus_inflight_touch(inflight, msg);
+        self->qos_stats.retransmitted++;
+    }
+}
+
+
+void bombus_handle_stream(struct bombus *self)
+{
+    if (!self->stream)
+        return;
+
+    unsigned int flags = idler_get_stream_status(self->idler, self->stream);
+    if (flags & STREAM_OUTGOING_READY)
+        stream_handle_outgoing_data(self->stream);
+    if (flags & STREAM_INCOMING_READY)
+        stream_handle_incoming_data(self->stream);
+}
+
+
+/**
+ * Ping idle MQTT 5 connection, stream does not know its session.
+ *
+ * Connection is idle when no packet was sent since previous check. Broker
+ * not answering ping within keep alive is gone, half open connection would
+ * be never noticed otherwise.
+ *
+ */
+static void bombus_ping(struct bombus *self, uint64_t now, unsigned short keep_alive)
+{
+    if (self->ping_time != 0) {
+        if (now - self->ping_time >= keep_alive * 1000ULL) {
+            BOMBUS_WARN("Client %d got no PINGRESP within %u s", stream_get_fd(self->stream), keep_alive);
+            bombus_close(self);
+            bombus_schedule_reconnect(self);
+        }
+        return;
+    }
+
+    unsigned long long packets = bombus_packets_out(self);
+    // Ping would split upload, broker sees data flowing anyway
+    if (packets == self->ping_packets && !self->upload.active) {
+        unsigned char ping[2] = { MQTT_PINGREQ << 4, 0 };
+        stream_write(self->stream, ping, sizeof(ping));
+        bombus_count_out(self, MQTT_PINGREQ, 0);
+        self->ping_time = now;
+        packets++;
+    }
+    self->ping_packets = packets;
+}
+
+
+/**
+ * Handle expired deadlines.
+ *
+ * Keep alive is checked four times per keep alive interval, so ping is never
+ * late by more than quarter of it.
+ *
+ */
+void bombus_handle_time(struct bombus *self)
+{
+    uint64_t now = bombus_clock_ms();
+
+    bombus_handle_state(self);
+
+    if (self->stream && now >= self->keep_alive_time) {
+        unsigned short keep_alive = bombus_keep_alive(self);
+        self->keep_alive_time = now + (keep_alive > 0 ? keep_alive * 250UL : 1000);
+        // Ping would split upload, broker sees data flowing anyway
+        if (!self->upload.active && !self->mqtt5)
+            stream_time(self->stream);
+        if (self->mqtt5 && self->connected && keep_alive > 0)
+            bombus_ping(self, now, keep_alive);
+    }
+
+    if (self->stream && self->connected)
+        bombus_resend_inflight(self, false);
+
+    bombus_flush(self, false);
+    bombus_rearm(self);
+}
+
+
+/**
+ * Get earliest time bombus_handle_time() has something to do.
+ *
+ */
+unsigned long long bombus_get_deadline(struct bombus *self)
+{
+    unsigned long long next = 0;
+
+    switch (self->state) {
+        case BOMBUS_STATE_CONNECTING:
+            // Finished attempts are reported by idler
+            next = bombus_min_deadline(self->state_deadline, bombus_connector_get_deadline(self->connector));
+            break;
+
+        case BOMBUS_STATE_HANDSHAKE:
+        case BOMBUS_STATE_BACKOFF:
+            next = self->state_deadline;
+            break;
+    }
+
+    if (self->stream)
+        next = bombus_min_deadline(next, self->keep_alive_time);
+    if (self->connected && !self->upload.active && !self->mqtt5)
+        next = bombus_min_deadline(next, bombus_inflight_next_timeout(self->inflight));
+    // MQTT 5 has no timeout, only resend interrupted by upload goes on
+    if (self->connected && !self->upload.active && self->mqtt5 && self->inflight->oldest &&
+        self->inflight->oldest->sent_ms < self->connack_time)
+        next = bombus_min_deadline(next, self->connack_time);
+    if (self->cork_len > 0)
+        next = bombus_min_deadline(next, self->cork_time + self->cork_delay_ms);
+
+    return next;
+}
+
+
+/**
+ * Recalculate deadline and notify timer handler.
+ *
+ */
+static void bombus_rearm(struct bombus *self)
+{
+    self->deadline = bombus_get_deadline(self);
+    if (self->timer_handler)
+        self->timer_handler(self->timer_object, self, self->deadline);
+}
+
+
+/**
+ * Send acknowledge packet, or keep it until upload is finished.
+ *
+ */
+static void bombus_send_ack(struct bombus *self, unsigned char type, unsigned short msg_id)
+{
+    struct stream_mqtt *stream_mqtt = stream_mqtt_from_stream(self->stream);
+
+    if (self->upload.active) {
+        if (self->deferred_len == self->deferred_size) {
+            self->deferred_size = self->deferred_size ? self->deferred_size * 2 : 16;
+            self->deferred_acks = xrealloc(self->deferred_acks, self->deferred_size * sizeof(unsigned int));
+        }
+        self->deferred_acks[self->deferred_len++] = ((unsigned int)type << 16) | msg_id;
+        return;
+    }
+
+    switch (type) {
+        case MQTT_PUBACK:   stream_mqtt_puback(stream_mqtt, msg_id);    break;
+        case MQTT_PUBREC:   stream_mqtt_pubrec(stream_mqtt, msg_id);    break;
+        case MQTT_PUBREL:   stream_mqtt_pubrel(stream_mqtt, msg_id);    break;
+        case MQTT_PUBCOMP:  stream_mqtt_pubcomp(stream_mqtt, msg_id);   break;
+    }
+    bombus_count_out(self, type, 2);
+}
+
+
+int bombus_handle_received_msg(void *object, struct stream_mqtt *stream, unsigned char type, unsigned char flags, void *mqtt_msg)
+{
+    struct bombus *self = (struct bombus*)object;
 
-    UNUSED(flags);
     UNUSED(stream);
 
     if (self->wait_msg_type == type)
         self->wait_msg_type = 0;    // Expected message type received
 
+    if (self->reader) {
+        // Frame already counted with its real length
+    }
+    else if (type == MQTT_PUBLISH) {
+        struct mqtt_publish *msg = (struct mqtt_publish*)mqtt_msg;
+        bombus_count_in(self, type, bombus_publish_remaining_len((flags >> 1) & 0x03, msg->topic_len, msg->payload_len));
+    }
+    else {
+        // Sizes of MQTT 3.1.1 acknowledges, single topic SUBACK
+        bombus_count_in(self, type, type == MQTT_SUBACK ? 3 : (type == MQTT_PINGRESP ? 0 : 2));
+    }
+
     switch (type) {
         case MQTT_CONNACK: {
             struct mqtt_connack *msg = (struct mqtt_connack*)mqtt_msg;
             if (msg->return_code == MQTT_CONNACK_ACCEPTED) {
                 self->connected = true;
+                self->state = BOMBUS_STATE_CONNECTED;
+                self->attempts = 0;
+                self->metrics.connects++;
+                self->metrics.connect_time_ms += bombus_clock_ms() - self->attempt_time;
+                if (self->stream_ssl)
+                    bombus_store_tls(self);
+                self->session_present = !self->clean_session && msg->session_present;
+                if (!self->session_present)
+                    bombus_inflight_clear_received(self->inflight);
+                if (!self->session_present && self->session)
+                    bombus_session_unsubscribe_all(self->session);
                 BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d connected", stream_get_fd(self->stream));
+                self->connack_time = bombus_clock_ms();
+                bombus_resend_inflight(self, true);
+                bombus_rearm(self);
+                if (self->conn_handler)
+                    self->conn_handler(self->conn_object, self, true);
             }
             else {
+                // Broker closes connection, reconnect with backoff
                 BOMBUS_WARN("Client with %d fd refused because %d", stream_get_fd(self->stream), msg->return_code);
             }
         }   break;
 
         case MQTT_SUBACK: {
             struct mqtt_suback *msg = (struct mqtt_suback*)mqtt_msg;
-            if (msg->return_code != MQTT_SUBACK_FAILURE) {
+            if (msg->return_code < MQTT_SUBACK_FAILURE) {
                 BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d subscribtion succes", stream_get_fd(self->stream));
             }
             else {
@@ -332,15 +1758,75 @@ int bombus_handle_received_msg(void *object, struct stream_mqtt *stream, unsigne
 
         case MQTT_PUBLISH: {
             struct mqtt_publish *msg = (struct mqtt_publish*)mqtt_msg;
-            char topic[msg->topic_len+1];
-            memcpy(topic, msg->topic, msg->topic_len);
-            topic[msg->topic_len] = '\0';
-
-            // TODO: Forward received message to application
-            char payload[msg->payload_len+1];
-            memcpy(payload, msg->payload, msg->payload_len);
-            payload[msg->payload_len] = '\0';
-            BOMBUS_INFO("Client %d received %s '%s'", stream_get_fd(self->stream), topic, payload);
+            unsigned char qos = (flags >> 1) & 0x03;
+            bool deliver = true;
+
+            if (qos == 1)
+                bombus_send_ack(self, MQTT_PUBACK, msg->msg_id);
+            if (qos == 2) {
+                // Deliver once, duplicates are only acknowledged
+                deliver = bombus_inflight_mark_received(self->inflight, msg->msg_id);
+                bombus_send_ack(self, MQTT_PUBREC, msg->msg_id);
+            }
+
+            if (!deliver)
+                break;
+
+            if (self->msg_handler) {
+                // Pass views into frame buffer, no copies
+                struct bombus_msg view = {
+                    .topic = msg->topic,
+                    .topic_len = msg->topic_len,
+                    .payload = msg->payload,
+                    .payload_len = msg->payload_len,
+                    .msg_id = msg->msg_id,
+                    .qos = qos,
+                    .retain = flags & 0x01,
+                    .dup = flags & 0x08,
+                };
+                self->msg_handler(self->msg_object, self, &view);
+            }
+            else {
+                BOMBUS_INFO("Client %d received %.*s '%.*s'", stream_get_fd(self->stream),
+                            (int)msg->topic_len, msg->topic, (int)msg->payload_len, (const char*)msg->payload);
+            }
+        }   break;
+
+        case MQTT_PUBREL: {
+            struct mqtt_pubrel *msg = (struct mqtt_pubrel*)mqtt_msg;
+            bombus_inflight_release_received(self->inflight, msg->msg_id);
+            bombus_send_ack(self, MQTT_PUBCOMP, msg->msg_id);
+        }   break;
+
+        case MQTT_PUBACK: {
+            struct mqtt_puback *msg = (struct mqtt_puback*)mqtt_msg;
+            struct bombus_inflight_msg *inflight_msg = bombus_inflight_find(self->inflight, msg->msg_id);
+            if (inflight_msg && inflight_msg->qos == 1) {
+                bombus_inflight_remove(self->inflight, inflight_msg);
+                self->qos_stats.acknowledged++;
+            }
+            else {
+                BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d unexpected PUBACK %d", stream_get_fd(self->stream), msg->msg_id);
+            }
+        }   break;
+
+        case MQTT_PUBREC: {
+            struct mqtt_pubrec *msg = (struct mqtt_pubrec*)mqtt_msg;
+            struct bombus_inflight_msg *inflight_msg = bombus_inflight_find(self->inflight, msg->msg_id);
+            if (inflight_msg && inflight_msg->qos == 2) {
+                // Payload no longer needed, only PUBREL may be retransmitted
+                bombus_inflight_release(self->inflight, inflight_msg);
+            }
+            bombus_send_ack(self, MQTT_PUBREL, msg->msg_id);
+        }   break;
+
+        case MQTT_PUBCOMP: {
+            struct mqtt_pubcomp *msg = (struct mqtt_pubcomp*)mqtt_msg;
+            struct bombus_inflight_msg *inflight_msg = bombus_inflight_find(self->inflight, msg->msg_id);
+            if (inflight_msg && inflight_msg->state == INFLIGHT_RELEASED) {
+                bombus_inflight_remove(self->inflight, inflight_msg);
+                self->qos_stats.acknowledged++;
+            }
         }   break;
     }
 
@@ -348,6 +1834,301 @@ int bombus_handle_received_msg(void *object, struct stream_mqtt *stream, unsigne
 }
 
 
+static inline unsigned short bombus_decode_id(const unsigned char *data)
+{
+    return ((unsigned short)data[0] << 8) | data[1];
+}
+
+
+/**
+ * Skip MQTT 5 properties at given position.
+ *
+ */
+static bool bombus_skip_properties(const unsigned char *body, size_t len, size_t *pos)
+{
+    size_t properties_len, used;
+
+    if (!bombus_packet_decode_remaining_len(&body[*pos], len - *pos, &properties_len, &used))
+        return false;
+    *pos += used + properties_len;
+    return *pos <= len;
+}
+
+
+/**
+ * Apply broker limits from MQTT 5 CONNACK properties.
+ *
+ */
+static bool bombus_handle_connack_properties(struct bombus *self, const unsigned char *body, size_t len)
+{
+    size_t properties_len, pos;
+    unsigned int alias_max = 0;
+    unsigned char id;
+    uint32_t value;
+
+    if (!bombus_packet_decode_remaining_len(body, len, &properties_len, &pos) || pos + properties_len > len)
+        return false;
+
+    size_t end = pos + properties_len;
+    self->receive_max = 65535;
+    self->max_packet_size = 0;
+    self->server_keep_alive = 0;
+    while (bombus_packet_next_property(body, end, &pos, &id, &value)) {
+        switch (id) {
+            case PROPERTY_RECEIVE_MAXIMUM:      self->receive_max = value;              break;
+            case PROPERTY_TOPIC_ALIAS_MAXIMUM:  alias_max = value;                      break;
+            case PROPERTY_MAXIMUM_PACKET_SIZE:  self->max_packet_size = value;          break;
+            case PROPERTY_SERVER_KEEP_ALIVE:    self->server_keep_alive = value;        break;
+        }
+    }
+    if (pos != end)
+        return false;
+
+    if (self->aliases)
+        bombus_aliases_reset(self->aliases, alias_max);
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d receive maximum %u, topic aliases %u, maximum packet size %zu",
+                 stream_get_fd(self->stream), self->receive_max, alias_max, self->max_packet_size);
+    return true;
+}
+
+
+/**
+ * Forget QoS 1/2 message refused by MQTT 5 broker.
+ *
+ * Refused message is not delivered, QoS 2 exchange ends without PUBREL.
+ *
+ */
+static void bombus_handle_refused(struct bombus *self, unsigned char type, unsigned short msg_id, unsigned char reason)
+{
+    struct bombus_inflight_msg *inflight_msg = bombus_inflight_find(self->inflight, msg_id);
+
+    if (inflight_msg && inflight_msg->state == INFLIGHT_PUBLISHED && inflight_msg->qos == (type == MQTT_PUBACK ? 1 : 2)) {
+        bombus_inflight_remove(self->inflight, inflight_msg);
+        self->qos_stats.refused++;
+        BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d message %d refused, reason 0x%02x", stream_get_fd(self->stream), msg_id, reason);
+    }
+    else {
+        BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %d unexpected refusal of %d", stream_get_fd(self->stream), msg_id);
+    }
+}
+
+
+/**
+ * Decode frame collected by reader and pass it on as if stream decoded it.
+ *
+ */
+static bool bombus_handle_frame(struct bombus *self, unsigned char header, const unsigned char *body, size_t len)
+{
+    unsigned char type = header >> 4;
+    unsigned char flags = header & 0x0F;
+    union {
+        struct mqtt_connack connack;
+        struct mqtt_publish publish;
+        struct mqtt_puback puback;
+        struct mqtt_pubrec pubrec;
+        struct mqtt_pubrel pubrel;
+        struct mqtt_pubcomp pubcomp;
+        struct mqtt_suback suback;
+        struct mqtt_unsuback unsuback;
+    } msg;
+
+    memset(&msg, 0, sizeof(msg));
+    if (type != MQTT_PINGRESP && type != MQTT_DISCONNECT && len < 2)
+        return false;
+
+    bombus_count_in(self, type, len);
+
+    switch (type) {
+        case MQTT_CONNACK:
+            msg.connack.session_present = body[0] & 0x01;
+            msg.connack.return_code = body[1];
+            if (self->mqtt5 && body[1] == MQTT_CONNACK_ACCEPTED && !bombus_handle_connack_properties(self, &body[2], len - 2))
+                return false;
+            break;
+
+        case MQTT_PUBLISH: {
+            size_t topic_len = bombus_decode_id(body);
+            size_t pos = 2 + topic_len;
+            unsigned char qos = (flags >> 1) & 0x03;
+            if (pos + (qos > 0 ? 2 : 0) > len)
+                return false;
+
+            msg.publish.topic = (const char*)&body[2];
+            msg.publish.topic_len = topic_len;
+            if (qos > 0) {
+                msg.publish.msg_id = bombus_decode_id(&body[pos]);
+                pos += 2;
+            }
+            if (self->mqtt5 && !bombus_skip_properties(body, len, &pos))
+                return false;
+            msg.publish.payload = &body[pos];
+            msg.publish.payload_len = len - pos;
+            msg.publish.qos = qos;
+            msg.publish.retain = flags & 0x01;
+            msg.publish.dup = flags & 0x08;
+        }   break;
+
+        case MQTT_PUBACK:
+        case MQTT_PUBREC:
+            // MQTT 5 reason code follows packet id, success may be omitted
+            if (self->mqtt5 && len > 2 && body[2] >= 0x80) {
+                bombus_handle_refused(self, type, bombus_decode_id(body), body[2]);
+                return true;
+            }
+            if (type == MQTT_PUBACK)
+                msg.puback.msg_id = bombus_decode_id(body);
+            else
+                msg.pubrec.msg_id = bombus_decode_id(body);
+            break;
+
+        case MQTT_PUBREL:   msg.pubrel.msg_id = bombus_decode_id(body);     break;
+        case MQTT_PUBCOMP:  msg.pubcomp.msg_id = bombus_decode_id(body);    break;
+        case MQTT_UNSUBACK: msg.unsuback.msg_id = bombus_decode_id(body);   break;
+
+        case MQTT_SUBACK: {
+            size_t pos = 2;
+            if (self->mqtt5 && !bombus_skip_properties(body, len, &pos))
+                return false;
+            if (len < pos + 1)
+                return false;
+            msg.suback.msg_id = bombus_decode_id(body);
+            msg.suback.return_code = body[pos];
+        }   break;
+
+        case MQTT_PINGRESP:
+            self->ping_time = 0;
+            break;
+
+        case MQTT_DISCONNECT:
+            // MQTT 5 broker tells reason before closing connection
+            BOMBUS_WARN("Client %d disconnected by broker, reason %d", stream_get_fd(self->stream), len > 0 ? body[0] : 0);
+            return self->mqtt5;
+
+        default:
+            return false;
+    }
+
+    bombus_handle_received_msg(self, stream_mqtt_from_stream(self->stream), type, flags, &msg);
+    return true;
+}
+
+
+/**
+ * Start large publish, only its header is kept.
+ *
+ */
+static void bombus_handle_large_publish(struct bombus *self, unsigned char header, const unsigned char *body, size_t len, size_t payload_len)
+{
+    struct bombus_chunk *chunk = &self->chunk;
+    size_t topic_len = bombus_decode_id(body);
+
+    chunk->topic = (const char*)&body[2];
+    chunk->topic_len = topic_len;
+    chunk->data = NULL;
+    chunk->len = 0;
+    chunk->offset = 0;
+    chunk->payload_len = payload_len;
+    chunk->qos = (header >> 1) & 0x03;
+    chunk->retain = header & 0x01;
+    chunk->dup = header & 0x08;
+    chunk->msg_id = chunk->qos > 0 ? bombus_decode_id(&body[2 + topic_len]) : 0;
+
+    if (self->wait_msg_type == MQTT_PUBLISH)
+        self->wait_msg_type = 0;
+    bombus_count_in(self, MQTT_PUBLISH, len + payload_len);
+
+    // Deliver once, duplicates are only acknowledged
+    self->chunk_deliver = chunk->qos < 2 || bombus_inflight_mark_received(self->inflight, chunk->msg_id);
+}
+
+
+/**
+ * Pass payload chunk to handler, acknowledge message after the last one.
+ *
+ */
+static void bombus_handle_chunk(struct bombus *self, const unsigned char *data, size_t len)
+{
+    struct bombus_chunk *chunk = &self->chunk;
+
+    chunk->data = data;
+    chunk->len = len;
+    if (self->chunk_deliver && self->chunk_handler)
+        self->chunk_handler(self->chunk_object, self, chunk);
+    chunk->offset += len;
+
+    if (chunk->offset < chunk->payload_len)
+        return;
+
+    // Broker resends messages not acknowledged before disconnection
+    if (chunk->qos == 1)
+        bombus_send_ack(self, MQTT_PUBACK, chunk->msg_id);
+    if (chunk->qos == 2)
+        bombus_send_ack(self, MQTT_PUBREC, chunk->msg_id);
+}
+
+
+/**
+ * Read stream in blocks and decode frames without stream frame buffer.
+ *
+ */
+static ssize_t bombus_read_stream(struct bombus *self, struct stream *stream)
+{
+    unsigned char data[BOMBUS_READ_SIZE];
+    struct bombus_reader_event event;
+    ssize_t bytes;
+
+    while ((bytes = stream_read(stream, data, sizeof(data))) > 0) {
+        size_t pos = 0;
+        while (pos < (size_t)bytes) {
+            pos += bombus_reader_process(self->reader, &data[pos], bytes - pos, &event);
+
+            bool valid = true;
+            switch (event.type) {
+                case READER_EVENT_FRAME:
+                    valid = bombus_handle_frame(self, self->reader->header, event.data, event.len);
+                    break;
+                case READER_EVENT_PUBLISH:
+                    bombus_handle_large_publish(self, self->reader->header, event.data, event.len, self->reader->payload_len);
+                    if (self->reader->payload_len == 0)
+                        bombus_handle_chunk(self, NULL, 0);
+                    break;
+                case READER_EVENT_CHUNK:
+                    bombus_handle_chunk(self, event.data, event.len);
+                    break;
+                case READER_EVENT_ERROR:
+                    valid = false;
+                    break;
+            }
+
+            if (!valid) {
+                BOMBUS_ERROR("Malformed packet from %d fd", stream_get_fd(stream));
+                return 0;
+            }
+        }
+    }
+
+    return bytes;
+}
+
+
+/**
+ * Connection attempt established or refused.
+ *
+ */
+int bombus_handle_attempt(void *object, struct stream *stream)
+{
+    struct bombus *self = (struct bombus*)object;
+
+    UNUSED(stream);
+
+    if (self->state == BOMBUS_STATE_CONNECTING) {
+        bombus_handle_state(self);
+        bombus_rearm(self);
+    }
+    return 0;
+}
+
+
 int bombus_handle_incomming_data(void *object, struct stream *stream)
 {
     struct bombus *self = (struct bombus*)object;
@@ -355,24 +2136,36 @@ int bombus_handle_incomming_data(void *object, struct stream *stream)
 
     ssize_t bytes;
 
-    do {
-        bytes = stream_mqtt_peek_frame(stream_mqtt);
-        if (bytes <= 0) {
-            if (bytes < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                    return bytes;   // All data already read
-                BOMBUS_ERROR("Receiving from %d fd failed with %d", stream_get_fd(stream), errno);
-            }
-            break;
+    if (self->reader) {
+        bytes = bombus_read_stream(self, stream);
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return bytes;   // All data already read
+            BOMBUS_ERROR("Receiving from %d fd failed with %d", stream_get_fd(stream), errno);
         }
-        else {
-            BOMBUS_ERROR("Message not handled by callback");
-            break;
-        }
-    } while (bytes > 0);
+    }
+    else {
+        do {
+            bytes = stream_mqtt_peek_frame(stream_mqtt);
+            if (bytes <= 0) {
+                if (bytes < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return bytes;   // All data already read
+                    BOMBUS_ERROR("Receiving from %d fd failed with %d", stream_get_fd(stream), errno);
+                }
+                break;
+            }
+            else {
+                BOMBUS_ERROR("Message not handled by callback");
+                break;
+            }
+        } while (bytes > 0);
+    }
 
     BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Disconnected from broker");
-    bombus_disconnect(self);
+    bombus_close(self);
+    bombus_schedule_reconnect(self);
+    bombus_rearm(self);
 
     return 0;
 }
@@ -0,0 +1,18 @@
+
+#ifndef __BOMBUS_CLOCK_H_
+#define __BOMBUS_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+
+
+static inline uint64_t bombus_clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+#endif /* __BOMBUS_CLOCK_H_ */
@@ -0,0 +1,284 @@
+
+#include "connector.h"
+#include "clock.h"
+
+#include "bombus/log.h"
+
+#include "mx/idler.h"
+#include "mx/stream.h"
+
+#include "mx/memory.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+
+
+
+/**
+ * Order addresses alternating between family listed first and others, so
+ * broken family costs only single attempt delay.
+ *
+ */
+static void bombus_connector_order(struct bombus_connector *self)
+{
+    unsigned int count = 0;
+    for (struct addrinfo *rp = self->result; rp != NULL; rp = rp->ai_next)
+        count++;
+
+    self->addrs = xmalloc(count * sizeof(struct addrinfo*));
+    self->attempts = xmalloc(count * sizeof(struct pollfd));
+    self->streams = xmalloc(count * sizeof(struct stream*));
+
+    int family = self->result->ai_family;
+    struct addrinfo *preferred = self->result;
+    struct addrinfo *other = self->result;
+    while (self->addrs_len < count) {
+        while (preferred && preferred->ai_family != family)
+            preferred = preferred->ai_next;
+        if (preferred) {
+            self->addrs[self->addrs_len++] = preferred;
+            preferred = preferred->ai_next;
+        }
+
+        while (other && other->ai_family == family)
+            other = other->ai_next;
+        if (other) {
+            self->addrs[self->addrs_len++] = other;
+            other = other->ai_next;
+        }
+    }
+}
+
+
+/**
+ * Start attempts to next addresses until one is in progress.
+ *
+ */
+static void bombus_connector_start_next(struct bombus_connector *self)
+{
+    while (self->next < self->addrs_len) {
+        struct addrinfo *rp = self->addrs[self->next++];
+
+        int fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            char host[NI_MAXHOST];
+            if (getnameinfo(rp->ai_addr, rp->ai_addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) == 0)
+                BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Connection attempt %u to %s", self->next, host);
+
+            self->attempts[self->attempts_len].fd = fd;
+            self->attempts[self->attempts_len].events = POLLOUT;
+            self->attempts[self->attempts_len].revents = 0;
+
+            struct stream *stream = stream_new(fd);
+            stream_set_observer(stream, self->object, self->handler);
+            idler_add_stream(self->idler, stream);
+            self->streams[self->attempts_len] = stream;
+            self->attempts_len++;
+            self->next_time = bombus_clock_ms() + BOMBUS_CONNECTOR_ATTEMPT_DELAY;
+            return;
+        }
+
+        close(fd);
+    }
+}
+
+
+/**
+ * Stop watching attempt, its socket is closed unless it won.
+ *
+ */
+static void bombus_connector_drop(struct bombus_connector *self, unsigned int idx, bool close_fd)
+{
+    idler_remove_stream(self->idler, self->streams[idx]);
+    stream_delete(self->streams[idx]);
+    if (close_fd)
+        close(self->attempts[idx].fd);
+
+    self->attempts_len--;
+    self->attempts[idx] = self->attempts[self->attempts_len];
+    self->streams[idx] = self->streams[self->attempts_len];
+}
+
+
+/**
+ * Release addresses, connections in progress are closed except winner.
+ *
+ */
+static void bombus_connector_finish(struct bombus_connector *self, int winner)
+{
+    while (self->attempts_len > 0)
+        bombus_connector_drop(self, self->attempts_len - 1, self->attempts[self->attempts_len - 1].fd != winner);
+
+    if (self->result)
+        freeaddrinfo(self->result);
+    if (self->addrs)
+        xfree(self->addrs);
+    if (self->attempts)
+        xfree(self->attempts);
+    if (self->streams)
+        xfree(self->streams);
+
+    self->result = NULL;
+    self->addrs = NULL;
+    self->addrs_len = 0;
+    self->next = 0;
+    self->attempts = NULL;
+    self->streams = NULL;
+    self->attempts_len = 0;
+    self->next_time = 0;
+}
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct bombus_connector* bombus_connector_new(void *object, bombus_connector_handler handler)
+{
+    struct bombus_connector *self = xmalloc(sizeof(struct bombus_connector));
+
+    self->idler = NULL;
+    self->object = object;
+    self->handler = handler;
+
+    self->result = NULL;
+    self->addrs = NULL;
+    self->addrs_len = 0;
+    self->next = 0;
+    self->attempts = NULL;
+    self->streams = NULL;
+    self->attempts_len = 0;
+    self->next_time = 0;
+
+    return self;
+}
+
+
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_connector* bombus_connector_delete(struct bombus_connector *self)
+{
+    bombus_connector_finish(self, -1);
+    return xfree(self);
+}
+
+
+/**
+ * Resolve address and start first connection attempt.
+ *
+ * Address resolution itself is still synchronous.
+ *
+ */
+bool bombus_connector_start(struct bombus_connector *self, struct idler *idler, int family, const char *address, unsigned int port)
+{
+    struct addrinfo hints;
+    char service[8];
+
+    bombus_connector_finish(self, -1);
+    self->idler = idler;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    int ret = getaddrinfo(address, service, &hints, &self->result);
+    if (ret != 0) {
+        BOMBUS_WARN("Could not resolve %s, %s", address, gai_strerror(ret));
+        self->result = NULL;
+        return false;
+    }
+
+    bombus_connector_order(self);
+    bombus_connector_start_next(self);
+    if (self->attempts_len == 0) {
+        bombus_connector_finish(self, -1);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Check connections progress without waiting, start next attempt when its
+ * time has come.
+ *
+ * On success established socket is returned in fd and connector is reset.
+ *
+ */
+int bombus_connector_check(struct bombus_connector *self, int *fd)
+{
+    int ret = poll(self->attempts, self->attempts_len, 0);
+    if (ret < 0 && errno != EINTR) {
+        bombus_connector_finish(self, -1);
+        return CONNECTOR_FAILED;
+    }
+
+    unsigned int i = 0;
+    while (ret > 0 && i < self->attempts_len) {
+        if (!self->attempts[i].revents) {
+            i++;
+            continue;
+        }
+
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(self->attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+            *fd = self->attempts[i].fd;
+            bombus_connector_finish(self, *fd);
+            return CONNECTOR_CONNECTED;
+        }
+
+        // Failed attempt gives way to next address immediately
+        bombus_connector_drop(self, i, true);
+        self->next_time = 0;
+    }
+
+    if (self->next < self->addrs_len && bombus_clock_ms() >= self->next_time)
+        bombus_connector_start_next(self);
+
+    if (self->attempts_len == 0) {
+        bombus_connector_finish(self, -1);
+        return CONNECTOR_FAILED;
+    }
+
+    return CONNECTOR_PENDING;
+}
+
+
+/**
+ * Close all connections in progress.
+ *
+ */
+void bombus_connector_cancel(struct bombus_connector *self)
+{
+    bombus_connector_finish(self, -1);
+}
+
+
+/**
+ * Get start time of next attempt, 0 when all addresses are tried.
+ *
+ */
+unsigned long long bombus_connector_get_deadline(struct bombus_connector *self)
+{
+    if (self->next < self->addrs_len)
+        return self->next_time;
+    return 0;
+}
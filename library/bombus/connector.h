@@ -0,0 +1,66 @@
+#ifndef __BOMBUS_CONNECTOR_H_
+#define __BOMBUS_CONNECTOR_H_
+
+#include <stdbool.h>
+
+
+
+#define BOMBUS_CONNECTOR_ATTEMPT_DELAY  250     // Head start of every address, RFC 8305
+
+
+struct addrinfo;
+struct pollfd;
+struct idler;
+struct stream;
+
+
+typedef int (*bombus_connector_handler)(void *object, struct stream *stream);
+
+
+enum bombus_connector_status_e {
+    CONNECTOR_FAILED = -1,
+    CONNECTOR_PENDING = 0,
+    CONNECTOR_CONNECTED = 1,
+};
+
+
+/**
+ * Connection racing over all resolved addresses.
+ *
+ * Addresses are ordered with families interleaved, attempts are started
+ * one after another with fixed delay, or immediately when previous ones
+ * failed. The first established connection wins, other attempts are
+ * cancelled.
+ *
+ * Attempts are watched by idler, handler is called when any of them
+ * makes progress, so connecting client does not have to be polled.
+ *
+ */
+struct bombus_connector
+{
+    struct idler *idler;
+    void *object;
+    bombus_connector_handler handler;
+
+    struct addrinfo *result;
+    struct addrinfo **addrs;
+    unsigned int addrs_len;
+    unsigned int next;              // Next address to try
+
+    struct pollfd *attempts;        // Connections in progress
+    struct stream **streams;        // Attempts registered in idler
+    unsigned int attempts_len;
+    unsigned long long next_time;   // Start of next attempt
+};
+
+
+struct bombus_connector* bombus_connector_new(void *object, bombus_connector_handler handler);
+struct bombus_connector* bombus_connector_delete(struct bombus_connector *self);
+
+bool bombus_connector_start(struct bombus_connector *self, struct idler *idler, int family, const char *address, unsigned int port);
+int bombus_connector_check(struct bombus_connector *self, int *fd);
+void bombus_connector_cancel(struct bombus_connector *self);
+unsigned long long bombus_connector_get_deadline(struct bombus_connector *self);
+
+
+#endif /* __BOMBUS_CONNECTOR_H_ */
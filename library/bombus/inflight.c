@@ -0,0 +1,374 @@
+
+#include "inflight.h"
+#include "clock.h"
+#include "session.h"
+
+#include "bombus/client.h"
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <string.h>
+
+
+#define INFLIGHT_IDS_NUM        65536
+
+
+
+
+
+static struct bombus_inflight_msg* bombus_inflight_slot(struct bombus_inflight *self, unsigned short msg_id)
+{
+    return &self->msgs[msg_id & (self->size - 1)];
+}
+
+
+/**
+ * Append change to journal, journal is compacted once it grows too big.
+ *
+ */
+static void bombus_inflight_journal(struct bombus_inflight *self, unsigned char type, unsigned short msg_id)
+{
+    if (!self->session)
+        return;
+
+    bombus_session_record(self->session, type, msg_id);
+    if (self->session->size > BOMBUS_SESSION_COMPACT_SIZE)
+        bombus_session_compact(self->session, self);
+}
+
+
+static void bombus_inflight_unlink(struct bombus_inflight *self, struct bombus_inflight_msg *msg)
+{
+    if (msg->older)
+        msg->older->newer = msg->newer;
+    else
+        self->oldest = msg->newer;
+    if (msg->newer)
+        msg->newer->older = msg->older;
+    else
+        self->newest = msg->older;
+    msg->older = NULL;
+    msg->newer = NULL;
+}
+
+
+static void bombus_inflight_msg_clean(struct bombus_inflight_msg *msg)
+{
+    if (msg->topic && !msg->shared_topic)
+        xfree(msg->topic);
+    msg->topic = NULL;
+    msg->shared_topic = false;
+    if (msg->payload && !msg->borrowed)
+        xfree(msg->payload);
+    msg->payload = NULL;
+    msg->payload_len = 0;
+    msg->borrowed = false;
+    msg->msg_id = 0;
+    msg->state = INFLIGHT_FREE;
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct bombus_inflight* bombus_inflight_new(unsigned int max, unsigned long timeout_ms)
+{
+    struct bombus_inflight *self = xmalloc(sizeof(struct bombus_inflight));
+
+    if (max == 0)
+        max = 1;
+    if (max > BOMBUS_MAX_INFLIGHT) {
+        BOMBUS_WARN("In-flight window %u limited to %u", max, BOMBUS_MAX_INFLIGHT);
+        max = BOMBUS_MAX_INFLIGHT;
+    }
+
+    // Power of two, so ids map to slots with a mask
+    self->size = 1;
+    while (self->size < max)
+        self->size <<= 1;
+
+    self->msgs = xmalloc(self->size * sizeof(struct bombus_inflight_msg));
+    memset(self->msgs, 0, self->size * sizeof(struct bombus_inflight_msg));
+    self->max = max;
+    self->count = 0;
+
+    self->next_id = 1;
+    self->timeout_ms = timeout_ms;
+    self->oldest = NULL;
+    self->newest = NULL;
+
+    self->received = NULL;
+    self->session = NULL;
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_inflight* bombus_inflight_delete(struct bombus_inflight *self)
+{
+    // Stored state outlives table
+    self->session = NULL;
+    bombus_inflight_clear(self);
+    xfree(self->msgs);
+    if (self->received)
+        xfree(self->received);
+
+    return xfree(self);
+}
+
+
+bool bombus_inflight_is_full(struct bombus_inflight *self)
+{
+    return self->count >= self->max;
+}
+
+
+/**
+ * Allocate packet id.
+ *
+ * Id 0 is not allowed, ids whose slot is occupied are skipped.
+ *
+ */
+unsigned short bombus_inflight_next_id(struct bombus_inflight *self)
+{
+    for (unsigned int i=0; i<INFLIGHT_IDS_NUM; i++) {
+        unsigned short msg_id = self->next_id++;
+        if (self->next_id == 0)
+            self->next_id = 1;
+
+        if (msg_id != 0 && bombus_inflight_slot(self, msg_id)->state == INFLIGHT_FREE)
+            return msg_id;
+    }
+
+    return 0;
+}
+
+
+static struct bombus_inflight_msg* bombus_inflight_insert(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                          const char *topic, bool shared_topic, const void *data, size_t data_len)
+{
+    struct bombus_inflight_msg *msg = bombus_inflight_slot(self, msg_id);
+    if (msg->state != INFLIGHT_FREE)
+        return NULL;
+
+    msg->msg_id = msg_id;
+    msg->state = INFLIGHT_PUBLISHED;
+    msg->qos = qos;
+    msg->retain = retain;
+    msg->topic = shared_topic ? (char*)topic : xstrdup(topic);
+    msg->shared_topic = shared_topic;
+    msg->payload = data_len > 0 ? xmemdup(data, data_len) : NULL;
+    msg->payload_len = data_len;
+    msg->older = NULL;
+    msg->newer = NULL;
+    bombus_inflight_touch(self, msg);
+
+    self->count++;
+
+    if (self->session) {
+        bombus_session_add(self->session, msg);
+        if (self->session->size > BOMBUS_SESSION_COMPACT_SIZE)
+            bombus_session_compact(self->session, self);
+    }
+
+    return msg;
+}
+
+
+struct bombus_inflight_msg* bombus_inflight_add(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                const char *topic, const void *data, size_t data_len)
+{
+    return bombus_inflight_insert(self, msg_id, qos, retain, topic, false, data, data_len);
+}
+
+
+/**
+ * Add message whose topic stays owned by caller.
+ *
+ * Topic of prepared publish is referenced, it must outlive the message.
+ *
+ */
+struct bombus_inflight_msg* bombus_inflight_add_shared(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                       const char *topic, const void *data, size_t data_len)
+{
+    return bombus_inflight_insert(self, msg_id, qos, retain, topic, true, data, data_len);
+}
+
+
+/**
+ * Add message whose payload stays owned by caller.
+ *
+ * Such messages are not journaled, payload is too big or not ours to keep.
+ *
+ */
+struct bombus_inflight_msg* bombus_inflight_add_borrowed(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                         const char *topic, const void *data, size_t data_len)
+{
+    struct bombus_session *session = self->session;
+
+    self->session = NULL;
+    struct bombus_inflight_msg *msg = bombus_inflight_add(self, msg_id, qos, retain, topic, NULL, 0);
+    self->session = session;
+
+    if (msg) {
+        msg->payload = (unsigned char*)data;
+        msg->payload_len = data_len;
+        msg->borrowed = true;
+    }
+    return msg;
+}
+
+
+struct bombus_inflight_msg* bombus_inflight_find(struct bombus_inflight *self, unsigned short msg_id)
+{
+    struct bombus_inflight_msg *msg = bombus_inflight_slot(self, msg_id);
+    if (msg->state == INFLIGHT_FREE || msg->msg_id != msg_id)
+        return NULL;
+
+    return msg;
+}
+
+
+/**
+ * QoS 2 message reached PUBREC, payload is no longer needed.
+ *
+ */
+void bombus_inflight_release(struct bombus_inflight *self, struct bombus_inflight_msg *msg)
+{
+    msg->state = INFLIGHT_RELEASED;
+    bombus_inflight_touch(self, msg);
+    if (msg->payload && !msg->borrowed)
+        xfree(msg->payload);
+    msg->payload = NULL;
+    msg->payload_len = 0;
+
+    if (!msg->borrowed)
+        bombus_inflight_journal(self, SESSION_RELEASE, msg->msg_id);
+    msg->borrowed = false;
+}
+
+
+/**
+ * Message was (re)sent now, it becomes the last one to time out.
+ *
+ * Timeout is the same for all messages, so keeping list in send order
+ * keeps the earliest deadline at its head.
+ *
+ */
+void bombus_inflight_touch(struct bombus_inflight *self, struct bombus_inflight_msg *msg)
+{
+    msg->sent_ms = bombus_clock_ms();
+    if (self->newest == msg)
+        return;
+
+    if (self->oldest == msg || msg->older)
+        bombus_inflight_unlink(self, msg);
+
+    msg->older = self->newest;
+    if (self->newest)
+        self->newest->newer = msg;
+    else
+        self->oldest = msg;
+    self->newest = msg;
+}
+
+
+void bombus_inflight_remove(struct bombus_inflight *self, struct bombus_inflight_msg *msg)
+{
+    if (msg->state == INFLIGHT_FREE)
+        return;
+
+    unsigned short msg_id = msg->msg_id;
+    bool borrowed = msg->borrowed;
+
+    bombus_inflight_unlink(self, msg);
+    bombus_inflight_msg_clean(msg);
+    self->count--;
+
+    if (!borrowed)
+        bombus_inflight_journal(self, SESSION_REMOVE, msg_id);
+}
+
+
+void bombus_inflight_clear(struct bombus_inflight *self)
+{
+    for (unsigned int i=0; i<self->size; i++)
+        bombus_inflight_remove(self, &self->msgs[i]);
+
+    if (self->received)
+        memset(self->received, 0, INFLIGHT_IDS_NUM/8);
+}
+
+
+/**
+ * Get time when the oldest message should be retransmitted, zero if none.
+ *
+ */
+unsigned long long bombus_inflight_next_timeout(struct bombus_inflight *self)
+{
+    if (!self->oldest)
+        return 0;
+
+    return self->oldest->sent_ms + self->timeout_ms;
+}
+
+
+/**
+ * Remember incoming QoS 2 message id.
+ *
+ * Returns false if message was already received, so duplicates are not
+ * delivered twice to application.
+ *
+ */
+bool bombus_inflight_mark_received(struct bombus_inflight *self, unsigned short msg_id)
+{
+    if (!self->received) {
+        self->received = xmalloc(INFLIGHT_IDS_NUM/8);
+        memset(self->received, 0, INFLIGHT_IDS_NUM/8);
+    }
+
+    unsigned char mask = 1 << (msg_id & 0x07);
+    if (self->received[msg_id >> 3] & mask)
+        return false;
+
+    self->received[msg_id >> 3] |= mask;
+    bombus_inflight_journal(self, SESSION_RECEIVED, msg_id);
+    return true;
+}
+
+
+void bombus_inflight_release_received(struct bombus_inflight *self, unsigned short msg_id)
+{
+    unsigned char mask = 1 << (msg_id & 0x07);
+
+    if (!self->received || !(self->received[msg_id >> 3] & mask))
+        return;
+
+    self->received[msg_id >> 3] &= ~mask;
+    bombus_inflight_journal(self, SESSION_FORGET, msg_id);
+}
+
+
+/**
+ * Forget incoming QoS 2 ids, broker without session never releases them.
+ *
+ */
+void bombus_inflight_clear_received(struct bombus_inflight *self)
+{
+    if (!self->received)
+        return;
+
+    memset(self->received, 0, INFLIGHT_IDS_NUM/8);
+    if (self->session)
+        bombus_session_compact(self->session, self);
+}
@@ -0,0 +1,90 @@
+
+#ifndef __BOMBUS_INFLIGHT_H_
+#define __BOMBUS_INFLIGHT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct bombus_session;
+
+
+enum bombus_inflight_state_e {
+    INFLIGHT_FREE = 0,
+    INFLIGHT_PUBLISHED,         // Waiting for PUBACK or PUBREC
+    INFLIGHT_RELEASED,          // QoS 2, waiting for PUBCOMP
+};
+
+
+struct bombus_inflight_msg
+{
+    unsigned short msg_id;
+    unsigned char state;
+    unsigned char qos;
+    bool retain;
+
+    char *topic;
+    bool shared_topic;          // Topic owned by prepared publish
+    unsigned char *payload;
+    size_t payload_len;
+    bool borrowed;              // Payload owned by caller, large publish
+
+    uint64_t sent_ms;
+    struct bombus_inflight_msg *older;  // Retransmit order, by sent_ms
+    struct bombus_inflight_msg *newer;
+};
+
+
+/**
+ * Outgoing QoS 1/2 messages waiting for acknowledge.
+ *
+ * Slots are indexed by packet id modulo table size, packet ids whose slot
+ * is still occupied are skipped, so lookup is O(1) and memory is bounded
+ * by window size.
+ *
+ */
+struct bombus_inflight
+{
+    struct bombus_inflight_msg *msgs;
+    unsigned int size;
+    unsigned int max;
+    unsigned int count;
+
+    unsigned short next_id;
+    unsigned long timeout_ms;
+    struct bombus_inflight_msg *oldest; // Next to time out
+    struct bombus_inflight_msg *newest;
+
+    unsigned char *received;    // Bitmap of incoming QoS 2 ids waiting for PUBREL
+
+    struct bombus_session *session; // Journal of changes, optional
+};
+
+
+struct bombus_inflight* bombus_inflight_new(unsigned int max, unsigned long timeout_ms);
+struct bombus_inflight* bombus_inflight_delete(struct bombus_inflight *self);
+
+bool bombus_inflight_is_full(struct bombus_inflight *self);
+unsigned short bombus_inflight_next_id(struct bombus_inflight *self);
+
+struct bombus_inflight_msg* bombus_inflight_add(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                const char *topic, const void *data, size_t data_len);
+struct bombus_inflight_msg* bombus_inflight_add_shared(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                       const char *topic, const void *data, size_t data_len);
+struct bombus_inflight_msg* bombus_inflight_add_borrowed(struct bombus_inflight *self, unsigned short msg_id, unsigned char qos, bool retain,
+                                                         const char *topic, const void *data, size_t data_len);
+struct bombus_inflight_msg* bombus_inflight_find(struct bombus_inflight *self, unsigned short msg_id);
+void bombus_inflight_release(struct bombus_inflight *self, struct bombus_inflight_msg *msg);
+void bombus_inflight_touch(struct bombus_inflight *self, struct bombus_inflight_msg *msg);
+void bombus_inflight_remove(struct bombus_inflight *self, struct bombus_inflight_msg *msg);
+void bombus_inflight_clear(struct bombus_inflight *self);
+unsigned long long bombus_inflight_next_timeout(struct bombus_inflight *self);
+
+bool bombus_inflight_mark_received(struct bombus_inflight *self, unsigned short msg_id);
+void bombus_inflight_release_received(struct bombus_inflight *self, unsigned short msg_id);
+void bombus_inflight_clear_received(struct bombus_inflight *self);
+
+
+#endif /* __BOMBUS_INFLIGHT_H_ */
@@ -0,0 +1,245 @@
+
+#include "packet.h"
+
+#include "mx/mqtt.h"
+
+#include <string.h>
+
+
+
+
+
+/**
+ * Encode MQTT variable length integer.
+ *
+ * Buffer must have at least 4 bytes, returns number of bytes used.
+ *
+ */
+size_t bombus_packet_encode_remaining_len(unsigned char *buffer, size_t len)
+{
+    size_t pos = 0;
+
+    do {
+        unsigned char byte = len & 0x7F;
+        len >>= 7;
+        if (len > 0)
+            byte |= 0x80;
+        buffer[pos++] = byte;
+    } while (len > 0 && pos < 4);
+
+    return pos;
+}
+
+
+/**
+ * Get whole packet size for given remaining length.
+ *
+ */
+size_t bombus_packet_size(size_t remaining_len)
+{
+    size_t len_bytes = 1;
+    for (size_t len = remaining_len >> 7; len > 0 && len_bytes < 4; len >>= 7)
+        len_bytes++;
+
+    return 1 + len_bytes + remaining_len;
+}
+
+
+/**
+ * Encode PUBLISH packet up to payload.
+ *
+ * Buffer must have at least BOMBUS_PACKET_MAX_HEADER_LEN bytes, payload is
+ * expected right after returned number of bytes.
+ *
+ */
+size_t bombus_packet_encode_publish_header(unsigned char *buffer, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                           const char *topic, size_t topic_len, size_t payload_len)
+{
+    size_t pos = 0;
+    size_t remaining_len = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+
+    buffer[pos++] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+    pos += bombus_packet_encode_remaining_len(&buffer[pos], remaining_len);
+
+    buffer[pos++] = (topic_len >> 8) & 0xFF;
+    buffer[pos++] = topic_len & 0xFF;
+    memcpy(&buffer[pos], topic, topic_len);
+    pos += topic_len;
+
+    if (qos > 0) {
+        buffer[pos++] = (msg_id >> 8) & 0xFF;
+        buffer[pos++] = msg_id & 0xFF;
+    }
+
+    return pos;
+}
+
+
+/**
+ * Encode PUBLISH variable header, it is completed for every message by
+ * bombus_packet_complete_publish_header().
+ *
+ * Topic is placed at BOMBUS_PACKET_PREPARED_OFFSET, packet id space follows
+ * for QoS 1/2. Returns variable header length.
+ *
+ */
+size_t bombus_packet_prepare_publish_header(unsigned char *buffer, const char *topic, size_t topic_len, unsigned char qos)
+{
+    size_t pos = BOMBUS_PACKET_PREPARED_OFFSET;
+
+    memset(buffer, 0, BOMBUS_PACKET_PREPARED_OFFSET);
+    buffer[pos++] = (topic_len >> 8) & 0xFF;
+    buffer[pos++] = topic_len & 0xFF;
+    memcpy(&buffer[pos], topic, topic_len);
+    pos += topic_len;
+
+    if (qos > 0) {
+        buffer[pos++] = 0;
+        buffer[pos++] = 0;
+    }
+
+    return pos - BOMBUS_PACKET_PREPARED_OFFSET;
+}
+
+
+/**
+ * Patch packet id and encode fixed header right before prepared topic.
+ *
+ * Returns offset of the first header byte in buffer, header ends with
+ * variable header.
+ *
+ */
+size_t bombus_packet_complete_publish_header(unsigned char *buffer, size_t variable_len, bool dup, unsigned char qos, bool retain,
+                                             unsigned short msg_id, size_t payload_len)
+{
+    unsigned char len_bytes[4];
+    size_t len_size = bombus_packet_encode_remaining_len(len_bytes, variable_len + payload_len);
+    size_t start = BOMBUS_PACKET_PREPARED_OFFSET - 1 - len_size;
+
+    buffer[start] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+    memcpy(&buffer[start + 1], len_bytes, len_size);
+
+    if (qos > 0) {
+        buffer[BOMBUS_PACKET_PREPARED_OFFSET + variable_len - 2] = (msg_id >> 8) & 0xFF;
+        buffer[BOMBUS_PACKET_PREPARED_OFFSET + variable_len - 1] = msg_id & 0xFF;
+    }
+
+    return start;
+}
+
+
+/**
+ * Encode MQTT 5 PUBLISH packet up to payload.
+ *
+ * Topic alias is sent as the only property when not zero, topic may be
+ * empty then. Buffer must have at least BOMBUS_PACKET_MAX_HEADER_LEN_V5 bytes.
+ *
+ */
+size_t bombus_packet_encode_publish_header_v5(unsigned char *buffer, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                              const char *topic, size_t topic_len, unsigned short alias, size_t payload_len)
+{
+    size_t pos = 0;
+    size_t properties_len = alias ? 3 : 0;
+    size_t remaining_len = 2 + topic_len + (qos > 0 ? 2 : 0) + 1 + properties_len + payload_len;
+
+    buffer[pos++] = (MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+    pos += bombus_packet_encode_remaining_len(&buffer[pos], remaining_len);
+
+    buffer[pos++] = (topic_len >> 8) & 0xFF;
+    buffer[pos++] = topic_len & 0xFF;
+    memcpy(&buffer[pos], topic, topic_len);
+    pos += topic_len;
+
+    if (qos > 0) {
+        buffer[pos++] = (msg_id >> 8) & 0xFF;
+        buffer[pos++] = msg_id & 0xFF;
+    }
+
+    buffer[pos++] = properties_len;
+    if (alias) {
+        buffer[pos++] = PROPERTY_TOPIC_ALIAS;
+        buffer[pos++] = (alias >> 8) & 0xFF;
+        buffer[pos++] = alias & 0xFF;
+    }
+
+    return pos;
+}
+
+
+/**
+ * Decode MQTT variable length integer.
+ *
+ */
+bool bombus_packet_decode_remaining_len(const unsigned char *buffer, size_t len, size_t *value, size_t *used)
+{
+    *value = 0;
+    for (size_t pos = 0; pos < len && pos < 4; pos++) {
+        *value |= (size_t)(buffer[pos] & 0x7F) << (7 * pos);
+        if (!(buffer[pos] & 0x80)) {
+            *used = pos + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Get next MQTT 5 property.
+ *
+ * Integer values are returned in value, strings and binary data are only
+ * skipped. Returns false at the end or when property is malformed.
+ *
+ */
+bool bombus_packet_next_property(const unsigned char *buffer, size_t len, size_t *pos, unsigned char *id, uint32_t *value)
+{
+    size_t size = 0, used;
+
+    if (*pos >= len)
+        return false;
+
+    *id = buffer[(*pos)++];
+    *value = 0;
+
+    switch (*id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+            size = 1;
+            break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            size = 2;
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            size = 4;
+            break;
+
+        case 0x0B: {
+            size_t varint;
+            if (!bombus_packet_decode_remaining_len(&buffer[*pos], len - *pos, &varint, &used))
+                return false;
+            *value = varint;
+            *pos += used;
+        }   return true;
+
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+        case 0x26:
+            // String or binary data, user property is pair of strings
+            for (int i = (*id == 0x26 ? 2 : 1); i > 0; i--) {
+                if (*pos + 2 > len)
+                    return false;
+                *pos += 2 + (((size_t)buffer[*pos] << 8) | buffer[*pos + 1]);
+            }
+            return *pos <= len;
+
+        default:
+            (*pos)--;   // Unknown property, caller sees properties not consumed
+            return false;
+    }
+
+    if (*pos + size > len)
+        return false;
+    for (size_t i=0; i<size; i++)
+        *value = (*value << 8) | buffer[(*pos)++];
+
+    return true;
+}
@@ -0,0 +1,42 @@
+
+#ifndef __BOMBUS_PACKET_H_
+#define __BOMBUS_PACKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define BOMBUS_PACKET_MAX_HEADER_LEN(topic_len)     (1 + 4 + 2 + (topic_len) + 2)
+#define BOMBUS_PACKET_MAX_HEADER_LEN_V5(topic_len)  (BOMBUS_PACKET_MAX_HEADER_LEN(topic_len) + 1 + 3)
+#define BOMBUS_PACKET_MAX_REMAINING_LEN             268435455
+#define BOMBUS_PACKET_PREPARED_OFFSET               5       // Room for fixed header before prepared topic
+
+
+enum bombus_packet_property_e {
+    PROPERTY_SESSION_EXPIRY = 0x11,
+    PROPERTY_SERVER_KEEP_ALIVE = 0x13,
+    PROPERTY_RECEIVE_MAXIMUM = 0x21,
+    PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22,
+    PROPERTY_TOPIC_ALIAS = 0x23,
+    PROPERTY_MAXIMUM_PACKET_SIZE = 0x27,
+};
+
+
+
+size_t bombus_packet_encode_remaining_len(unsigned char *buffer, size_t len);
+size_t bombus_packet_size(size_t remaining_len);
+size_t bombus_packet_encode_publish_header(unsigned char *buffer, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                           const char *topic, size_t topic_len, size_t payload_len);
+size_t bombus_packet_encode_publish_header_v5(unsigned char *buffer, bool dup, unsigned char qos, bool retain, unsigned short msg_id,
+                                              const char *topic, size_t topic_len, unsigned short alias, size_t payload_len);
+
+size_t bombus_packet_prepare_publish_header(unsigned char *buffer, const char *topic, size_t topic_len, unsigned char qos);
+size_t bombus_packet_complete_publish_header(unsigned char *buffer, size_t variable_len, bool dup, unsigned char qos, bool retain,
+                                             unsigned short msg_id, size_t payload_len);
+
+bool bombus_packet_decode_remaining_len(const unsigned char *buffer, size_t len, size_t *value, size_t *used);
+bool bombus_packet_next_property(const unsigned char *buffer, size_t len, size_t *pos, unsigned char *id, uint32_t *value);
+
+
+#endif /* __BOMBUS_PACKET_H_ */
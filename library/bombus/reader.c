@@ -0,0 +1,241 @@
+
+#include "reader.h"
+#include "packet.h"
+
+#include "mx/memory.h"
+#include "mx/mqtt.h"
+
+#include <string.h>
+
+
+#define READER_MIN_BUFFER_SIZE      256
+
+
+
+
+static void bombus_reader_reserve(struct bombus_reader *self, size_t size)
+{
+    if (size <= self->buffer_size)
+        return;
+
+    self->buffer_size = size < READER_MIN_BUFFER_SIZE ? READER_MIN_BUFFER_SIZE : size;
+    self->buffer = xrealloc(self->buffer, self->buffer_size);
+}
+
+
+/**
+ * Copy bytes into buffer until it holds body_len bytes.
+ *
+ */
+static size_t bombus_reader_collect(struct bombus_reader *self, const unsigned char *data, size_t len)
+{
+    size_t take = self->body_len - self->buffer_len;
+    if (take > len)
+        take = len;
+
+    memcpy(&self->buffer[self->buffer_len], data, take);
+    self->buffer_len += take;
+    return take;
+}
+
+
+/**
+ * Decide how frame body is read once remaining length is known.
+ *
+ */
+static void bombus_reader_start_body(struct bombus_reader *self, struct bombus_reader_event *event)
+{
+    self->buffer_len = 0;
+
+    if (self->remaining_len <= self->threshold) {
+        if (self->remaining_len == 0) {
+            event->type = READER_EVENT_FRAME;
+            event->data = self->buffer;
+            event->len = 0;
+            self->state = READER_TYPE;
+            return;
+        }
+        bombus_reader_reserve(self, self->remaining_len);
+        self->body_len = self->remaining_len;
+        self->state = READER_BODY;
+        return;
+    }
+
+    if ((self->header >> 4) != MQTT_PUBLISH) {
+        event->type = READER_EVENT_ERROR;
+        return;
+    }
+
+    // Topic length first, then the rest of variable header
+    bombus_reader_reserve(self, 2);
+    self->body_len = 2;
+    self->state = READER_PUBLISH_HEADER;
+}
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct bombus_reader* bombus_reader_new(size_t threshold)
+{
+    struct bombus_reader *self = xmalloc(sizeof(struct bombus_reader));
+    self->buffer = NULL;
+    self->buffer_size = 0;
+    self->threshold = threshold;
+    self->v5 = false;
+    bombus_reader_reset(self);
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_reader* bombus_reader_delete(struct bombus_reader *self)
+{
+    if (self->buffer)
+        xfree(self->buffer);
+    return xfree(self);
+}
+
+
+/**
+ * Forget partially read frame, connection starts again.
+ *
+ */
+void bombus_reader_reset(struct bombus_reader *self)
+{
+    self->state = READER_TYPE;
+    self->header = 0;
+    self->remaining_len = 0;
+    self->len_bytes = 0;
+    self->buffer_len = 0;
+    self->body_len = 0;
+    self->properties_pos = 0;
+    self->payload_len = 0;
+    self->payload_left = 0;
+}
+
+
+/**
+ * Consume input until event is produced or input is exhausted.
+ *
+ * Returns number of bytes consumed, caller handles event and passes the rest
+ * of input again. Frame and publish header events point into reader buffer,
+ * chunks point into input.
+ *
+ */
+size_t bombus_reader_process(struct bombus_reader *self, const unsigned char *data, size_t len, struct bombus_reader_event *event)
+{
+    size_t pos = 0;
+
+    event->type = READER_EVENT_NONE;
+
+    while (pos < len && event->type == READER_EVENT_NONE) {
+        switch (self->state) {
+            case READER_TYPE:
+                self->header = data[pos++];
+                self->remaining_len = 0;
+                self->len_bytes = 0;
+                self->state = READER_LENGTH;
+                break;
+
+            case READER_LENGTH: {
+                unsigned char byte = data[pos++];
+                self->remaining_len |= (size_t)(byte & 0x7F) << (7 * self->len_bytes);
+                self->len_bytes++;
+                if (byte & 0x80) {
+                    if (self->len_bytes == 4)
+                        event->type = READER_EVENT_ERROR;
+                    break;
+                }
+                bombus_reader_start_body(self, event);
+            }   break;
+
+            case READER_BODY:
+                pos += bombus_reader_collect(self, &data[pos], len - pos);
+                if (self->buffer_len == self->body_len) {
+                    event->type = READER_EVENT_FRAME;
+                    event->data = self->buffer;
+                    event->len = self->buffer_len;
+                    self->state = READER_TYPE;
+                }
+                break;
+
+            case READER_PUBLISH_HEADER:
+                pos += bombus_reader_collect(self, &data[pos], len - pos);
+                if (self->buffer_len < self->body_len)
+                    break;
+
+                if (self->body_len == 2) {
+                    // Topic length known, packet id follows for QoS 1/2, then properties for MQTT 5
+                    size_t topic_len = ((size_t)self->buffer[0] << 8) | self->buffer[1];
+                    self->body_len = 2 + topic_len + (((self->header >> 1) & 0x03) > 0 ? 2 : 0);
+                    if (self->v5) {
+                        self->properties_pos = self->body_len;
+                        self->body_len++;
+                    }
+                    if (self->body_len > self->remaining_len) {
+                        event->type = READER_EVENT_ERROR;
+                        break;
+                    }
+                    bombus_reader_reserve(self, self->body_len);
+                    if (self->body_len > 2)
+                        break;
+                }
+
+                if (self->properties_pos > 0) {
+                    // Property length is variable integer, collected byte by byte
+                    size_t properties_len, used;
+                    if (!bombus_packet_decode_remaining_len(&self->buffer[self->properties_pos],
+                                                            self->body_len - self->properties_pos, &properties_len, &used)) {
+                        if (self->body_len - self->properties_pos == 4 || self->body_len == self->remaining_len) {
+                            event->type = READER_EVENT_ERROR;
+                            break;
+                        }
+                        self->body_len++;
+                        bombus_reader_reserve(self, self->body_len);
+                        break;
+                    }
+
+                    self->properties_pos = 0;
+                    self->body_len += properties_len;
+                    if (self->body_len > self->remaining_len) {
+                        event->type = READER_EVENT_ERROR;
+                        break;
+                    }
+                    bombus_reader_reserve(self, self->body_len);
+                    if (properties_len > 0)
+                        break;
+                }
+
+                self->payload_len = self->remaining_len - self->body_len;
+                self->payload_left = self->payload_len;
+                self->state = self->payload_left > 0 ? READER_PUBLISH_PAYLOAD : READER_TYPE;
+                event->type = READER_EVENT_PUBLISH;
+                event->data = self->buffer;
+                event->len = self->buffer_len;
+                break;
+
+            case READER_PUBLISH_PAYLOAD: {
+                size_t take = len - pos;
+                if (take > self->payload_left)
+                    take = self->payload_left;
+
+                event->type = READER_EVENT_CHUNK;
+                event->data = &data[pos];
+                event->len = take;
+                pos += take;
+                self->payload_left -= take;
+                if (self->payload_left == 0)
+                    self->state = READER_TYPE;
+            }   break;
+        }
+    }
+
+    return pos;
+}
@@ -0,0 +1,70 @@
+#ifndef __BOMBUS_READER_H_
+#define __BOMBUS_READER_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+enum bombus_reader_state_e {
+    READER_TYPE = 0,
+    READER_LENGTH,
+    READER_BODY,                // Whole frame kept in buffer
+    READER_PUBLISH_HEADER,      // Large publish, topic and packet id kept in buffer
+    READER_PUBLISH_PAYLOAD,     // Large publish, payload passed through
+};
+
+
+enum bombus_reader_event_e {
+    READER_EVENT_NONE = 0,
+    READER_EVENT_FRAME,         // Complete frame in buffer
+    READER_EVENT_PUBLISH,       // Large publish header decoded
+    READER_EVENT_CHUNK,         // Part of large publish payload
+    READER_EVENT_ERROR,
+};
+
+
+struct bombus_reader_event
+{
+    int type;
+    const unsigned char *data;  // Frame body or payload chunk
+    size_t len;
+};
+
+
+/**
+ * Incremental MQTT frame decoder.
+ *
+ * Frames up to threshold are collected whole, publishes above it are split
+ * into header and payload chunks taken straight from input, so memory stays
+ * bounded by threshold and topic length.
+ *
+ */
+struct bombus_reader
+{
+    int state;
+    unsigned char header;       // Packet type and flags
+    size_t remaining_len;
+    unsigned int len_bytes;
+
+    unsigned char *buffer;
+    size_t buffer_len;
+    size_t buffer_size;
+    size_t threshold;
+    bool v5;                    // MQTT 5, publish header ends with properties
+
+    size_t body_len;            // Bytes expected in buffer
+    size_t properties_pos;      // Property length being collected, zero if none
+    size_t payload_len;
+    size_t payload_left;
+};
+
+
+struct bombus_reader* bombus_reader_new(size_t threshold);
+struct bombus_reader* bombus_reader_delete(struct bombus_reader *self);
+
+void bombus_reader_reset(struct bombus_reader *self);
+size_t bombus_reader_process(struct bombus_reader *self, const unsigned char *data, size_t len, struct bombus_reader_event *event);
+
+
+#endif /* __BOMBUS_READER_H_ */
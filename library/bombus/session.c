@@ -0,0 +1,469 @@
+
+#include "session.h"
+#include "inflight.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+
+#define SESSION_HEADER_LEN      8
+#define SESSION_FLAG_RETAIN     0x04
+#define SESSION_FLAG_RELEASED   0x08
+
+
+
+
+static void bombus_session_encode_header(unsigned char *buffer, unsigned char type, unsigned char flags, unsigned short msg_id, size_t body_len)
+{
+    buffer[0] = type;
+    buffer[1] = flags;
+    buffer[2] = (msg_id >> 8) & 0xFF;
+    buffer[3] = msg_id & 0xFF;
+    buffer[4] = (body_len >> 24) & 0xFF;
+    buffer[5] = (body_len >> 16) & 0xFF;
+    buffer[6] = (body_len >> 8) & 0xFF;
+    buffer[7] = body_len & 0xFF;
+}
+
+
+static bool bombus_session_write(int fd, const void *data, size_t len)
+{
+    const unsigned char *ptr = data;
+
+    while (len > 0) {
+        ssize_t written = write(fd, ptr, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += written;
+        len -= written;
+    }
+    return true;
+}
+
+
+static bool bombus_session_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // Skip what was written, continue with the rest
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (unsigned char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Append message record, header, topic and payload go with single write.
+ *
+ */
+static size_t bombus_session_write_msg(int fd, const struct bombus_inflight_msg *msg)
+{
+    size_t topic_len = strlen(msg->topic);
+    size_t payload_len = msg->state == INFLIGHT_RELEASED ? 0 : msg->payload_len;
+    size_t body_len = 2 + topic_len + payload_len;
+    unsigned char flags = msg->qos | (msg->retain ? SESSION_FLAG_RETAIN : 0) |
+                          (msg->state == INFLIGHT_RELEASED ? SESSION_FLAG_RELEASED : 0);
+
+    unsigned char header[SESSION_HEADER_LEN + 2];
+    bombus_session_encode_header(header, SESSION_ADD, flags, msg->msg_id, body_len);
+    header[SESSION_HEADER_LEN] = (topic_len >> 8) & 0xFF;
+    header[SESSION_HEADER_LEN + 1] = topic_len & 0xFF;
+
+    struct iovec iov[3] = {
+        { .iov_base = header, .iov_len = sizeof(header) },
+        { .iov_base = msg->topic, .iov_len = topic_len },
+        { .iov_base = msg->payload, .iov_len = payload_len },
+    };
+
+    if (!bombus_session_writev(fd, iov, payload_len > 0 ? 3 : 2))
+        return 0;
+    return SESSION_HEADER_LEN + body_len;
+}
+
+
+/**
+ * Append record with topic as body, subscription changes.
+ *
+ */
+static size_t bombus_session_write_topic(int fd, unsigned char type, unsigned char flags, const char *topic, size_t topic_len)
+{
+    unsigned char header[SESSION_HEADER_LEN];
+    bombus_session_encode_header(header, type, flags, 0, topic_len);
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = sizeof(header) },
+        { .iov_base = (char*)topic, .iov_len = topic_len },
+    };
+
+    if (!bombus_session_writev(fd, iov, 2))
+        return 0;
+    return SESSION_HEADER_LEN + topic_len;
+}
+
+
+static int bombus_session_subscription_index(struct bombus_session *self, const char *topic, size_t topic_len)
+{
+    for (unsigned int i=0; i<self->subscriptions_len; i++) {
+        const char *stored = self->subscriptions[i].topic;
+        if (!strncmp(stored, topic, topic_len) && stored[topic_len] == '\0')
+            return i;
+    }
+    return -1;
+}
+
+
+static void bombus_session_set_subscription(struct bombus_session *self, const char *topic, size_t topic_len, unsigned char qos)
+{
+    int idx = bombus_session_subscription_index(self, topic, topic_len);
+    if (idx < 0) {
+        if (self->subscriptions_len == self->subscriptions_size) {
+            self->subscriptions_size = self->subscriptions_size ? 2 * self->subscriptions_size : 8;
+            self->subscriptions = xrealloc(self->subscriptions, self->subscriptions_size * sizeof(struct bombus_session_subscription));
+        }
+        idx = self->subscriptions_len++;
+        self->subscriptions[idx].topic = xmalloc(topic_len + 1);
+        memcpy(self->subscriptions[idx].topic, topic, topic_len);
+        self->subscriptions[idx].topic[topic_len] = '\0';
+    }
+    self->subscriptions[idx].qos = qos;
+}
+
+
+static void bombus_session_drop_subscription(struct bombus_session *self, unsigned int idx)
+{
+    xfree(self->subscriptions[idx].topic);
+    self->subscriptions[idx] = self->subscriptions[--self->subscriptions_len];
+}
+
+
+/**
+ * Rebuild in-flight table from journal, torn record at the end is ignored.
+ *
+ * Fails when stored messages do not fit in-flight window, journal is kept
+ * untouched, so no message is lost.
+ *
+ */
+static bool bombus_session_load(struct bombus_session *self, struct bombus_inflight *inflight, const unsigned char *data, size_t len)
+{
+    size_t pos = 0;
+    unsigned int dropped = 0;
+
+    while (pos + SESSION_HEADER_LEN <= len) {
+        const unsigned char *header = &data[pos];
+        unsigned char type = header[0];
+        unsigned char flags = header[1];
+        unsigned short msg_id = ((unsigned short)header[2] << 8) | header[3];
+        size_t body_len = ((size_t)header[4] << 24) | ((size_t)header[5] << 16) | ((size_t)header[6] << 8) | header[7];
+        const unsigned char *body = &data[pos + SESSION_HEADER_LEN];
+
+        if (pos + SESSION_HEADER_LEN + body_len > len)
+            break;
+        pos += SESSION_HEADER_LEN + body_len;
+
+        switch (type) {
+            case SESSION_ADD: {
+                size_t topic_len = body_len >= 2 ? ((size_t)body[0] << 8) | body[1] : 0;
+                if (body_len < 2 + topic_len)
+                    break;
+
+                char topic[topic_len + 1];
+                memcpy(topic, &body[2], topic_len);
+                topic[topic_len] = '\0';
+
+                struct bombus_inflight_msg *msg = bombus_inflight_find(inflight, msg_id);
+                if (msg)
+                    bombus_inflight_remove(inflight, msg);
+                msg = bombus_inflight_add(inflight, msg_id, flags & 0x03, flags & SESSION_FLAG_RETAIN, topic,
+                                          &body[2 + topic_len], body_len - 2 - topic_len);
+                if (!msg) {
+                    dropped++;
+                    break;
+                }
+                if (flags & SESSION_FLAG_RELEASED)
+                    bombus_inflight_release(inflight, msg);
+            }   break;
+
+            case SESSION_RELEASE: {
+                struct bombus_inflight_msg *msg = bombus_inflight_find(inflight, msg_id);
+                if (msg)
+                    bombus_inflight_release(inflight, msg);
+            }   break;
+
+            case SESSION_REMOVE: {
+                struct bombus_inflight_msg *msg = bombus_inflight_find(inflight, msg_id);
+                if (msg)
+                    bombus_inflight_remove(inflight, msg);
+            }   break;
+
+            case SESSION_RECEIVED:
+                bombus_inflight_mark_received(inflight, msg_id);
+                break;
+
+            case SESSION_FORGET:
+                bombus_inflight_release_received(inflight, msg_id);
+                break;
+
+            case SESSION_SUBSCRIBE:
+                bombus_session_set_subscription(self, (const char*)body, body_len, flags & 0x03);
+                break;
+
+            case SESSION_UNSUBSCRIBE: {
+                int idx = bombus_session_subscription_index(self, (const char*)body, body_len);
+                if (idx >= 0)
+                    bombus_session_drop_subscription(self, idx);
+            }   break;
+
+            case SESSION_UNSUBSCRIBE_ALL:
+                while (self->subscriptions_len > 0)
+                    bombus_session_drop_subscription(self, self->subscriptions_len - 1);
+                break;
+        }
+    }
+
+    if (dropped > 0) {
+        BOMBUS_ERROR("Session %s holds more messages than in-flight window %u, %u do not fit",
+                     self->path, inflight->max, dropped);
+        bombus_inflight_clear(inflight);
+        return false;
+    }
+    if (inflight->count > 0)
+        BOMBUS_INFO("Session %s restored %u messages in flight", self->path, inflight->count);
+    return true;
+}
+
+
+
+
+/*
+ * Constructor
+ *
+ * Journal is created when missing, stored state is loaded into in-flight
+ * table and journal is compacted right away.
+ *
+ */
+struct bombus_session* bombus_session_open(const char *path, struct bombus_inflight *inflight)
+{
+    struct bombus_session *self = xmalloc(sizeof(struct bombus_session));
+    self->path = xstrdup(path);
+    self->fd = -1;
+    self->size = 0;
+    self->subscriptions = NULL;
+    self->subscriptions_len = 0;
+    self->subscriptions_size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        bool loaded = true;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            unsigned char *data = xmalloc(st.st_size);
+            size_t len = 0;
+            while (len < (size_t)st.st_size) {
+                ssize_t bytes = read(fd, data + len, st.st_size - len);
+                if (bytes < 0 && errno == EINTR)
+                    continue;
+                if (bytes < 0) {
+                    BOMBUS_ERROR("Cannot read session %s, error %d", path, errno);
+                    loaded = false;
+                }
+                if (bytes <= 0)
+                    break;
+                len += bytes;
+            }
+            if (loaded)
+                loaded = bombus_session_load(self, inflight, data, len);
+            xfree(data);
+        }
+        close(fd);
+        if (!loaded)
+            return bombus_session_close(self);
+    }
+    else if (errno != ENOENT) {
+        BOMBUS_ERROR("Cannot open session %s, error %d", path, errno);
+        return bombus_session_close(self);
+    }
+
+    bombus_session_compact(self, inflight);
+    if (self->fd < 0)
+        return bombus_session_close(self);
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct bombus_session* bombus_session_close(struct bombus_session *self)
+{
+    if (self->fd >= 0)
+        close(self->fd);
+    while (self->subscriptions_len > 0)
+        bombus_session_drop_subscription(self, self->subscriptions_len - 1);
+    if (self->subscriptions)
+        xfree(self->subscriptions);
+    xfree(self->path);
+
+    return xfree(self);
+}
+
+
+void bombus_session_add(struct bombus_session *self, const struct bombus_inflight_msg *msg)
+{
+    size_t written = bombus_session_write_msg(self->fd, msg);
+    if (written == 0)
+        BOMBUS_ERROR("Cannot write session %s, error %d", self->path, errno);
+    self->size += written;
+}
+
+
+void bombus_session_record(struct bombus_session *self, unsigned char type, unsigned short msg_id)
+{
+    unsigned char record[SESSION_HEADER_LEN];
+    bombus_session_encode_header(record, type, 0, msg_id, 0);
+
+    if (!bombus_session_write(self->fd, record, sizeof(record)))
+        BOMBUS_ERROR("Cannot write session %s, error %d", self->path, errno);
+    self->size += sizeof(record);
+}
+
+
+/**
+ * Replace journal with snapshot of live state.
+ *
+ * Snapshot is written aside and renamed over journal, so crash in between
+ * leaves old journal intact.
+ *
+ */
+void bombus_session_compact(struct bombus_session *self, struct bombus_inflight *inflight)
+{
+    char tmp_path[strlen(self->path) + 5];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", self->path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        BOMBUS_ERROR("Cannot create session %s, error %d", tmp_path, errno);
+        return;
+    }
+
+    size_t size = 0;
+    bool success = true;
+    for (unsigned int i=0; i<inflight->size && success; i++) {
+        const struct bombus_inflight_msg *msg = &inflight->msgs[i];
+        if (msg->state == INFLIGHT_FREE || msg->borrowed)
+            continue;
+        size_t written = bombus_session_write_msg(fd, msg);
+        success = written > 0;
+        size += written;
+    }
+
+    for (unsigned int id=1; inflight->received && id<65536 && success; id++) {
+        if (!(inflight->received[id >> 3] & (1 << (id & 0x07))))
+            continue;
+        unsigned char record[SESSION_HEADER_LEN];
+        bombus_session_encode_header(record, SESSION_RECEIVED, 0, id, 0);
+        success = bombus_session_write(fd, record, sizeof(record));
+        size += sizeof(record);
+    }
+
+    for (unsigned int i=0; i<self->subscriptions_len && success; i++) {
+        const struct bombus_session_subscription *subscription = &self->subscriptions[i];
+        size_t written = bombus_session_write_topic(fd, SESSION_SUBSCRIBE, subscription->qos, subscription->topic, strlen(subscription->topic));
+        success = written > 0;
+        size += written;
+    }
+
+    if (!success || rename(tmp_path, self->path) < 0) {
+        BOMBUS_ERROR("Cannot write session %s, error %d", self->path, errno);
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+
+    if (self->fd >= 0)
+        close(self->fd);
+    self->fd = fd;
+    self->size = size;
+}
+
+
+/**
+ * Broker keeps subscription in session, journal remembers it for next run.
+ *
+ */
+void bombus_session_subscribe(struct bombus_session *self, const char *topic, unsigned char qos)
+{
+    size_t topic_len = strlen(topic);
+
+    bombus_session_set_subscription(self, topic, topic_len, qos);
+    size_t written = bombus_session_write_topic(self->fd, SESSION_SUBSCRIBE, qos, topic, topic_len);
+    if (written == 0)
+        BOMBUS_ERROR("Cannot write session %s, error %d", self->path, errno);
+    self->size += written;
+}
+
+
+void bombus_session_unsubscribe(struct bombus_session *self, const char *topic)
+{
+    size_t topic_len = strlen(topic);
+    int idx = bombus_session_subscription_index(self, topic, topic_len);
+    if (idx < 0)
+        return;
+
+    size_t written = bombus_session_write_topic(self->fd, SESSION_UNSUBSCRIBE, 0, topic, topic_len);
+    if (written == 0)
+        BOMBUS_ERROR("Cannot write session %s, error %d", self->path, errno);
+    self->size += written;
+    bombus_session_drop_subscription(self, idx);
+}
+
+
+/**
+ * Broker started clean session, it keeps no subscription.
+ *
+ */
+void bombus_session_unsubscribe_all(struct bombus_session *self)
+{
+    if (self->subscriptions_len == 0)
+        return;
+
+    while (self->subscriptions_len > 0)
+        bombus_session_drop_subscription(self, self->subscriptions_len - 1);
+    bombus_session_record(self, SESSION_UNSUBSCRIBE_ALL, 0);
+}
+
+
+const struct bombus_session_subscription* bombus_session_find_subscription(struct bombus_session *self, const char *topic)
+{
+    int idx = bombus_session_subscription_index(self, topic, strlen(topic));
+    return idx >= 0 ? &self->subscriptions[idx] : NULL;
+}
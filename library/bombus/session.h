@@ -0,0 +1,72 @@
+#ifndef __BOMBUS_SESSION_H_
+#define __BOMBUS_SESSION_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+#define BOMBUS_SESSION_COMPACT_SIZE     (4*1024*1024)
+
+
+struct bombus_inflight;
+struct bombus_inflight_msg;
+
+
+enum bombus_session_record_e {
+    SESSION_ADD = 1,            // Outgoing message waiting for acknowledge
+    SESSION_RELEASE,            // QoS 2 PUBREC received, payload dropped
+    SESSION_REMOVE,             // Outgoing message acknowledged
+    SESSION_RECEIVED,           // Incoming QoS 2 id waiting for PUBREL
+    SESSION_FORGET,             // Incoming QoS 2 id released
+    SESSION_SUBSCRIBE,          // Filter subscribed on broker, QoS in flags
+    SESSION_UNSUBSCRIBE,        // Filter unsubscribed on broker
+    SESSION_UNSUBSCRIBE_ALL,    // Broker started clean session
+};
+
+
+struct bombus_session_subscription
+{
+    char *topic;
+    unsigned char qos;
+};
+
+
+/**
+ * On-disk journal of QoS 1/2 state.
+ *
+ * Every change of in-flight table and of subscriptions kept by broker is
+ * appended as compact record, the file is replayed on open and rewritten as
+ * snapshot of live state whenever it grows over BOMBUS_SESSION_COMPACT_SIZE.
+ *
+ * Journal is not synced to disk, it survives crash of the process but not
+ * of the machine. Publish path never waits for disk, compaction rewrites
+ * only live window and runs once per BOMBUS_SESSION_COMPACT_SIZE of records.
+ *
+ */
+struct bombus_session
+{
+    char *path;
+    int fd;
+    size_t size;
+
+    struct bombus_session_subscription *subscriptions;
+    unsigned int subscriptions_len;
+    unsigned int subscriptions_size;
+};
+
+
+struct bombus_session* bombus_session_open(const char *path, struct bombus_inflight *inflight);
+struct bombus_session* bombus_session_close(struct bombus_session *self);
+
+void bombus_session_add(struct bombus_session *self, const struct bombus_inflight_msg *msg);
+void bombus_session_record(struct bombus_session *self, unsigned char type, unsigned short msg_id);
+void bombus_session_compact(struct bombus_session *self, struct bombus_inflight *inflight);
+
+void bombus_session_subscribe(struct bombus_session *self, const char *topic, unsigned char qos);
+void bombus_session_unsubscribe(struct bombus_session *self, const char *topic);
+void bombus_session_unsubscribe_all(struct bombus_session *self);
+const struct bombus_session_subscription* bombus_session_find_subscription(struct bombus_session *self, const char *topic);
+
+
+#endif /* __BOMBUS_SESSION_H_ */
@@ -0,0 +1,1196 @@
+
+#include "app.h"
+#include "utils.h"
+#include "latency.h"
+#include "topic_tree.h"
+#include "spool.h"
+#include "feeder.h"
+#include "sink.h"
+#include "pacer.h"
+#include "generator.h"
+#include "upload.h"
+#include "store.h"
+
+#include "bombus/client.h"
+#include "bombus/log.h"
+
+#include "mx/string.h"
+#include "mx/memory.h"
+#include "mx/stream.h"
+#include "mx/mqtt.h"
+#include "mx/idler.h"
+#include "mx/misc.h"
+#include "mx/timer.h"
+#include "mx/queue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+
+#define BOMBUS_CONNECTION_TIMEOUT       5000
+#define BOMBUS_BACKOFF_BASE             500
+#define BOMBUS_BACKOFF_MAX              30000
+#define BOMBUS_ACK_TIMEOUT              10000
+#define BOMBUS_SPOOL_SEGMENT_SIZE       (1024*1024)
+#define BOMBUS_SPOOL_REPLAY_BATCH       256
+#define BOMBUS_FEED_BATCH               4096
+#define BOMBUS_FEED_MAX_OUTGOING        (256*1024)
+#define BOMBUS_SINK_BUFFER_SIZE         (1024*1024)
+#define BOMBUS_STATS_UPDATE_INTERVAL    1000
+#define BOMBUS_HOUSEKEEPING_INTERVAL    1000
+#define BOMBUS_HOUSEKEEPING_BUSY        100
+#define BOMBUS_MAX_TIMEOUT              60000
+#define BOMBUS_ITEMS_PER_SLAB           16
+#define BOMBUS_SCRATCH_SIZE             (2*LINE_BUFFER_SIZE)
+#define BOMBUS_DRAIN_INTERVAL           10
+#define BOMBUS_DISPATCH_HANDLERS        4       // Distinct handlers run for one message
+
+
+
+static void app_subscription_delete(void *data);
+static void app_subscribe(struct app *self, const char *topic, unsigned char qos, bool remote, app_msg_handler handler);
+static void app_log_msg(struct app_client *client, const struct bombus_msg *msg);
+static void app_latency_msg(struct app_client *client, const struct bombus_msg *msg);
+static void app_handle_connection(void *object, struct bombus *bombus, bool connected);
+static void app_publish(struct app_client *client, const char *topic, unsigned char qos, bool retain, const void *payload, size_t payload_len);
+static void app_connect_clients(struct app *self);
+static void app_replay_spool(struct app_client *client);
+static void app_feed(struct app *self);
+static bool app_is_drained(struct app *self);
+static void app_handle_msg(void *object, struct bombus *bombus, const struct bombus_msg *msg);
+static void app_handle_chunk(void *object, struct bombus *bombus, const struct bombus_chunk *chunk);
+static void app_handle_timer(void *object, struct bombus *bombus, unsigned long long deadline);
+static void app_client_expired(void *arg);
+static void app_housekeeping(void *arg);
+static void app_pace(void *arg);
+static void app_upload(struct app *self);
+
+
+void app_init(struct app *self)
+{
+    self->idler = idler_new();
+    timer_wheel_init(&self->timers, monotonic_time_ms());
+    timer_entry_init(&self->housekeeping, app_housekeeping, self);
+    self->clients = NULL;
+    self->clients_num = 0;
+    self->first = 0;
+
+    self->ramp = 0;
+    self->ramp_tokens = 0;
+    self->ramp_time = 0;
+
+    self->retain = false;
+    self->update_clock = true;
+    self->alive = true;
+    self->reconnect = true;
+    self->clean_session = true;
+    self->subscriptions = topic_tree_new();
+    self->publish_messages = NULL;
+    self->latency = NULL;
+    self->spool_rate = 0;
+
+    self->feeder = NULL;
+    self->feed_qos = 0;
+    self->feed_next = 0;
+    self->feed_blocked = false;
+
+    self->sink = NULL;
+    self->store = NULL;
+
+    self->pacer = NULL;
+    timer_entry_init(&self->pace_timer, app_pace, self);
+    self->pace_msg = NULL;
+    self->pace_blocked = false;
+    self->generator = NULL;
+
+    self->upload = NULL;
+    self->upload_ready = false;
+
+    slab_pool_init(&self->items, sizeof(struct mqtt_msg_item), BOMBUS_ITEMS_PER_SLAB);
+    arena_init(&self->scratch, BOMBUS_SCRATCH_SIZE);
+
+    stats_reset(&self->stats);
+    self->stats_time = 0;
+    self->wakeups = 0;
+    self->reporting = false;
+}
+
+
+void app_clean(struct app *self)
+{
+    if (self->feeder)
+        self->feeder = feeder_delete(self->feeder);
+    if (self->sink)
+        self->sink = sink_delete(self->sink);
+    if (self->pacer)
+        self->pacer = pacer_delete(self->pacer);
+    self->pace_msg = NULL;
+    if (self->generator)
+        self->generator = generator_delete(self->generator);
+    if (self->reporting)
+        stats_reporter_clean(&self->reporter);
+    self->reporting = false;
+
+    if (self->latency)
+        self->latency = latency_delete(self->latency);
+
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        bombus_set_timer_handler(self->clients[i].bombus, NULL, NULL);
+        bombus_disconnect(self->clients[i].bombus);
+        bombus_delete(self->clients[i].bombus);
+        if (self->clients[i].spool)
+            spool_delete(self->clients[i].spool);
+        if (self->clients[i].store_fd >= 0)
+            store_close(self->store, self->clients[i].store_fd, false);
+    }
+    if (self->store)
+        self->store = store_delete(self->store);
+    if (self->clients)
+        self->clients = xfree(self->clients);
+    self->clients_num = 0;
+
+    // Mapping is referenced by client until it is gone
+    if (self->upload)
+        self->upload = upload_delete(self->upload);
+    self->upload_ready = false;
+
+    timer_wheel_clean(&self->timers);
+    idler_delete(self->idler);
+
+    self->alive = false;
+
+    if (self->subscriptions)
+        self->subscriptions = topic_tree_delete(self->subscriptions, app_subscription_delete);
+    self->publish_messages = NULL;
+
+    slab_pool_clean(&self->items);
+    arena_clean(&self->scratch);
+}
+
+
+bool app_is_alive(struct app *self)
+{
+    return self->alive;
+}
+
+
+struct idler* app_get_idler(struct app *self)
+{
+    return self->idler;
+}
+
+
+/**
+ * Configure clients.
+ *
+ * Application may serve only part of all clients, first is the global number
+ * of its first client.
+ *
+ */
+void app_configure(struct app *self, struct args *args, unsigned int first, unsigned int count)
+{
+    self->clients_num = count;
+    self->first = first;
+    self->clients = xmalloc(self->clients_num * sizeof(struct app_client));
+    self->ramp = args->ramp;
+    if (self->ramp > 0 && args->clients > count) {
+        // Share ramp rate with other applications
+        self->ramp = (unsigned int)((uint64_t)args->ramp * count / args->clients);
+        if (self->ramp == 0)
+            self->ramp = 1;
+    }
+    self->ramp_time = monotonic_time_ms();
+    self->spool_rate = args->spool_rate;
+    self->clean_session = !args->session_dir;
+    if (args->session_dir && mkdir(args->session_dir, 0755) < 0 && errno != EEXIST) {
+        BOMBUS_ERROR("Cannot create %s, error %d", args->session_dir, errno);
+        self->alive = false;
+    }
+
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        struct bombus *bombus = bombus_new(self->idler);
+        bombus_set_mqtt_keep_alive(bombus, args->keep_alive);
+
+        // Every client needs unique id
+        char client_id[strlen(args->client_id) + 12];
+        if (args->clients > 1)
+            snprintf(client_id, sizeof(client_id), "%s-%u", args->client_id, first + i);
+        else
+            snprintf(client_id, sizeof(client_id), "%s", args->client_id);
+        bombus_set_mqtt_client_id(bombus, client_id);
+
+        bombus_configure_address(bombus, args->address, args->port);
+        if (args->mqtt5)
+            bombus_configure_mqtt5(bombus, args->topic_aliases);
+        bombus_set_msg_handler(bombus, &self->clients[i], app_handle_msg);
+        bombus_set_conn_handler(bombus, &self->clients[i], app_handle_connection);
+        bombus_set_timer_handler(bombus, &self->clients[i], app_handle_timer);
+        bombus_configure_reconnect(bombus, args->reconnect_attempts, BOMBUS_CONNECTION_TIMEOUT, BOMBUS_BACKOFF_BASE, BOMBUS_BACKOFF_MAX);
+        if (args->max_inflight > 0)
+            bombus_configure_inflight(bombus, args->max_inflight, BOMBUS_ACK_TIMEOUT);
+        if (args->cork > 0)
+            bombus_configure_cork(bombus, args->cork, args->cork_delay);
+        if (args->session_dir) {
+            // After in-flight window, stored messages are loaded into it
+            char path[strlen(args->session_dir) + sizeof(client_id) + 10];
+            snprintf(path, sizeof(path), "%s/%s.session", args->session_dir, client_id);
+            if (!bombus_configure_session(bombus, path))
+                self->alive = false;
+        }
+        if (args->stream_dir)
+            bombus_configure_streaming(bombus, args->stream_size, &self->clients[i], app_handle_chunk);
+
+//        if (args->ssl) {
+//            bombus_configure_ssl(bombus, NULL);
+//        }
+//        if (args->websocket) {
+//            bombus_configure_websocket(bombus, NULL);
+//        }
+
+        self->clients[i].app = self;
+        self->clients[i].bombus = bombus;
+        self->clients[i].idx = i;
+        timer_entry_init(&self->clients[i].timer, app_client_expired, &self->clients[i]);
+        self->clients[i].spool = NULL;
+        self->clients[i].spool_tokens = 0;
+        self->clients[i].spool_time = 0;
+        self->clients[i].store_fd = -1;
+
+        if (args->spool_dir) {
+            size_t segment_size = BOMBUS_SPOOL_SEGMENT_SIZE;
+            if (segment_size > args->spool_size)
+                segment_size = args->spool_size;
+            self->clients[i].spool = spool_new(args->spool_dir, client_id, segment_size, args->spool_size);
+        }
+    }
+
+    if (args->bench) {
+        self->latency = latency_new(args->bench->msg.topic, args->bench->msg.qos, args->bench_size,
+                                    args->bench_window, args->bench_interval, first, self->clients_num);
+
+        // Every client subscribes its own benchmark topic
+        char topic[strlen(args->bench->msg.topic) + 3];
+        snprintf(topic, sizeof(topic), "%s/+", args->bench->msg.topic);
+        app_subscribe(self, topic, args->bench->msg.qos, false, app_latency_msg);
+    }
+
+    if (args->subscribe_topics) {
+        // Store subscribe topics for future use
+        struct mqtt_msg_item *item;
+        LIST_FOREACH(item, args->subscribe_topics, _entry_) {
+            app_subscribe(self, item->msg.topic, item->msg.qos, true, app_log_msg);
+        }
+    }
+
+    if (count == args->clients && (args->stats_interval > 0 || args->stats_path)) {
+        stats_reporter_init(&self->reporter, args->stats_interval, args->stats_path);
+        self->reporting = true;
+    }
+
+    if (args->out_format != SINK_FORMAT_LOG) {
+        self->sink = sink_new(args->out_path, args->out_format, BOMBUS_SINK_BUFFER_SIZE, args->out_flush);
+        if (!self->sink)
+            self->alive = false;
+    }
+
+    if (args->pub_stdin || args->pub_file) {
+        const char *topic = args->pub_topic ? args->pub_topic->msg.topic : NULL;
+        self->feed_qos = args->pub_topic ? args->pub_topic->msg.qos : 0;
+        self->feeder = feeder_new(self->idler, args->pub_stdin ? NULL : args->pub_file, topic, args->pub_format);
+        if (!self->feeder)
+            self->alive = false;
+    }
+
+    if (args->rate > 0) {
+        // Exact share of rate and count, sums up to requested values over all applications.
+        // Count follows rate share, application without rate gets no messages.
+        uint64_t rate_first = (uint64_t)args->rate * first / args->clients;
+        uint64_t rate_last = (uint64_t)args->rate * (first + count) / args->clients;
+        unsigned int rate = rate_last - rate_first;
+        unsigned long long messages = args->count * rate_last / args->rate - args->count * rate_first / args->rate;
+        unsigned int burst = args->burst > 0 ? (uint64_t)args->burst * count / args->clients : 0;
+        if (args->burst > 0 && burst == 0)
+            burst = 1;
+        if (rate > 0 && (args->count == 0 || messages > 0)) {
+            self->pacer = pacer_new(rate, burst, messages, args->duration);
+            self->pace_msg = &args->pub_topic->msg;
+        }
+        if (self->pacer && args->payload != GENERATOR_NONE) {
+            // Every application renders own ring, seed keeps runs repeatable
+            self->generator = generator_new(args->payload, args->payload_size, first + 1);
+            if (!self->generator)
+                self->alive = false;
+        }
+    }
+
+    if (args->upload && first == 0) {
+        const struct mqtt_msg *msg = &args->upload->msg;
+        self->upload = upload_new((const char*)msg->payload, msg->topic, msg->qos, msg->retain);
+        if (!self->upload)
+            self->alive = false;
+    }
+
+    if (args->stream_dir) {
+        self->store = store_new(args->stream_dir);
+        if (!self->store)
+            self->alive = false;
+    }
+
+    // Publish messages are shared read-only with other applications, args outlive them
+    self->publish_messages = args->publish_messages;
+
+    self->ramp_tokens = self->ramp;
+    app_connect_clients(self);
+    timer_wheel_schedule(&self->timers, &self->housekeeping, monotonic_time_ms() + BOMBUS_HOUSEKEEPING_BUSY);
+}
+
+
+bool app_prepare_tasks(struct app *self)
+{
+    if (self->feeder)
+        app_feed(self);
+    if (self->upload)
+        app_upload(self);
+    if (self->pace_blocked)
+        app_pace(self);
+
+    return true;
+}
+
+
+void app_handle_tasks(struct app *self)
+{
+    struct stream *stream = NULL;
+    unsigned int flags;
+    do {
+        flags = 0;
+        stream = idler_get_next_stream(self->idler, stream, &flags);
+        if (flags & STREAM_OUTGOING_READY)
+            stream_handle_outgoing_data(stream);
+        if (flags & STREAM_INCOMING_READY)
+            stream_handle_incoming_data(stream);
+    } while(stream);
+}
+
+
+/**
+ * Run expired timers.
+ *
+ * Only clients with passed deadline are visited, idle clients cost nothing.
+ *
+ */
+void app_handle_time(struct app *self)
+{
+    timer_wheel_advance(&self->timers, monotonic_time_ms());
+}
+
+
+static void app_handle_timer(void *object, struct bombus *bombus, unsigned long long deadline)
+{
+    struct app_client *client = (struct app_client*)object;
+
+    UNUSED(bombus);
+
+    if (deadline == 0)
+        timer_wheel_cancel(&client->app->timers, &client->timer);
+    else
+        timer_wheel_schedule(&client->app->timers, &client->timer, deadline);
+}
+
+
+static void app_client_expired(void *arg)
+{
+    struct app_client *client = (struct app_client*)arg;
+
+    bombus_handle_time(client->bombus);
+}
+
+
+/**
+ * Periodic tasks not bound to single client deadline.
+ *
+ * Runs more often while clients are ramped up or spools are replayed.
+ *
+ */
+static void app_housekeeping(void *arg)
+{
+    struct app *self = (struct app*)arg;
+    bool busy = false;
+
+    if (self->reconnect) {
+        app_connect_clients(self);
+        for (unsigned int i=0; i<self->clients_num && !busy; i++)
+            busy = bombus_get_state(self->clients[i].bombus) == BOMBUS_STATE_DISCONNECTED;
+    }
+
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        struct app_client *client = &self->clients[i];
+        if (self->latency)
+            latency_check_client(self->latency, client->bombus, i);
+        if (client->spool) {
+            app_replay_spool(client);
+            busy = busy || !spool_is_empty(client->spool);
+        }
+    }
+
+    if (self->latency)
+        latency_handle_time(self->latency);
+
+    if (self->upload && self->upload->started && !self->upload->written) {
+        upload_handle_time(self->upload, bombus_get_upload_progress(self->clients[0].bombus));
+        busy = true;
+    }
+
+    if (self->reporting && stats_reporter_is_due(&self->reporter)) {
+        app_update_stats(self);
+        stats_reporter_report(&self->reporter, &self->stats);
+    }
+    else if (monotonic_time_ms() - self->stats_time >= BOMBUS_STATS_UPDATE_INTERVAL) {
+        app_update_stats(self);
+    }
+
+    unsigned int interval = busy ? BOMBUS_HOUSEKEEPING_BUSY : BOMBUS_HOUSEKEEPING_INTERVAL;
+    timer_wheel_schedule(&self->timers, &self->housekeeping, monotonic_time_ms() + interval);
+}
+
+
+static void app_subscription_delete(void *data)
+{
+    struct app_subscription *subscription = (struct app_subscription*)data;
+    xfree(subscription->topic);
+    xfree(subscription);
+}
+
+
+/**
+ * Store subscription in topic tree.
+ *
+ * Remote subscriptions are sent to broker after every connection, local ones
+ * only route messages subscribed in other way.
+ *
+ */
+static void app_subscribe(struct app *self, const char *topic, unsigned char qos, bool remote, app_msg_handler handler)
+{
+    struct app_subscription *subscription = topic_tree_find(self->subscriptions, topic);
+    if (!subscription) {
+        subscription = xmalloc(sizeof(struct app_subscription));
+        subscription->topic = xstrdup(topic);
+        topic_tree_insert(self->subscriptions, topic, subscription);
+    }
+
+    subscription->qos = qos;
+    subscription->remote = remote;
+    subscription->handler = handler;
+}
+
+
+static void app_resubscribe(void *arg, void *data)
+{
+    struct bombus *bombus = (struct bombus*)arg;
+    struct app_subscription *subscription = (struct app_subscription*)data;
+
+    if (subscription->remote && !bombus_has_subscription(bombus, subscription->topic, subscription->qos))
+        bombus_subscribe(bombus, subscription->topic, subscription->qos);
+}
+
+
+static void app_count_local(void *arg, void *data)
+{
+    struct app_subscription *subscription = (struct app_subscription*)data;
+
+    if (!subscription->remote)
+        (*(unsigned int*)arg)++;
+}
+
+
+/**
+ * Bring broker subscriptions in line with wanted ones after connection.
+ *
+ * Resumed session keeps filters subscribed before, only changes made while
+ * client was offline or since previous run are sent. Filters routed locally,
+ * e.g. latency topics, are left to their owners.
+ *
+ */
+static void app_restore_subscriptions(struct app *self, struct bombus *bombus)
+{
+    unsigned int count = bombus_get_subscriptions(bombus, NULL, 0);
+    if (count > 0) {
+        const char **topics = xmalloc(count * sizeof(const char*));
+        bombus_get_subscriptions(bombus, topics, count);
+        for (unsigned int i=0; i<count; i++) {
+            struct app_subscription *subscription = topic_tree_find(self->subscriptions, topics[i]);
+            unsigned int local = 0;
+            if (!subscription)
+                topic_tree_match(self->subscriptions, topics[i], strlen(topics[i]), app_count_local, &local);
+            if (!subscription && local == 0)
+                bombus_unsubscribe(bombus, topics[i]);
+        }
+        xfree(topics);
+    }
+
+    topic_tree_foreach(self->subscriptions, app_resubscribe, bombus);
+}
+
+
+/**
+ * Write buffered output, corked publishes are flushed by client timers.
+ *
+ */
+void app_flush(struct app *self)
+{
+    if (self->sink)
+        sink_flush(self->sink, false);
+}
+
+
+
+/**
+ * Get max time to wait for events.
+ *
+ * Idler sleeps until the earliest timer, there is no fixed tick.
+ *
+ */
+unsigned long app_get_timeout(struct app *self)
+{
+    struct feeder_record record;
+
+    if (self->feeder && !self->feed_blocked && feeder_peek(self->feeder, &record))
+        return 0;   // Records ready to publish
+    if (self->upload_ready)
+        return 0;
+
+    uint64_t now = monotonic_time_ms();
+    uint64_t next = timer_wheel_next_expiry(&self->timers);
+    if (self->sink) {
+        uint64_t flush = sink_get_deadline(self->sink);
+        if (flush != 0 && (next == 0 || flush < next))
+            next = flush;
+    }
+
+    if (next == 0)
+        return BOMBUS_MAX_TIMEOUT;
+    if (next <= now)
+        return 0;
+    if (next - now > BOMBUS_MAX_TIMEOUT)
+        return BOMBUS_MAX_TIMEOUT;
+    return (unsigned long)(next - now);
+}
+
+
+/**
+ * Serve clients until application or alive flag is cleared.
+ *
+ */
+void app_run(struct app *self, bool *alive)
+{
+    while (__atomic_load_n(alive, __ATOMIC_ACQUIRE) && app_is_alive(self)) {
+        if (!app_prepare_tasks(self)) {
+            continue;
+        }
+        int status = idler_wait(self->idler, app_get_timeout(self));
+        if (status == IDLER_ERROR) {
+            BOMBUS_ERROR("Idler error %d", errno);
+            break;
+        }
+        if (status == IDLER_INTERRUPT) {
+            BOMBUS_WARN("Interrupt");
+            break;
+        }
+        if (status == IDLER_OPERATION) {
+            self->wakeups++;
+            app_handle_tasks(self);
+        }
+        if (self->update_clock)
+            clock_update_sys();
+        app_handle_time(self);
+        app_flush(self);
+    }
+}
+
+
+/**
+ * Refresh stats snapshot, called by thread owning application.
+ *
+ */
+void app_update_stats(struct app *self)
+{
+    struct stats current;
+    stats_reset(&current);
+
+    for (unsigned int i=0; i<self->clients_num; i++)
+        stats_add_client(&current, self->clients[i].bombus);
+    current.wakeups = self->wakeups;
+    current.items = self->items.stats;
+    current.scratch = self->scratch.stats;
+
+    stats_store(&self->stats, &current);
+    self->stats_time = monotonic_time_ms();
+}
+
+
+/**
+ * Add last snapshot, safe to call from any thread.
+ *
+ */
+void app_get_stats(struct app *self, struct stats *total)
+{
+    stats_load_add(total, &self->stats);
+}
+
+
+/**
+ * Restore client state after every successful connection.
+ *
+ */
+static void app_handle_connection(void *object, struct bombus *bombus, bool connected)
+{
+    struct app_client *client = (struct app_client*)object;
+    struct app *self = client->app;
+
+    if (!connected) {
+        // Library retransmits QoS 1/2 upload on its own, QoS 0 one starts again
+        if (self->upload && client->idx == 0 && self->upload->qos == 0 && !self->upload->written)
+            self->upload->started = false;
+        if (client->store_fd >= 0) {
+            BOMBUS_WARN("Client %u lost connection while receiving large message", self->first + client->idx);
+            store_close(self->store, client->store_fd, false);
+            client->store_fd = -1;
+        }
+        return;     // Library reconnects on its own
+    }
+
+    struct mqtt_msg_item *item;
+    if (bombus_is_session_present(bombus))
+        BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Client %u resumed session", self->first + client->idx);
+    app_restore_subscriptions(self, bombus);
+
+    // Messages from offline period go before new ones
+    if (client->spool) {
+        client->spool_tokens = 0;
+        client->spool_time = monotonic_time_ms();
+        app_replay_spool(client);
+    }
+
+    if (self->publish_messages) {
+        LIST_FOREACH(item, self->publish_messages, _entry_) {
+            app_publish(client, item->msg.topic, item->msg.qos, item->msg.retain, item->msg.payload, item->msg.payload_len);
+        }
+    }
+
+    if (self->latency)
+        latency_start_client(self->latency, bombus, client->idx);
+
+    if (self->pacer && !pacer_is_started(self->pacer)) {
+        pacer_start(self->pacer);
+        timer_wheel_schedule(&self->timers, &self->pace_timer, monotonic_time_ms());
+    }
+
+    if (self->upload && client->idx == 0 && !self->upload->started) {
+        struct upload *upload = self->upload;
+        if (bombus_publish_large(bombus, upload->topic, upload->qos, upload->retain, upload->data, upload->len))
+            upload_start(upload);
+        else
+            self->alive = false;
+    }
+}
+
+
+/**
+ * Publish message or store it in spool.
+ *
+ * Spooled messages go first, so new messages wait in spool until
+ * replay catches up.
+ *
+ */
+static void app_publish(struct app_client *client, const char *topic, unsigned char qos, bool retain, const void *payload, size_t payload_len)
+{
+    if (client->spool) {
+        if (!bombus_is_connected(client->bombus) || !spool_is_empty(client->spool) ||
+            !bombus_publish(client->bombus, topic, qos, retain, payload, payload_len))
+            spool_append(client->spool, topic, qos, retain, payload, payload_len);
+    }
+    else if (bombus_is_connected(client->bombus)) {
+        bombus_publish(client->bombus, topic, qos, retain, payload, payload_len);
+    }
+}
+
+
+/**
+ * Publish message by next client able to take it.
+ *
+ * Messages are spread round robin, clients with full socket buffers
+ * are skipped.
+ *
+ */
+static struct app_client* app_publish_any(struct app *self, const char *topic, unsigned char qos, bool retain, const void *payload, size_t payload_len)
+{
+    for (unsigned int n=0; n<self->clients_num; n++) {
+        struct app_client *client = &self->clients[self->feed_next];
+        if (++self->feed_next >= self->clients_num)
+            self->feed_next = 0;
+
+        if (!bombus_is_connected(client->bombus))
+            continue;
+        if (bombus_get_outgoing_len(client->bombus) >= BOMBUS_FEED_MAX_OUTGOING)
+            continue;
+        if (bombus_publish(client->bombus, topic, qos, retain, payload, payload_len))
+            return client;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Publish records from pipe.
+ *
+ * Reading stops when no client takes more data and resumes when all buffered
+ * records are published. Application finishes once all records are delivered.
+ *
+ */
+static void app_feed(struct app *self)
+{
+    struct feeder_record record;
+    unsigned int batch = BOMBUS_FEED_BATCH;
+
+    self->feed_blocked = false;
+    while (batch-- > 0 && feeder_peek(self->feeder, &record)) {
+        if (record.topic && !app_publish_any(self, record.topic, self->feed_qos, false, record.payload, record.payload_len)) {
+            self->feed_blocked = true;
+            feeder_pause(self->feeder, true);
+            return;
+        }
+        feeder_pop(self->feeder, &record);
+    }
+
+    if (!feeder_is_done(self->feeder)) {
+        feeder_pause(self->feeder, false);
+        return;
+    }
+
+    if (!app_is_drained(self))
+        return;
+
+    BOMBUS_INFO("Published %llu records", self->feeder->records);
+    self->alive = false;
+}
+
+
+/**
+ * Publish at rate allowed by pacer.
+ *
+ * Timer is rearmed at the time next token becomes available. When clients
+ * refused messages, pacing resumes on next event instead, like acknowledge
+ * freeing in-flight window or socket becoming writable.
+ *
+ */
+static void app_pace(void *arg)
+{
+    struct app *self = (struct app*)arg;
+    struct mqtt_msg *msg = self->pace_msg;
+    unsigned int allowed = pacer_acquire(self->pacer);
+    unsigned int sent = 0;
+    bool blocked = false;
+
+    self->pace_blocked = false;
+    while (sent < allowed) {
+        const void *payload = msg->payload;
+        size_t payload_len = msg->payload_len;
+        if (self->generator)
+            payload = generator_next(self->generator, &payload_len);
+
+        if (!app_publish_any(self, msg->topic, msg->qos, msg->retain, payload, payload_len)) {
+            if (self->generator)
+                generator_unget(self->generator);
+            blocked = true;
+            break;
+        }
+        sent++;
+    }
+    pacer_consume(self->pacer, sent, blocked);
+    pacer_handle_time(self->pacer);
+
+    uint64_t now = monotonic_time_ms();
+    if (pacer_is_done(self->pacer)) {
+        if (app_is_drained(self))
+            self->alive = false;
+        else
+            timer_wheel_schedule(&self->timers, &self->pace_timer, now + BOMBUS_DRAIN_INTERVAL);
+        return;
+    }
+
+    if (blocked) {
+        self->pace_blocked = true;
+        return;
+    }
+
+    // Round up, token must be available on wakeup
+    uint64_t next = (pacer_next_ns(self->pacer) + 999999) / 1000000;
+    timer_wheel_schedule(&self->timers, &self->pace_timer, next);
+}
+
+
+/**
+ * Pass next part of upload to socket.
+ *
+ * Application finishes once whole file is written and acknowledged.
+ *
+ */
+static void app_upload(struct app *self)
+{
+    struct upload *upload = self->upload;
+    struct bombus *bombus = self->clients[0].bombus;
+
+    self->upload_ready = false;
+    if (!upload->started)
+        return;
+
+    if (bombus_is_uploading(bombus)) {
+        self->upload_ready = bombus_handle_upload(bombus);
+        return;
+    }
+    if (!bombus_is_connected(bombus))
+        return;
+
+    if (!upload->written) {
+        upload->written = true;
+        upload_report(upload, upload->len, true);
+    }
+
+    if (app_is_drained(self))
+        self->alive = false;
+}
+
+
+/**
+ * Check all messages of connected clients were written and acknowledged.
+ *
+ */
+static bool app_is_drained(struct app *self)
+{
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        struct bombus *bombus = self->clients[i].bombus;
+        if (bombus_is_connected(bombus) && (bombus_get_inflight_count(bombus) > 0 || bombus_get_outgoing_len(bombus) > 0))
+            return false;
+    }
+    return true;
+}
+
+
+/**
+ * Replay spooled messages at configured rate.
+ *
+ * Replay pauses when in-flight window is full.
+ *
+ */
+static void app_replay_spool(struct app_client *client)
+{
+    struct app *self = client->app;
+    struct spool_msg msg;
+    unsigned int batch = BOMBUS_SPOOL_REPLAY_BATCH;
+
+    if (!bombus_is_connected(client->bombus))
+        return;
+
+    if (self->spool_rate > 0) {
+        uint64_t now = monotonic_time_ms();
+        client->spool_tokens += (double)(now - client->spool_time) * self->spool_rate / 1000;
+        if (client->spool_tokens > self->spool_rate)
+            client->spool_tokens = self->spool_rate;
+        client->spool_time = now;
+    }
+
+    while (batch-- > 0 && spool_peek(client->spool, &msg)) {
+        if (self->spool_rate > 0) {
+            if (client->spool_tokens < 1)
+                break;
+        }
+        if (!bombus_publish(client->bombus, msg.topic, msg.qos, msg.retain, msg.payload, msg.payload_len))
+            break;
+        spool_pop(client->spool);
+        if (self->spool_rate > 0)
+            client->spool_tokens -= 1;
+    }
+}
+
+
+/**
+ * Start connecting idle clients.
+ *
+ * Number of connection attempts is limited by ramp rate (clients per second),
+ * unused budget is accumulated up to one second worth of connections.
+ * Connections are established asynchronously, reconnections are handled
+ * by library.
+ *
+ */
+static void app_connect_clients(struct app *self)
+{
+    if (self->ramp > 0) {
+        uint64_t now = monotonic_time_ms();
+        self->ramp_tokens += (double)(now - self->ramp_time) * self->ramp / 1000;
+        if (self->ramp_tokens > self->ramp)
+            self->ramp_tokens = self->ramp;
+        self->ramp_time = now;
+    }
+
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        struct app_client *client = &self->clients[i];
+        if (bombus_get_state(client->bombus) != BOMBUS_STATE_DISCONNECTED)
+            continue;
+
+        if (self->ramp > 0) {
+            if (self->ramp_tokens < 1)
+                break;
+            self->ramp_tokens -= 1;
+        }
+
+        bombus_connect(client->bombus, self->clean_session);
+    }
+}
+
+
+static void app_log_msg(struct app_client *client, const struct bombus_msg *msg)
+{
+    struct app *self = client->app;
+
+    if (self->sink) {
+        sink_write(self->sink, self->first + client->idx, msg);
+        return;
+    }
+    BOMBUS_INFO("Client %u received %.*s '%.*s'", self->first + client->idx, (int)msg->topic_len, msg->topic, (int)msg->payload_len, (const char*)msg->payload);
+}
+
+
+static void app_latency_msg(struct app_client *client, const struct bombus_msg *msg)
+{
+    latency_handle_msg(client->app->latency, client->bombus, client->idx, msg->payload, msg->payload_len);
+}
+
+
+struct app_dispatch
+{
+    struct app_client *client;
+    const struct bombus_msg *msg;
+
+    app_msg_handler handled[BOMBUS_DISPATCH_HANDLERS];
+    unsigned int handled_num;
+};
+
+
+/**
+ * Run subscription handler unless overlapping filter has already run it
+ * for this message.
+ *
+ */
+static void app_dispatch_msg(void *arg, void *data)
+{
+    struct app_dispatch *dispatch = (struct app_dispatch*)arg;
+    struct app_subscription *subscription = (struct app_subscription*)data;
+
+    for (unsigned int i=0; i<dispatch->handled_num; i++) {
+        if (dispatch->handled[i] == subscription->handler)
+            return;
+    }
+    if (dispatch->handled_num < BOMBUS_DISPATCH_HANDLERS)
+        dispatch->handled[dispatch->handled_num++] = subscription->handler;
+
+    subscription->handler(dispatch->client, dispatch->msg);
+}
+
+
+static void app_handle_msg(void *object, struct bombus *bombus, const struct bombus_msg *msg)
+{
+    struct app_client *client = (struct app_client*)object;
+    struct app *self = client->app;
+
+    UNUSED(bombus);
+
+    struct app_dispatch dispatch = { .client = client, .msg = msg, .handled_num = 0 };
+    if (topic_tree_match(self->subscriptions, msg->topic, msg->topic_len, app_dispatch_msg, &dispatch) == 0)
+        app_log_msg(client, msg);   // Not subscribed by this application, e.g. session leftovers
+}
+
+
+/**
+ * Write large message straight to its own file, chunk by chunk.
+ *
+ */
+static void app_handle_chunk(void *object, struct bombus *bombus, const struct bombus_chunk *chunk)
+{
+    struct app_client *client = (struct app_client*)object;
+    struct app *self = client->app;
+    unsigned int num = self->first + client->idx;
+
+    UNUSED(bombus);
+
+    if (chunk->offset == 0) {
+        if (client->store_fd >= 0)
+            store_close(self->store, client->store_fd, false);
+        client->store_fd = store_open(self->store, num, chunk->topic, chunk->topic_len);
+    }
+
+    if (client->store_fd < 0)
+        return;     // Rest of failed message is dropped
+
+    if (chunk->len > 0 && !store_write(self->store, client->store_fd, chunk->data, chunk->len)) {
+        store_close(self->store, client->store_fd, false);
+        client->store_fd = -1;
+        return;
+    }
+
+    if (chunk->offset + chunk->len == chunk->payload_len) {
+        store_close(self->store, client->store_fd, true);
+        client->store_fd = -1;
+        BOMBUS_INFO("Client %u received %.*s, %zu bytes stored", num, (int)chunk->topic_len, chunk->topic, chunk->payload_len);
+    }
+}
+
+
+
+
+
+static void app_handle_connect(struct app *self, char *params);
+static void app_handle_disconnect(struct app *self, char *params);
+static void app_handle_subscribe(struct app *self, char *params);
+static void app_handle_unsubscribe(struct app *self, char *params);
+static void app_handle_publish(struct app *self, char *params);
+static void app_handle_stats(struct app *self, char *params);
+
+
+struct command_handler_map {
+    const char *command;
+    void (*handler)(struct app*, char *params);
+};
+
+
+static const struct command_handler_map command_handlers[] = {
+        { "publish",        app_handle_publish},
+        { "subscribe",      app_handle_subscribe},
+        { "unsubscribe",    app_handle_unsubscribe},
+        { "connect",        app_handle_connect},
+        { "disconnect",     app_handle_disconnect},
+        { "stats",          app_handle_stats},
+        {  NULL,            NULL}
+};
+
+
+
+static void app_handle_connect(struct app *self, char *params)
+{
+    UNUSED(params);
+
+    self->reconnect = true;
+    for (unsigned int i=0; i<self->clients_num; i++) {
+        if (bombus_get_state(self->clients[i].bombus) == BOMBUS_STATE_FAILED)
+            bombus_connect(self->clients[i].bombus, self->clean_session);
+    }
+    timer_wheel_schedule(&self->timers, &self->housekeeping, monotonic_time_ms());
+}
+
+
+static void app_handle_disconnect(struct app *self, char *params)
+{
+    UNUSED(params);
+
+    self->reconnect = false;
+    for (unsigned int i=0; i<self->clients_num; i++)
+        bombus_disconnect(self->clients[i].bombus);
+}
+
+
+static void app_handle_subscribe(struct app *self, char *params)
+{
+    struct mqtt_msg_item *item = mqtt_msg_item_parse(params, &self->items, &self->scratch);
+    if (item) {
+        if (!topic_is_valid_filter(item->msg.topic)) {
+            BOMBUS_WARN("Invalid topic filter %s", item->msg.topic);
+            mqtt_msg_item_release(item, &self->items);
+            return;
+        }
+
+        for (unsigned int i=0; i<self->clients_num; i++) {
+            if (bombus_is_connected(self->clients[i].bombus))
+                bombus_subscribe(self->clients[i].bombus, item->msg.topic, item->msg.qos);
+        }
+
+        // Store topic for further use or just update qos
+        app_subscribe(self, item->msg.topic, item->msg.qos, true, app_log_msg);
+        mqtt_msg_item_release(item, &self->items);
+    }
+}
+
+
+static void app_handle_unsubscribe(struct app *self, char *params)
+{
+    struct mqtt_msg_item *item = mqtt_msg_item_parse(params, &self->items, &self->scratch);
+    if (item) {
+        for (unsigned int i=0; i<self->clients_num; i++) {
+            if (bombus_is_connected(self->clients[i].bombus))
+                bombus_unsubscribe(self->clients[i].bombus, item->msg.topic);
+        }
+
+        struct app_subscription *found = topic_tree_remove(self->subscriptions, item->msg.topic);
+        if (found)
+            app_subscription_delete(found);
+        mqtt_msg_item_release(item, &self->items);
+    }
+}
+
+
+static void app_handle_publish(struct app *self, char *params)
+{
+    struct mqtt_msg_item *item = mqtt_msg_item_parse(params, &self->items, &self->scratch);
+    if (item) {
+        for (unsigned int i=0; i<self->clients_num; i++)
+            app_publish(&self->clients[i], item->msg.topic, item->msg.qos, item->msg.retain, item->msg.payload, item->msg.payload_len);
+        mqtt_msg_item_release(item, &self->items);
+    }
+}
+
+
+static void app_handle_stats(struct app *self, char *params)
+{
+    UNUSED(params);
+
+    app_update_stats(self);
+    if (self->reporting) {
+        stats_print(&self->stats, &self->reporter.prev, monotonic_time_ms() - self->reporter.time);
+    }
+    else {
+        struct stats zero;
+        stats_reset(&zero);
+        stats_print(&self->stats, &zero, 0);
+    }
+}
+
+
+/**
+ * Handle single console command line.
+ *
+ */
+void app_handle_command(struct app *self, char *command)
+{
+    size_t command_len = xstr_word_len(command, " \t\n");
+    char *params = xstrltrim(command + command_len);
+
+    if (command_len == 0)
+        return;
+
+    if (!strncmp(command, "quit", command_len)) {
+        self->alive = false;
+        return;
+    }
+
+    const struct command_handler_map *cmd_hndl = command_handlers;
+    while (cmd_hndl->command && cmd_hndl->handler) {
+        if (!strncmp(cmd_hndl->command, command, command_len)) {
+            cmd_hndl->handler(self, params);
+            break;
+        }
+        cmd_hndl++;
+    }
+    arena_reset(&self->scratch);
+}
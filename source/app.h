@@ -0,0 +1,133 @@
+
+#ifndef __BOMBUS_APP_H_
+#define __BOMBUS_APP_H_
+
+
+#include "args.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct app;
+struct spool;
+struct feeder;
+struct sink;
+struct store;
+struct pacer;
+struct generator;
+struct upload;
+struct bombus;
+struct bombus_msg;
+
+
+struct app_client
+{
+    struct app *app;
+    struct bombus *bombus;
+    unsigned int idx;
+    struct timer_entry timer;   // Client deadline
+
+    struct spool *spool;        // Publishes stored while disconnected
+    double spool_tokens;
+    uint64_t spool_time;
+
+    int store_fd;               // Large message being received, -1 if none
+};
+
+
+typedef void (*app_msg_handler)(struct app_client *client, const struct bombus_msg *msg);
+
+
+struct app_subscription
+{
+    char *topic;
+    unsigned char qos;
+    bool remote;                // Subscribed on broker by every client
+    app_msg_handler handler;
+};
+
+
+/**
+ * Group of clients served by one idler.
+ *
+ */
+struct app
+{
+    struct idler *idler;
+    struct timer_wheel timers;
+    struct timer_entry housekeeping;
+    struct app_client *clients;
+    unsigned int clients_num;
+    unsigned int first;         // Global number of first client
+
+    unsigned int ramp;
+    double ramp_tokens;
+    uint64_t ramp_time;
+
+    struct topic_tree *subscriptions;
+    struct mqtt_msg_list *publish_messages;
+
+    struct latency *latency;
+
+    unsigned int spool_rate;    // Replayed messages per second per client
+
+    struct feeder *feeder;      // Pipe publishing source
+    unsigned char feed_qos;
+    unsigned int feed_next;
+    bool feed_blocked;
+
+    struct sink *sink;          // Received messages output, log when not set
+    struct store *store;        // Large received messages, one file each
+
+    struct pacer *pacer;        // Rate publishing
+    struct timer_entry pace_timer;
+    struct mqtt_msg *pace_msg;
+    bool pace_blocked;          // Clients refused messages, retried on next event
+    struct generator *generator; // Rate payloads, message payload when not set
+
+    struct upload *upload;      // Large file published by first client
+    bool upload_ready;          // Upload may continue without waiting
+
+    struct slab_pool items;     // Command messages
+    struct arena scratch;       // Command strings, reset after every command
+
+    struct stats stats;         // Snapshot readable from other threads
+    uint64_t stats_time;
+    unsigned long long wakeups;
+    struct stats_reporter reporter;
+    bool reporting;             // Application serving all clients reports on its own
+
+    bool retain;
+    bool reconnect;
+    bool clean_session;         // Persistent sessions keep broker state between connections
+    bool update_clock;          // Only one thread updates shared library clock
+    bool alive;
+};
+
+
+
+void app_init(struct app *self);
+void app_clean(struct app *self);
+void app_configure(struct app *self, struct args *args, unsigned int first, unsigned int count);
+
+bool app_is_alive(struct app *self);
+struct idler* app_get_idler(struct app *self);
+
+bool app_prepare_tasks(struct app *self);
+void app_handle_tasks(struct app *self);
+void app_handle_time(struct app *self);
+void app_flush(struct app *self);
+unsigned long app_get_timeout(struct app *self);
+void app_run(struct app *self, bool *alive);
+
+void app_handle_command(struct app *self, char *command);
+void app_update_stats(struct app *self);
+void app_get_stats(struct app *self, struct stats *total);
+
+
+#endif /* __BOMBUS_APP_H_ */
@@ -1,7 +1,12 @@
 
 #include "args.h"
 #include "utils.h"
+#include "feeder.h"
+#include "sink.h"
+#include "generator.h"
+#include "topic_tree.h"
 
+#include "bombus/client.h"
 #include "bombus/log.h"
 #include "bombus/version.h"
 
@@ -31,6 +36,41 @@ enum long_option_en
     OPT_PUB,
     OPT_CLI,
     OPT_BROKER,
+    OPT_CLIENTS,
+    OPT_THREADS,
+    OPT_RAMP,
+    OPT_INFLIGHT,
+    OPT_RECONNECT,
+    OPT_CORK,
+    OPT_CORK_DELAY,
+    OPT_MQTT5,
+    OPT_TOPIC_ALIASES,
+    OPT_BENCH,
+    OPT_BENCH_SIZE,
+    OPT_BENCH_WINDOW,
+    OPT_BENCH_INTERVAL,
+    OPT_SESSION,
+    OPT_SPOOL,
+    OPT_SPOOL_SIZE,
+    OPT_SPOOL_RATE,
+    OPT_PUB_STDIN,
+    OPT_PUB_FILE,
+    OPT_PUB_TOPIC,
+    OPT_PUB_FORMAT,
+    OPT_RATE,
+    OPT_BURST,
+    OPT_DURATION,
+    OPT_COUNT,
+    OPT_PAYLOAD,
+    OPT_PAYLOAD_SIZE,
+    OPT_UPLOAD,
+    OPT_OUT,
+    OPT_OUT_FORMAT,
+    OPT_OUT_FLUSH,
+    OPT_STREAM_DIR,
+    OPT_STREAM_SIZE,
+    OPT_STATS,
+    OPT_STATS_FILE,
 };
 
 
@@ -57,6 +97,41 @@ static struct option options[] =
     {"pub",                     required_argument,  0,  OPT_PUB},
     {"cli",                     no_argument,        0,  OPT_CLI},
     {"broker",                  no_argument,        0,  OPT_BROKER},
+    {"clients",                 required_argument,  0,  OPT_CLIENTS},
+    {"threads",                 required_argument,  0,  OPT_THREADS},
+    {"ramp",                    required_argument,  0,  OPT_RAMP},
+    {"inflight",                required_argument,  0,  OPT_INFLIGHT},
+    {"reconnect",               required_argument,  0,  OPT_RECONNECT},
+    {"cork",                    required_argument,  0,  OPT_CORK},
+    {"cork-delay",              required_argument,  0,  OPT_CORK_DELAY},
+    {"mqtt5",                   no_argument,        0,  OPT_MQTT5},
+    {"topic-aliases",           required_argument,  0,  OPT_TOPIC_ALIASES},
+    {"bench",                   required_argument,  0,  OPT_BENCH},
+    {"bench-size",              required_argument,  0,  OPT_BENCH_SIZE},
+    {"bench-window",            required_argument,  0,  OPT_BENCH_WINDOW},
+    {"bench-interval",          required_argument,  0,  OPT_BENCH_INTERVAL},
+    {"session",                 required_argument,  0,  OPT_SESSION},
+    {"spool",                   required_argument,  0,  OPT_SPOOL},
+    {"spool-size",              required_argument,  0,  OPT_SPOOL_SIZE},
+    {"spool-rate",              required_argument,  0,  OPT_SPOOL_RATE},
+    {"pub-stdin",               no_argument,        0,  OPT_PUB_STDIN},
+    {"pub-file",                required_argument,  0,  OPT_PUB_FILE},
+    {"pub-topic",               required_argument,  0,  OPT_PUB_TOPIC},
+    {"pub-format",              required_argument,  0,  OPT_PUB_FORMAT},
+    {"rate",                    required_argument,  0,  OPT_RATE},
+    {"burst",                   required_argument,  0,  OPT_BURST},
+    {"duration",                required_argument,  0,  OPT_DURATION},
+    {"count",                   required_argument,  0,  OPT_COUNT},
+    {"payload",                 required_argument,  0,  OPT_PAYLOAD},
+    {"payload-size",            required_argument,  0,  OPT_PAYLOAD_SIZE},
+    {"upload",                  required_argument,  0,  OPT_UPLOAD},
+    {"out",                     required_argument,  0,  OPT_OUT},
+    {"out-format",              required_argument,  0,  OPT_OUT_FORMAT},
+    {"out-flush",               required_argument,  0,  OPT_OUT_FLUSH},
+    {"stream-dir",              required_argument,  0,  OPT_STREAM_DIR},
+    {"stream-size",             required_argument,  0,  OPT_STREAM_SIZE},
+    {"stats",                   required_argument,  0,  OPT_STATS},
+    {"stats-file",              required_argument,  0,  OPT_STATS_FILE},
 
     {"config",                  required_argument,  0,  'c'},
     {"verbose",                 required_argument,  0,  'v'},
@@ -99,8 +174,44 @@ static void show_help(const char *name)
     printf("  -p  --pass PASSWORD       MQTT client password\n");
     //
     printf("      --cli                     command line mode\n");
+    printf("      --broker                  run local broker listening on address\n");
     printf("      --sub 'TOPIC QOS'         subscribe topic\n");
     printf("      --pub 'TOPIC QOS MESSAGE' publish message on topic\n");
+    printf("      --clients NUM             number of clients, id is suffixed with client number\n");
+    printf("      --threads NUM             number of worker threads, clients are split between them\n");
+    printf("      --ramp NUM                clients connected per second [0-unlimited]\n");
+    printf("      --inflight NUM            max QoS 1/2 messages in flight per client [1-32768]\n");
+    printf("      --reconnect NUM           reconnection attempts [-1-unlimited]\n");
+    printf("      --cork BYTES              coalesce publishes into BYTES buffer per client\n");
+    printf("      --cork-delay MS           max time publishes stay in cork buffer\n");
+    printf("      --mqtt5                   use MQTT 5 instead of 3.1.1\n");
+    printf("      --topic-aliases NUM       MQTT 5 topic aliases per client [0-disabled]\n");
+    printf("      --bench 'TOPIC QOS'       latency benchmark, every client uses TOPIC/NUM\n");
+    printf("      --bench-size BYTES        benchmark payload size\n");
+    printf("      --bench-window NUM        benchmark messages in flight per client\n");
+    printf("      --bench-interval SEC      benchmark statistics interval\n");
+    printf("      --session DIR             persistent session, unacknowledged messages kept in DIR\n");
+    printf("      --spool DIR               store publishes in DIR while disconnected\n");
+    printf("      --spool-size BYTES        max spool size per client\n");
+    printf("      --spool-rate NUM          spool replay messages per second [0-unlimited]\n");
+    printf("      --pub-stdin               publish records read from stdin, spread over clients\n");
+    printf("      --pub-file FILE           publish records read from FILE, spread over clients\n");
+    printf("      --pub-topic 'TOPIC QOS'   topic for records, otherwise every record starts with topic\n");
+    printf("      --pub-format FMT          record format [line,length]\n");
+    printf("      --rate NUM                publish --pub-topic message NUM times per second, spread over clients\n");
+    printf("      --burst NUM               max messages published at once in rate mode\n");
+    printf("      --duration SEC            stop rate publishing after SEC seconds\n");
+    printf("      --count NUM               stop rate publishing after NUM messages\n");
+    printf("      --payload KIND            generate rate payloads [fixed,random,json,counter]\n");
+    printf("      --payload-size SPEC       generated payload size [SIZE,MIN-MAX,@FILE]\n");
+    printf("      --upload 'TOPIC QOS FILE' publish whole FILE as single message, first client only\n");
+    printf("      --out FILE                write received messages to FILE [-stdout]\n");
+    printf("      --out-format FMT          received messages format [log,raw,json,length]\n");
+    printf("      --out-flush MS            max time received messages stay buffered\n");
+    printf("      --stream-dir DIR          write received messages bigger than --stream-size to files in DIR\n");
+    printf("      --stream-size BYTES       messages streamed in chunks instead of buffered whole\n");
+    printf("      --stats SEC               print stats line every SEC seconds\n");
+    printf("      --stats-file FILE         rewrite Prometheus metrics FILE with every stats\n");
     //
     printf("  -v  --verbose NUM     set verbose value [0-silent,1-error,2-warning,3-info,4-debug]\n");
     printf("  -l  --logger HEX      set logger value\n");
@@ -179,6 +290,7 @@ static bool parse_parameters(struct args *self, int argc, char *argv[], int *ret
     int c;
     int option_idx = 0;
     bool success = true;
+    bool out_log = false;
 
     while (1) {
         long val;
@@ -226,6 +338,12 @@ static bool parse_parameters(struct args *self, int argc, char *argv[], int *ret
 
         case OPT_SUB: {
             struct mqtt_msg_item *msg_item = mqtt_msg_item_from_param(optarg);
+            if (msg_item && !topic_is_valid_filter(msg_item->msg.topic)) {
+                BOMBUS_ERROR("Invalid topic filter %s", msg_item->msg.topic);
+                mqtt_msg_item_delete(msg_item);
+                msg_item = NULL;
+                success = false;
+            }
             if (msg_item) {
                 if (!self->subscribe_topics)
                     self->subscribe_topics = mqtt_msg_list_new();
@@ -233,6 +351,313 @@ static bool parse_parameters(struct args *self, int argc, char *argv[], int *ret
             }
         }   break;
 
+        case OPT_BROKER:
+            self->broker = true;
+            break;
+
+        case OPT_CLIENTS:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val > 0) {
+                self->clients = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid number of clients %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_THREADS:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val > 0) {
+                self->threads = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid number of threads %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_RAMP:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                self->ramp = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid ramp rate %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_INFLIGHT:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val > 0 && val <= BOMBUS_MAX_INFLIGHT) {
+                self->max_inflight = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid in-flight window %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_RECONNECT:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= -1) {
+                self->reconnect_attempts = (int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid reconnection attempts %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_CORK:
+        case OPT_CORK_DELAY:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                if (c == OPT_CORK)
+                    self->cork = (unsigned int)val;
+                else
+                    self->cork_delay = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid cork argument %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_MQTT5:
+            self->mqtt5 = true;
+            break;
+
+        case OPT_TOPIC_ALIASES:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0 && val <= 65535) {
+                self->topic_aliases = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid topic aliases %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_BENCH:
+            if (self->bench)
+                mqtt_msg_item_delete(self->bench);
+            self->bench = mqtt_msg_item_from_param(optarg);
+            if (!self->bench)
+                success = false;
+            break;
+
+        case OPT_BENCH_SIZE:
+        case OPT_BENCH_WINDOW:
+        case OPT_BENCH_INTERVAL:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val > 0) {
+                if (c == OPT_BENCH_SIZE)
+                    self->bench_size = (unsigned int)val;
+                else if (c == OPT_BENCH_WINDOW)
+                    self->bench_window = (unsigned int)val;
+                else
+                    self->bench_interval = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid benchmark argument %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_SESSION:
+            if (self->session_dir)
+                xfree(self->session_dir);
+            self->session_dir = xstrdup(optarg);
+            break;
+
+        case OPT_SPOOL:
+            if (self->spool_dir)
+                xfree(self->spool_dir);
+            self->spool_dir = xstrdup(optarg);
+            break;
+
+        case OPT_SPOOL_SIZE:
+        case OPT_SPOOL_RATE:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                if (c == OPT_SPOOL_SIZE && val >= 4096)
+                    self->spool_size = (size_t)val;
+                else if (c == OPT_SPOOL_RATE)
+                    self->spool_rate = (unsigned int)val;
+                else
+                    success = false;
+            }
+            if (!success)
+                BOMBUS_ERROR("Invalid spool argument %s", optarg);
+            break;
+
+        case OPT_PUB_STDIN:
+            self->pub_stdin = true;
+            break;
+
+        case OPT_PUB_FILE:
+            if (self->pub_file)
+                xfree(self->pub_file);
+            self->pub_file = xstrdup(optarg);
+            break;
+
+        case OPT_PUB_TOPIC:
+            if (self->pub_topic)
+                mqtt_msg_item_delete(self->pub_topic);
+            self->pub_topic = mqtt_msg_item_from_param(optarg);
+            if (!self->pub_topic)
+                success = false;
+            break;
+
+        case OPT_PUB_FORMAT:
+            if (!strcmp(optarg, "line")) {
+                self->pub_format = FEEDER_FORMAT_LINE;
+            }
+            else if (!strcmp(optarg, "length")) {
+                self->pub_format = FEEDER_FORMAT_LENGTH;
+            }
+            else {
+                BOMBUS_ERROR("Invalid record format %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_RATE:
+        case OPT_BURST:
+        case OPT_DURATION:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                if (c == OPT_RATE)
+                    self->rate = (unsigned int)val;
+                else if (c == OPT_BURST)
+                    self->burst = (unsigned int)val;
+                else
+                    self->duration = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid rate argument %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_COUNT:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                self->count = (unsigned long long)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid message count %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_PAYLOAD:
+            self->payload = generator_parse_kind(optarg);
+            if (self->payload == GENERATOR_NONE) {
+                BOMBUS_ERROR("Invalid payload kind %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_PAYLOAD_SIZE:
+            if (self->payload_size)
+                xfree(self->payload_size);
+            self->payload_size = xstrdup(optarg);
+            break;
+
+        case OPT_UPLOAD:
+            if (self->upload)
+                mqtt_msg_item_delete(self->upload);
+            self->upload = mqtt_msg_item_from_param(optarg);
+            if (!self->upload || !self->upload->msg.payload) {
+                BOMBUS_ERROR("Upload needs topic and file");
+                success = false;
+            }
+            break;
+
+        case OPT_OUT:
+            if (self->out_path)
+                xfree(self->out_path);
+            self->out_path = xstrdup(optarg);
+            if (self->out_format == SINK_FORMAT_LOG)
+                self->out_format = SINK_FORMAT_RAW;
+            if (out_log) {
+                BOMBUS_ERROR("Log format cannot be written to --out");
+                success = false;
+            }
+            break;
+
+        case OPT_OUT_FORMAT:
+            if (!strcmp(optarg, "log")) {
+                self->out_format = SINK_FORMAT_LOG;
+                out_log = true;
+                if (self->out_path) {
+                    BOMBUS_ERROR("Log format cannot be written to --out");
+                    success = false;
+                }
+            }
+            else if (!strcmp(optarg, "raw")) {
+                self->out_format = SINK_FORMAT_RAW;
+            }
+            else if (!strcmp(optarg, "json")) {
+                self->out_format = SINK_FORMAT_JSON;
+            }
+            else if (!strcmp(optarg, "length")) {
+                self->out_format = SINK_FORMAT_LENGTH;
+            }
+            else {
+                BOMBUS_ERROR("Invalid output format %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_OUT_FLUSH:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                self->out_flush = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid output flush interval %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_STATS:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val >= 0) {
+                self->stats_interval = (unsigned int)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid stats interval %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_STREAM_DIR:
+            if (self->stream_dir)
+                xfree(self->stream_dir);
+            self->stream_dir = xstrdup(optarg);
+            break;
+
+        case OPT_STREAM_SIZE:
+            success = xstrtol(optarg, &val, 10);
+            if (success && val > 0) {
+                self->stream_size = (size_t)val;
+            }
+            else {
+                BOMBUS_ERROR("Invalid stream size %s", optarg);
+                success = false;
+            }
+            break;
+
+        case OPT_STATS_FILE:
+            if (self->stats_path)
+                xfree(self->stats_path);
+            self->stats_path = xstrdup(optarg);
+            break;
+
         case 'v':
             success = xstrtol(optarg, &val, 10);
             if (success) {
@@ -283,6 +708,36 @@ static bool check_mandatory_values(struct args *self)
         self->websocket_uri = xfree(self->websocket_uri);
     }
 
+    if (self->rate > 0) {
+        if (!self->pub_topic) {
+            BOMBUS_ERROR("Rate publishing needs --pub-topic");
+            return false;
+        }
+        if (self->pub_stdin || self->pub_file) {
+            BOMBUS_ERROR("Rate publishing cannot be combined with pipe publishing");
+            return false;
+        }
+    }
+    else if (self->count > 0 || self->duration > 0) {
+        BOMBUS_ERROR("Message count and duration need --rate");
+        return false;
+    }
+
+    if ((self->pub_stdin || self->pub_file) && !self->pub_topic)
+        BOMBUS_WARN("Records with own topics are published with QoS 0, --pub-topic sets QoS");
+
+    if (self->payload_size && self->payload == GENERATOR_NONE)
+        self->payload = GENERATOR_FIXED;
+    if (self->payload != GENERATOR_NONE && self->rate == 0) {
+        BOMBUS_ERROR("Generated payloads need --rate");
+        return false;
+    }
+
+    if (self->upload && (self->rate > 0 || self->pub_stdin || self->pub_file)) {
+        BOMBUS_ERROR("Upload cannot be combined with rate or pipe publishing");
+        return false;
+    }
+
     return true;
 }
 
@@ -328,9 +783,54 @@ void args_init(struct args *self)
     self->websocket_uri = NULL;
 
     self->cli = false;
+    self->broker = false;
     self->client_id = NULL;
     self->keep_alive = 60;
 
+    self->clients = 1;
+    self->threads = 1;
+    self->ramp = 0;
+    self->max_inflight = 0;
+    self->reconnect_attempts = -1;
+    self->cork = 0;
+    self->cork_delay = 0;
+    self->mqtt5 = false;
+    self->topic_aliases = 16;
+
+    self->bench = NULL;
+    self->bench_size = 64;
+    self->bench_window = 1;
+    self->bench_interval = 1;
+
+    self->session_dir = NULL;
+
+    self->spool_dir = NULL;
+    self->spool_size = 64*1024*1024;
+    self->spool_rate = 0;
+
+    self->pub_stdin = false;
+    self->pub_file = NULL;
+    self->pub_topic = NULL;
+    self->pub_format = FEEDER_FORMAT_LINE;
+
+    self->rate = 0;
+    self->burst = 0;
+    self->duration = 0;
+    self->count = 0;
+    self->payload = GENERATOR_NONE;
+    self->payload_size = NULL;
+
+    self->upload = NULL;
+
+    self->out_path = NULL;
+    self->out_format = SINK_FORMAT_LOG;
+    self->out_flush = 100;
+    self->stream_dir = NULL;
+    self->stream_size = 1024*1024;
+
+    self->stats_interval = 0;
+    self->stats_path = NULL;
+
     self->subscribe_topics = NULL;
     self->publish_messages = NULL;
 }
@@ -388,4 +888,31 @@ void args_clean(struct args *self)
         self->subscribe_topics = mqtt_msg_list_delete(self->subscribe_topics);
     if (self->publish_messages)
         self->publish_messages = mqtt_msg_list_delete(self->publish_messages);
+
+    if (self->bench)
+        self->bench = mqtt_msg_item_delete(self->bench);
+
+    if (self->session_dir)
+        self->session_dir = xfree(self->session_dir);
+
+    if (self->spool_dir)
+        self->spool_dir = xfree(self->spool_dir);
+
+    if (self->pub_file)
+        self->pub_file = xfree(self->pub_file);
+    if (self->pub_topic)
+        self->pub_topic = mqtt_msg_item_delete(self->pub_topic);
+    if (self->payload_size)
+        self->payload_size = xfree(self->payload_size);
+    if (self->upload)
+        self->upload = mqtt_msg_item_delete(self->upload);
+
+    if (self->out_path)
+        self->out_path = xfree(self->out_path);
+
+    if (self->stream_dir)
+        self->stream_dir = xfree(self->stream_dir);
+
+    if (self->stats_path)
+        self->stats_path = xfree(self->stats_path);
 }
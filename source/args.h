@@ -24,10 +24,55 @@ struct args
     char *ssl_ca_path;
 
     bool cli;
+    bool broker;
 
     unsigned short keep_alive;
     char *client_id;
 
+    unsigned int clients;
+    unsigned int threads;
+    unsigned int ramp;
+    unsigned int max_inflight;
+    int reconnect_attempts;
+    unsigned int cork;
+    unsigned int cork_delay;
+    bool mqtt5;
+    unsigned int topic_aliases;
+
+    struct mqtt_msg_item *bench;
+    unsigned int bench_size;
+    unsigned int bench_window;
+    unsigned int bench_interval;
+
+    char *session_dir;
+
+    char *spool_dir;
+    size_t spool_size;
+    unsigned int spool_rate;
+
+    bool pub_stdin;
+    char *pub_file;
+    struct mqtt_msg_item *pub_topic;
+    int pub_format;
+
+    unsigned int rate;
+    unsigned int burst;
+    unsigned int duration;
+    unsigned long long count;
+    int payload;
+    char *payload_size;
+
+    struct mqtt_msg_item *upload;
+
+    char *out_path;
+    int out_format;
+    unsigned int out_flush;
+    char *stream_dir;
+    size_t stream_size;
+
+    unsigned int stats_interval;
+    char *stats_path;
+
     struct mqtt_msg_list *subscribe_topics;
     struct mqtt_msg_list *publish_messages;
 
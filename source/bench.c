@@ -0,0 +1,402 @@
+
+#include "broker.h"
+#include "utils.h"
+
+#include "bombus/client.h"
+#include "bombus/log.h"
+
+#include "mx/log.h"
+#include "mx/memory.h"
+#include "mx/string.h"
+#include "mx/misc.h"
+#include "mx/mqtt.h"
+#include "mx/stream.h"
+#include "mx/idler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+
+#define BENCH_TOPIC             "bombus/bench"
+#define BENCH_PORT              18830
+#define BENCH_CONNECT_TIMEOUT   5000
+#define BENCH_DRAIN_TIMEOUT     5000
+#define BENCH_ACK_TIMEOUT       10000
+
+#define ARRAY_LEN(array)        (sizeof(array) / sizeof((array)[0]))
+
+
+
+static const size_t payload_sizes[] = { 16, 256, 4096, 65536 };
+static const unsigned char qos_levels[] = { 0, 1 };
+
+
+struct bench_transport
+{
+    const char *name;
+    const char *address;
+    unsigned int port;
+};
+
+
+/**
+ * Loopback benchmark, single client publishes to topic it is subscribed to.
+ *
+ */
+struct bench
+{
+    struct idler *idler;
+    struct bombus *bombus;
+
+    struct broker *broker;
+    pthread_t broker_thread;
+    bool broker_alive;              // Read atomically by broker thread
+
+    unsigned long duration_ms;
+    unsigned int window;
+    unsigned char *payload;
+    bool prepared;                  // Publish with pre-encoded headers
+    struct bombus_prepared *headers[3];     // By QoS, outlive messages in flight
+
+    unsigned long long sent;
+    unsigned long long received;
+
+    FILE *json;
+};
+
+
+struct bench_result
+{
+    unsigned long long messages;
+    uint64_t elapsed_ns;
+    uint64_t process_cpu_ns;        // Client and broker
+    uint64_t client_cpu_ns;         // Client thread only
+};
+
+
+
+
+static uint64_t cpu_time_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+
+static void bench_handle_msg(void *object, struct bombus *bombus, const struct bombus_msg *msg)
+{
+    struct bench *self = (struct bench*)object;
+
+    UNUSED(bombus);
+    UNUSED(msg);
+
+    self->received++;
+}
+
+
+static void* bench_broker_run(void *arg)
+{
+    struct bench *self = (struct bench*)arg;
+
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    broker_run(self->broker, &self->broker_alive);
+    return NULL;
+}
+
+
+static bool bench_start_broker(struct bench *self, const struct bench_transport *transport)
+{
+    if (transport->port == 0)
+        unlink(transport->address);
+
+    self->broker = broker_new();
+    if (!broker_listen(self->broker, transport->address, transport->port)) {
+        self->broker = broker_delete(self->broker);
+        return false;
+    }
+
+    __atomic_store_n(&self->broker_alive, true, __ATOMIC_RELEASE);
+    if (pthread_create(&self->broker_thread, NULL, bench_broker_run, self)) {
+        self->broker = broker_delete(self->broker);
+        return false;
+    }
+
+    return true;
+}
+
+
+static void bench_stop_broker(struct bench *self, const struct bench_transport *transport)
+{
+    // Broker is woken up, it may have no client to notice the flag
+    __atomic_store_n(&self->broker_alive, false, __ATOMIC_RELEASE);
+    broker_stop(self->broker);
+    if (self->bombus) {
+        bombus_disconnect(self->bombus);
+        self->bombus = bombus_delete(self->bombus);
+    }
+
+    pthread_join(self->broker_thread, NULL);
+    self->broker = broker_delete(self->broker);
+
+    if (transport->port == 0)
+        unlink(transport->address);
+}
+
+
+static void bench_handle_tasks(struct bench *self, unsigned long timeout_ms)
+{
+    int status = idler_wait(self->idler, timeout_ms);
+    if (status == IDLER_OPERATION) {
+        struct stream *stream = NULL;
+        unsigned int flags;
+        do {
+            flags = 0;
+            stream = idler_get_next_stream(self->idler, stream, &flags);
+            if (flags & STREAM_OUTGOING_READY)
+                stream_handle_outgoing_data(stream);
+            if (flags & STREAM_INCOMING_READY)
+                stream_handle_incoming_data(stream);
+        } while(stream);
+    }
+    bombus_handle_time(self->bombus);
+}
+
+
+static bool bench_connect(struct bench *self, const struct bench_transport *transport)
+{
+    self->bombus = bombus_new(self->idler);
+    bombus_set_mqtt_client_id(self->bombus, "bombus-bench");
+    bombus_configure_address(self->bombus, transport->address, transport->port);
+    bombus_configure_reconnect(self->bombus, 0, BENCH_CONNECT_TIMEOUT, 0, 0);
+    bombus_configure_inflight(self->bombus, self->window, BENCH_ACK_TIMEOUT);
+    bombus_set_msg_handler(self->bombus, self, bench_handle_msg);
+
+    if (!bombus_connect(self->bombus, true) || !bombus_wait_for_connection(self->bombus, BENCH_CONNECT_TIMEOUT)) {
+        BOMBUS_ERROR("Cannot connect to %s", transport->name);
+        return false;
+    }
+
+    bombus_subscribe(self->bombus, BENCH_TOPIC, 1);
+    if (!bombus_wait_for_msg(self->bombus, MQTT_SUBACK, BENCH_CONNECT_TIMEOUT)) {
+        BOMBUS_ERROR("Subscription to %s failed", transport->name);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Keep window of messages on the way for configured time, then wait for
+ * the rest of them.
+ *
+ */
+static bool bench_run_case(struct bench *self, unsigned char qos, size_t payload_size, struct bench_result *result)
+{
+    self->sent = 0;
+    self->received = 0;
+
+    uint64_t start = monotonic_time_ns();
+    uint64_t process_cpu = cpu_time_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t client_cpu = cpu_time_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t end = start + (uint64_t)self->duration_ms * 1000000;
+    struct bombus_prepared *prepared = self->headers[qos];
+
+    while (monotonic_time_ns() < end) {
+        if (!bombus_is_connected(self->bombus))
+            break;
+
+        while (self->sent - self->received < self->window) {
+            bool published = prepared ? bombus_publish_prepared(self->bombus, prepared, self->payload, payload_size) :
+                                        bombus_publish(self->bombus, BENCH_TOPIC, qos, false, self->payload, payload_size);
+            if (!published)
+                break;
+            self->sent++;
+        }
+        bench_handle_tasks(self, 10);
+    }
+
+    uint64_t drain = monotonic_time_ns() + (uint64_t)BENCH_DRAIN_TIMEOUT * 1000000;
+    while (self->received < self->sent && monotonic_time_ns() < drain)
+        bench_handle_tasks(self, 10);
+
+    result->messages = self->received;
+    result->elapsed_ns = monotonic_time_ns() - start;
+    result->process_cpu_ns = cpu_time_ns(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+    result->client_cpu_ns = cpu_time_ns(CLOCK_THREAD_CPUTIME_ID) - client_cpu;
+
+    return self->received == self->sent;
+}
+
+
+static void bench_report(struct bench *self, const char *transport, unsigned char qos, size_t payload_size,
+                         const struct bench_result *result, bool complete)
+{
+    double seconds = result->elapsed_ns / 1e9;
+    double rate = seconds > 0 ? result->messages / seconds : 0;
+    double process_ns = result->messages ? (double)result->process_cpu_ns / result->messages : 0;
+    double client_ns = result->messages ? (double)result->client_cpu_ns / result->messages : 0;
+
+    const char *api = self->prepared ? "prepared" : "publish";
+
+    printf("%-6s %-8s qos %u %6zu B: %10.0f msg/s %8.1f MB/s, cpu %8.0f ns/msg (client %8.0f ns/msg)%s\n",
+           transport, api, qos, payload_size, rate, rate * payload_size / 1e6, process_ns, client_ns,
+           complete ? "" : ", incomplete");
+    fflush(stdout);
+
+    if (self->json) {
+        fprintf(self->json, "{\"transport\":\"%s\",\"api\":\"%s\",\"qos\":%u,\"payload_size\":%zu,\"messages\":%llu,\"seconds\":%.6f,"
+                            "\"msg_per_sec\":%.1f,\"bytes_per_sec\":%.1f,\"cpu_ns_per_msg\":%.1f,\"client_cpu_ns_per_msg\":%.1f,"
+                            "\"complete\":%s}\n",
+                transport, api, qos, payload_size, result->messages, seconds,
+                rate, rate * payload_size, process_ns, client_ns, complete ? "true" : "false");
+        fflush(self->json);
+    }
+}
+
+
+static bool bench_run_transport(struct bench *self, const struct bench_transport *transport)
+{
+    bool success = true;
+
+    if (!bench_start_broker(self, transport))
+        return false;
+
+    if (bench_connect(self, transport)) {
+        for (size_t q=0; q<ARRAY_LEN(qos_levels); q++) {
+            for (size_t s=0; s<ARRAY_LEN(payload_sizes); s++) {
+                struct bench_result result;
+                bool complete = bench_run_case(self, qos_levels[q], payload_sizes[s], &result);
+                bench_report(self, transport->name, qos_levels[q], payload_sizes[s], &result, complete);
+                success = success && complete;
+            }
+        }
+    }
+    else {
+        success = false;
+    }
+
+    bench_stop_broker(self, transport);
+    return success;
+}
+
+
+
+
+static struct option options[] =
+{
+    {"duration",    required_argument,  0,  'd'},
+    {"window",      required_argument,  0,  'w'},
+    {"json",        required_argument,  0,  'j'},
+    {"prepared",    no_argument,        0,  'p'},
+    {"verbose",     required_argument,  0,  'v'},
+    {"help",        no_argument,        0,  'h'},
+    {0,             0,                  0,   0}
+};
+
+
+static void show_help(const char *name)
+{
+    printf("\nUsage: %s [options]\n", name);
+    printf("\nOPTIONS:\n");
+    printf("  -d  --duration MS     time spent in every case\n");
+    printf("  -w  --window NUM      messages on the way\n");
+    printf("  -j  --json FILE       write results as JSON lines [-stdout]\n");
+    printf("  -p  --prepared        publish with pre-encoded headers\n");
+    printf("  -v  --verbose NUM     set verbose value [0-silent,1-error,2-warning,3-info,4-debug]\n");
+    printf("  -h  --help            help\n");
+    printf("\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    log_init(deflogger, "bombus-bench");
+
+    struct bench bench;
+    memset(&bench, 0, sizeof(struct bench));
+    bench.duration_ms = 2000;
+    bench.window = 256;
+
+    const char *json_path = NULL;
+    int c;
+    long val;
+    while ((c = getopt_long(argc, argv, "d:w:j:pv:h", options, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            if (!xstrtol(optarg, &val, 10) || val <= 0)
+                return -1;
+            bench.duration_ms = (unsigned long)val;
+            break;
+        case 'w':
+            if (!xstrtol(optarg, &val, 10) || val <= 0 || val > 65535)
+                return -1;
+            bench.window = (unsigned int)val;
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'p':
+            bench.prepared = true;
+            break;
+        case 'v':
+            if (xstrtol(optarg, &val, 10) && RESET_LEVEL <= val && val <= DEBUG_LEVEL)
+                deflogger->conf.bits.verbosity = val;
+            break;
+        case 'h':
+            show_help(argv[0]);
+            return 0;
+        default:
+            show_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if (json_path) {
+        bench.json = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+        if (!bench.json) {
+            BOMBUS_ERROR("Cannot open %s, error %d", json_path, errno);
+            return -1;
+        }
+    }
+
+    char unix_path[64];
+    snprintf(unix_path, sizeof(unix_path), "/tmp/bombus-bench-%d.sock", (int)getpid());
+    const struct bench_transport transports[] = {
+        { "unix",   unix_path,      0 },
+        { "tcp",    "127.0.0.1",    BENCH_PORT },
+    };
+
+    bench.idler = idler_new();
+    bench.payload = xmalloc(payload_sizes[ARRAY_LEN(payload_sizes) - 1]);
+    memset(bench.payload, 'x', payload_sizes[ARRAY_LEN(payload_sizes) - 1]);
+
+    for (unsigned char qos=0; qos<ARRAY_LEN(bench.headers) && bench.prepared; qos++)
+        bench.headers[qos] = bombus_prepared_new(BENCH_TOPIC, qos, false);
+
+    bool success = true;
+    for (size_t i=0; i<ARRAY_LEN(transports); i++)
+        success = bench_run_transport(&bench, &transports[i]) && success;
+
+    for (unsigned char qos=0; qos<ARRAY_LEN(bench.headers) && bench.prepared; qos++)
+        bombus_prepared_delete(bench.headers[qos]);
+    xfree(bench.payload);
+    idler_delete(bench.idler);
+    if (bench.json && bench.json != stdout)
+        fclose(bench.json);
+
+    return success ? 0 : 1;
+}
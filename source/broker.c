@@ -0,0 +1,582 @@
+
+#include "broker.h"
+#include "utils.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+#include "mx/misc.h"
+#include "mx/mqtt.h"
+#include "mx/socket.h"
+#include "mx/stream.h"
+#include "mx/stream_mqtt.h"
+#include "mx/idler.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+#define BROKER_SESSIONS_PER_SLAB        256
+#define BROKER_CONNECT_TIMEOUT          10000
+#define BROKER_MAX_OUTGOING             (4*1024*1024)
+#define BROKER_MAX_TIMEOUT              60000
+#define BROKER_IDS_NUM                  65536
+
+
+
+
+static int broker_handle_data(void *object, struct stream *stream);
+static int broker_handle_msg(void *object, struct stream_mqtt *stream, unsigned char type, unsigned char flags, void *mqtt_msg);
+static void broker_session_expired(void *arg);
+static void broker_session_close(struct broker_session *session);
+
+
+
+static void broker_topic_delete(void *data)
+{
+    struct broker_topic *topic = (struct broker_topic*)data;
+
+    if (topic->subs)
+        xfree(topic->subs);
+    xfree(topic->filter);
+    xfree(topic);
+}
+
+
+/**
+ * Arm keep alive timer, broker waits one and a half keep alive interval.
+ *
+ */
+static void broker_session_touch(struct broker_session *session)
+{
+    struct broker *self = session->broker;
+    uint64_t timeout = BROKER_CONNECT_TIMEOUT;
+
+    if (session->connected) {
+        if (session->keep_alive == 0) {
+            timer_wheel_cancel(&self->timers, &session->timer);
+            return;
+        }
+        timeout = session->keep_alive * 1500UL;
+    }
+
+    timer_wheel_schedule(&self->timers, &session->timer, monotonic_time_ms() + timeout);
+}
+
+
+static void broker_handle_accept(struct broker *self)
+{
+    while (1) {
+        int fd = socket_accept(self->listen_fd);
+        if (!socket_is_valid(fd))
+            break;
+
+        socket_set_non_blocking(fd, 1);
+
+        struct broker_session *session = slab_pool_alloc(&self->sessions_pool);
+        memset(session, 0, sizeof(struct broker_session));
+        session->broker = self;
+
+        struct stream_mqtt *stream_mqtt = stream_mqtt_new(stream_new(fd));
+        stream_mqtt_set_observer(stream_mqtt, session, broker_handle_msg);
+        session->stream = stream_mqtt_to_stream(stream_mqtt);
+        stream_set_observer(session->stream, session, broker_handle_data);
+        idler_add_stream(self->idler, session->stream);
+
+        timer_entry_init(&session->timer, broker_session_expired, session);
+        broker_session_touch(session);
+
+        LIST_INSERT_HEAD(&self->sessions, session, _entry_);
+        self->sessions_num++;
+        self->stats.connections++;
+        BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Client %d accepted", fd);
+    }
+}
+
+
+static int broker_handle_listen(void *object, struct stream *stream)
+{
+    struct broker *self = (struct broker*)object;
+
+    UNUSED(stream);
+
+    broker_handle_accept(self);
+    return 1;
+}
+
+
+static int broker_handle_wakeup(void *object, struct stream *stream)
+{
+    struct broker *self = (struct broker*)object;
+    char buffer[16];
+
+    if (read(stream_get_fd(stream), buffer, sizeof(buffer)) != 0)
+        self->alive = false;
+    return 1;
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct broker* broker_new(void)
+{
+    struct broker *self = xmalloc(sizeof(struct broker));
+
+    self->idler = idler_new();
+    self->listen_fd = -1;
+    self->listen_stream = NULL;
+
+    topic_tree_init(&self->topics);
+    timer_wheel_init(&self->timers, monotonic_time_ms());
+    slab_pool_init(&self->sessions_pool, sizeof(struct broker_session), BROKER_SESSIONS_PER_SLAB);
+    LIST_INIT(&self->sessions);
+    self->sessions_num = 0;
+
+    memset(&self->stats, 0, sizeof(struct broker_stats));
+    self->alive = true;
+
+    self->wakeup_stream = NULL;
+    if (pipe(self->wakeup) < 0) {
+        BOMBUS_ERROR("Broker wakeup pipe error %d", errno);
+        self->wakeup[0] = self->wakeup[1] = -1;
+        return self;
+    }
+    self->wakeup_stream = stream_new(self->wakeup[0]);
+    stream_set_observer(self->wakeup_stream, self, broker_handle_wakeup);
+    idler_add_stream(self->idler, self->wakeup_stream);
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct broker* broker_delete(struct broker *self)
+{
+    while (!LIST_EMPTY(&self->sessions))
+        broker_session_close(LIST_FIRST(&self->sessions));
+
+    if (self->listen_stream) {
+        idler_remove_stream(self->idler, self->listen_stream);
+        self->listen_stream = stream_delete(self->listen_stream);
+    }
+    if (socket_is_valid(self->listen_fd))
+        socket_close(self->listen_fd);
+
+    if (self->wakeup_stream) {
+        idler_remove_stream(self->idler, self->wakeup_stream);
+        stream_delete(self->wakeup_stream);
+    }
+    if (self->wakeup[0] >= 0)
+        close(self->wakeup[0]);
+    if (self->wakeup[1] >= 0)
+        close(self->wakeup[1]);
+
+    topic_tree_clean(&self->topics, broker_topic_delete);
+    timer_wheel_clean(&self->timers);
+    slab_pool_clean(&self->sessions_pool);
+    idler_delete(self->idler);
+
+    return xfree(self);
+}
+
+
+/**
+ * Listen on TCP port, or on local socket when port is zero.
+ *
+ */
+bool broker_listen(struct broker *self, const char *address, unsigned int port)
+{
+    if (port > 0) {
+        BOMBUS_INFO("Broker listening on %s:%u", address, port);
+        self->listen_fd = socket_listen_inet(AF_UNSPEC, address, port);
+    }
+    else {
+        BOMBUS_INFO("Broker listening on %s", address);
+        self->listen_fd = socket_listen_unix(address);
+    }
+
+    if (!socket_is_valid(self->listen_fd)) {
+        BOMBUS_ERROR("Cannot listen on %s, error %d", address, errno);
+        return false;
+    }
+
+    socket_set_non_blocking(self->listen_fd, 1);
+    self->listen_stream = stream_new(self->listen_fd);
+    stream_set_observer(self->listen_stream, self, broker_handle_listen);
+    idler_add_stream(self->idler, self->listen_stream);
+
+    return true;
+}
+
+
+/**
+ * Serve connections until alive flag is cleared.
+ *
+ */
+void broker_run(struct broker *self, bool *alive)
+{
+    while (__atomic_load_n(alive, __ATOMIC_ACQUIRE) && self->alive) {
+        unsigned long timeout = BROKER_MAX_TIMEOUT;
+        uint64_t next = timer_wheel_next_expiry(&self->timers);
+        if (next != 0) {
+            uint64_t now = monotonic_time_ms();
+            timeout = next <= now ? 0 : (next - now < BROKER_MAX_TIMEOUT ? next - now : BROKER_MAX_TIMEOUT);
+        }
+
+        int status = idler_wait(self->idler, timeout);
+        if (status == IDLER_ERROR) {
+            BOMBUS_ERROR("Idler error %d", errno);
+            break;
+        }
+        if (status == IDLER_INTERRUPT)
+            break;
+        if (status == IDLER_OPERATION) {
+            struct stream *stream = NULL;
+            unsigned int flags;
+            do {
+                flags = 0;
+                stream = idler_get_next_stream(self->idler, stream, &flags);
+                if (flags & STREAM_OUTGOING_READY)
+                    stream_handle_outgoing_data(stream);
+                if (flags & STREAM_INCOMING_READY)
+                    stream_handle_incoming_data(stream);
+            } while(stream);
+        }
+
+        timer_wheel_advance(&self->timers, monotonic_time_ms());
+    }
+
+    BOMBUS_INFO("Broker served %llu connections, received %llu, delivered %llu, dropped %llu, duplicates %llu",
+                self->stats.connections, self->stats.received, self->stats.delivered, self->stats.dropped,
+                self->stats.duplicates);
+}
+
+
+/**
+ * Make broker_run return, safe to call from any thread.
+ *
+ */
+void broker_stop(struct broker *self)
+{
+    if (self->wakeup[1] < 0)
+        return;
+
+    if (write(self->wakeup[1], "q", 1) != 1)
+        BOMBUS_WARN("Broker wakeup write error %d", errno);
+}
+
+
+
+
+static void broker_session_subscribe(struct broker_session *session, const char *filter, unsigned char qos)
+{
+    struct broker *self = session->broker;
+
+    struct broker_topic *topic = topic_tree_find(&self->topics, filter);
+    if (!topic) {
+        topic = xmalloc(sizeof(struct broker_topic));
+        topic->filter = xstrdup(filter);
+        topic->subs = NULL;
+        topic->subs_num = 0;
+        topic->subs_size = 0;
+        topic_tree_insert(&self->topics, filter, topic);
+    }
+
+    for (unsigned int i=0; i<topic->subs_num; i++) {
+        if (topic->subs[i].session == session) {
+            topic->subs[i].qos = qos;   // Resubscription only updates qos
+            return;
+        }
+    }
+
+    if (topic->subs_num == topic->subs_size) {
+        topic->subs_size = topic->subs_size ? topic->subs_size * 2 : 4;
+        topic->subs = xrealloc(topic->subs, topic->subs_size * sizeof(struct broker_sub));
+    }
+    topic->subs[topic->subs_num].session = session;
+    topic->subs[topic->subs_num].qos = qos;
+    topic->subs_num++;
+
+    if (session->topics_num == session->topics_size) {
+        session->topics_size = session->topics_size ? session->topics_size * 2 : 4;
+        session->topics = xrealloc(session->topics, session->topics_size * sizeof(struct broker_topic*));
+    }
+    session->topics[session->topics_num++] = topic;
+}
+
+
+static void broker_topic_remove_session(struct broker *self, struct broker_topic *topic, struct broker_session *session)
+{
+    for (unsigned int i=0; i<topic->subs_num; i++) {
+        if (topic->subs[i].session == session) {
+            topic->subs[i] = topic->subs[--topic->subs_num];
+            break;
+        }
+    }
+
+    if (topic->subs_num == 0) {
+        topic_tree_remove(&self->topics, topic->filter);
+        broker_topic_delete(topic);
+    }
+}
+
+
+static void broker_session_unsubscribe(struct broker_session *session, const char *filter)
+{
+    struct broker *self = session->broker;
+
+    for (unsigned int i=0; i<session->topics_num; i++) {
+        struct broker_topic *topic = session->topics[i];
+        if (!strcmp(topic->filter, filter)) {
+            session->topics[i] = session->topics[--session->topics_num];
+            broker_topic_remove_session(self, topic, session);
+            return;
+        }
+    }
+}
+
+
+static void broker_session_close(struct broker_session *session)
+{
+    struct broker *self = session->broker;
+
+    BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Client %s disconnected", session->client_id ? session->client_id : "-");
+
+    for (unsigned int i=0; i<session->topics_num; i++)
+        broker_topic_remove_session(self, session->topics[i], session);
+    if (session->topics)
+        xfree(session->topics);
+
+    timer_wheel_cancel(&self->timers, &session->timer);
+
+    idler_remove_stream(self->idler, session->stream);
+    socket_close(stream_get_fd(session->stream));
+    stream_delete(session->stream);
+
+    if (session->client_id)
+        xfree(session->client_id);
+    if (session->received)
+        xfree(session->received);
+
+    LIST_REMOVE(session, _entry_);
+    self->sessions_num--;
+    slab_pool_free(&self->sessions_pool, session);
+}
+
+
+static void broker_session_expired(void *arg)
+{
+    struct broker_session *session = (struct broker_session*)arg;
+
+    BOMBUS_WARN("Client %s keep alive expired", session->client_id ? session->client_id : "-");
+    broker_session_close(session);
+}
+
+
+
+
+struct broker_route
+{
+    const struct mqtt_publish *msg;
+    const char *topic;          // Null terminated copy of topic
+    unsigned char qos;
+};
+
+
+static void broker_deliver(void *arg, void *data)
+{
+    struct broker_route *route = (struct broker_route*)arg;
+    struct broker_topic *topic = (struct broker_topic*)data;
+
+    for (unsigned int i=0; i<topic->subs_num; i++) {
+        struct broker_session *session = topic->subs[i].session;
+        struct broker *self = session->broker;
+        unsigned char qos = route->qos < topic->subs[i].qos ? route->qos : topic->subs[i].qos;
+
+        if (stream_get_outgoing_len(session->stream) >= BROKER_MAX_OUTGOING) {
+            self->stats.dropped++;  // Slow subscriber, no state is kept to deliver it later
+            continue;
+        }
+
+        unsigned short msg_id = 0;
+        if (qos > 0) {
+            if (++session->next_id == 0)
+                session->next_id = 1;
+            msg_id = session->next_id;
+        }
+
+        stream_mqtt_publish(stream_mqtt_from_stream(session->stream), false, false, qos, msg_id,
+                            route->topic, route->msg->payload, route->msg->payload_len);
+        self->stats.delivered++;
+    }
+}
+
+
+/**
+ * Route message straight from received frame.
+ *
+ * QoS 2 is downgraded to QoS 1, broker keeps no delivery state, messages
+ * acknowledged by subscribers are simply forgotten.
+ *
+ */
+static void broker_route(struct broker *self, const struct mqtt_publish *msg, unsigned char qos)
+{
+    char topic[msg->topic_len + 1];
+    memcpy(topic, msg->topic, msg->topic_len);
+    topic[msg->topic_len] = '\0';
+
+    struct broker_route route = { .msg = msg, .topic = topic, .qos = qos > 1 ? 1 : qos };
+    topic_tree_match(&self->topics, msg->topic, msg->topic_len, broker_deliver, &route);
+    self->stats.received++;
+}
+
+
+/**
+ * Check whether publish should be routed, remember its id.
+ *
+ * Publisher retransmits with DUP flag when acknowledge did not reach it,
+ * such message was routed already. QoS 2 ids are forgotten on PUBREL.
+ *
+ */
+static bool broker_session_receive(struct broker_session *session, unsigned short msg_id, bool dup)
+{
+    if (!session->received) {
+        session->received = xmalloc(BROKER_IDS_NUM/8);
+        memset(session->received, 0, BROKER_IDS_NUM/8);
+    }
+
+    unsigned char bit = 1 << (msg_id & 0x07);
+    unsigned char *byte = &session->received[msg_id >> 3];
+    if (dup && (*byte & bit)) {
+        session->broker->stats.duplicates++;
+        return false;
+    }
+
+    *byte |= bit;
+    return true;
+}
+
+
+static int broker_handle_msg(void *object, struct stream_mqtt *stream, unsigned char type, unsigned char flags, void *mqtt_msg)
+{
+    struct broker_session *session = (struct broker_session*)object;
+    struct broker *self = session->broker;
+
+    if (!session->connected && type != MQTT_CONNECT)
+        return 1;   // Protocol violation, ignored until connection times out
+
+    switch (type) {
+        case MQTT_CONNECT: {
+            struct mqtt_connect *msg = (struct mqtt_connect*)mqtt_msg;
+            if (session->connected)
+                break;
+            session->connected = true;
+            session->keep_alive = msg->keep_alive;
+            session->client_id = xstrndup(msg->client_id, msg->client_id_len);
+            stream_mqtt_connack(stream, false, MQTT_CONNACK_ACCEPTED);
+            BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Client %s connected", session->client_id);
+        }   break;
+
+        case MQTT_SUBSCRIBE: {
+            struct mqtt_subscribe *msg = (struct mqtt_subscribe*)mqtt_msg;
+            char filter[msg->topic_len + 1];
+            memcpy(filter, msg->topic, msg->topic_len);
+            filter[msg->topic_len] = '\0';
+
+            if (topic_is_valid_filter(filter)) {
+                unsigned char qos = msg->qos > 1 ? 1 : msg->qos;
+                if (msg->qos > 1)
+                    BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Client %s subscription %s granted QoS 1 instead of 2", session->client_id, filter);
+                broker_session_subscribe(session, filter, qos);
+                stream_mqtt_suback(stream, msg->msg_id, qos);
+            }
+            else {
+                stream_mqtt_suback(stream, msg->msg_id, MQTT_SUBACK_FAILURE);
+            }
+        }   break;
+
+        case MQTT_UNSUBSCRIBE: {
+            struct mqtt_unsubscribe *msg = (struct mqtt_unsubscribe*)mqtt_msg;
+            char filter[msg->topic_len + 1];
+            memcpy(filter, msg->topic, msg->topic_len);
+            filter[msg->topic_len] = '\0';
+
+            broker_session_unsubscribe(session, filter);
+            stream_mqtt_unsuback(stream, msg->msg_id);
+        }   break;
+
+        case MQTT_PUBLISH: {
+            struct mqtt_publish *msg = (struct mqtt_publish*)mqtt_msg;
+            unsigned char qos = (flags >> 1) & 0x03;
+
+            if (qos == 0 || broker_session_receive(session, msg->msg_id, flags & 0x08))
+                broker_route(self, msg, qos);
+            if (qos == 1)
+                stream_mqtt_puback(stream, msg->msg_id);
+            else if (qos == 2)
+                stream_mqtt_pubrec(stream, msg->msg_id);
+        }   break;
+
+        case MQTT_PUBREL: {
+            struct mqtt_pubrel *msg = (struct mqtt_pubrel*)mqtt_msg;
+            if (session->received)
+                session->received[msg->msg_id >> 3] &= ~(1 << (msg->msg_id & 0x07));
+            stream_mqtt_pubcomp(stream, msg->msg_id);
+        }   break;
+
+        case MQTT_PINGREQ:
+            stream_mqtt_pingresp(stream);
+            break;
+
+        case MQTT_DISCONNECT:
+            // Stream is in use, session is closed once frame is handled
+            session->disconnected = true;
+            return 1;
+    }
+
+    broker_session_touch(session);
+    return 1;
+}
+
+
+static int broker_handle_data(void *object, struct stream *stream)
+{
+    struct broker_session *session = (struct broker_session*)object;
+    struct stream_mqtt *stream_mqtt = stream_mqtt_from_stream(stream);
+
+    ssize_t bytes;
+
+    do {
+        bytes = stream_mqtt_peek_frame(stream_mqtt);
+        if (session->disconnected) {
+            BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Client %s sent disconnect", session->client_id);
+            break;
+        }
+        if (bytes <= 0) {
+            if (bytes < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return bytes;   // All data already read
+                BOMBUS_DEBUG(BOMBUS_DBG_BROKER, "Receiving from %d fd failed with %d", stream_get_fd(stream), errno);
+            }
+            break;
+        }
+        else {
+            BOMBUS_ERROR("Message not handled by callback");
+            break;
+        }
+    } while (bytes > 0);
+
+    broker_session_close(session);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef __BOMBUS_BROKER_H_
+#define __BOMBUS_BROKER_H_
+
+#include "topic_tree.h"
+#include "timer_wheel.h"
+#include "pool.h"
+
+#include "mx/queue.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct idler;
+struct stream;
+struct broker;
+struct broker_session;
+
+
+struct broker_sub
+{
+    struct broker_session *session;
+    unsigned char qos;
+};
+
+
+/**
+ * Subscribers of single topic filter.
+ *
+ */
+struct broker_topic
+{
+    char *filter;
+    struct broker_sub *subs;
+    unsigned int subs_num;
+    unsigned int subs_size;
+};
+
+
+/**
+ * Client connection.
+ *
+ * Session lives as long as its connection, subscriptions are dropped on
+ * disconnect.
+ *
+ */
+struct broker_session
+{
+    struct broker *broker;
+    struct stream *stream;
+    char *client_id;
+    bool connected;             // CONNECT received
+    bool disconnected;          // DISCONNECT received, closed after frame
+
+    unsigned short keep_alive;
+    unsigned short next_id;
+    struct timer_entry timer;   // Keep alive expiry
+    unsigned char *received;    // Bitmap of routed QoS 1/2 ids, allocated on first one
+
+    struct broker_topic **topics;
+    unsigned int topics_num;
+    unsigned int topics_size;
+
+    LIST_ENTRY(broker_session) _entry_;
+};
+
+
+// struct broker_session_list
+LIST_HEAD(broker_session_list, broker_session);
+
+
+struct broker_stats
+{
+    unsigned long long connections;
+    unsigned long long received;
+    unsigned long long delivered;
+    unsigned long long dropped;     // Messages dropped for slow subscribers
+    unsigned long long duplicates;  // DUP publishes already routed
+};
+
+
+/**
+ * Minimal MQTT 3.1.1 broker, QoS 0 and 1.
+ *
+ * All connections are served by single idler. Messages are routed through
+ * topic tree straight from received frame into subscribers output buffers,
+ * nothing is allocated per message.
+ *
+ * Broker keeps no delivery state. Subscribers with full output buffer lose
+ * messages of any QoS and QoS 1 deliveries are not retransmitted. QoS 2 is
+ * accepted from publishers and in subscriptions, but delivered as QoS 1.
+ *
+ */
+struct broker
+{
+    struct idler *idler;
+    int listen_fd;
+    struct stream *listen_stream;
+
+    struct topic_tree topics;
+    struct timer_wheel timers;
+    struct slab_pool sessions_pool;
+    struct broker_session_list sessions;
+    unsigned int sessions_num;
+
+    struct broker_stats stats;
+    bool alive;
+
+    int wakeup[2];              // Stop request from other thread
+    struct stream *wakeup_stream;
+};
+
+
+
+struct broker* broker_new(void);
+struct broker* broker_delete(struct broker *self);
+
+bool broker_listen(struct broker *self, const char *address, unsigned int port);
+void broker_run(struct broker *self, bool *alive);
+void broker_stop(struct broker *self);
+
+
+#endif /* __BOMBUS_BROKER_H_ */
@@ -0,0 +1,301 @@
+
+#include "feeder.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+#include "mx/stream.h"
+#include "mx/idler.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define FEEDER_BUFFER_SIZE      (256*1024)
+
+
+
+
+static int feeder_handle_data(void *object, struct stream *stream);
+
+
+
+/*
+ * Constructor
+ *
+ * Path is NULL for standard input.
+ *
+ */
+struct feeder* feeder_new(struct idler *idler, const char *path, const char *topic, int format)
+{
+    struct feeder *self = xmalloc(sizeof(struct feeder));
+    self->idler = idler;
+    self->stream = NULL;
+    self->reading = false;
+    self->data = NULL;
+    self->data_len = 0;
+    self->data_pos = 0;
+    self->buffer_size = 0;
+    self->mapped = false;
+    self->eof = false;
+    self->topic = topic ? xstrdup(topic) : NULL;
+    self->format = format;
+    self->records = 0;
+
+    if (path) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            BOMBUS_ERROR("Cannot open %s, error %d", path, errno);
+            if (fd >= 0)
+                close(fd);
+            return feeder_delete(self);
+        }
+
+        if (st.st_size > 0) {
+            void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mem == MAP_FAILED) {
+                BOMBUS_ERROR("Cannot map %s, error %d", path, errno);
+                close(fd);
+                return feeder_delete(self);
+            }
+            madvise(mem, st.st_size, MADV_SEQUENTIAL);
+            self->data = mem;
+            self->data_len = st.st_size;
+            self->mapped = true;
+        }
+        close(fd);
+        self->eof = true;
+    }
+    else {
+        self->buffer_size = FEEDER_BUFFER_SIZE;
+        self->data = xmalloc(self->buffer_size);
+        self->stream = stream_new(STDIN_FILENO);
+        stream_set_observer(self->stream, self, feeder_handle_data);
+        feeder_pause(self, false);
+    }
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct feeder* feeder_delete(struct feeder *self)
+{
+    if (self->stream) {
+        feeder_pause(self, true);
+        stream_delete(self->stream);
+    }
+    if (self->mapped)
+        munmap(self->data, self->data_len);
+    else if (self->data)
+        xfree(self->data);
+    if (self->topic)
+        xfree(self->topic);
+
+    return xfree(self);
+}
+
+
+/**
+ * Stop or resume reading standard input.
+ *
+ */
+void feeder_pause(struct feeder *self, bool pause)
+{
+    if (!self->stream || self->eof || self->reading == !pause)
+        return;
+
+    if (pause)
+        idler_remove_stream(self->idler, self->stream);
+    else
+        idler_add_stream(self->idler, self->stream);
+    self->reading = !pause;
+}
+
+
+static int feeder_handle_data(void *object, struct stream *stream)
+{
+    struct feeder *self = (struct feeder*)object;
+
+    if (self->data_pos > 0) {
+        // Move partial record to the beginning
+        memmove(self->data, self->data + self->data_pos, self->data_len - self->data_pos);
+        self->data_len -= self->data_pos;
+        self->data_pos = 0;
+    }
+
+    if (self->data_len == self->buffer_size) {
+        // Buffer full of single record, wait till it is consumed
+        feeder_pause(self, true);
+        return 1;
+    }
+
+    int bytes = stream_read(stream, self->data + self->data_len, self->buffer_size - self->data_len);
+    if (bytes > 0) {
+        self->data_len += bytes;
+    }
+    else if (bytes == 0 || (errno != EAGAIN && errno != EINTR)) {
+        feeder_pause(self, true);
+        self->eof = true;
+    }
+
+    return 1;
+}
+
+
+static uint32_t feeder_read_be(const unsigned char *ptr, size_t len)
+{
+    uint32_t val = 0;
+    for (size_t i=0; i<len; i++)
+        val = (val << 8) | ptr[i];
+    return val;
+}
+
+
+static bool feeder_set_topic(struct feeder *self, struct feeder_record *record, const char *topic, size_t topic_len)
+{
+    if (topic_len == 0 || topic_len > FEEDER_TOPIC_MAX_LEN)
+        return false;
+
+    memcpy(self->record_topic, topic, topic_len);
+    self->record_topic[topic_len] = '\0';
+    record->topic = self->record_topic;
+    return true;
+}
+
+
+static bool feeder_parse_line(struct feeder *self, struct feeder_record *record, const unsigned char *ptr, size_t len)
+{
+    const unsigned char *end = memchr(ptr, '\n', len);
+    size_t line_len;
+    if (end) {
+        line_len = end - ptr;
+        record->size = line_len + 1;
+    }
+    else if (self->eof || len == self->buffer_size) {
+        // Last or overlong line
+        line_len = len;
+        record->size = len;
+    }
+    else {
+        return false;
+    }
+
+    if (self->topic) {
+        record->topic = self->topic;
+        record->payload = ptr;
+        record->payload_len = line_len;
+        return true;
+    }
+
+    const unsigned char *space = memchr(ptr, ' ', line_len);
+    size_t topic_len = space ? (size_t)(space - ptr) : line_len;
+    if (!feeder_set_topic(self, record, (const char*)ptr, topic_len))
+        record->topic = NULL;
+    record->payload = space ? space + 1 : ptr + line_len;
+    record->payload_len = space ? line_len - topic_len - 1 : 0;
+    return true;
+}
+
+
+static bool feeder_parse_length(struct feeder *self, struct feeder_record *record, const unsigned char *ptr, size_t len)
+{
+    size_t pos = 0;
+
+    record->topic = self->topic;
+    if (!self->topic) {
+        if (len < 2)
+            return false;
+        size_t topic_len = feeder_read_be(ptr, 2);
+        if (len < 2 + topic_len)
+            return false;
+        if (!feeder_set_topic(self, record, (const char*)ptr + 2, topic_len))
+            record->topic = NULL;
+        pos = 2 + topic_len;
+    }
+
+    if (len < pos + 4)
+        return false;
+    size_t payload_len = feeder_read_be(ptr + pos, 4);
+    pos += 4;
+
+    if (payload_len > FEEDER_RECORD_MAX_LEN) {
+        // Stream cannot be resynchronized after malformed length
+        BOMBUS_ERROR("Record of %zu bytes exceeds maximum, rest of input dropped", payload_len);
+        self->data_pos = self->data_len;
+        feeder_pause(self, true);
+        self->eof = true;
+        return false;
+    }
+
+    if (len < pos + payload_len) {
+        if (!self->mapped && pos + payload_len > self->buffer_size) {
+            // Make room for big record, buffer never shrinks
+            self->buffer_size = pos + payload_len;
+            self->data = xrealloc(self->data, self->buffer_size);
+            feeder_pause(self, false);
+        }
+        return false;
+    }
+
+    record->payload = ptr + pos;
+    record->payload_len = payload_len;
+    record->size = pos + payload_len;
+    return true;
+}
+
+
+/**
+ * Parse next complete record.
+ *
+ * Records with invalid topic are returned with NULL topic and should be skipped.
+ *
+ */
+bool feeder_peek(struct feeder *self, struct feeder_record *record)
+{
+    const unsigned char *ptr = self->data + self->data_pos;
+    size_t len = self->data_len - self->data_pos;
+
+    if (len == 0)
+        return false;
+
+    if (self->format == FEEDER_FORMAT_LENGTH)
+        return feeder_parse_length(self, record, ptr, len);
+    return feeder_parse_line(self, record, ptr, len);
+}
+
+
+void feeder_pop(struct feeder *self, const struct feeder_record *record)
+{
+    self->data_pos += record->size;
+    self->records++;
+
+    if (self->data_pos == self->data_len && !self->mapped) {
+        self->data_pos = 0;
+        self->data_len = 0;
+    }
+}
+
+
+/**
+ * All data read and published.
+ *
+ */
+bool feeder_is_done(struct feeder *self)
+{
+    if (!self->eof)
+        return false;
+
+    struct feeder_record record;
+    return !feeder_peek(self, &record);
+}
@@ -0,0 +1,80 @@
+#ifndef __BOMBUS_FEEDER_H_
+#define __BOMBUS_FEEDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+#define FEEDER_TOPIC_MAX_LEN    1024
+#define FEEDER_RECORD_MAX_LEN   268435455       // MQTT maximum remaining length
+
+
+struct idler;
+struct stream;
+
+
+enum feeder_format_e {
+    FEEDER_FORMAT_LINE = 0,     // Newline delimited records
+    FEEDER_FORMAT_LENGTH,       // Records prefixed with 32-bit big endian length
+};
+
+
+/**
+ * Single record, payload points directly into feeder data.
+ *
+ */
+struct feeder_record
+{
+    const char *topic;
+    const void *payload;
+    size_t payload_len;
+    size_t size;                // Bytes consumed by record
+};
+
+
+/**
+ * Streaming source of publish records.
+ *
+ * Files are memory-mapped, standard input is read in large blocks into
+ * single buffer. Records are parsed in place, without allocations. QoS 0
+ * records are published straight from feeder data, QoS 1/2 ones are still
+ * copied into client in-flight table, stdin buffer is reused before they
+ * are acknowledged.
+ *
+ * Without fixed topic every record carries its own one, as the first word of
+ * line or as 16-bit big endian length prefixed string before payload length.
+ *
+ */
+struct feeder
+{
+    struct idler *idler;
+    struct stream *stream;      // Standard input only
+    bool reading;
+
+    unsigned char *data;
+    size_t data_len;
+    size_t data_pos;
+    size_t buffer_size;
+    bool mapped;
+    bool eof;
+
+    char *topic;
+    int format;
+    char record_topic[FEEDER_TOPIC_MAX_LEN + 1];
+
+    unsigned long long records;
+};
+
+
+struct feeder* feeder_new(struct idler *idler, const char *path, const char *topic, int format);
+struct feeder* feeder_delete(struct feeder *self);
+
+bool feeder_peek(struct feeder *self, struct feeder_record *record);
+void feeder_pop(struct feeder *self, const struct feeder_record *record);
+void feeder_pause(struct feeder *self, bool pause);
+bool feeder_is_done(struct feeder *self);
+
+
+#endif /* __BOMBUS_FEEDER_H_ */
@@ -0,0 +1,312 @@
+
+#include "generator.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+#define GENERATOR_DEFAULT_SIZE      64
+#define GENERATOR_COUNTER_LEN       8
+#define GENERATOR_JSON_RECORD_LEN   256     // Longest record without padding
+
+
+static const char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+
+
+
+/**
+ * Load size distribution, every line holds size and optional weight.
+ *
+ */
+static bool generator_load_sizes(struct generator *self, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        BOMBUS_ERROR("Cannot open size distribution %s, error %d", path, errno);
+        return false;
+    }
+
+    char line[256];
+    unsigned int size = 0;
+    uint64_t total = 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long payload_size, weight = 1;
+        char *ptr = xstrltrim(line);
+        if (*ptr == '#' || *ptr == '\0' || *ptr == '\n')
+            continue;
+        if (sscanf(ptr, "%llu %llu", &payload_size, &weight) < 1 || weight == 0) {
+            BOMBUS_ERROR("Invalid size distribution line %s", ptr);
+            fclose(file);
+            return false;
+        }
+
+        if (self->sizes_num == size) {
+            size = size ? size * 2 : 16;
+            self->sizes = xrealloc(self->sizes, size * sizeof(struct generator_size));
+        }
+        total += weight;
+        self->sizes[self->sizes_num].size = (size_t)payload_size;
+        self->sizes[self->sizes_num].weight = total;
+        self->sizes_num++;
+
+        if (payload_size > self->max_size)
+            self->max_size = (size_t)payload_size;
+    }
+    fclose(file);
+
+    if (self->sizes_num == 0) {
+        BOMBUS_ERROR("Empty size distribution %s", path);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Parse size specification, SIZE, MIN-MAX or @FILE.
+ *
+ */
+static bool generator_parse_sizes(struct generator *self, const char *spec)
+{
+    unsigned long long min, max;
+
+    if (!spec) {
+        self->min_size = self->max_size = GENERATOR_DEFAULT_SIZE;
+        return true;
+    }
+
+    if (spec[0] == '@')
+        return generator_load_sizes(self, spec + 1);
+
+    int fields = sscanf(spec, "%llu-%llu", &min, &max);
+    if (fields == 1)
+        max = min;
+    if (fields < 1 || min > max) {
+        BOMBUS_ERROR("Invalid payload size %s", spec);
+        return false;
+    }
+
+    self->min_size = (size_t)min;
+    self->max_size = (size_t)max;
+    return true;
+}
+
+
+static size_t generator_draw_size(struct generator *self)
+{
+    if (self->sizes_num > 0) {
+        uint64_t total = self->sizes[self->sizes_num - 1].weight;
+        uint64_t point = ((uint64_t)rand_r(&self->seed) << 31 | rand_r(&self->seed)) % total;
+
+        // Binary search in cumulative weights
+        unsigned int low = 0, high = self->sizes_num - 1;
+        while (low < high) {
+            unsigned int mid = (low + high) / 2;
+            if (self->sizes[mid].weight > point)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return self->sizes[low].size;
+    }
+
+    if (self->max_size == self->min_size)
+        return self->min_size;
+    return self->min_size + (size_t)rand_r(&self->seed) % (self->max_size - self->min_size + 1);
+}
+
+
+static void generator_fill_pattern(unsigned char *data, size_t len, size_t shift)
+{
+    for (size_t i=0; i<len; i++)
+        data[i] = pattern[(i + shift) % (sizeof(pattern) - 1)];
+}
+
+
+/**
+ * Render sensor record, padded to requested size when it is longer.
+ *
+ * Data must hold at least size or GENERATOR_JSON_RECORD_LEN bytes, the
+ * larger of the two. Returns rendered length.
+ *
+ */
+static size_t generator_render_json(struct generator *self, unsigned char *data, size_t size, unsigned int slot)
+{
+    char record[GENERATOR_JSON_RECORD_LEN];
+    int len = snprintf(record, sizeof(record),
+                       "{\"sensor\":\"sensor-%u\",\"seq\":%u,\"temperature\":%.2f,\"humidity\":%.1f,\"battery\":%u",
+                       slot % 100, slot, 15.0 + (rand_r(&self->seed) % 2000) / 100.0,
+                       30.0 + (rand_r(&self->seed) % 600) / 10.0, 20 + rand_r(&self->seed) % 80);
+
+    const char pad[] = ",\"pad\":\"";
+    size_t min_padded = len + sizeof(pad) - 1 + 2;
+    if (size < min_padded) {
+        record[len++] = '}';
+        memcpy(data, record, len);
+        return len;
+    }
+
+    memcpy(data, record, len);
+    memcpy(data + len, pad, sizeof(pad) - 1);
+    generator_fill_pattern(data + len + sizeof(pad) - 1, size - min_padded, slot);
+    memcpy(data + size - 2, "\"}", 2);
+    return size;
+}
+
+
+/**
+ * Render every slot once, straight into the ring.
+ *
+ */
+static void generator_render(struct generator *self)
+{
+    size_t total = 0, capacity = 0;
+    self->slots = GENERATOR_RING_SLOTS;
+    self->offsets = xmalloc(self->slots * sizeof(size_t));
+    self->lens = xmalloc(self->slots * sizeof(size_t));
+    self->data = NULL;
+
+    for (unsigned int i=0; i<self->slots; i++) {
+        size_t size = generator_draw_size(self);
+        if (self->kind == GENERATOR_COUNTER && size < GENERATOR_COUNTER_LEN)
+            size = GENERATOR_COUNTER_LEN;
+
+        size_t room = size;
+        if (self->kind == GENERATOR_JSON && room < GENERATOR_JSON_RECORD_LEN)
+            room = GENERATOR_JSON_RECORD_LEN;
+        if (total + room > capacity) {
+            while (total + room > capacity)
+                capacity = capacity ? capacity * 2 : total + room;
+            self->data = xrealloc(self->data, capacity);
+        }
+
+        unsigned char *slot = self->data + total;
+        switch (self->kind) {
+            case GENERATOR_RANDOM:
+                for (size_t n=0; n<size; n++)
+                    slot[n] = (unsigned char)rand_r(&self->seed);
+                break;
+
+            case GENERATOR_JSON:
+                size = generator_render_json(self, slot, size, i);
+                break;
+
+            default:
+                generator_fill_pattern(slot, size, i);
+                break;
+        }
+
+        if (i > 0 && total + size > GENERATOR_RING_MAX_BYTES) {
+            self->slots = i;    // Large payloads, shorter ring
+            break;
+        }
+        self->offsets[i] = total;
+        self->lens[i] = size;
+        total += size;
+    }
+
+    // Drop unused growth
+    self->data = xrealloc(self->data, total > 0 ? total : 1);
+}
+
+
+
+
+int generator_parse_kind(const char *kind)
+{
+    if (!strcmp(kind, "fixed"))
+        return GENERATOR_FIXED;
+    if (!strcmp(kind, "random"))
+        return GENERATOR_RANDOM;
+    if (!strcmp(kind, "json"))
+        return GENERATOR_JSON;
+    if (!strcmp(kind, "counter"))
+        return GENERATOR_COUNTER;
+    return GENERATOR_NONE;
+}
+
+
+/*
+ * Constructor
+ *
+ */
+struct generator* generator_new(int kind, const char *size_spec, unsigned int seed)
+{
+    struct generator *self = xmalloc(sizeof(struct generator));
+    memset(self, 0, sizeof(struct generator));
+    self->kind = kind;
+    self->seed = seed;
+
+    if (!generator_parse_sizes(self, size_spec))
+        return generator_delete(self);
+
+    generator_render(self);
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct generator* generator_delete(struct generator *self)
+{
+    if (self->sizes)
+        xfree(self->sizes);
+    if (self->offsets)
+        xfree(self->offsets);
+    if (self->lens)
+        xfree(self->lens);
+    if (self->data)
+        xfree(self->data);
+
+    return xfree(self);
+}
+
+
+/**
+ * Take next payload from ring.
+ *
+ * Payload stays valid until ring wraps around, publish copies it into
+ * output buffer anyway.
+ *
+ */
+const void* generator_next(struct generator *self, size_t *len)
+{
+    unsigned int slot = self->next;
+    if (++self->next >= self->slots)
+        self->next = 0;
+
+    unsigned char *payload = self->data + self->offsets[slot];
+    *len = self->lens[slot];
+
+    if (self->kind == GENERATOR_COUNTER) {
+        uint64_t seq = self->seq++;
+        for (int i=GENERATOR_COUNTER_LEN-1; i>=0; i--) {
+            payload[i] = (unsigned char)seq;
+            seq >>= 8;
+        }
+    }
+
+    return payload;
+}
+
+
+/**
+ * Return last payload back to ring, it was not published.
+ *
+ */
+void generator_unget(struct generator *self)
+{
+    self->next = self->next > 0 ? self->next - 1 : self->slots - 1;
+    if (self->kind == GENERATOR_COUNTER)
+        self->seq--;
+}
@@ -0,0 +1,67 @@
+#ifndef __BOMBUS_GENERATOR_H_
+#define __BOMBUS_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+#define GENERATOR_RING_SLOTS        1024
+#define GENERATOR_RING_MAX_BYTES    (64*1024*1024)
+
+
+enum generator_kind_e {
+    GENERATOR_NONE = 0,
+    GENERATOR_FIXED,            // Repeated printable pattern
+    GENERATOR_RANDOM,           // Random bytes
+    GENERATOR_JSON,             // Sensor records
+    GENERATOR_COUNTER,          // 64-bit big endian sequence number followed by pattern
+};
+
+
+struct generator_size
+{
+    size_t size;
+    uint64_t weight;            // Cumulative
+};
+
+
+/**
+ * Synthetic payloads.
+ *
+ * Payloads are rendered at startup into ring of slots, sizes are drawn from
+ * configured distribution. Taking payload costs O(1), only counter payloads
+ * get their sequence number stored in place.
+ *
+ */
+struct generator
+{
+    int kind;
+
+    struct generator_size *sizes;
+    unsigned int sizes_num;
+    size_t min_size;            // Uniform range when no table
+    size_t max_size;
+
+    unsigned char *data;
+    size_t *offsets;
+    size_t *lens;
+    unsigned int slots;
+    unsigned int next;
+
+    unsigned long long seq;
+    unsigned int seed;
+};
+
+
+int generator_parse_kind(const char *kind);
+
+struct generator* generator_new(int kind, const char *size_spec, unsigned int seed);
+struct generator* generator_delete(struct generator *self);
+
+const void* generator_next(struct generator *self, size_t *len);
+void generator_unget(struct generator *self);
+
+
+#endif /* __BOMBUS_GENERATOR_H_ */
@@ -0,0 +1,165 @@
+
+#include "histogram.h"
+
+#include "mx/memory.h"
+
+#include <string.h>
+
+
+
+
+
+static size_t histogram_index(const struct histogram *self, uint64_t value)
+{
+    uint64_t sub_bucket_mask = (1ULL << self->sub_bucket_bits) - 1;
+    unsigned int half_bits = self->sub_bucket_bits - 1;
+
+    unsigned int pow2ceiling = 64 - __builtin_clzll(value | sub_bucket_mask);
+    unsigned int bucket = pow2ceiling - self->sub_bucket_bits;
+    uint64_t sub_bucket = value >> bucket;
+
+    return ((size_t)(bucket + 1) << half_bits) + (sub_bucket - (1ULL << half_bits));
+}
+
+
+static uint64_t histogram_value(const struct histogram *self, size_t index)
+{
+    unsigned int half_bits = self->sub_bucket_bits - 1;
+    uint64_t half = 1ULL << half_bits;
+
+    int bucket = (int)(index >> half_bits) - 1;
+    uint64_t sub_bucket = (index & (half - 1)) + half;
+    if (bucket < 0) {
+        sub_bucket -= half;
+        bucket = 0;
+    }
+
+    // Highest value equivalent to given index
+    return (sub_bucket << bucket) + (1ULL << bucket) - 1;
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct histogram* histogram_new(uint64_t highest_value, unsigned int significant_bits)
+{
+    struct histogram *self = xmalloc(sizeof(struct histogram));
+    histogram_init(self, highest_value, significant_bits);
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct histogram* histogram_delete(struct histogram *self)
+{
+    histogram_clean(self);
+    return xfree(self);
+}
+
+
+/**
+ * Initialize histogram.
+ *
+ * Number of significant bits determines precision, e.g. 11 bits gives
+ * relative error below 0.1%.
+ *
+ */
+void histogram_init(struct histogram *self, uint64_t highest_value, unsigned int significant_bits)
+{
+    if (significant_bits < 2)
+        significant_bits = 2;
+    if (significant_bits > 20)
+        significant_bits = 20;
+
+    self->sub_bucket_bits = significant_bits;
+    self->highest_value = highest_value;
+
+    self->counts_len = histogram_index(self, highest_value) + 1;
+    self->counts = xmalloc(self->counts_len * sizeof(uint64_t));
+
+    histogram_reset(self);
+}
+
+
+void histogram_clean(struct histogram *self)
+{
+    if (self->counts)
+        self->counts = xfree(self->counts);
+    self->counts_len = 0;
+}
+
+
+void histogram_reset(struct histogram *self)
+{
+    memset(self->counts, 0, self->counts_len * sizeof(uint64_t));
+    self->total = 0;
+    self->min = UINT64_MAX;
+    self->max = 0;
+}
+
+
+void histogram_record(struct histogram *self, uint64_t value)
+{
+    if (value > self->highest_value)
+        value = self->highest_value;    // Saturate, max still counts
+
+    self->counts[histogram_index(self, value)]++;
+    self->total++;
+
+    if (value < self->min)
+        self->min = value;
+    if (value > self->max)
+        self->max = value;
+}
+
+
+/**
+ * Add other histogram counts.
+ *
+ * Both histograms must be initialized with the same parameters.
+ *
+ */
+void histogram_merge(struct histogram *self, const struct histogram *other)
+{
+    for (size_t i=0; i<self->counts_len && i<other->counts_len; i++)
+        self->counts[i] += other->counts[i];
+
+    self->total += other->total;
+    if (other->min < self->min)
+        self->min = other->min;
+    if (other->max > self->max)
+        self->max = other->max;
+}
+
+
+uint64_t histogram_percentile(const struct histogram *self, double percentile)
+{
+    if (self->total == 0)
+        return 0;
+
+    if (percentile >= 100.0)
+        return self->max;
+
+    uint64_t count_at_percentile = (uint64_t)(percentile * self->total / 100.0 + 0.5);
+    if (count_at_percentile == 0)
+        count_at_percentile = 1;
+
+    uint64_t count = 0;
+    for (size_t i=0; i<self->counts_len; i++) {
+        count += self->counts[i];
+        if (count >= count_at_percentile) {
+            uint64_t value = histogram_value(self, i);
+            return value < self->max ? value : self->max;
+        }
+    }
+
+    return self->max;
+}
@@ -0,0 +1,43 @@
+
+#ifndef __BOMBUS_HISTOGRAM_H_
+#define __BOMBUS_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+/**
+ * High dynamic range histogram.
+ *
+ * Values are grouped into power of two buckets, every bucket is split into
+ * linear sub-buckets, so relative error is constant over the whole range.
+ *
+ */
+struct histogram
+{
+    uint64_t *counts;
+    size_t counts_len;
+
+    unsigned int sub_bucket_bits;
+    uint64_t highest_value;
+
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+
+struct histogram* histogram_new(uint64_t highest_value, unsigned int significant_bits);
+struct histogram* histogram_delete(struct histogram *self);
+
+void histogram_init(struct histogram *self, uint64_t highest_value, unsigned int significant_bits);
+void histogram_clean(struct histogram *self);
+void histogram_reset(struct histogram *self);
+
+void histogram_record(struct histogram *self, uint64_t value);
+void histogram_merge(struct histogram *self, const struct histogram *other);
+uint64_t histogram_percentile(const struct histogram *self, double percentile);
+
+
+#endif /* __BOMBUS_HISTOGRAM_H_ */
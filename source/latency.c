@@ -0,0 +1,254 @@
+
+#include "latency.h"
+#include "utils.h"
+
+#include "bombus/client.h"
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+#define LATENCY_MAGIC               0x424d4253      // "BMBS"
+#define LATENCY_HIGHEST_NS          60000000000ULL  // 60 s
+#define LATENCY_SIGNIFICANT_BITS    11
+
+
+struct latency_header
+{
+    uint32_t magic;
+    uint32_t client;
+    uint64_t seq;
+    uint64_t send_ns;
+};
+
+
+
+
+
+static bool latency_publish(struct latency *self, struct bombus *bombus, unsigned int idx)
+{
+    struct latency_client *client = &self->clients[idx];
+
+    struct latency_header header = {
+        .magic = LATENCY_MAGIC,
+        .client = self->first + idx,
+        .seq = client->seq,
+        .send_ns = monotonic_time_ns(),
+    };
+    memcpy(self->payload, &header, sizeof(header));
+
+    char topic[strlen(self->topic) + 12];
+    snprintf(topic, sizeof(topic), "%s/%u", self->topic, self->first + idx);
+
+    if (!bombus_publish(bombus, topic, self->qos, false, self->payload, self->payload_size))
+        return false;   // In-flight window full
+
+    client->seq++;
+    client->outstanding++;
+    self->sent++;
+    return true;
+}
+
+
+static void latency_print(struct latency *self, const char *label, struct histogram *histogram, uint64_t received, uint64_t elapsed_ns)
+{
+    double rate = elapsed_ns ? (double)received * 1000000000.0 / elapsed_ns : 0;
+
+    // Standard output may carry received messages
+    BOMBUS_INFO("%s: %" PRIu64 " msgs %.0f msg/s, latency us p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f, sent %" PRIu64 " lost %" PRIu64,
+                label, received, rate,
+                histogram_percentile(histogram, 50.0) / 1000.0,
+                histogram_percentile(histogram, 90.0) / 1000.0,
+                histogram_percentile(histogram, 99.0) / 1000.0,
+                histogram_percentile(histogram, 99.9) / 1000.0,
+                histogram_percentile(histogram, 100.0) / 1000.0,
+                self->sent, self->lost);
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct latency* latency_new(const char *topic, unsigned char qos, size_t payload_size, unsigned int window, unsigned int interval_s,
+                            unsigned int first, unsigned int clients_num)
+{
+    struct latency *self = xmalloc(sizeof(struct latency));
+
+    self->topic = xstrdup(topic);
+    self->qos = qos;
+    self->payload_size = payload_size > sizeof(struct latency_header) ? payload_size : sizeof(struct latency_header);
+    self->window = window > 0 ? window : 1;
+
+    self->first = first;
+    self->clients_num = clients_num;
+    self->clients = xmalloc(clients_num * sizeof(struct latency_client));
+    memset(self->clients, 0, clients_num * sizeof(struct latency_client));
+
+    histogram_init(&self->interval_histogram, LATENCY_HIGHEST_NS, LATENCY_SIGNIFICANT_BITS);
+    histogram_init(&self->histogram, LATENCY_HIGHEST_NS, LATENCY_SIGNIFICANT_BITS);
+
+    self->start_ns = monotonic_time_ns();
+    self->report_ns = self->start_ns;
+    self->interval_ns = (uint64_t)(interval_s > 0 ? interval_s : 1) * 1000000000;
+
+    self->sent = 0;
+    self->received = 0;
+    self->lost = 0;
+    self->interval_received = 0;
+
+    self->payload = xmalloc(self->payload_size);
+    memset(self->payload, 'x', self->payload_size);
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct latency* latency_delete(struct latency *self)
+{
+    histogram_clean(&self->interval_histogram);
+    histogram_clean(&self->histogram);
+
+    xfree(self->clients);
+    xfree(self->payload);
+    xfree(self->topic);
+
+    return xfree(self);
+}
+
+
+/**
+ * Subscribe benchmark topic and fill publish window.
+ *
+ * Should be called after every successful connection.
+ *
+ */
+void latency_start_client(struct latency *self, struct bombus *bombus, unsigned int idx)
+{
+    struct latency_client *client = &self->clients[idx];
+
+    char topic[strlen(self->topic) + 12];
+    snprintf(topic, sizeof(topic), "%s/%u", self->topic, self->first + idx);
+    bombus_subscribe(bombus, topic, self->qos);
+
+    client->outstanding = 0;
+    client->last_rx_ns = monotonic_time_ns();
+    client->started = true;
+    while (client->outstanding < self->window)
+        if (!latency_publish(self, bombus, idx))
+            break;
+}
+
+
+void latency_handle_msg(struct latency *self, struct bombus *bombus, unsigned int idx, const void *payload, size_t payload_len)
+{
+    struct latency_header header;
+
+    if (payload_len < sizeof(header))
+        return;
+
+    memcpy(&header, payload, sizeof(header));
+    if (header.magic != LATENCY_MAGIC || header.client != self->first + idx)
+        return;     // Not a benchmark message
+
+    uint64_t now = monotonic_time_ns();
+    uint64_t rtt = now - header.send_ns;
+    histogram_record(&self->interval_histogram, rtt);
+    histogram_record(&self->histogram, rtt);
+    self->received++;
+    self->interval_received++;
+
+    struct latency_client *client = &self->clients[idx];
+    if (header.seq > client->expected_seq)
+        self->lost += header.seq - client->expected_seq;
+    if (header.seq >= client->expected_seq)
+        client->expected_seq = header.seq + 1;
+    client->last_rx_ns = now;
+
+    if (client->outstanding > 0)
+        client->outstanding--;
+    if (bombus_is_connected(bombus)) {
+        while (client->outstanding < self->window)
+            if (!latency_publish(self, bombus, idx))
+                break;
+    }
+}
+
+
+/**
+ * Refill window of stalled client.
+ *
+ * Messages sent before subscription was confirmed are never delivered, window
+ * is refilled when client did not receive anything for whole interval.
+ *
+ */
+void latency_check_client(struct latency *self, struct bombus *bombus, unsigned int idx)
+{
+    struct latency_client *client = &self->clients[idx];
+    if (!client->started || !bombus_is_connected(bombus))
+        return;
+
+    uint64_t now = monotonic_time_ns();
+    if (now - client->last_rx_ns >= self->interval_ns) {
+        client->outstanding = 0;
+        client->last_rx_ns = now;
+        while (client->outstanding < self->window)
+            if (!latency_publish(self, bombus, idx))
+                break;
+    }
+}
+
+
+/**
+ * Print interval statistics when due.
+ *
+ */
+void latency_handle_time(struct latency *self)
+{
+    if (monotonic_time_ns() - self->report_ns >= self->interval_ns)
+        latency_report(self, false);
+}
+
+
+void latency_report(struct latency *self, bool final)
+{
+    uint64_t now = monotonic_time_ns();
+
+    if (final) {
+        latency_print(self, "total", &self->histogram, self->received, now - self->start_ns);
+    }
+    else {
+        latency_print(self, "interval", &self->interval_histogram, self->interval_received, now - self->report_ns);
+        histogram_reset(&self->interval_histogram);
+        self->interval_received = 0;
+        self->report_ns = now;
+    }
+}
+
+
+/**
+ * Add other benchmark results, e.g. from other thread.
+ *
+ */
+void latency_merge(struct latency *self, const struct latency *other)
+{
+    histogram_merge(&self->histogram, &other->histogram);
+
+    self->sent += other->sent;
+    self->received += other->received;
+    self->lost += other->lost;
+    if (other->start_ns < self->start_ns)
+        self->start_ns = other->start_ns;
+}
@@ -0,0 +1,71 @@
+
+#ifndef __BOMBUS_LATENCY_H_
+#define __BOMBUS_LATENCY_H_
+
+#include "histogram.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+struct bombus;
+
+
+struct latency_client
+{
+    uint64_t seq;
+    uint64_t expected_seq;
+    uint64_t last_rx_ns;
+    unsigned int outstanding;
+    bool started;
+};
+
+
+/**
+ * End-to-end publish to receive latency benchmark.
+ *
+ * Every client publishes timestamped messages on its own topic, receives them
+ * back through subscription and keeps constant number of messages in flight.
+ *
+ */
+struct latency
+{
+    char *topic;
+    unsigned char qos;
+    size_t payload_size;
+    unsigned int window;
+
+    struct latency_client *clients;
+    unsigned int first;         // Number of first client, topics use global numbers
+    unsigned int clients_num;
+
+    struct histogram interval_histogram;
+    struct histogram histogram;
+
+    uint64_t start_ns;
+    uint64_t report_ns;
+    uint64_t interval_ns;
+
+    uint64_t sent;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t interval_received;
+
+    unsigned char *payload;
+};
+
+
+struct latency* latency_new(const char *topic, unsigned char qos, size_t payload_size, unsigned int window, unsigned int interval_s,
+                            unsigned int first, unsigned int clients_num);
+struct latency* latency_delete(struct latency *self);
+
+void latency_start_client(struct latency *self, struct bombus *bombus, unsigned int idx);
+void latency_handle_msg(struct latency *self, struct bombus *bombus, unsigned int idx, const void *payload, size_t payload_len);
+void latency_check_client(struct latency *self, struct bombus *bombus, unsigned int idx);
+void latency_handle_time(struct latency *self);
+void latency_report(struct latency *self, bool final);
+void latency_merge(struct latency *self, const struct latency *other);
+
+
+#endif /* __BOMBUS_LATENCY_H_ */
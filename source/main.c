@@ -1,26 +1,23 @@
 
 #include "args.h"
 #include "utils.h"
+#include "app.h"
+#include "worker.h"
+#include "latency.h"
+#include "pacer.h"
+#include "stats.h"
+#include "broker.h"
 
 #include "bombus/client.h"
 #include "bombus/log.h"
 
 #include "mx/log.h"
-#include "mx/socket.h"
-#include "mx/string.h"
 #include "mx/memory.h"
 #include "mx/stream.h"
-#include "mx/stream_ssl.h"
-#include "mx/stream_ws.h"
-#include "mx/stream_mqtt.h"
-#include "mx/mqtt.h"
 #include "mx/idler.h"
 #include "mx/misc.h"
-#include "mx/ssl.h"
-#include "mx/url.h"
+#include "mx/string.h"
 #include "mx/timer.h"
-#include "mx/queue.h"
-#include "mx/rand.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -29,317 +26,347 @@
 #include <signal.h>
 #include <errno.h>
 
-//#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 
 
-#define BOMBUS_CONNECTION_TIMEOUT       5000
 
+#define TOPIC_REPORT_MAX    10
 
-static volatile bool alive = true;
 
 
-int app_handle_console(void *object, struct stream *stream);
+static bool alive = true;        // Accessed atomically, cleared by signal handler
 
 
-
-struct app
+/**
+ * Console commands are passed to every application.
+ *
+ */
+struct console
 {
     struct idler *idler;
-    struct bombus *bombus;
-    struct stream *console;
-
-    struct mqtt_msg_list *subscribe_topics;
-    struct mqtt_msg_list *publish_messages;
+    struct stream *stream;
+    struct line_buffer buffer;
 
-    bool retain;
-    bool reconnect;
-    bool alive;
+    struct app *app;
+    struct worker *workers;
+    unsigned int workers_num;
+    struct stats_reporter *reporter;
 };
 
 
-static void app_reconnect_bombus(struct app *self);
-
-
-void app_init(struct app *self)
+static void get_workers_stats(struct worker *workers, unsigned int workers_num, struct stats *total)
 {
-    self->idler = idler_new();
-    self->bombus = NULL;
-
-    self->console = stream_new(STDIN_FILENO);
-    stream_set_observer(self->console, self, app_handle_console);
-    idler_add_stream(self->idler, self->console);
-
-    self->retain = false;
-    self->alive = true;
-    self->reconnect = true;
-    self->subscribe_topics = NULL;
-    self->publish_messages = NULL;
+    stats_reset(total);
+    for (unsigned int i=0; i<workers_num; i++)
+        app_get_stats(&workers[i].app, total);
 }
 
 
-void app_clean(struct app *self)
+static bool command_is(const char *command, size_t command_len, const char *name)
 {
-    idler_remove_stream(self->idler, self->console);
-    stream_delete(self->console);
-    close(STDIN_FILENO);
-
-    if (self->bombus) {
-        bombus_disconnect(self->bombus);
-        bombus_delete(self->bombus);
-    }
-
-    idler_delete(self->idler);
-
-    self->alive = false;
-
-    if (self->subscribe_topics)
-        self->subscribe_topics = mqtt_msg_list_delete(self->subscribe_topics);
-    if (self->publish_messages)
-        self->publish_messages = mqtt_msg_list_delete(self->publish_messages);
+    return command_len == strlen(name) && !strncmp(command, name, command_len);
 }
 
 
-bool app_is_alive(struct app *self)
+static void console_handle_command(void *object, char *command)
 {
-    return self->alive;
-}
-
+    struct console *self = (struct console*)object;
 
-struct idler* app_get_idler(struct app *self)
-{
-    return self->idler;
-}
-
-
-void app_configure(struct app *self, struct args *args)
-{
-    self->bombus = bombus_new(self->idler);
-    bombus_set_mqtt_keep_alive(self->bombus, args->keep_alive);
-    bombus_set_mqtt_client_id(self->bombus, args->client_id);
-
-    bombus_configure_address(self->bombus, args->address, args->port);
-
-//    if (args->ssl) {
-//        bombus_configure_ssl(self->bombus, NULL);
-//    }
-//    if (args->websocket) {
-//        bombus_configure_websocket(self->bombus, NULL);
-//    }
-
-    if (args->subscribe_topics) {
-        // Grab subscribe topics for future use
-        self->subscribe_topics = args->subscribe_topics;
-        args->subscribe_topics = NULL;
+    if (self->app) {
+        app_handle_command(self->app, command);
+        return;
     }
 
-    if (args->publish_messages) {
-        // Grab publish messages for future use
-        self->publish_messages = args->publish_messages;
-        args->publish_messages = NULL;
+    size_t command_len = xstr_word_len(command, " \t\n");
+    if (command_is(command, command_len, "quit"))
+        __atomic_store_n(&alive, false, __ATOMIC_RELEASE);
+
+    if (command_is(command, command_len, "stats")) {
+        // Workers snapshots are aggregated here
+        struct stats total;
+        get_workers_stats(self->workers, self->workers_num, &total);
+        stats_print(&total, &self->reporter->prev, monotonic_time_ms() - self->reporter->time);
+        return;
     }
 
-    app_reconnect_bombus(self);
+    for (unsigned int i=0; i<self->workers_num; i++)
+        worker_send_command(&self->workers[i], command);
 }
 
 
-bool app_prepare_tasks(struct app *self)
+static int console_handle_data(void *object, struct stream *stream)
 {
-    if (!bombus_is_connected(self->bombus)) {
-        if (self->reconnect)
-            app_reconnect_bombus(self);
-    }
+    struct console *self = (struct console*)object;
 
-    return true;
+    if (line_buffer_read(&self->buffer, stream, console_handle_command, self) <= 0) {
+        // Console closed, keep running
+        idler_remove_stream(self->idler, stream);
+    }
+    return 1;
 }
 
 
-void app_handle_tasks(struct app *self)
+
+/**
+ * Interrupt quit handler.
+ */
+void quit_request(int sig)
 {
-    struct stream *stream = NULL;
-    unsigned int flags;
-    do {
-        flags = 0;
-        stream = idler_get_next_stream(self->idler, stream, &flags);
-        if (flags & STREAM_OUTGOING_READY)
-            stream_handle_outgoing_data(stream);
-        if (flags & STREAM_INCOMING_READY)
-            stream_handle_incoming_data(stream);
-    } while(stream);
+    UNUSED(sig);
+
+    __atomic_store_n(&alive, false, __ATOMIC_RELEASE);
 }
 
 
-void app_handle_time(struct app *self)
+static void console_init(struct console *self, struct idler *idler)
 {
-    if (self->bombus)
-        bombus_handle_time(self->bombus);
+    self->idler = idler;
+    self->app = NULL;
+    self->workers = NULL;
+    self->workers_num = 0;
+    self->reporter = NULL;
+
+    line_buffer_init(&self->buffer);
+    self->stream = stream_new(STDIN_FILENO);
+    stream_set_observer(self->stream, self, console_handle_data);
+    idler_add_stream(self->idler, self->stream);
 }
 
 
-void app_reconnect_bombus(struct app *self)
+static void console_clean(struct console *self)
 {
-    bool success = bombus_connect(self->bombus, true);
-     if (success)
-         success = bombus_wait_for_connection(self->bombus, BOMBUS_CONNECTION_TIMEOUT);
-     if (success) {
-         struct mqtt_msg_item *item;
-         if (self->subscribe_topics) {
-             LIST_FOREACH(item, self->subscribe_topics, _entry_) {
-                 bombus_subscribe(self->bombus, item->msg.topic, item->msg.qos);
-             }
-         }
-
-         if (self->publish_messages) {
-             LIST_FOREACH(item, self->publish_messages, _entry_) {
-                 bombus_publish(self->bombus, item->msg.topic, item->msg.qos, item->msg.retain, item->msg.payload, item->msg.payload_len);
-             }
-         }
-     }
+    idler_remove_stream(self->idler, self->stream);
+    stream_delete(self->stream);
+    close(STDIN_FILENO);
 }
 
 
-
-
-
-void app_handle_connect(struct app *self, char *params);
-void app_handle_disconnect(struct app *self, char *params);
-void app_handle_subscribe(struct app *self, char *params);
-void app_handle_unsubscribe(struct app *self, char *params);
-void app_handle_publish(struct app *self, char *params);
-
-
-struct command_handler_map {
-    const char *command;
-    void (*handler)(struct app*, char *params);
-};
-
-
-static const struct command_handler_map command_handlers[] = {
-        { "publish",        app_handle_publish},
-        { "subscribe",      app_handle_subscribe},
-        { "unsubscribe",    app_handle_unsubscribe},
-        { "connect",        app_handle_connect},
-        { "disconnect",     app_handle_disconnect},
-        {  NULL,            NULL}
-};
-
-
-
-void app_handle_connect(struct app *self, char *params)
+static int compare_topic_name(const void *a, const void *b)
 {
-    UNUSED(params);
-
-    if (!bombus_is_connected(self->bombus))
-        app_reconnect_bombus(self);
+    return strcmp(((const struct bombus_topic_stats*)a)->topic, ((const struct bombus_topic_stats*)b)->topic);
 }
 
 
-void app_handle_disconnect(struct app *self, char *params)
+static int compare_topic_saved(const void *a, const void *b)
 {
-    UNUSED(params);
-
-    if (bombus_is_connected(self->bombus))
-        bombus_disconnect(self->bombus);
+    long long saved_a = ((const struct bombus_topic_stats*)a)->saved;
+    long long saved_b = ((const struct bombus_topic_stats*)b)->saved;
+    return saved_a < saved_b ? 1 : (saved_a > saved_b ? -1 : 0);
 }
 
 
-void app_handle_subscribe(struct app *self, char *params)
+/**
+ * Log topics with the most net bytes saved by MQTT 5 aliases, summed over
+ * all clients.
+ *
+ */
+static void report_topic_aliases(struct app *apps[], unsigned int apps_num)
 {
-    if (bombus_is_connected(self->bombus)) {
-        struct mqtt_msg_item *item = mqtt_msg_item_from_param(params);
-        if (item) {
-            bombus_subscribe(self->bombus, item->msg.topic, item->msg.qos);
-            struct mqtt_msg_item *found = mqtt_msg_list_find_topic(self->subscribe_topics, item->msg.topic);
-            if (!found) {
-                // Store topic for further use
-                LIST_INSERT_HEAD(self->subscribe_topics, item, _entry_);
-            } else {
-                // Just update qos in already stored topic
-                found->msg.qos = item->msg.qos;
-                mqtt_msg_item_delete(item);
-            }
+    struct bombus_topic_stats *topics = NULL;
+    size_t len = 0;
+
+    for (unsigned int i=0; i<apps_num; i++) {
+        for (unsigned int j=0; j<apps[i]->clients_num; j++) {
+            struct bombus *bombus = apps[i]->clients[j].bombus;
+            unsigned int count = bombus_get_topic_stats(bombus, NULL, 0);
+            if (count == 0)
+                continue;
+            topics = xrealloc(topics, (len + count) * sizeof(struct bombus_topic_stats));
+            len += bombus_get_topic_stats(bombus, &topics[len], count);
+        }
+    }
+    if (len == 0)
+        return;
+
+    qsort(topics, len, sizeof(struct bombus_topic_stats), compare_topic_name);
+    size_t merged = 0;
+    for (size_t i=0; i<len; i++) {
+        if (merged > 0 && !strcmp(topics[merged - 1].topic, topics[i].topic)) {
+            topics[merged - 1].publishes += topics[i].publishes;
+            topics[merged - 1].saved += topics[i].saved;
+        }
+        else {
+            topics[merged++] = topics[i];
         }
     }
+
+    qsort(topics, merged, sizeof(struct bombus_topic_stats), compare_topic_saved);
+    for (size_t i=0; i<merged && i<TOPIC_REPORT_MAX; i++)
+        BOMBUS_INFO("Topic %s published %llu, alias saved %lld B", topics[i].topic, topics[i].publishes, topics[i].saved);
+
+    xfree(topics);
 }
 
 
-void app_handle_unsubscribe(struct app *self, char *params)
+static void report_stats(struct app *apps[], unsigned int apps_num)
 {
-    if (bombus_is_connected(self->bombus)) {
-        struct mqtt_msg_item *item = mqtt_msg_item_from_param(params);
-        if (item) {
-            bombus_unsubscribe(self->bombus, item->msg.topic);
-            struct mqtt_msg_item *found = mqtt_msg_list_find_topic(self->subscribe_topics, item->msg.topic);
-            if (found) {
-                LIST_REMOVE(found, _entry_);
-                mqtt_msg_item_delete(found);
-            }
-            mqtt_msg_item_delete(item);
+    struct latency *total = NULL;
+    struct pacer *pacer = NULL;
+    struct stats stats;
+    stats_reset(&stats);
+
+    for (unsigned int i=0; i<apps_num; i++) {
+        app_update_stats(apps[i]);
+        app_get_stats(apps[i], &stats);
+        if (apps[i]->pacer) {
+            if (!pacer)
+                pacer = apps[i]->pacer;
+            else
+                pacer_merge(pacer, apps[i]->pacer);
         }
+        if (!apps[i]->latency)
+            continue;
+        if (!total)
+            total = apps[i]->latency;
+        else
+            latency_merge(total, apps[i]->latency);
+    }
+
+    if (total)
+        latency_report(total, true);
+    if (pacer)
+        pacer_report(pacer, true);
+    if (stats.qos.published > 0) {
+        BOMBUS_INFO("Clients connected %llu, published %llu, acknowledged %llu, retransmitted %llu, rejected %llu, refused %llu",
+                    stats.connected, stats.qos.published, stats.qos.acknowledged, stats.qos.retransmitted, stats.qos.rejected,
+                    stats.qos.refused);
+    }
+    if (stats.traffic.alias_saved != 0) {
+        BOMBUS_INFO("Topic aliases saved %lld B net", stats.traffic.alias_saved);
+        report_topic_aliases(apps, apps_num);
     }
 }
 
 
-void app_handle_publish(struct app *self, char *params)
+/**
+ * Run all clients in main thread.
+ *
+ */
+static void run_single(struct args *args)
 {
-    if (bombus_is_connected(self->bombus)) {
-        struct mqtt_msg_item *item = mqtt_msg_item_from_param(params);
-        if (item) {
-            bombus_publish(self->bombus, item->msg.topic, item->msg.qos, item->msg.retain, item->msg.payload, item->msg.payload_len);
-            mqtt_msg_item_delete(item);
-        }
+    struct app app;
+    app_init(&app);
+
+    // Standard input may be used as publish source
+    struct console console;
+    if (!args->pub_stdin) {
+        console_init(&console, app_get_idler(&app));
+        console.app = &app;
     }
+
+    app_configure(&app, args, 0, args->clients);
+    app_run(&app, &alive);
+
+    struct app *apps[] = { &app };
+    report_stats(apps, 1);
+
+    if (!args->pub_stdin)
+        console_clean(&console);
+    app_clean(&app);
 }
 
 
-int app_handle_console(void *object, struct stream *console)
+/**
+ * Split clients between worker threads, main thread serves console only.
+ *
+ */
+static void run_workers(struct args *args)
 {
-    struct app *self = (struct app*)object;
+    unsigned int workers_num = args->threads;
+    if (workers_num > args->clients)
+        workers_num = args->clients;
+
+    struct worker *workers = xmalloc(workers_num * sizeof(struct worker));
+    unsigned int first = 0;
+    for (unsigned int i=0; i<workers_num; i++) {
+        unsigned int count = args->clients / workers_num;
+        if (i < args->clients % workers_num)
+            count++;
+
+        worker_init(&workers[i], i, &alive);
+        worker_configure(&workers[i], args, first, count);
+        first += count;
+    }
 
-    char buffer[1024];
-    int bytes = stream_read(console, buffer, sizeof(buffer)-1);
-    buffer[bytes] = '\0';
+    unsigned int started = 0;
+    while (started < workers_num && worker_start(&workers[started]))
+        started++;
 
-    char *command = buffer;
-    size_t command_len = xstr_word_len(command, " \t\n");
-    char *params = xstrltrim(command + command_len);
+    struct stats_reporter reporter;
+    stats_reporter_init(&reporter, args->stats_interval, args->stats_path);
+    bool reporting = args->stats_interval > 0 || args->stats_path;
 
-    if (command_len == 0)
-        return 1;
+    struct idler *idler = idler_new();
+    struct console console;
+    console_init(&console, idler);
+    console.workers = workers;
+    console.workers_num = workers_num;
+    console.reporter = &reporter;
 
-    if (!strncmp(command, "quit", command_len)) {
-        self->alive = false;
-        return 1;
-    }
-
-    const struct command_handler_map *cmd_hndl = command_handlers;
-    while (cmd_hndl->command && cmd_hndl->handler) {
-        if (!strncmp(cmd_hndl->command, command, command_len)) {
-            cmd_hndl->handler(self, params);
+    while (__atomic_load_n(&alive, __ATOMIC_ACQUIRE) && started == workers_num) {
+        int status = idler_wait(idler, 1000);
+        if (status == IDLER_ERROR) {
+            BOMBUS_ERROR("Idler error %d", errno);
             break;
         }
-        cmd_hndl++;
-    }
-
-    return 1;
-}
+        if (status == IDLER_INTERRUPT)
+            break;
+        if (status == IDLER_OPERATION) {
+            struct stream *stream = NULL;
+            unsigned int flags;
+            do {
+                flags = 0;
+                stream = idler_get_next_stream(idler, stream, &flags);
+                if (flags & STREAM_INCOMING_READY)
+                    stream_handle_incoming_data(stream);
+            } while(stream);
+        }
 
+        // Shared library clock has single writer, workers only read it
+        clock_update_sys();
 
+        if (reporting && stats_reporter_is_due(&reporter)) {
+            struct stats total;
+            get_workers_stats(workers, workers_num, &total);
+            stats_reporter_report(&reporter, &total);
+        }
 
+        unsigned int finished = 0;
+        while (finished < workers_num && worker_is_finished(&workers[finished]))
+            finished++;
+        if (finished == workers_num)
+            break;
+    }
+    __atomic_store_n(&alive, false, __ATOMIC_RELEASE);
 
+    struct app *apps[workers_num];
+    for (unsigned int i=0; i<workers_num; i++) {
+        worker_stop(&workers[i]);
+        apps[i] = &workers[i].app;
+    }
+    report_stats(apps, workers_num);
 
+    console_clean(&console);
+    idler_delete(idler);
+    stats_reporter_clean(&reporter);
 
+    for (unsigned int i=0; i<workers_num; i++)
+        worker_clean(&workers[i]);
+    xfree(workers);
+}
 
 
 /**
- * Interrupt quit handler.
+ * Serve local clients until interrupted.
+ *
  */
-void quit_request(int sig)
+static void run_broker(struct args *args)
 {
-    UNUSED(sig);
+    struct broker *broker = broker_new();
 
-    alive = false;
+    if (broker_listen(broker, args->address, args->port))
+        broker_run(broker, &alive);
+
+    broker_delete(broker);
 }
 
 
@@ -362,31 +389,18 @@ int main(int argc, char *argv[])
         return retval;
     }
 
-    struct app app;
-    app_init(&app);
-    app_configure(&app, &args);
+    if (args.threads > 1 && (args.pub_stdin || args.pub_file))
+        BOMBUS_WARN("Pipe publishing runs in single thread");
+    if (args.threads > 1 && args.upload)
+        BOMBUS_WARN("Upload runs in single thread");
 
-    while (alive && app_is_alive(&app)) {
-        if (!app_prepare_tasks(&app)) {
-            continue;
-        }
-        int status = idler_wait(app_get_idler(&app), 1000);
-        if (status == IDLER_ERROR) {
-            BOMBUS_ERROR("Idler error %d", errno);
-            break;
-        }
-        if (status == IDLER_INTERRUPT) {
-            BOMBUS_WARN("Interrupt");
-            break;
-        }
-        if (status == IDLER_OPERATION) {
-            app_handle_tasks(&app);
-        }
-        clock_update_sys();
-        app_handle_time(&app);
-    }
+    if (args.broker)
+        run_broker(&args);
+    else if (args.threads > 1 && args.clients > 1 && !args.pub_stdin && !args.pub_file && !args.upload)
+        run_workers(&args);
+    else
+        run_single(&args);
 
-    app_clean(&app);
     args_clean(&args);
 
     return 0;
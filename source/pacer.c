@@ -0,0 +1,237 @@
+
+#include "pacer.h"
+#include "utils.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+
+#include <string.h>
+
+
+#define PACER_REPORT_INTERVAL_NS    10000000000ULL      // 10 s
+#define PACER_LATE_THRESHOLD        100                 // Late tokens allowed per 10000 sent
+#define NSEC_PER_SEC                1000000000ULL
+
+
+
+
+
+/**
+ * Add tokens accrued since last refill.
+ *
+ */
+static void pacer_refill(struct pacer *self, uint64_t now)
+{
+    if (self->due_ns && now > self->due_ns && now - self->due_ns > self->max_lag_ns)
+        self->max_lag_ns = now - self->due_ns;
+
+    self->tokens += (double)(now - self->time_ns) * self->rate / NSEC_PER_SEC;
+    self->time_ns = now;
+
+    if (self->tokens > self->burst) {
+        unsigned long long lost = (unsigned long long)(self->tokens - self->burst);
+        if (self->blocked)
+            self->dropped += lost;
+        else
+            self->late += lost;
+        self->tokens = self->burst;
+    }
+}
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct pacer* pacer_new(unsigned int rate, unsigned int burst, unsigned long long count, unsigned int duration_s)
+{
+    struct pacer *self = xmalloc(sizeof(struct pacer));
+    memset(self, 0, sizeof(struct pacer));
+
+    self->rate = rate;
+    self->burst = burst;
+    if (self->burst == 0) {
+        // Ten milliseconds worth of messages absorbs wakeup jitter
+        self->burst = rate / 100;
+        if (self->burst == 0)
+            self->burst = 1;
+    }
+    self->count = count;
+    self->duration_ns = (uint64_t)duration_s * NSEC_PER_SEC;
+    self->interval_ns = PACER_REPORT_INTERVAL_NS;
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct pacer* pacer_delete(struct pacer *self)
+{
+    return xfree(self);
+}
+
+
+/**
+ * Start pacing, bucket starts with single token.
+ *
+ */
+void pacer_start(struct pacer *self)
+{
+    uint64_t now = monotonic_time_ns();
+
+    self->started = true;
+    self->tokens = 1;
+    self->time_ns = now;
+    self->due_ns = 0;
+    self->start_ns = now;
+    self->finish_ns = now;
+    self->report_ns = now;
+}
+
+
+bool pacer_is_started(struct pacer *self)
+{
+    return self->started;
+}
+
+
+bool pacer_is_done(struct pacer *self)
+{
+    if (!self->started)
+        return false;
+    if (self->count > 0 && self->sent >= self->count)
+        return true;
+    if (self->duration_ns > 0 && self->time_ns - self->start_ns >= self->duration_ns)
+        return true;
+    return false;
+}
+
+
+/**
+ * Get number of messages allowed now.
+ *
+ */
+unsigned int pacer_acquire(struct pacer *self)
+{
+    if (!self->started || pacer_is_done(self))
+        return 0;
+
+    pacer_refill(self, monotonic_time_ns());
+    if (pacer_is_done(self))
+        return 0;
+
+    unsigned long long allowed = (unsigned long long)self->tokens;
+    if (self->count > 0 && allowed > self->count - self->sent)
+        allowed = self->count - self->sent;
+    return (unsigned int)allowed;
+}
+
+
+/**
+ * Take tokens of published messages.
+ *
+ * Blocked means clients refused further messages.
+ *
+ */
+void pacer_consume(struct pacer *self, unsigned int sent, bool blocked)
+{
+    self->tokens -= sent;
+    self->sent += sent;
+    self->blocked = blocked;
+    if (blocked)
+        self->blocks++;
+    if (sent > 0)
+        self->finish_ns = self->time_ns;
+}
+
+
+/**
+ * Get time next token is available.
+ *
+ */
+uint64_t pacer_next_ns(struct pacer *self)
+{
+    if (self->tokens >= 1)
+        self->due_ns = self->time_ns;
+    else
+        self->due_ns = self->time_ns + (uint64_t)((1 - self->tokens) * NSEC_PER_SEC / self->rate) + 1;
+    return self->due_ns;
+}
+
+
+/**
+ * Print interval statistics when due.
+ *
+ */
+void pacer_handle_time(struct pacer *self)
+{
+    if (self->started && monotonic_time_ns() - self->report_ns >= self->interval_ns)
+        pacer_report(self, false);
+}
+
+
+void pacer_report(struct pacer *self, bool final)
+{
+    uint64_t now = monotonic_time_ns();
+
+    if (!self->started)
+        return;
+
+    if (!final) {
+        uint64_t elapsed = now - self->report_ns;
+        double achieved = elapsed ? (double)(self->sent - self->report_sent) * NSEC_PER_SEC / elapsed : 0;
+        BOMBUS_INFO("rate interval: target %u msg/s, achieved %.0f msg/s, sent %llu", self->rate, achieved, self->sent - self->report_sent);
+        self->report_sent = self->sent;
+        self->report_ns = now;
+        return;
+    }
+
+    uint64_t elapsed = self->finish_ns - self->start_ns;
+    double achieved = elapsed ? (double)self->sent * NSEC_PER_SEC / elapsed : 0;
+    BOMBUS_INFO("rate total: target %u msg/s, achieved %.0f msg/s, sent %llu in %.3f s, late %llu, blocked %llu times, max lag %.1f ms",
+                self->rate, achieved, self->sent, elapsed / 1e9, self->late, self->blocks, self->max_lag_ns / 1e6);
+
+    if (self->late * 10000 > self->sent * PACER_LATE_THRESHOLD)
+        BOMBUS_WARN("Publisher is the bottleneck, %llu messages missed due to late wakeups", self->late);
+    if (self->dropped > 0)
+        BOMBUS_WARN("Broker or network is the bottleneck, %llu messages missed while clients were blocked", self->dropped);
+}
+
+
+/**
+ * Add pacing results, e.g. from other thread.
+ *
+ */
+void pacer_merge(struct pacer *self, const struct pacer *other)
+{
+    unsigned int rate = self->rate + other->rate;
+
+    if (!other->started) {
+        self->rate = rate;
+        return;
+    }
+
+    if (!self->started) {
+        memcpy(self, other, sizeof(struct pacer));
+        self->rate = rate;
+        return;
+    }
+
+    self->rate = rate;
+    self->sent += other->sent;
+    self->late += other->late;
+    self->dropped += other->dropped;
+    self->blocks += other->blocks;
+    if (other->max_lag_ns > self->max_lag_ns)
+        self->max_lag_ns = other->max_lag_ns;
+    if (other->start_ns < self->start_ns)
+        self->start_ns = other->start_ns;
+    if (other->finish_ns > self->finish_ns)
+        self->finish_ns = other->finish_ns;
+}
@@ -0,0 +1,61 @@
+#ifndef __BOMBUS_PACER_H_
+#define __BOMBUS_PACER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/**
+ * Token bucket publish pacing.
+ *
+ * Tokens accrue with nanosecond precision, bucket holds at most burst
+ * tokens. Tokens overflowing the bucket are counted as late when caused by
+ * slow wakeups (publisher is the bottleneck) and as blocked when clients
+ * could not take more messages (broker or network is the bottleneck).
+ *
+ */
+struct pacer
+{
+    unsigned int rate;          // Messages per second
+    unsigned int burst;
+    unsigned long long count;   // Messages to publish, zero for unlimited
+    uint64_t duration_ns;       // Zero for unlimited
+
+    double tokens;
+    uint64_t time_ns;
+    uint64_t due_ns;            // Expected wakeup
+    uint64_t start_ns;
+    uint64_t finish_ns;
+    bool started;
+    bool blocked;
+
+    unsigned long long sent;
+    unsigned long long late;
+    unsigned long long dropped; // Tokens lost while blocked
+    unsigned long long blocks;
+    uint64_t max_lag_ns;
+
+    uint64_t interval_ns;
+    uint64_t report_ns;
+    unsigned long long report_sent;
+};
+
+
+struct pacer* pacer_new(unsigned int rate, unsigned int burst, unsigned long long count, unsigned int duration_s);
+struct pacer* pacer_delete(struct pacer *self);
+
+void pacer_start(struct pacer *self);
+bool pacer_is_started(struct pacer *self);
+bool pacer_is_done(struct pacer *self);
+
+unsigned int pacer_acquire(struct pacer *self);
+void pacer_consume(struct pacer *self, unsigned int sent, bool blocked);
+uint64_t pacer_next_ns(struct pacer *self);
+
+void pacer_handle_time(struct pacer *self);
+void pacer_report(struct pacer *self, bool final);
+void pacer_merge(struct pacer *self, const struct pacer *other);
+
+
+#endif /* __BOMBUS_PACER_H_ */
@@ -0,0 +1,177 @@
+
+#include "pool.h"
+
+#include "mx/memory.h"
+
+#include <string.h>
+
+
+#define POOL_ALIGN              16
+#define POOL_ALIGN_UP(size)     (((size) + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1))
+
+
+
+struct slab
+{
+    struct slab *next;
+    unsigned char data[] __attribute__((aligned(POOL_ALIGN)));
+};
+
+
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    unsigned char data[] __attribute__((aligned(POOL_ALIGN)));
+};
+
+
+
+
+void slab_pool_init(struct slab_pool *self, size_t obj_size, unsigned int per_slab)
+{
+    if (obj_size < sizeof(void*))
+        obj_size = sizeof(void*);
+
+    self->obj_size = POOL_ALIGN_UP(obj_size);
+    self->per_slab = per_slab > 0 ? per_slab : 1;
+    self->free_list = NULL;
+    self->slabs = NULL;
+    memset(&self->stats, 0, sizeof(struct pool_stats));
+}
+
+
+void slab_pool_clean(struct slab_pool *self)
+{
+    while (self->slabs) {
+        struct slab *slab = self->slabs;
+        self->slabs = slab->next;
+        xfree(slab);
+    }
+    self->free_list = NULL;
+}
+
+
+static void slab_pool_grow(struct slab_pool *self)
+{
+    struct slab *slab = xmalloc(sizeof(struct slab) + self->obj_size * self->per_slab);
+    slab->next = self->slabs;
+    self->slabs = slab;
+    self->stats.heap_allocs++;
+
+    // Free list is threaded through unused objects
+    for (unsigned int i=self->per_slab; i>0; i--) {
+        void **obj = (void**)(slab->data + (i - 1) * self->obj_size);
+        *obj = self->free_list;
+        self->free_list = obj;
+    }
+}
+
+
+void* slab_pool_alloc(struct slab_pool *self)
+{
+    if (!self->free_list)
+        slab_pool_grow(self);
+
+    void **obj = (void**)self->free_list;
+    self->free_list = *obj;
+    self->stats.allocs++;
+    return obj;
+}
+
+
+void slab_pool_free(struct slab_pool *self, void *obj)
+{
+    if (!obj)
+        return;
+
+    *(void**)obj = self->free_list;
+    self->free_list = obj;
+    self->stats.frees++;
+}
+
+
+
+
+static struct arena_chunk* arena_chunk_new(struct arena *self, size_t size, struct arena_chunk *next)
+{
+    struct arena_chunk *chunk = xmalloc(sizeof(struct arena_chunk) + size);
+    chunk->next = next;
+    chunk->size = size;
+    self->stats.heap_allocs++;
+    return chunk;
+}
+
+
+void arena_init(struct arena *self, size_t chunk_size)
+{
+    self->chunk_size = chunk_size;
+    self->chunks = NULL;
+    self->pos = 0;
+    self->used = 0;
+    memset(&self->stats, 0, sizeof(struct pool_stats));
+}
+
+
+void arena_clean(struct arena *self)
+{
+    while (self->chunks) {
+        struct arena_chunk *chunk = self->chunks;
+        self->chunks = chunk->next;
+        xfree(chunk);
+    }
+    self->pos = 0;
+}
+
+
+/**
+ * Release all allocations.
+ *
+ */
+void arena_reset(struct arena *self)
+{
+    self->stats.frees += self->used;
+    self->used = 0;
+    self->pos = 0;
+
+    if (!self->chunks || !self->chunks->next)
+        return;
+
+    // Replace overflowed chunks with single one big enough for all of them
+    size_t size = 0;
+    while (self->chunks) {
+        struct arena_chunk *chunk = self->chunks;
+        self->chunks = chunk->next;
+        size += chunk->size;
+        xfree(chunk);
+    }
+    self->chunk_size = size;
+    self->chunks = arena_chunk_new(self, size, NULL);
+}
+
+
+void* arena_alloc(struct arena *self, size_t size)
+{
+    size = POOL_ALIGN_UP(size);
+
+    if (!self->chunks || self->pos + size > self->chunks->size) {
+        size_t chunk_size = size > self->chunk_size ? size : self->chunk_size;
+        self->chunks = arena_chunk_new(self, chunk_size, self->chunks);
+        self->pos = 0;
+    }
+
+    void *data = self->chunks->data + self->pos;
+    self->pos += size;
+    self->used++;
+    self->stats.allocs++;
+    return data;
+}
+
+
+char* arena_strndup(struct arena *self, const char *str, size_t len)
+{
+    char *dup = arena_alloc(self, len + 1);
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
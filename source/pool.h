@@ -0,0 +1,79 @@
+#ifndef __BOMBUS_POOL_H_
+#define __BOMBUS_POOL_H_
+
+#include <stddef.h>
+
+
+
+/**
+ * Allocation counters, heap_allocs stays constant in steady state.
+ *
+ */
+struct pool_stats
+{
+    unsigned long long allocs;
+    unsigned long long frees;
+    unsigned long long heap_allocs;
+};
+
+
+struct slab;
+
+
+/**
+ * Fixed size objects carved from slabs.
+ *
+ * Freed objects are kept on free list for reuse, slabs are released
+ * only when pool is cleaned.
+ *
+ */
+struct slab_pool
+{
+    size_t obj_size;
+    unsigned int per_slab;
+
+    void *free_list;
+    struct slab *slabs;
+
+    struct pool_stats stats;
+};
+
+
+void slab_pool_init(struct slab_pool *self, size_t obj_size, unsigned int per_slab);
+void slab_pool_clean(struct slab_pool *self);
+
+void* slab_pool_alloc(struct slab_pool *self);
+void slab_pool_free(struct slab_pool *self, void *obj);
+
+
+
+struct arena_chunk;
+
+
+/**
+ * Bump allocator for short living data.
+ *
+ * All allocations are released at once by arena_reset(). When data did not
+ * fit into single chunk, chunks are merged into bigger one on reset.
+ *
+ */
+struct arena
+{
+    size_t chunk_size;
+    struct arena_chunk *chunks;
+    size_t pos;
+
+    unsigned long long used;    // Allocations since last reset
+    struct pool_stats stats;
+};
+
+
+void arena_init(struct arena *self, size_t chunk_size);
+void arena_clean(struct arena *self);
+void arena_reset(struct arena *self);
+
+void* arena_alloc(struct arena *self, size_t size);
+char* arena_strndup(struct arena *self, const char *str, size_t len);
+
+
+#endif /* __BOMBUS_POOL_H_ */
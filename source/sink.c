@@ -0,0 +1,337 @@
+
+#include "sink.h"
+#include "utils.h"
+
+#include "bombus/client.h"
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+
+
+// Sinks of all threads may share output, records are never split between writes
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char hex_chars[] = "0123456789abcdef";
+
+
+
+
+static void sink_write_all(struct sink *self, const void *data, size_t len)
+{
+    const unsigned char *ptr = data;
+    while (len > 0) {
+        ssize_t bytes = write(self->fd, ptr, len);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            BOMBUS_ERROR("Output write error %d", errno);
+            return;
+        }
+        ptr += bytes;
+        len -= bytes;
+    }
+}
+
+
+static size_t base64_encode(unsigned char *out, const unsigned char *data, size_t len)
+{
+    unsigned char *ptr = out;
+    size_t i = 0;
+    for (; i + 2 < len; i += 3) {
+        uint32_t val = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+        *ptr++ = base64_chars[(val >> 18) & 0x3f];
+        *ptr++ = base64_chars[(val >> 12) & 0x3f];
+        *ptr++ = base64_chars[(val >> 6) & 0x3f];
+        *ptr++ = base64_chars[val & 0x3f];
+    }
+    if (i < len) {
+        uint32_t val = data[i] << 16;
+        if (i + 1 < len)
+            val |= data[i+1] << 8;
+        *ptr++ = base64_chars[(val >> 18) & 0x3f];
+        *ptr++ = base64_chars[(val >> 12) & 0x3f];
+        *ptr++ = (i + 1 < len) ? base64_chars[(val >> 6) & 0x3f] : '=';
+        *ptr++ = '=';
+    }
+    return ptr - out;
+}
+
+
+/**
+ * Check if data is valid UTF-8 text.
+ *
+ */
+static bool is_text(const unsigned char *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = data[i];
+        size_t follow;
+        if (c < 0x80) {
+            if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+                return false;
+            i++;
+            continue;
+        }
+        else if ((c & 0xe0) == 0xc0 && c >= 0xc2) {
+            follow = 1;
+        }
+        else if ((c & 0xf0) == 0xe0) {
+            follow = 2;
+        }
+        else if ((c & 0xf8) == 0xf0 && c <= 0xf4) {
+            follow = 3;
+        }
+        else {
+            return false;
+        }
+        if (i + follow >= len)
+            return false;
+        for (size_t n=1; n<=follow; n++) {
+            if ((data[i+n] & 0xc0) != 0x80)
+                return false;
+        }
+        i += follow + 1;
+    }
+    return true;
+}
+
+
+static size_t json_escape(unsigned char *out, const unsigned char *data, size_t len)
+{
+    unsigned char *ptr = out;
+    for (size_t i=0; i<len; i++) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            *ptr++ = '\\';
+            *ptr++ = c;
+        }
+        else if (c < 0x20) {
+            memcpy(ptr, "\\u00", 4);
+            ptr[4] = hex_chars[c >> 4];
+            ptr[5] = hex_chars[c & 0xf];
+            ptr += 6;
+        }
+        else {
+            *ptr++ = c;
+        }
+    }
+    return ptr - out;
+}
+
+
+/**
+ * Get space for record of given max size.
+ *
+ * Returns NULL when record does not fit into empty buffer.
+ *
+ */
+static unsigned char* sink_reserve(struct sink *self, size_t len)
+{
+    if (self->len + len > self->size)
+        sink_flush(self, true);
+    if (len > self->size)
+        return NULL;
+    return self->buffer + self->len;
+}
+
+
+static size_t sink_format_json(unsigned char *out, unsigned int client, const struct bombus_msg *msg)
+{
+    unsigned char *ptr = out;
+    const unsigned char *payload = msg->payload;
+
+    ptr += sprintf((char*)ptr, "{\"client\":%u,\"topic\":\"", client);
+    ptr += json_escape(ptr, (const unsigned char*)msg->topic, msg->topic_len);
+    ptr += sprintf((char*)ptr, "\",\"qos\":%u,\"retain\":%s,", msg->qos, msg->retain ? "true" : "false");
+    if (is_text(payload, msg->payload_len)) {
+        memcpy(ptr, "\"payload\":\"", 11);
+        ptr += 11;
+        ptr += json_escape(ptr, payload, msg->payload_len);
+    }
+    else {
+        memcpy(ptr, "\"payload_base64\":\"", 18);
+        ptr += 18;
+        ptr += base64_encode(ptr, payload, msg->payload_len);
+    }
+    memcpy(ptr, "\"}\n", 3);
+    ptr += 3;
+
+    return ptr - out;
+}
+
+
+static size_t sink_format_length(unsigned char *out, const struct bombus_msg *msg)
+{
+    unsigned char *ptr = out;
+
+    *ptr++ = (msg->topic_len >> 8) & 0xff;
+    *ptr++ = msg->topic_len & 0xff;
+    memcpy(ptr, msg->topic, msg->topic_len);
+    ptr += msg->topic_len;
+    *ptr++ = (msg->payload_len >> 24) & 0xff;
+    *ptr++ = (msg->payload_len >> 16) & 0xff;
+    *ptr++ = (msg->payload_len >> 8) & 0xff;
+    *ptr++ = msg->payload_len & 0xff;
+    memcpy(ptr, msg->payload, msg->payload_len);
+    ptr += msg->payload_len;
+
+    return ptr - out;
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ * Path NULL or "-" stands for standard output.
+ *
+ */
+struct sink* sink_new(const char *path, int format, size_t size, unsigned int flush_ms)
+{
+    int fd = STDOUT_FILENO;
+    bool owned = false;
+
+    if (path && strcmp(path, "-")) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            BOMBUS_ERROR("Cannot open output %s, error %d", path, errno);
+            return NULL;
+        }
+        owned = true;
+    }
+
+    struct sink *self = xmalloc(sizeof(struct sink));
+    self->fd = fd;
+    self->owned = owned;
+    self->format = format;
+    self->buffer = xmalloc(size);
+    self->size = size;
+    self->len = 0;
+    self->flush_ms = flush_ms;
+    self->flush_time = monotonic_time_ms();
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct sink* sink_delete(struct sink *self)
+{
+    sink_flush(self, true);
+    if (self->owned)
+        close(self->fd);
+
+    xfree(self->buffer);
+    return xfree(self);
+}
+
+
+void sink_write(struct sink *self, unsigned int client, const struct bombus_msg *msg)
+{
+    size_t max_len;
+    size_t len;
+    unsigned char *ptr;
+
+    switch (self->format) {
+    case SINK_FORMAT_RAW:
+        max_len = msg->payload_len + 1;
+        ptr = sink_reserve(self, max_len);
+        if (!ptr) {
+            pthread_mutex_lock(&sink_lock);
+            sink_write_all(self, msg->payload, msg->payload_len);
+            sink_write_all(self, "\n", 1);
+            pthread_mutex_unlock(&sink_lock);
+            break;
+        }
+        memcpy(ptr, msg->payload, msg->payload_len);
+        ptr[msg->payload_len] = '\n';
+        self->len += max_len;
+        break;
+
+    case SINK_FORMAT_JSON:
+        // Escaped text takes up to 6 bytes per byte, base64 less
+        max_len = 128 + msg->topic_len * 6 + msg->payload_len * 6;
+        ptr = sink_reserve(self, max_len);
+        if (!ptr) {
+            unsigned char *tmp = xmalloc(max_len);
+            len = sink_format_json(tmp, client, msg);
+            pthread_mutex_lock(&sink_lock);
+            sink_write_all(self, tmp, len);
+            pthread_mutex_unlock(&sink_lock);
+            xfree(tmp);
+            break;
+        }
+        self->len += sink_format_json(ptr, client, msg);
+        break;
+
+    case SINK_FORMAT_LENGTH:
+        max_len = 6 + msg->topic_len + msg->payload_len;
+        ptr = sink_reserve(self, max_len);
+        if (!ptr) {
+            unsigned char *tmp = xmalloc(max_len);
+            len = sink_format_length(tmp, msg);
+            pthread_mutex_lock(&sink_lock);
+            sink_write_all(self, tmp, len);
+            pthread_mutex_unlock(&sink_lock);
+            xfree(tmp);
+            break;
+        }
+        self->len += sink_format_length(ptr, msg);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/**
+ * Write buffered records.
+ *
+ * Without force, data is written only when flush interval elapsed.
+ *
+ */
+void sink_flush(struct sink *self, bool force)
+{
+    if (self->len == 0)
+        return;
+
+    uint64_t now = monotonic_time_ms();
+    if (!force && now - self->flush_time < self->flush_ms)
+        return;
+
+    pthread_mutex_lock(&sink_lock);
+    sink_write_all(self, self->buffer, self->len);
+    pthread_mutex_unlock(&sink_lock);
+
+    self->len = 0;
+    self->flush_time = now;
+}
+
+
+/**
+ * Get time buffered records are due, zero when buffer is empty.
+ *
+ */
+uint64_t sink_get_deadline(struct sink *self)
+{
+    if (self->len == 0)
+        return 0;
+    return self->flush_time + self->flush_ms;
+}
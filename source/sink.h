@@ -0,0 +1,51 @@
+#ifndef __BOMBUS_SINK_H_
+#define __BOMBUS_SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct bombus_msg;
+
+
+enum sink_format_e {
+    SINK_FORMAT_LOG = 0,        // Human readable log, no sink used
+    SINK_FORMAT_RAW,            // Payload followed by newline
+    SINK_FORMAT_JSON,           // One JSON object per line, binary payload in base64
+    SINK_FORMAT_LENGTH,         // Length prefixed topic and payload
+};
+
+
+/**
+ * Buffered output of received messages.
+ *
+ * Messages are formatted directly into user-space buffer, which is written
+ * when it fills up or flush interval elapses.
+ *
+ */
+struct sink
+{
+    int fd;
+    bool owned;
+    int format;
+
+    unsigned char *buffer;
+    size_t size;
+    size_t len;
+
+    unsigned int flush_ms;
+    uint64_t flush_time;
+};
+
+
+struct sink* sink_new(const char *path, int format, size_t size, unsigned int flush_ms);
+struct sink* sink_delete(struct sink *self);
+
+void sink_write(struct sink *self, unsigned int client, const struct bombus_msg *msg);
+void sink_flush(struct sink *self, bool force);
+uint64_t sink_get_deadline(struct sink *self);
+
+
+#endif /* __BOMBUS_SINK_H_ */
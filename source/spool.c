@@ -0,0 +1,403 @@
+
+#include "spool.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define SPOOL_MAGIC             0x4c4f4f53      // "SOOL" little endian
+#define SPOOL_ALIGN(len)        (((len) + 7) & ~(size_t)7)
+
+
+
+struct spool_segment_header
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t write_pos;         // End of committed records
+    uint64_t read_pos;          // Start of first not replayed record
+};
+
+
+struct spool_record
+{
+    uint32_t topic_len;         // Including terminating zero
+    uint32_t payload_len;
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t reserved[6];
+};
+
+
+#define SPOOL_DATA_START        SPOOL_ALIGN(sizeof(struct spool_segment_header))
+
+
+
+
+static size_t spool_record_size(size_t topic_len, size_t payload_len)
+{
+    return SPOOL_ALIGN(sizeof(struct spool_record) + topic_len + payload_len);
+}
+
+
+static char* spool_segment_path(struct spool *self, unsigned int seq)
+{
+    size_t len = strlen(self->path) + 16;
+    char *path = xmalloc(len);
+    snprintf(path, len, "%s-%08u.spool", self->path, seq);
+    return path;
+}
+
+
+static bool spool_segment_open(struct spool *self, struct spool_segment *segment, unsigned int seq, bool create)
+{
+    char *path = spool_segment_path(self, seq);
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (fd < 0) {
+        BOMBUS_ERROR("Cannot open spool segment %s, error %d", path, errno);
+        xfree(path);
+        return false;
+    }
+
+    size_t size = self->segment_size;
+    if (create) {
+        if (ftruncate(fd, size) < 0) {
+            BOMBUS_ERROR("Cannot allocate spool segment %s, error %d", path, errno);
+            goto error;
+        }
+    }
+    else {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < SPOOL_DATA_START) {
+            BOMBUS_ERROR("Invalid spool segment %s", path);
+            goto error;
+        }
+        size = st.st_size;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        BOMBUS_ERROR("Cannot map spool segment %s, error %d", path, errno);
+        goto error;
+    }
+    close(fd);
+
+    segment->seq = seq;
+    segment->mem = mem;
+    segment->size = size;
+    segment->header = mem;
+
+    if (create) {
+        segment->header->magic = SPOOL_MAGIC;
+        segment->header->write_pos = SPOOL_DATA_START;
+        segment->header->read_pos = SPOOL_DATA_START;
+    }
+    else if (segment->header->magic != SPOOL_MAGIC ||
+             segment->header->write_pos > size ||
+             segment->header->read_pos > segment->header->write_pos) {
+        BOMBUS_ERROR("Corrupted spool segment %s", path);
+        munmap(mem, size);
+        segment->mem = NULL;
+        xfree(path);
+        return false;
+    }
+
+    xfree(path);
+    return true;
+
+error:
+    close(fd);
+    if (create)
+        unlink(path);
+    xfree(path);
+    return false;
+}
+
+
+static void spool_segment_close(struct spool_segment *segment)
+{
+    if (segment->mem)
+        munmap(segment->mem, segment->size);
+    segment->mem = NULL;
+    segment->header = NULL;
+}
+
+
+static void spool_segment_remove(struct spool *self, struct spool_segment *segment)
+{
+    char *path = spool_segment_path(self, segment->seq);
+    spool_segment_close(segment);
+    unlink(path);
+    xfree(path);
+}
+
+
+/**
+ * Find segments left by previous run.
+ *
+ */
+static void spool_scan(struct spool *self, const char *dir, const char *name)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    size_t name_len = strlen(name);
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        unsigned int seq;
+        char suffix[8];
+        if (strncmp(entry->d_name, name, name_len) || entry->d_name[name_len] != '-')
+            continue;
+        if (sscanf(entry->d_name + name_len + 1, "%8u.%7s", &seq, suffix) != 2 || strcmp(suffix, "spool"))
+            continue;
+
+        if (!self->has_segments || seq < self->first_seq)
+            self->first_seq = seq;
+        if (!self->has_segments || seq > self->last_seq)
+            self->last_seq = seq;
+        self->has_segments = true;
+    }
+    closedir(d);
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct spool* spool_new(const char *dir, const char *name, size_t segment_size, size_t max_size)
+{
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        BOMBUS_ERROR("Cannot create spool directory %s, error %d", dir, errno);
+        return NULL;
+    }
+
+    struct spool *self = xmalloc(sizeof(struct spool));
+    size_t path_len = strlen(dir) + strlen(name) + 2;
+    self->path = xmalloc(path_len);
+    snprintf(self->path, path_len, "%s/%s", dir, name);
+
+    self->segment_size = segment_size;
+    self->max_segments = max_size / segment_size;
+    if (self->max_segments == 0)
+        self->max_segments = 1;
+
+    self->first_seq = 0;
+    self->last_seq = 0;
+    self->has_segments = false;
+    self->read = NULL;
+    self->write = NULL;
+    self->read_segment.mem = NULL;
+    self->write_segment.mem = NULL;
+    self->dropped = 0;
+
+    spool_scan(self, dir, name);
+    if (self->has_segments) {
+        // Continue writing last segment
+        if (spool_segment_open(self, &self->write_segment, self->last_seq, false))
+            self->write = &self->write_segment;
+        else
+            self->last_seq++;       // Leave broken segment, start new one
+        BOMBUS_INFO("Spool %s recovered segments %u-%u", self->path, self->first_seq, self->last_seq);
+    }
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ * Segment files are kept for next run.
+ *
+ */
+struct spool* spool_delete(struct spool *self)
+{
+    if (self->read && self->read != self->write)
+        spool_segment_close(self->read);
+    if (self->write)
+        spool_segment_close(self->write);
+
+    xfree(self->path);
+    return xfree(self);
+}
+
+
+static unsigned int spool_segments_num(struct spool *self)
+{
+    return self->has_segments ? self->last_seq - self->first_seq + 1 : 0;
+}
+
+
+/**
+ * Start new write segment.
+ *
+ */
+static bool spool_roll(struct spool *self)
+{
+    unsigned int seq = self->has_segments ? self->last_seq + 1 : 0;
+
+    if (self->write) {
+        if (self->read == self->write) {
+            // Keep mapping for reader
+            self->read_segment = self->write_segment;
+            self->read = &self->read_segment;
+        }
+        else {
+            spool_segment_close(self->write);
+        }
+        self->write = NULL;
+    }
+
+    if (!spool_segment_open(self, &self->write_segment, seq, true))
+        return false;
+
+    self->write = &self->write_segment;
+    if (!self->has_segments)
+        self->first_seq = seq;
+    self->last_seq = seq;
+    self->has_segments = true;
+    return true;
+}
+
+
+/**
+ * Store message at the end of spool.
+ *
+ * Message is dropped when spool is full.
+ *
+ */
+bool spool_append(struct spool *self, const char *topic, unsigned char qos, bool retain, const void *payload, size_t payload_len)
+{
+    size_t topic_len = strlen(topic) + 1;
+    size_t size = spool_record_size(topic_len, payload_len);
+
+    if (SPOOL_DATA_START + size > self->segment_size) {
+        BOMBUS_WARN("Message %s too big for spool", topic);
+        self->dropped++;
+        return false;
+    }
+
+    if (!self->write || self->write->header->write_pos + size > self->write->size) {
+        if (spool_segments_num(self) >= self->max_segments || !spool_roll(self)) {
+            if (self->dropped++ == 0)
+                BOMBUS_WARN("Spool %s full, dropping messages", self->path);
+            return false;
+        }
+    }
+
+    struct spool_segment_header *header = self->write->header;
+    unsigned char *ptr = self->write->mem + header->write_pos;
+    struct spool_record *record = (struct spool_record*)ptr;
+    record->topic_len = topic_len;
+    record->payload_len = payload_len;
+    record->qos = qos;
+    record->retain = retain;
+    memcpy(ptr + sizeof(struct spool_record), topic, topic_len);
+    memcpy(ptr + sizeof(struct spool_record) + topic_len, payload, payload_len);
+
+    // Commit record after its data is in place
+    header->write_pos += size;
+    return true;
+}
+
+
+/**
+ * Get oldest message without removing it.
+ *
+ */
+bool spool_peek(struct spool *self, struct spool_msg *msg)
+{
+    while (self->has_segments) {
+        if (!self->read) {
+            if (self->write && self->write->seq == self->first_seq) {
+                self->read = self->write;
+            }
+            else if (spool_segment_open(self, &self->read_segment, self->first_seq, false)) {
+                self->read = &self->read_segment;
+            }
+            else {
+                self->first_seq++;      // Skip broken segment
+                if (self->first_seq > self->last_seq)
+                    self->has_segments = false;
+                continue;
+            }
+        }
+
+        struct spool_segment_header *header = self->read->header;
+        if (header->read_pos < header->write_pos) {
+            const unsigned char *ptr = self->read->mem + header->read_pos;
+            const struct spool_record *record = (const struct spool_record*)ptr;
+            msg->topic = (const char*)ptr + sizeof(struct spool_record);
+            msg->qos = record->qos;
+            msg->retain = record->retain;
+            msg->payload = ptr + sizeof(struct spool_record) + record->topic_len;
+            msg->payload_len = record->payload_len;
+            return true;
+        }
+
+        if (self->read == self->write)
+            return false;
+
+        // Segment replayed, move to next one
+        spool_segment_remove(self, self->read);
+        self->read = NULL;
+        self->first_seq++;
+        if (self->first_seq > self->last_seq)
+            self->has_segments = false;
+    }
+
+    return false;
+}
+
+
+/**
+ * Remove oldest message.
+ *
+ */
+void spool_pop(struct spool *self)
+{
+    if (!self->read)
+        return;
+
+    struct spool_segment_header *header = self->read->header;
+    if (header->read_pos >= header->write_pos)
+        return;
+
+    const struct spool_record *record = (const struct spool_record*)(self->read->mem + header->read_pos);
+    header->read_pos += spool_record_size(record->topic_len, record->payload_len);
+
+    if (header->read_pos == header->write_pos && self->read == self->write) {
+        // Everything replayed, reuse segment from the beginning
+        header->read_pos = SPOOL_DATA_START;
+        header->write_pos = SPOOL_DATA_START;
+    }
+}
+
+
+bool spool_is_empty(struct spool *self)
+{
+    if (!self->has_segments)
+        return true;
+    if (self->first_seq != self->last_seq || !self->write)
+        return false;
+
+    struct spool_segment_header *header = self->write->header;
+    return header->read_pos == header->write_pos;
+}
@@ -0,0 +1,72 @@
+#ifndef __BOMBUS_SPOOL_H_
+#define __BOMBUS_SPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct spool_segment_header;
+
+
+struct spool_segment
+{
+    unsigned int seq;
+    unsigned char *mem;
+    size_t size;
+    struct spool_segment_header *header;
+};
+
+
+/**
+ * View of spooled message, valid until spool is modified.
+ *
+ */
+struct spool_msg
+{
+    const char *topic;
+    unsigned char qos;
+    bool retain;
+    const void *payload;
+    size_t payload_len;
+};
+
+
+/**
+ * Append-only message spool.
+ *
+ * Messages are stored in memory-mapped segment files, only the segment being
+ * written and the one being replayed are mapped. Fully replayed segments are
+ * removed, so disk usage is bounded by segment size times number of segments.
+ *
+ */
+struct spool
+{
+    char *path;                 // Segment file path prefix
+    size_t segment_size;
+    unsigned int max_segments;
+
+    unsigned int first_seq;
+    unsigned int last_seq;
+    bool has_segments;
+
+    struct spool_segment *read;
+    struct spool_segment *write;
+    struct spool_segment read_segment;
+    struct spool_segment write_segment;
+
+    unsigned long long dropped;
+};
+
+
+struct spool* spool_new(const char *dir, const char *name, size_t segment_size, size_t max_size);
+struct spool* spool_delete(struct spool *self);
+
+bool spool_append(struct spool *self, const char *topic, unsigned char qos, bool retain, const void *payload, size_t payload_len);
+bool spool_peek(struct spool *self, struct spool_msg *msg);
+void spool_pop(struct spool *self);
+bool spool_is_empty(struct spool *self);
+
+
+#endif /* __BOMBUS_SPOOL_H_ */
@@ -0,0 +1,261 @@
+
+#include "stats.h"
+#include "utils.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+
+#define STATS_FIELDS    (sizeof(struct stats) / sizeof(unsigned long long))
+
+
+
+static const char *packet_types[BOMBUS_METRICS_TYPES] = {
+    NULL, "connect", "connack", "publish", "puback", "pubrec", "pubrel", "pubcomp",
+    "subscribe", "suback", "unsubscribe", "unsuback", "pingreq", "pingresp", "disconnect", "auth",
+};
+
+
+
+
+static unsigned long long sum(const unsigned long long *counters)
+{
+    unsigned long long total = 0;
+    for (unsigned int i=0; i<BOMBUS_METRICS_TYPES; i++)
+        total += counters[i];
+    return total;
+}
+
+
+void stats_reset(struct stats *self)
+{
+    memset(self, 0, sizeof(struct stats));
+}
+
+
+/**
+ * Add client counters, called by thread owning client.
+ *
+ */
+void stats_add_client(struct stats *self, struct bombus *bombus)
+{
+    const struct bombus_metrics *metrics = &bombus->metrics;
+
+    for (unsigned int i=0; i<BOMBUS_METRICS_TYPES; i++) {
+        self->traffic.packets_in[i] += metrics->packets_in[i];
+        self->traffic.packets_out[i] += metrics->packets_out[i];
+        self->traffic.bytes_in[i] += metrics->bytes_in[i];
+        self->traffic.bytes_out[i] += metrics->bytes_out[i];
+    }
+    self->traffic.connects += metrics->connects;
+    self->traffic.reconnects += metrics->reconnects;
+    self->traffic.connect_time_ms += metrics->connect_time_ms;
+    self->traffic.alias_saved += metrics->alias_saved;
+
+    self->qos.published += bombus->qos_stats.published;
+    self->qos.acknowledged += bombus->qos_stats.acknowledged;
+    self->qos.retransmitted += bombus->qos_stats.retransmitted;
+    self->qos.rejected += bombus->qos_stats.rejected;
+    self->qos.refused += bombus->qos_stats.refused;
+
+    self->clients++;
+    if (bombus_is_connected(bombus))
+        self->connected++;
+    self->inflight += bombus_get_inflight_count(bombus);
+    self->outgoing += bombus_get_outgoing_len(bombus);
+}
+
+
+/**
+ * Publish snapshot for other threads.
+ *
+ */
+void stats_store(struct stats *self, const struct stats *src)
+{
+    unsigned long long *dst_fields = (unsigned long long*)self;
+    const unsigned long long *src_fields = (const unsigned long long*)src;
+
+    for (size_t i=0; i<STATS_FIELDS; i++)
+        __atomic_store_n(&dst_fields[i], src_fields[i], __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Add snapshot published by other thread.
+ *
+ */
+void stats_load_add(struct stats *self, const struct stats *src)
+{
+    unsigned long long *dst_fields = (unsigned long long*)self;
+    unsigned long long *src_fields = (unsigned long long*)src;
+
+    for (size_t i=0; i<STATS_FIELDS; i++)
+        dst_fields[i] += __atomic_load_n(&src_fields[i], __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Print one line summary, rates are computed against previous snapshot.
+ *
+ */
+void stats_print(const struct stats *self, const struct stats *prev, uint64_t interval_ms)
+{
+    double seconds = interval_ms > 0 ? interval_ms / 1000.0 : 1.0;
+
+    unsigned long long msgs_in = self->traffic.packets_in[MQTT_PUBLISH] - prev->traffic.packets_in[MQTT_PUBLISH];
+    unsigned long long msgs_out = self->traffic.packets_out[MQTT_PUBLISH] - prev->traffic.packets_out[MQTT_PUBLISH];
+    unsigned long long bytes_in = sum(self->traffic.bytes_in) - sum(prev->traffic.bytes_in);
+    unsigned long long bytes_out = sum(self->traffic.bytes_out) - sum(prev->traffic.bytes_out);
+    unsigned long long wakeups = self->wakeups - prev->wakeups;
+    unsigned long long allocs = self->items.allocs + self->scratch.allocs - prev->items.allocs - prev->scratch.allocs;
+    unsigned long long heap_allocs = self->items.heap_allocs + self->scratch.heap_allocs - prev->items.heap_allocs - prev->scratch.heap_allocs;
+
+    BOMBUS_INFO("Stats: clients %llu/%llu, in %.0f msg/s ~%.0f B/s, out %.0f msg/s ~%.0f B/s, "
+                "inflight %llu, outgoing %llu B, reconnects %llu, wakeups %.0f/s, command allocs %llu (heap %llu)",
+                self->connected, self->clients,
+                msgs_in / seconds, bytes_in / seconds, msgs_out / seconds, bytes_out / seconds,
+                self->inflight, self->outgoing, self->traffic.reconnects, wakeups / seconds, allocs, heap_allocs);
+}
+
+
+static void write_typed(FILE *file, const char *name, const char *help, const unsigned long long *counters)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (unsigned int i=1; i<BOMBUS_METRICS_TYPES; i++)
+        fprintf(file, "%s{type=\"%s\"} %llu\n", name, packet_types[i], counters[i]);
+}
+
+
+static void write_value(FILE *file, const char *name, const char *type, const char *help, unsigned long long value)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, value);
+}
+
+
+static void write_pool(FILE *file, const char *name, const char *help, unsigned long long items, unsigned long long scratch)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    fprintf(file, "%s{pool=\"items\"} %llu\n%s{pool=\"scratch\"} %llu\n", name, items, name, scratch);
+}
+
+
+/**
+ * Write metrics in Prometheus text format.
+ *
+ * File is replaced atomically, readers never see partial content.
+ *
+ */
+bool stats_write_prometheus(const struct stats *self, const char *path)
+{
+    size_t tmp_len = strlen(path) + 5;
+    char tmp_path[tmp_len];
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        BOMBUS_ERROR("Cannot open %s, error %d", tmp_path, errno);
+        return false;
+    }
+
+    write_typed(file, "bombus_packets_received_total", "MQTT packets received", self->traffic.packets_in);
+    write_typed(file, "bombus_packets_sent_total", "MQTT packets sent", self->traffic.packets_out);
+    write_typed(file, "bombus_estimated_bytes_received_total", "MQTT bytes received, estimated from packet fields", self->traffic.bytes_in);
+    write_typed(file, "bombus_estimated_bytes_sent_total", "MQTT bytes sent, estimated from packet fields", self->traffic.bytes_out);
+
+    write_value(file, "bombus_connects_total", "counter", "Successful connections", self->traffic.connects);
+    write_value(file, "bombus_reconnects_total", "counter", "Reconnection attempts", self->traffic.reconnects);
+    fprintf(file, "# HELP bombus_connect_seconds_total Time spent connecting\n"
+                  "# TYPE bombus_connect_seconds_total counter\n"
+                  "bombus_connect_seconds_total %.3f\n", self->traffic.connect_time_ms / 1000.0);
+
+    // Net saving drops while new topics are mapped
+    fprintf(file, "# HELP bombus_topic_alias_saved_bytes Net bytes saved by MQTT 5 topic aliases\n"
+                  "# TYPE bombus_topic_alias_saved_bytes gauge\n"
+                  "bombus_topic_alias_saved_bytes %lld\n", self->traffic.alias_saved);
+
+    write_value(file, "bombus_published_total", "counter", "Messages published", self->qos.published);
+    write_value(file, "bombus_acknowledged_total", "counter", "QoS 1/2 messages acknowledged", self->qos.acknowledged);
+    write_value(file, "bombus_retransmitted_total", "counter", "QoS 1/2 messages retransmitted", self->qos.retransmitted);
+    write_value(file, "bombus_rejected_total", "counter", "Publishes rejected by full in-flight window", self->qos.rejected);
+    write_value(file, "bombus_refused_total", "counter", "QoS 1/2 messages refused by MQTT 5 broker", self->qos.refused);
+
+    write_value(file, "bombus_clients", "gauge", "Configured clients", self->clients);
+    write_value(file, "bombus_clients_connected", "gauge", "Connected clients", self->connected);
+    write_value(file, "bombus_inflight_messages", "gauge", "QoS 1/2 messages in flight", self->inflight);
+    write_value(file, "bombus_outgoing_bytes", "gauge", "Bytes waiting for sockets", self->outgoing);
+    write_value(file, "bombus_wakeups_total", "counter", "Event loop wakeups", self->wakeups);
+
+    write_pool(file, "bombus_pool_allocs_total", "Command path allocations", self->items.allocs, self->scratch.allocs);
+    write_pool(file, "bombus_pool_heap_allocs_total", "Command path allocations served by heap", self->items.heap_allocs, self->scratch.heap_allocs);
+
+    bool success = !ferror(file);
+    if (fclose(file) != 0)
+        success = false;
+    if (!success || rename(tmp_path, path) < 0) {
+        BOMBUS_ERROR("Cannot write %s, error %d", path, errno);
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+
+
+#define STATS_FILE_INTERVAL     10
+
+
+
+/**
+ * Initialize reporter.
+ *
+ * Without interval only Prometheus file is written, every 10 seconds.
+ *
+ */
+void stats_reporter_init(struct stats_reporter *self, unsigned int interval_s, const char *path)
+{
+    self->print = interval_s > 0;
+    self->interval_ms = (interval_s > 0 ? interval_s : STATS_FILE_INTERVAL) * 1000;
+    self->path = path ? xstrdup(path) : NULL;
+    self->time = monotonic_time_ms();
+    stats_reset(&self->prev);
+}
+
+
+void stats_reporter_clean(struct stats_reporter *self)
+{
+    if (self->path)
+        self->path = xfree(self->path);
+}
+
+
+bool stats_reporter_is_due(struct stats_reporter *self)
+{
+    return monotonic_time_ms() - self->time >= self->interval_ms;
+}
+
+
+/**
+ * Print stats line and rewrite Prometheus file.
+ *
+ */
+void stats_reporter_report(struct stats_reporter *self, const struct stats *current)
+{
+    uint64_t now = monotonic_time_ms();
+
+    if (self->print)
+        stats_print(current, &self->prev, now - self->time);
+    if (self->path)
+        stats_write_prometheus(current, self->path);
+
+    self->prev = *current;
+    self->time = now;
+}
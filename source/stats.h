@@ -0,0 +1,66 @@
+#ifndef __BOMBUS_STATS_H_
+#define __BOMBUS_STATS_H_
+
+#include "pool.h"
+
+#include "bombus/client.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/**
+ * Snapshot of client metrics.
+ *
+ * Every thread publishes its own snapshot, readers sum them up. Snapshot is
+ * accessed field by field with relaxed atomics, so all fields must be
+ * unsigned long long. Signed long long net counters sum up the same way.
+ *
+ */
+struct stats
+{
+    struct bombus_metrics traffic;
+    struct bombus_qos_stats qos;
+
+    unsigned long long clients;
+    unsigned long long connected;
+    unsigned long long inflight;
+    unsigned long long outgoing;        // Bytes waiting for sockets
+    unsigned long long wakeups;         // Idler wakeups
+    struct pool_stats items;            // Command message pool
+    struct pool_stats scratch;          // Command strings arena
+};
+
+
+/**
+ * Periodic stats line and Prometheus file.
+ *
+ */
+struct stats_reporter
+{
+    unsigned long interval_ms;
+    bool print;
+    char *path;
+
+    uint64_t time;
+    struct stats prev;
+};
+
+
+
+void stats_reset(struct stats *self);
+void stats_add_client(struct stats *self, struct bombus *bombus);
+void stats_store(struct stats *self, const struct stats *src);
+void stats_load_add(struct stats *self, const struct stats *src);
+
+void stats_print(const struct stats *self, const struct stats *prev, uint64_t interval_ms);
+bool stats_write_prometheus(const struct stats *self, const char *path);
+
+void stats_reporter_init(struct stats_reporter *self, unsigned int interval_s, const char *path);
+void stats_reporter_clean(struct stats_reporter *self);
+bool stats_reporter_is_due(struct stats_reporter *self);
+void stats_reporter_report(struct stats_reporter *self, const struct stats *current);
+
+
+#endif /* __BOMBUS_STATS_H_ */
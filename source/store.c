@@ -0,0 +1,154 @@
+
+#include "store.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct store* store_new(const char *dir)
+{
+    struct store *self = xmalloc(sizeof(struct store));
+    self->dir = xstrdup(dir);
+    snprintf(self->run, sizeof(self->run), "%lld-%d", (long long)time(NULL), (int)getpid());
+    self->files = 0;
+    self->bytes = 0;
+    self->parts = NULL;
+    self->parts_size = 0;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        BOMBUS_ERROR("Cannot create %s, error %d", dir, errno);
+        return store_delete(self);
+    }
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct store* store_delete(struct store *self)
+{
+    for (unsigned int fd=0; fd<self->parts_size; fd++) {
+        if (self->parts[fd])
+            store_close(self, fd, false);
+    }
+    if (self->parts)
+        xfree(self->parts);
+    xfree(self->dir);
+    return xfree(self);
+}
+
+
+/**
+ * Create partial file for next message, returns -1 on failure.
+ *
+ */
+int store_open(struct store *self, unsigned int client, const char *topic, size_t topic_len)
+{
+    char name[STORE_TOPIC_MAX_LEN + 1];
+    size_t name_len = topic_len < STORE_TOPIC_MAX_LEN ? topic_len : STORE_TOPIC_MAX_LEN;
+    for (size_t i=0; i<name_len; i++)
+        name[i] = (topic[i] == '/' || topic[i] == '\0') ? '_' : topic[i];
+    name[name_len] = '\0';
+
+    // Existing file is never truncated, colliding name takes next number
+    char path[strlen(self->dir) + sizeof(self->run) + sizeof(name) + 48];
+    int fd;
+    do {
+        snprintf(path, sizeof(path), "%s/%s-%u-%llu-%s.bin.part", self->dir, self->run, client, self->files++, name);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (fd < 0 && errno == EEXIST);
+    if (fd < 0) {
+        BOMBUS_ERROR("Cannot create %s, error %d", path, errno);
+        return -1;
+    }
+
+    if ((unsigned int)fd >= self->parts_size) {
+        unsigned int size = self->parts_size ? self->parts_size : 16;
+        while (size <= (unsigned int)fd)
+            size *= 2;
+        self->parts = xrealloc(self->parts, size * sizeof(char*));
+        memset(&self->parts[self->parts_size], 0, (size - self->parts_size) * sizeof(char*));
+        self->parts_size = size;
+    }
+    self->parts[fd] = xstrdup(path);
+
+    BOMBUS_INFO("Client %u stores %.*s in %s", client, (int)topic_len, topic, path);
+    return fd;
+}
+
+
+bool store_write(struct store *self, int fd, const void *data, size_t len)
+{
+    const unsigned char *ptr = data;
+
+    while (len > 0) {
+        ssize_t written = write(fd, ptr, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            BOMBUS_ERROR("Cannot write message file, error %d", errno);
+            return false;
+        }
+        ptr += written;
+        len -= written;
+        self->bytes += written;
+    }
+
+    return true;
+}
+
+
+/**
+ * Close message file, complete one gets its final name.
+ *
+ * Incomplete file is removed, so truncated message never looks like
+ * received one.
+ *
+ */
+void store_close(struct store *self, int fd, bool complete)
+{
+    close(fd);
+
+    char *part = (unsigned int)fd < self->parts_size ? self->parts[fd] : NULL;
+    if (!part)
+        return;
+    self->parts[fd] = NULL;
+
+    if (!complete) {
+        unlink(part);
+        xfree(part);
+        return;
+    }
+
+    // Link fails instead of replacing file of previous run
+    size_t len = strlen(part) - strlen(".part");
+    char path[len + 1];
+    memcpy(path, part, len);
+    path[len] = '\0';
+    if (link(part, path) < 0)
+        BOMBUS_WARN("Cannot rename %s, error %d, message left in partial file", part, errno);
+    else
+        unlink(part);
+    xfree(part);
+}
@@ -0,0 +1,44 @@
+#ifndef __BOMBUS_STORE_H_
+#define __BOMBUS_STORE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+#define STORE_TOPIC_MAX_LEN     128
+
+
+/**
+ * Directory receiving large messages, one file per message.
+ *
+ * File name is made of run stamp, client number, message sequence number and
+ * topic with slashes replaced, so files of concurrent clients and of earlier
+ * runs never collide. Run stamp is start time and process id.
+ *
+ * Message is written to file with .part suffix, which is renamed when whole
+ * message is received and removed when it is not. Existing files are never
+ * replaced.
+ *
+ */
+struct store
+{
+    char *dir;
+    char run[32];               // Start time and process id
+    unsigned long long files;
+    unsigned long long bytes;
+
+    char **parts;               // Partial file paths, indexed by descriptor
+    unsigned int parts_size;
+};
+
+
+struct store* store_new(const char *dir);
+struct store* store_delete(struct store *self);
+
+int store_open(struct store *self, unsigned int client, const char *topic, size_t topic_len);
+bool store_write(struct store *self, int fd, const void *data, size_t len);
+void store_close(struct store *self, int fd, bool complete);
+
+
+#endif /* __BOMBUS_STORE_H_ */
@@ -0,0 +1,223 @@
+
+#include "timer_wheel.h"
+
+#include <string.h>
+
+
+#define TIMER_WHEEL_MASK        (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE       (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+
+
+
+static void timer_list_add(struct timer_entry **head, struct timer_entry *timer)
+{
+    timer->next = *head;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+
+static void timer_list_remove(struct timer_entry *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+
+/**
+ * Put timer into slot matching its distance from current time.
+ *
+ */
+static void timer_wheel_place(struct timer_wheel *self, struct timer_entry *timer)
+{
+    uint64_t expires = timer->expires;
+
+    if (expires < self->now)
+        expires = self->now;    // Overdue, run with current tick
+    else if (expires - self->now >= TIMER_WHEEL_RANGE)
+        expires = self->now + TIMER_WHEEL_RANGE - 1;    // Moved down again later
+
+    uint64_t delta = expires - self->now;
+    unsigned int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+
+    unsigned int slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer_list_add(&self->slots[level][slot], timer);
+}
+
+
+/**
+ * Move timers of current higher level slot down.
+ *
+ * Returns slot index, zero means next level has to be cascaded too.
+ *
+ */
+static unsigned int timer_wheel_cascade(struct timer_wheel *self, unsigned int level)
+{
+    unsigned int slot = (self->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    struct timer_entry *timer = self->slots[level][slot];
+    self->slots[level][slot] = NULL;
+    while (timer) {
+        struct timer_entry *next = timer->next;
+        timer->pprev = NULL;
+        timer_wheel_place(self, timer);
+        timer = next;
+    }
+
+    return slot;
+}
+
+
+
+
+
+void timer_entry_init(struct timer_entry *self, timer_cb cb, void *arg)
+{
+    self->next = NULL;
+    self->pprev = NULL;
+    self->expires = 0;
+    self->cb = cb;
+    self->arg = arg;
+}
+
+
+bool timer_entry_is_pending(const struct timer_entry *self)
+{
+    return self->pprev != NULL;
+}
+
+
+void timer_wheel_init(struct timer_wheel *self, uint64_t now)
+{
+    self->now = now;
+    self->count = 0;
+    memset(self->slots, 0, sizeof(self->slots));
+}
+
+
+/**
+ * Detach all timers, entries are owned by caller.
+ *
+ */
+void timer_wheel_clean(struct timer_wheel *self)
+{
+    for (unsigned int level=0; level<TIMER_WHEEL_LEVELS; level++) {
+        for (unsigned int slot=0; slot<TIMER_WHEEL_SLOTS; slot++) {
+            while (self->slots[level][slot])
+                timer_list_remove(self->slots[level][slot]);
+        }
+    }
+    self->count = 0;
+}
+
+
+/**
+ * Schedule or reschedule timer.
+ *
+ */
+void timer_wheel_schedule(struct timer_wheel *self, struct timer_entry *timer, uint64_t expires)
+{
+    if (timer->pprev)
+        timer_list_remove(timer);
+    else
+        self->count++;
+
+    timer->expires = expires;
+    timer_wheel_place(self, timer);
+}
+
+
+void timer_wheel_cancel(struct timer_wheel *self, struct timer_entry *timer)
+{
+    if (!timer->pprev)
+        return;
+
+    timer_list_remove(timer);
+    self->count--;
+}
+
+
+/**
+ * Run all timers expired up to given time.
+ *
+ * Timers may be scheduled and cancelled from callbacks.
+ *
+ */
+void timer_wheel_advance(struct timer_wheel *self, uint64_t now)
+{
+    while (self->now <= now) {
+        if (self->count == 0) {
+            self->now = now + 1;
+            break;
+        }
+
+        unsigned int slot = self->now & TIMER_WHEEL_MASK;
+        if (slot == 0) {
+            for (unsigned int level=1; level<TIMER_WHEEL_LEVELS; level++) {
+                if (timer_wheel_cascade(self, level) != 0)
+                    break;
+            }
+        }
+
+        // Detach slot and move on, timers rescheduled by callbacks land in future slots
+        struct timer_entry *pending = self->slots[0][slot];
+        self->slots[0][slot] = NULL;
+        if (pending)
+            pending->pprev = &pending;
+        self->now++;
+
+        while (pending) {
+            struct timer_entry *timer = pending;
+            timer_list_remove(timer);
+            self->count--;
+            timer->cb(timer->arg);
+        }
+    }
+}
+
+
+/**
+ * Get earliest expiry time, zero when nothing is scheduled.
+ *
+ * Only the first occupied slot of every level is examined, slots of different
+ * levels overlap, so all levels are checked.
+ *
+ */
+uint64_t timer_wheel_next_expiry(struct timer_wheel *self)
+{
+    uint64_t next = 0;
+
+    if (self->count == 0)
+        return 0;
+
+    for (unsigned int level=0; level<TIMER_WHEEL_LEVELS; level++) {
+        unsigned int shift = TIMER_WHEEL_BITS * level;
+        unsigned int start = (self->now >> shift) & TIMER_WHEEL_MASK;
+
+        // Already cascaded current slot of higher level holds only timers one full turn ahead
+        unsigned int skip = (level > 0 && (self->now & ((1ULL << shift) - 1)) != 0) ? 1 : 0;
+
+        for (unsigned int n=0; n<TIMER_WHEEL_SLOTS; n++) {
+            struct timer_entry *timer = self->slots[level][(start + n + skip) & TIMER_WHEEL_MASK];
+            if (!timer)
+                continue;
+
+            for (; timer; timer = timer->next) {
+                uint64_t expires = timer->expires < self->now ? self->now : timer->expires;
+                if (next == 0 || expires < next)
+                    next = expires;
+            }
+            break;
+        }
+    }
+
+    return next;
+}
@@ -0,0 +1,60 @@
+#ifndef __BOMBUS_TIMER_WHEEL_H_
+#define __BOMBUS_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS      4
+
+
+typedef void (*timer_cb)(void *arg);
+
+
+/**
+ * Timer embedded in owner structure.
+ *
+ */
+struct timer_entry
+{
+    struct timer_entry *next;
+    struct timer_entry **pprev;     // NULL when not scheduled
+
+    uint64_t expires;
+    timer_cb cb;
+    void *arg;
+};
+
+
+/**
+ * Hierarchical timer wheel with millisecond resolution.
+ *
+ * Every level has 64 slots, each slot of a level spans whole lower level.
+ * Scheduling and cancelling cost O(1), timers from higher levels are moved
+ * down when their slot is reached.
+ *
+ */
+struct timer_wheel
+{
+    uint64_t now;
+    unsigned int count;
+    struct timer_entry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+
+void timer_entry_init(struct timer_entry *self, timer_cb cb, void *arg);
+bool timer_entry_is_pending(const struct timer_entry *self);
+
+void timer_wheel_init(struct timer_wheel *self, uint64_t now);
+void timer_wheel_clean(struct timer_wheel *self);
+
+void timer_wheel_schedule(struct timer_wheel *self, struct timer_entry *timer, uint64_t expires);
+void timer_wheel_cancel(struct timer_wheel *self, struct timer_entry *timer);
+void timer_wheel_advance(struct timer_wheel *self, uint64_t now);
+uint64_t timer_wheel_next_expiry(struct timer_wheel *self);
+
+
+#endif /* __BOMBUS_TIMER_WHEEL_H_ */
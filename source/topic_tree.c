@@ -0,0 +1,434 @@
+
+#include "topic_tree.h"
+
+#include "mx/memory.h"
+
+#include <string.h>
+
+
+#define TOPIC_NODE_INITIAL_SIZE     4
+
+
+
+
+
+static uint32_t topic_level_hash(const char *level, size_t level_len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<level_len; i++) {
+        hash ^= (unsigned char)level[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static size_t topic_level_len(const char *topic, size_t topic_len)
+{
+    const char *end = memchr(topic, '/', topic_len);
+    return end ? (size_t)(end - topic) : topic_len;
+}
+
+
+static bool topic_level_is(const char *level, size_t level_len, char wildcard)
+{
+    return level_len == 1 && level[0] == wildcard;
+}
+
+
+
+static void topic_node_init(struct topic_node *self, struct topic_node *parent, const char *level, size_t level_len)
+{
+    self->level = level ? xmemdup(level, level_len + 1) : NULL;
+    if (self->level)
+        self->level[level_len] = '\0';
+    self->level_len = level_len;
+    self->hash = topic_level_hash(level, level_len);
+
+    self->parent = parent;
+    self->next = NULL;
+
+    self->children = NULL;
+    self->children_size = 0;
+    self->children_num = 0;
+
+    self->single_wildcard = NULL;
+    self->multi_wildcard = NULL;
+
+    self->data = NULL;
+}
+
+
+static void topic_node_clean(struct topic_node *self, void (*destroy)(void *data));
+
+
+static void topic_node_free(struct topic_node *self, void (*destroy)(void *data))
+{
+    topic_node_clean(self, destroy);
+    xfree(self);
+}
+
+
+static void topic_node_clean(struct topic_node *self, void (*destroy)(void *data))
+{
+    for (unsigned int i=0; i<self->children_size; i++) {
+        struct topic_node *child = self->children[i];
+        while (child) {
+            struct topic_node *next = child->next;
+            topic_node_free(child, destroy);
+            child = next;
+        }
+    }
+    if (self->children)
+        self->children = xfree(self->children);
+    self->children_size = 0;
+    self->children_num = 0;
+
+    if (self->single_wildcard)
+        topic_node_free(self->single_wildcard, destroy);
+    if (self->multi_wildcard)
+        topic_node_free(self->multi_wildcard, destroy);
+    self->single_wildcard = NULL;
+    self->multi_wildcard = NULL;
+
+    if (self->data && destroy)
+        destroy(self->data);
+    self->data = NULL;
+
+    if (self->level)
+        self->level = xfree(self->level);
+}
+
+
+static struct topic_node* topic_node_find_child(struct topic_node *self, const char *level, size_t level_len)
+{
+    if (topic_level_is(level, level_len, '+'))
+        return self->single_wildcard;
+    if (topic_level_is(level, level_len, '#'))
+        return self->multi_wildcard;
+
+    if (self->children_num == 0)
+        return NULL;
+
+    uint32_t hash = topic_level_hash(level, level_len);
+    struct topic_node *child = self->children[hash & (self->children_size - 1)];
+    while (child) {
+        if (child->hash == hash && child->level_len == level_len && !memcmp(child->level, level, level_len))
+            return child;
+        child = child->next;
+    }
+
+    return NULL;
+}
+
+
+static void topic_node_resize(struct topic_node *self, unsigned int size)
+{
+    struct topic_node **children = xmalloc(size * sizeof(struct topic_node*));
+    memset(children, 0, size * sizeof(struct topic_node*));
+
+    for (unsigned int i=0; i<self->children_size; i++) {
+        struct topic_node *child = self->children[i];
+        while (child) {
+            struct topic_node *next = child->next;
+            unsigned int idx = child->hash & (size - 1);
+            child->next = children[idx];
+            children[idx] = child;
+            child = next;
+        }
+    }
+
+    if (self->children)
+        xfree(self->children);
+    self->children = children;
+    self->children_size = size;
+}
+
+
+static struct topic_node* topic_node_add_child(struct topic_node *self, const char *level, size_t level_len)
+{
+    struct topic_node *child = xmalloc(sizeof(struct topic_node));
+    topic_node_init(child, self, level, level_len);
+
+    if (topic_level_is(level, level_len, '+')) {
+        self->single_wildcard = child;
+    }
+    else if (topic_level_is(level, level_len, '#')) {
+        self->multi_wildcard = child;
+    }
+    else {
+        if (self->children_num >= self->children_size)
+            topic_node_resize(self, self->children_size ? self->children_size*2 : TOPIC_NODE_INITIAL_SIZE);
+
+        unsigned int idx = child->hash & (self->children_size - 1);
+        child->next = self->children[idx];
+        self->children[idx] = child;
+        self->children_num++;
+    }
+
+    return child;
+}
+
+
+static void topic_node_remove_child(struct topic_node *self, struct topic_node *child)
+{
+    if (self->single_wildcard == child) {
+        self->single_wildcard = NULL;
+    }
+    else if (self->multi_wildcard == child) {
+        self->multi_wildcard = NULL;
+    }
+    else {
+        struct topic_node **link = &self->children[child->hash & (self->children_size - 1)];
+        while (*link && *link != child)
+            link = &(*link)->next;
+        if (*link) {
+            *link = child->next;
+            self->children_num--;
+        }
+    }
+
+    topic_node_free(child, NULL);
+}
+
+
+static bool topic_node_is_empty(struct topic_node *self)
+{
+    return !self->data && self->children_num == 0 && !self->single_wildcard && !self->multi_wildcard;
+}
+
+
+static struct topic_node* topic_tree_find_node(struct topic_tree *self, const char *topic)
+{
+    struct topic_node *node = &self->root;
+    size_t topic_len = strlen(topic);
+
+    while (node) {
+        size_t level_len = topic_level_len(topic, topic_len);
+        node = topic_node_find_child(node, topic, level_len);
+        if (level_len == topic_len)
+            break;
+        topic += level_len + 1;
+        topic_len -= level_len + 1;
+    }
+
+    return node;
+}
+
+
+static unsigned int topic_node_match(struct topic_node *self, const char *topic, size_t topic_len, bool first, topic_tree_cb cb, void *arg)
+{
+    unsigned int count = 0;
+    size_t level_len = topic_level_len(topic, topic_len);
+    bool last = level_len == topic_len;
+
+    // Wildcards do not match topics starting with '$'
+    bool wildcards = !(first && level_len > 0 && topic[0] == '$');
+
+    if (wildcards && self->multi_wildcard && self->multi_wildcard->data) {
+        cb(arg, self->multi_wildcard->data);
+        count++;
+    }
+
+    struct topic_node *nodes[2] = {
+        topic_node_find_child(self, topic, level_len),
+        wildcards ? self->single_wildcard : NULL,
+    };
+
+    for (int i=0; i<2; i++) {
+        struct topic_node *node = nodes[i];
+        if (!node)
+            continue;
+
+        if (last) {
+            if (node->data) {
+                cb(arg, node->data);
+                count++;
+            }
+            // Parent level matches 'level/#' as well
+            if (node->multi_wildcard && node->multi_wildcard->data) {
+                cb(arg, node->multi_wildcard->data);
+                count++;
+            }
+        }
+        else {
+            count += topic_node_match(node, topic + level_len + 1, topic_len - level_len - 1, false, cb, arg);
+        }
+    }
+
+    return count;
+}
+
+
+static void topic_node_foreach(struct topic_node *self, topic_tree_cb cb, void *arg)
+{
+    if (self->data)
+        cb(arg, self->data);
+
+    for (unsigned int i=0; i<self->children_size; i++) {
+        for (struct topic_node *child = self->children[i]; child; child = child->next)
+            topic_node_foreach(child, cb, arg);
+    }
+
+    if (self->single_wildcard)
+        topic_node_foreach(self->single_wildcard, cb, arg);
+    if (self->multi_wildcard)
+        topic_node_foreach(self->multi_wildcard, cb, arg);
+}
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct topic_tree* topic_tree_new(void)
+{
+    struct topic_tree *self = xmalloc(sizeof(struct topic_tree));
+    topic_tree_init(self);
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct topic_tree* topic_tree_delete(struct topic_tree *self, void (*destroy)(void *data))
+{
+    topic_tree_clean(self, destroy);
+    return xfree(self);
+}
+
+
+void topic_tree_init(struct topic_tree *self)
+{
+    topic_node_init(&self->root, NULL, NULL, 0);
+    self->size = 0;
+}
+
+
+void topic_tree_clean(struct topic_tree *self, void (*destroy)(void *data))
+{
+    topic_node_clean(&self->root, destroy);
+    self->size = 0;
+}
+
+
+/**
+ * Insert data for given topic filter.
+ *
+ * Returns data previously stored for the same topic filter, if any.
+ *
+ */
+void* topic_tree_insert(struct topic_tree *self, const char *topic, void *data)
+{
+    struct topic_node *node = &self->root;
+    size_t topic_len = strlen(topic);
+
+    while (1) {
+        size_t level_len = topic_level_len(topic, topic_len);
+        struct topic_node *child = topic_node_find_child(node, topic, level_len);
+        if (!child)
+            child = topic_node_add_child(node, topic, level_len);
+        node = child;
+        if (level_len == topic_len)
+            break;
+        topic += level_len + 1;
+        topic_len -= level_len + 1;
+    }
+
+    void *prev = node->data;
+    node->data = data;
+    if (!prev)
+        self->size++;
+
+    return prev;
+}
+
+
+/**
+ * Remove topic filter.
+ *
+ * Returns removed data, empty nodes are released.
+ *
+ */
+void* topic_tree_remove(struct topic_tree *self, const char *topic)
+{
+    struct topic_node *node = topic_tree_find_node(self, topic);
+    if (!node || !node->data)
+        return NULL;
+
+    void *data = node->data;
+    node->data = NULL;
+    self->size--;
+
+    while (node != &self->root && topic_node_is_empty(node)) {
+        struct topic_node *parent = node->parent;
+        topic_node_remove_child(parent, node);
+        node = parent;
+    }
+
+    return data;
+}
+
+
+/**
+ * Find data stored for exactly given topic filter.
+ *
+ */
+void* topic_tree_find(struct topic_tree *self, const char *topic)
+{
+    struct topic_node *node = topic_tree_find_node(self, topic);
+    return node ? node->data : NULL;
+}
+
+
+/**
+ * Call cb for every topic filter matching given topic name.
+ *
+ * Topic does not have to be null terminated. Returns number of matches.
+ *
+ */
+unsigned int topic_tree_match(struct topic_tree *self, const char *topic, size_t topic_len, topic_tree_cb cb, void *arg)
+{
+    return topic_node_match(&self->root, topic, topic_len, true, cb, arg);
+}
+
+
+void topic_tree_foreach(struct topic_tree *self, topic_tree_cb cb, void *arg)
+{
+    topic_node_foreach(&self->root, cb, arg);
+}
+
+
+/**
+ * Check topic filter wildcards placement.
+ *
+ */
+bool topic_is_valid_filter(const char *topic)
+{
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0)
+        return false;
+
+    while (1) {
+        size_t level_len = topic_level_len(topic, topic_len);
+        if (memchr(topic, '+', level_len) && !topic_level_is(topic, level_len, '+'))
+            return false;
+        if (memchr(topic, '#', level_len)) {
+            // Multi level wildcard allowed only as whole last level
+            if (!topic_level_is(topic, level_len, '#') || level_len != topic_len)
+                return false;
+        }
+        if (level_len == topic_len)
+            break;
+        topic += level_len + 1;
+        topic_len -= level_len + 1;
+    }
+
+    return true;
+}
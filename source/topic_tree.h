@@ -0,0 +1,64 @@
+
+#ifndef __BOMBUS_TOPIC_TREE_H_
+#define __BOMBUS_TOPIC_TREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+struct topic_node
+{
+    char *level;
+    size_t level_len;
+    uint32_t hash;
+
+    struct topic_node *parent;
+    struct topic_node *next;            // Next node in parent bucket
+
+    struct topic_node **children;
+    unsigned int children_size;
+    unsigned int children_num;
+
+    struct topic_node *single_wildcard; // '+' child
+    struct topic_node *multi_wildcard;  // '#' child
+
+    void *data;
+};
+
+
+/**
+ * Topic tree.
+ *
+ * Topics are split into levels, every level is a node with hashed children,
+ * so both exact lookup and wildcard matching cost is proportional to topic depth.
+ *
+ */
+struct topic_tree
+{
+    struct topic_node root;
+    size_t size;
+};
+
+
+typedef void (*topic_tree_cb)(void *arg, void *data);
+
+
+struct topic_tree* topic_tree_new(void);
+struct topic_tree* topic_tree_delete(struct topic_tree *self, void (*destroy)(void *data));
+
+void topic_tree_init(struct topic_tree *self);
+void topic_tree_clean(struct topic_tree *self, void (*destroy)(void *data));
+
+void* topic_tree_insert(struct topic_tree *self, const char *topic, void *data);
+void* topic_tree_remove(struct topic_tree *self, const char *topic);
+void* topic_tree_find(struct topic_tree *self, const char *topic);
+
+unsigned int topic_tree_match(struct topic_tree *self, const char *topic, size_t topic_len, topic_tree_cb cb, void *arg);
+void topic_tree_foreach(struct topic_tree *self, topic_tree_cb cb, void *arg);
+
+bool topic_is_valid_filter(const char *topic);
+
+
+#endif /* __BOMBUS_TOPIC_TREE_H_ */
@@ -0,0 +1,130 @@
+
+#include "upload.h"
+#include "utils.h"
+
+#include "bombus/log.h"
+
+#include "mx/memory.h"
+#include "mx/string.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+
+
+/*
+ * Constructor
+ *
+ */
+struct upload* upload_new(const char *path, const char *topic, unsigned char qos, bool retain)
+{
+    struct upload *self = xmalloc(sizeof(struct upload));
+    self->path = xstrdup(path);
+    self->data = NULL;
+    self->len = 0;
+    self->topic = xstrdup(topic);
+    self->qos = qos;
+    self->retain = retain;
+    self->started = false;
+    self->written = false;
+    self->start_time = 0;
+    self->report_time = 0;
+    self->reported = 0;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        BOMBUS_ERROR("Cannot open %s, error %d", path, errno);
+        if (fd >= 0)
+            close(fd);
+        return upload_delete(self);
+    }
+
+    if (st.st_size > 0) {
+        void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem == MAP_FAILED) {
+            BOMBUS_ERROR("Cannot map %s, error %d", path, errno);
+            close(fd);
+            return upload_delete(self);
+        }
+        madvise(mem, st.st_size, MADV_SEQUENTIAL);
+        self->data = mem;
+        self->len = st.st_size;
+    }
+    close(fd);
+
+    return self;
+}
+
+
+/**
+ * Destructor
+ *
+ */
+struct upload* upload_delete(struct upload *self)
+{
+    if (self->data)
+        munmap(self->data, self->len);
+    xfree(self->path);
+    xfree(self->topic);
+
+    return xfree(self);
+}
+
+
+/**
+ * Mark upload started, restarted uploads are measured from the beginning.
+ *
+ */
+void upload_start(struct upload *self)
+{
+    self->started = true;
+    self->written = false;
+    self->start_time = monotonic_time_ms();
+    self->report_time = self->start_time;
+    self->reported = 0;
+}
+
+
+void upload_handle_time(struct upload *self, size_t written)
+{
+    if (!self->started || self->written)
+        return;
+    if (monotonic_time_ms() - self->report_time < UPLOAD_REPORT_INTERVAL)
+        return;
+
+    upload_report(self, written, false);
+}
+
+
+/**
+ * Print progress with throughput since last report, final report shows
+ * average throughput of whole upload.
+ *
+ */
+void upload_report(struct upload *self, size_t written, bool final)
+{
+    uint64_t now = monotonic_time_ms();
+
+    if (final) {
+        double seconds = (now - self->start_time) / 1000.0;
+        BOMBUS_INFO("Uploaded %s, %zu bytes in %.1f s, %.1f MB/s", self->path, self->len, seconds,
+                    seconds > 0 ? self->len / seconds / 1e6 : 0);
+        return;
+    }
+
+    double seconds = (now - self->report_time) / 1000.0;
+    double rate = seconds > 0 ? (written - self->reported) / seconds / 1e6 : 0;
+    BOMBUS_INFO("Uploading %s, %.1f/%.1f MB (%u%%), %.1f MB/s", self->path, written / 1e6, self->len / 1e6,
+                self->len > 0 ? (unsigned int)((uint64_t)written * 100 / self->len) : 100, rate);
+
+    self->report_time = now;
+    self->reported = written;
+}
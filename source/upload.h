@@ -0,0 +1,46 @@
+#ifndef __BOMBUS_UPLOAD_H_
+#define __BOMBUS_UPLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+#define UPLOAD_REPORT_INTERVAL      1000
+
+
+/**
+ * Memory-mapped file published as single message.
+ *
+ * Mapping is passed to client as it is, pages are read by kernel on demand
+ * and never copied into heap.
+ *
+ */
+struct upload
+{
+    char *path;
+    unsigned char *data;
+    size_t len;
+
+    char *topic;
+    unsigned char qos;
+    bool retain;
+
+    bool started;
+    bool written;
+    uint64_t start_time;
+    uint64_t report_time;
+    size_t reported;            // Bytes written at last report
+};
+
+
+struct upload* upload_new(const char *path, const char *topic, unsigned char qos, bool retain);
+struct upload* upload_delete(struct upload *self);
+
+void upload_start(struct upload *self);
+void upload_handle_time(struct upload *self, size_t written);
+void upload_report(struct upload *self, size_t written, bool final);
+
+
+#endif /* __BOMBUS_UPLOAD_H_ */
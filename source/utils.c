@@ -1,11 +1,16 @@
 
 #include "utils.h"
+#include "pool.h"
 
 #include "bombus/log.h"
 
 #include "mx/memory.h"
 #include "mx/string.h"
 #include "mx/misc.h"
+#include "mx/stream.h"
+
+#include <time.h>
+#include <string.h>
 
 
 
@@ -35,33 +40,47 @@ struct mqtt_msg_item* mqtt_msg_item_delete(struct mqtt_msg_item *self)
 }
 
 
-struct mqtt_msg_item* mqtt_msg_item_from_param(const char *param)
+static void* mqtt_msg_strndup(struct arena *arena, const char *str, size_t len)
 {
-    struct mqtt_msg_item *self = mqtt_msg_item_new();
+    if (arena)
+        return arena_strndup(arena, str, len);
+
+    char *dup = xmemdup(str, len + 1);
+    dup[len] = '\0';
+    return dup;
+}
+
 
+/**
+ * Parse 'TOPIC [QOS[R]] [PAYLOAD]' parameter.
+ *
+ * Strings are allocated from arena when given, from heap otherwise.
+ *
+ */
+static bool mqtt_msg_parse(struct mqtt_msg *msg, const char *param, struct arena *arena)
+{
     const char *topic = xstrltrim(param);
     size_t topic_len = xstr_word_len(topic, NULL);
-    self->msg.topic = xmemdup(topic, topic_len + 1);
-    self->msg.topic[topic_len] = '\0';
+    msg->topic = mqtt_msg_strndup(arena, topic, topic_len);
     if (strlen(param) == topic_len)
-        return self;
+        return true;
 
     const char *qos = xstrltrim(topic + topic_len);
     size_t qos_len = xstr_word_len(qos, NULL);
     if (qos_len > 0) {
         if ('0' <= qos[0] && qos[0] <= '2') {
-            self->msg.qos = qos[0] - '0';
+            msg->qos = qos[0] - '0';
         }
         else {
             BOMBUS_WARN("Invalid QoS argument, %c", qos[0]);
-            return mqtt_msg_item_delete(self);
+            return false;
         }
         if (qos_len > 1) {
             if (qos[1] == 'R') {
-                self->msg.retain = true;
+                msg->retain = true;
             } else {
                 BOMBUS_WARN("Invalid retain argument, %c", qos[1]);
-                return mqtt_msg_item_delete(self);
+                return false;
             }
         }
     }
@@ -69,16 +88,55 @@ struct mqtt_msg_item* mqtt_msg_item_from_param(const char *param)
     const char *payload = xstrltrim(qos + qos_len);
     size_t payload_len = strlen(payload);
     if (payload_len > 0) {
-        self->msg.payload = xmemdup(payload, payload_len + 1);
-        self->msg.payload[payload_len] = '\0';
-        xstrrtrim((char*)self->msg.payload);
-        self->msg.payload_len = strlen((char*)self->msg.payload);
+        msg->payload = mqtt_msg_strndup(arena, payload, payload_len);
+        xstrrtrim((char*)msg->payload);
+        msg->payload_len = strlen((char*)msg->payload);
     }
 
+    return true;
+}
+
+
+struct mqtt_msg_item* mqtt_msg_item_from_param(const char *param)
+{
+    struct mqtt_msg_item *self = mqtt_msg_item_new();
+
+    if (!mqtt_msg_parse(&self->msg, param, NULL))
+        return mqtt_msg_item_delete(self);
+    return self;
+}
+
+
+/**
+ * Parse parameter without touching heap in steady state.
+ *
+ * Item comes from pool, strings from arena, both are valid until item is
+ * released and arena reset.
+ *
+ */
+struct mqtt_msg_item* mqtt_msg_item_parse(const char *param, struct slab_pool *pool, struct arena *arena)
+{
+    struct mqtt_msg_item *self = slab_pool_alloc(pool);
+    mqtt_msg_init(&self->msg);
+
+    if (!mqtt_msg_parse(&self->msg, param, arena)) {
+        mqtt_msg_item_release(self, pool);
+        return NULL;
+    }
     return self;
 }
 
 
+/**
+ * Return parsed item to pool, strings are owned by arena.
+ *
+ */
+void mqtt_msg_item_release(struct mqtt_msg_item *self, struct slab_pool *pool)
+{
+    slab_pool_free(pool, self);
+}
+
+
 
 struct mqtt_msg_list* mqtt_msg_list_new(void)
 {
@@ -100,14 +158,63 @@ struct mqtt_msg_list* mqtt_msg_list_delete(struct mqtt_msg_list *self)
 }
 
 
-struct mqtt_msg_item* mqtt_msg_list_find_topic(struct mqtt_msg_list *self, const char *topic)
+
+
+uint64_t monotonic_time_ms(void)
 {
-    struct mqtt_msg_item *item;
-    LIST_FOREACH(item, self, _entry_) {
-        if (!strcmp(topic, item->msg.topic))
-            return item;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+uint64_t monotonic_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
 
-    return NULL;
+
+
+
+void line_buffer_init(struct line_buffer *self)
+{
+    self->len = 0;
 }
 
+
+/**
+ * Read available data and call handler for every complete line.
+ *
+ * Returns number of bytes read, zero or less on error.
+ *
+ */
+int line_buffer_read(struct line_buffer *self, struct stream *stream, line_handler handler, void *object)
+{
+    int bytes = stream_read(stream, self->data + self->len, sizeof(self->data) - self->len - 1);
+    if (bytes <= 0)
+        return bytes;
+
+    self->len += bytes;
+    self->data[self->len] = '\0';
+
+    char *line = self->data;
+    char *end;
+    while ((end = strchr(line, '\n'))) {
+        *end = '\0';
+        handler(object, line);
+        line = end + 1;
+    }
+
+    size_t left = self->len - (line - self->data);
+    if (left == sizeof(self->data) - 1) {
+        // Line too long, treat it as complete
+        handler(object, line);
+        left = 0;
+    }
+    memmove(self->data, line, left);
+    self->len = left;
+
+    return bytes;
+}
@@ -5,6 +5,9 @@
 #include "mx/mqtt.h"
 #include "mx/queue.h"
 
+#include <stdint.h>
+#include <stddef.h>
+
 
 
 
@@ -21,6 +24,12 @@ struct mqtt_msg_item* mqtt_msg_item_new(void);
 struct mqtt_msg_item* mqtt_msg_item_delete(struct mqtt_msg_item *self);
 struct mqtt_msg_item* mqtt_msg_item_from_param(const char *param);
 
+struct slab_pool;
+struct arena;
+
+struct mqtt_msg_item* mqtt_msg_item_parse(const char *param, struct slab_pool *pool, struct arena *arena);
+void mqtt_msg_item_release(struct mqtt_msg_item *self, struct slab_pool *pool);
+
 
 
 
@@ -31,7 +40,36 @@ LIST_HEAD(mqtt_msg_list, mqtt_msg_item);
 struct mqtt_msg_list* mqtt_msg_list_new(void);
 struct mqtt_msg_list* mqtt_msg_list_delete(struct mqtt_msg_list *self);
 
-struct mqtt_msg_item* mqtt_msg_list_find_topic(struct mqtt_msg_list *self, const char *topic);
+
+
+uint64_t monotonic_time_ms(void);
+uint64_t monotonic_time_ns(void);
+
+
+
+
+#define LINE_BUFFER_SIZE    4096
+
+
+struct stream;
+
+
+/**
+ * Splits stream data into lines, partial line is kept for the next read.
+ *
+ */
+struct line_buffer
+{
+    char data[LINE_BUFFER_SIZE];
+    size_t len;
+};
+
+
+typedef void (*line_handler)(void *object, char *line);
+
+
+void line_buffer_init(struct line_buffer *self);
+int line_buffer_read(struct line_buffer *self, struct stream *stream, line_handler handler, void *object);
 
 
 #endif /* __BOMBUS_UTILS_H_ */
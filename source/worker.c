@@ -0,0 +1,162 @@
+
+#include "worker.h"
+
+#include "bombus/log.h"
+
+#include "mx/stream.h"
+#include "mx/idler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+
+
+
+static int worker_handle_control(void *object, struct stream *stream);
+static void worker_handle_command(void *object, char *command);
+
+
+
+void worker_init(struct worker *self, unsigned int idx, bool *alive)
+{
+    self->idx = idx;
+    self->running = false;
+    self->finished = false;
+    self->alive = alive;
+
+    app_init(&self->app);
+    self->app.update_clock = false;     // Main thread updates clock
+
+    if (pipe(self->control) < 0) {
+        BOMBUS_ERROR("Worker %u control pipe error %d", idx, errno);
+        self->control[0] = self->control[1] = -1;
+        self->control_stream = NULL;
+        return;
+    }
+
+    line_buffer_init(&self->control_buffer);
+    self->control_stream = stream_new(self->control[0]);
+    stream_set_observer(self->control_stream, self, worker_handle_control);
+    idler_add_stream(app_get_idler(&self->app), self->control_stream);
+}
+
+
+void worker_clean(struct worker *self)
+{
+    if (self->running)
+        worker_stop(self);
+
+    if (self->control_stream) {
+        idler_remove_stream(app_get_idler(&self->app), self->control_stream);
+        stream_delete(self->control_stream);
+        self->control_stream = NULL;
+    }
+    if (self->control[0] >= 0)
+        close(self->control[0]);
+    if (self->control[1] >= 0)
+        close(self->control[1]);
+    self->control[0] = self->control[1] = -1;
+
+    app_clean(&self->app);
+}
+
+
+/**
+ * Configure worker clients, called before worker is started.
+ *
+ */
+void worker_configure(struct worker *self, struct args *args, unsigned int first, unsigned int count)
+{
+    app_configure(&self->app, args, first, count);
+}
+
+
+static void* worker_run(void *arg)
+{
+    struct worker *self = (struct worker*)arg;
+
+    // Signals are handled by main thread only
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Worker %u started with %u clients", self->idx, self->app.clients_num);
+    app_run(&self->app, self->alive);
+    __atomic_store_n(&self->finished, true, __ATOMIC_RELEASE);
+    BOMBUS_DEBUG(BOMBUS_DBG_CLIENT, "Worker %u finished", self->idx);
+
+    return NULL;
+}
+
+
+bool worker_start(struct worker *self)
+{
+    int err = pthread_create(&self->thread, NULL, worker_run, self);
+    if (err) {
+        BOMBUS_ERROR("Worker %u start error %d", self->idx, err);
+        return false;
+    }
+
+    self->running = true;
+    return true;
+}
+
+
+void worker_stop(struct worker *self)
+{
+    if (!self->running)
+        return;
+
+    worker_send_command(self, "quit");
+    pthread_join(self->thread, NULL);
+    self->running = false;
+}
+
+
+/**
+ * Pass command to worker thread.
+ *
+ * Command is written at once, pipe writes up to PIPE_BUF are atomic.
+ *
+ */
+void worker_send_command(struct worker *self, const char *command)
+{
+    if (self->control[1] < 0)
+        return;
+
+    char line[LINE_BUFFER_SIZE];
+    int len = snprintf(line, sizeof(line), "%s\n", command);
+    if (len < 0 || (size_t)len >= sizeof(line)) {
+        BOMBUS_WARN("Worker %u command too long", self->idx);
+        return;
+    }
+
+    if (write(self->control[1], line, len) != len)
+        BOMBUS_WARN("Worker %u command write error %d", self->idx, errno);
+}
+
+
+bool worker_is_finished(struct worker *self)
+{
+    return __atomic_load_n(&self->finished, __ATOMIC_ACQUIRE);
+}
+
+
+static int worker_handle_control(void *object, struct stream *stream)
+{
+    struct worker *self = (struct worker*)object;
+
+    line_buffer_read(&self->control_buffer, stream, worker_handle_command, self);
+    return 1;
+}
+
+
+static void worker_handle_command(void *object, char *command)
+{
+    struct worker *self = (struct worker*)object;
+
+    app_handle_command(&self->app, command);
+}
@@ -0,0 +1,52 @@
+
+#ifndef __BOMBUS_WORKER_H_
+#define __BOMBUS_WORKER_H_
+
+
+#include "app.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+
+
+struct stream;
+
+
+/**
+ * Application running in its own thread.
+ *
+ * Worker owns a shard of clients and its own idler, nothing is shared with
+ * other workers. Commands are passed through control pipe.
+ *
+ */
+struct worker
+{
+    unsigned int idx;
+    pthread_t thread;
+    bool running;
+    bool finished;              // Application stopped on its own, read atomically
+
+    struct app app;
+
+    int control[2];
+    struct stream *control_stream;
+    struct line_buffer control_buffer;
+
+    bool *alive;                // Shared by all workers, read atomically
+};
+
+
+
+void worker_init(struct worker *self, unsigned int idx, bool *alive);
+void worker_clean(struct worker *self);
+void worker_configure(struct worker *self, struct args *args, unsigned int first, unsigned int count);
+
+bool worker_start(struct worker *self);
+void worker_stop(struct worker *self);
+void worker_send_command(struct worker *self, const char *command);
+bool worker_is_finished(struct worker *self);
+
+
+#endif /* __BOMBUS_WORKER_H_ */
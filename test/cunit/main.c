@@ -0,0 +1,38 @@
+
+#include "tests.h"
+
+#include <CUnit/Basic.h>
+
+
+
+
+int main(void)
+{
+    int (*registers[])(void) = {
+        test_timer_wheel_register,
+        test_topic_tree_register,
+        test_packet_register,
+        test_alias_register,
+        test_inflight_register,
+        test_reader_register,
+        test_session_register,
+    };
+
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    for (unsigned int i=0; i<sizeof(registers)/sizeof(registers[0]); i++) {
+        if (registers[i]() != CUE_SUCCESS) {
+            CU_cleanup_registry();
+            return CU_get_error();
+        }
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    unsigned int failures = CU_get_number_of_failures();
+    CU_cleanup_registry();
+
+    return failures > 0 ? 1 : 0;
+}
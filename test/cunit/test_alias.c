@@ -0,0 +1,117 @@
+
+#include "tests.h"
+
+#include "alias.h"
+
+#include <string.h>
+
+
+
+
+static unsigned short test_alias_get(struct bombus_aliases *aliases, const char *topic, bool *known)
+{
+    return bombus_aliases_get(aliases, topic, strlen(topic), known);
+}
+
+
+
+
+static void test_alias_assign(void)
+{
+    struct bombus_aliases *aliases = bombus_aliases_new(4);
+    bool known;
+
+    // Not granted by broker
+    bombus_aliases_reset(aliases, 0);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "a", &known), 0);
+    CU_ASSERT_FALSE(known);
+
+    bombus_aliases_reset(aliases, 2);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "sensor/1", &known), 1);
+    CU_ASSERT_FALSE(known);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "sensor/2", &known), 2);
+    CU_ASSERT_FALSE(known);
+
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "sensor/1", &known), 1);
+    CU_ASSERT_TRUE(known);
+    CU_ASSERT_EQUAL(aliases->slots[0].topic->publishes, 2);
+    // Mapping costs alias property, later publish saves topic
+    CU_ASSERT_EQUAL(aliases->slots[0].topic->saved, 8 - 2 * BOMBUS_ALIAS_PROPERTY_LEN);
+
+    bombus_aliases_delete(aliases);
+}
+
+
+static void test_alias_lru(void)
+{
+    struct bombus_aliases *aliases = bombus_aliases_new(3);
+    bool known;
+
+    bombus_aliases_reset(aliases, 3);
+    test_alias_get(aliases, "a", &known);
+    test_alias_get(aliases, "b", &known);
+    test_alias_get(aliases, "c", &known);
+    test_alias_get(aliases, "a", &known);
+
+    // Least recently used 'b' gives its slot
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "d", &known), 2);
+    CU_ASSERT_FALSE(known);
+    CU_ASSERT_EQUAL(aliases->slots[1].topic->publishes, 1);
+
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "e", &known), 3);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "a", &known), 1);
+    CU_ASSERT_TRUE(known);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "b", &known), 2);
+    CU_ASSERT_FALSE(known);
+
+    // Evicted topics keep their counters
+    CU_ASSERT_EQUAL(aliases->topics_num, 5);
+    CU_ASSERT_EQUAL(aliases->slots[1].topic->publishes, 2);
+    CU_ASSERT_EQUAL(aliases->slots[1].topic->saved, -2 * BOMBUS_ALIAS_PROPERTY_LEN);
+
+    bombus_aliases_delete(aliases);
+}
+
+
+static void test_alias_reset(void)
+{
+    struct bombus_aliases *aliases = bombus_aliases_new(4);
+    bool known;
+
+    bombus_aliases_reset(aliases, 8);
+    CU_ASSERT_EQUAL(aliases->max, 4);
+    test_alias_get(aliases, "a", &known);
+    test_alias_get(aliases, "a", &known);
+    CU_ASSERT_TRUE(known);
+
+    // New connection, mapping is sent again but counters stay
+    bombus_aliases_reset(aliases, 4);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "a", &known), 1);
+    CU_ASSERT_FALSE(known);
+    CU_ASSERT_EQUAL(aliases->slots[0].topic->publishes, 3);
+
+    // Slots beyond broker limit are not used
+    bombus_aliases_reset(aliases, 1);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "b", &known), 1);
+    CU_ASSERT_EQUAL(test_alias_get(aliases, "a", &known), 1);
+    CU_ASSERT_FALSE(known);
+
+    bombus_aliases_delete(aliases);
+}
+
+
+
+
+int test_alias_register(void)
+{
+    CU_pSuite suite = CU_add_suite("alias", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "assign", test_alias_assign) ||
+        !CU_add_test(suite, "lru", test_alias_lru) ||
+        !CU_add_test(suite, "reset", test_alias_reset))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
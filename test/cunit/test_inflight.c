@@ -0,0 +1,100 @@
+
+#include "tests.h"
+
+#include "inflight.h"
+
+
+
+
+static void test_inflight_timeout_order(void)
+{
+    struct bombus_inflight *inflight = bombus_inflight_new(4, 1000);
+    struct bombus_inflight_msg *msgs[3];
+
+    CU_ASSERT_EQUAL(bombus_inflight_next_timeout(inflight), 0);
+
+    for (unsigned int i=0; i<3; i++) {
+        unsigned short msg_id = bombus_inflight_next_id(inflight);
+        msgs[i] = bombus_inflight_add(inflight, msg_id, 1, false, "t", "x", 1);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(msgs[i]);
+    }
+    CU_ASSERT_PTR_EQUAL(inflight->oldest, msgs[0]);
+    CU_ASSERT_EQUAL(bombus_inflight_next_timeout(inflight), msgs[0]->sent_ms + 1000);
+
+    // Resent message times out last
+    bombus_inflight_touch(inflight, msgs[0]);
+    CU_ASSERT_PTR_EQUAL(inflight->oldest, msgs[1]);
+    CU_ASSERT_PTR_EQUAL(inflight->newest, msgs[0]);
+
+    bombus_inflight_release(inflight, msgs[1]);
+    CU_ASSERT_PTR_EQUAL(inflight->oldest, msgs[2]);
+
+    bombus_inflight_remove(inflight, msgs[2]);
+    CU_ASSERT_PTR_EQUAL(inflight->oldest, msgs[0]);
+    CU_ASSERT_EQUAL(bombus_inflight_next_timeout(inflight), msgs[0]->sent_ms + 1000);
+
+    bombus_inflight_clear(inflight);
+    CU_ASSERT_EQUAL(inflight->count, 0);
+    CU_ASSERT_PTR_NULL(inflight->oldest);
+    CU_ASSERT_PTR_NULL(inflight->newest);
+    CU_ASSERT_EQUAL(bombus_inflight_next_timeout(inflight), 0);
+
+    bombus_inflight_delete(inflight);
+}
+
+
+static void test_inflight_ids(void)
+{
+    struct bombus_inflight *inflight = bombus_inflight_new(2, 1000);
+
+    unsigned short first = bombus_inflight_next_id(inflight);
+    CU_ASSERT_NOT_EQUAL(first, 0);
+    CU_ASSERT_PTR_NOT_NULL(bombus_inflight_add(inflight, first, 1, false, "t", NULL, 0));
+    CU_ASSERT_PTR_NULL(bombus_inflight_add(inflight, first, 1, false, "t", NULL, 0));
+    CU_ASSERT_PTR_NOT_NULL(bombus_inflight_find(inflight, first));
+
+    // Id whose slot is occupied is skipped
+    unsigned short second = bombus_inflight_next_id(inflight);
+    CU_ASSERT_PTR_NOT_NULL(bombus_inflight_add(inflight, second, 1, false, "t", NULL, 0));
+    CU_ASSERT_TRUE(bombus_inflight_is_full(inflight));
+    CU_ASSERT_EQUAL(bombus_inflight_next_id(inflight), 0);
+
+    bombus_inflight_delete(inflight);
+}
+
+
+static void test_inflight_shared_topic(void)
+{
+    struct bombus_inflight *inflight = bombus_inflight_new(2, 1000);
+    static const char topic[] = "prepared";
+
+    // Topic is referenced, payload is still copied for retransmission
+    unsigned short msg_id = bombus_inflight_next_id(inflight);
+    struct bombus_inflight_msg *msg = bombus_inflight_add_shared(inflight, msg_id, 1, false, topic, "x", 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
+    CU_ASSERT_PTR_EQUAL(msg->topic, topic);
+    CU_ASSERT_EQUAL(msg->payload_len, 1);
+
+    bombus_inflight_remove(inflight, msg);
+    CU_ASSERT_PTR_NULL(msg->topic);
+    CU_ASSERT_FALSE(msg->shared_topic);
+
+    bombus_inflight_delete(inflight);
+}
+
+
+
+
+int test_inflight_register(void)
+{
+    CU_pSuite suite = CU_add_suite("inflight", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "timeout_order", test_inflight_timeout_order) ||
+        !CU_add_test(suite, "ids", test_inflight_ids) ||
+        !CU_add_test(suite, "shared_topic", test_inflight_shared_topic))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
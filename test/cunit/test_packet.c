@@ -0,0 +1,116 @@
+
+#include "tests.h"
+
+#include "packet.h"
+
+
+
+
+static void test_packet_remaining_len(void)
+{
+    const struct {
+        unsigned char data[5];
+        size_t len;
+        size_t value;
+        size_t used;
+    } cases[] = {
+        { { 0x00 }, 1, 0, 1 },
+        { { 0x7F }, 1, 127, 1 },
+        { { 0x80, 0x01 }, 2, 128, 2 },
+        { { 0xFF, 0x7F }, 2, 16383, 2 },
+        { { 0x80, 0x80, 0x01 }, 3, 16384, 3 },
+        { { 0xFF, 0xFF, 0xFF, 0x7F }, 4, 268435455, 4 },
+        { { 0x05, 0xFF }, 2, 5, 1 },        // Trailing data is not consumed
+    };
+
+    for (unsigned int i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        size_t value, used;
+        CU_ASSERT_TRUE(bombus_packet_decode_remaining_len(cases[i].data, cases[i].len, &value, &used));
+        CU_ASSERT_EQUAL(value, cases[i].value);
+        CU_ASSERT_EQUAL(used, cases[i].used);
+    }
+}
+
+
+static void test_packet_remaining_len_invalid(void)
+{
+    const unsigned char truncated[] = { 0x80, 0x80 };
+    const unsigned char too_long[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+    size_t value, used;
+
+    CU_ASSERT_FALSE(bombus_packet_decode_remaining_len(truncated, 0, &value, &used));
+    CU_ASSERT_FALSE(bombus_packet_decode_remaining_len(truncated, sizeof(truncated), &value, &used));
+    CU_ASSERT_FALSE(bombus_packet_decode_remaining_len(too_long, sizeof(too_long), &value, &used));
+}
+
+
+static void test_packet_properties(void)
+{
+    const unsigned char props[] = {
+        0x24, 0x01,                         // Maximum QoS
+        0x22, 0x00, 0x0A,                   // Topic alias maximum
+        0x27, 0x00, 0x01, 0x00, 0x00,       // Maximum packet size
+        0x0B, 0x80, 0x01,                   // Subscription identifier
+        0x12, 0x00, 0x02, 'i', 'd',         // Assigned client identifier
+        0x26, 0x00, 0x01, 'k', 0x00, 0x01, 'v', // User property
+        0x13, 0x00, 0x3C,                   // Server keep alive
+    };
+    const unsigned char ids[] = { 0x24, 0x22, 0x27, 0x0B, 0x12, 0x26, 0x13 };
+    const uint32_t values[] = { 1, 10, 65536, 128, 0, 0, 60 };
+
+    size_t pos = 0;
+    unsigned char id;
+    uint32_t value;
+
+    for (unsigned int i=0; i<sizeof(ids); i++) {
+        CU_ASSERT_TRUE_FATAL(bombus_packet_next_property(props, sizeof(props), &pos, &id, &value));
+        CU_ASSERT_EQUAL(id, ids[i]);
+        CU_ASSERT_EQUAL(value, values[i]);
+    }
+    CU_ASSERT_EQUAL(pos, sizeof(props));
+    CU_ASSERT_FALSE(bombus_packet_next_property(props, sizeof(props), &pos, &id, &value));
+}
+
+
+static void test_packet_properties_malformed(void)
+{
+    const unsigned char short_int[] = { 0x22, 0x00 };
+    const unsigned char short_string[] = { 0x1F, 0x00, 0x05, 'e', 'r' };
+    const unsigned char short_pair[] = { 0x26, 0x00, 0x01, 'k' };
+    const unsigned char unknown[] = { 0x24, 0x01, 0x7F, 0x00 };
+
+    size_t pos;
+    unsigned char id;
+    uint32_t value;
+
+    pos = 0;
+    CU_ASSERT_FALSE(bombus_packet_next_property(short_int, sizeof(short_int), &pos, &id, &value));
+    pos = 0;
+    CU_ASSERT_FALSE(bombus_packet_next_property(short_string, sizeof(short_string), &pos, &id, &value));
+    pos = 0;
+    CU_ASSERT_FALSE(bombus_packet_next_property(short_pair, sizeof(short_pair), &pos, &id, &value));
+
+    // Unknown property is left for caller
+    pos = 0;
+    CU_ASSERT_TRUE(bombus_packet_next_property(unknown, sizeof(unknown), &pos, &id, &value));
+    CU_ASSERT_FALSE(bombus_packet_next_property(unknown, sizeof(unknown), &pos, &id, &value));
+    CU_ASSERT_EQUAL(pos, 2);
+}
+
+
+
+
+int test_packet_register(void)
+{
+    CU_pSuite suite = CU_add_suite("packet", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "remaining_len", test_packet_remaining_len) ||
+        !CU_add_test(suite, "remaining_len_invalid", test_packet_remaining_len_invalid) ||
+        !CU_add_test(suite, "properties", test_packet_properties) ||
+        !CU_add_test(suite, "properties_malformed", test_packet_properties_malformed))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
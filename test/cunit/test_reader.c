@@ -0,0 +1,221 @@
+
+#include "tests.h"
+
+#include "reader.h"
+
+#include <string.h>
+
+
+#define TEST_READER_MAX_EVENTS  8
+#define TEST_READER_MAX_DATA    512
+
+
+/**
+ * Events of one input, data of each event kind concatenated.
+ *
+ * Consecutive chunks are one event, their number depends on input split.
+ *
+ */
+struct test_reader_log
+{
+    int events[TEST_READER_MAX_EVENTS];
+    unsigned int count;
+    unsigned char frames[TEST_READER_MAX_DATA];
+    size_t frames_len;
+    unsigned char header[TEST_READER_MAX_DATA];
+    size_t header_len;
+    unsigned char payload[TEST_READER_MAX_DATA];
+    size_t payload_len;
+};
+
+
+
+
+static void test_reader_append(unsigned char *dst, size_t *dst_len, const unsigned char *data, size_t len)
+{
+    CU_ASSERT_FATAL(*dst_len + len <= TEST_READER_MAX_DATA);
+    memcpy(&dst[*dst_len], data, len);
+    *dst_len += len;
+}
+
+
+static void test_reader_record(struct test_reader_log *log, const struct bombus_reader_event *event)
+{
+    if (event->type == READER_EVENT_NONE)
+        return;
+
+    if (event->type != READER_EVENT_CHUNK || log->count == 0 || log->events[log->count - 1] != READER_EVENT_CHUNK) {
+        CU_ASSERT_FATAL(log->count < TEST_READER_MAX_EVENTS);
+        log->events[log->count++] = event->type;
+    }
+
+    if (event->type == READER_EVENT_FRAME)
+        test_reader_append(log->frames, &log->frames_len, event->data, event->len);
+    else if (event->type == READER_EVENT_PUBLISH)
+        test_reader_append(log->header, &log->header_len, event->data, event->len);
+    else if (event->type == READER_EVENT_CHUNK)
+        test_reader_append(log->payload, &log->payload_len, event->data, event->len);
+}
+
+
+/**
+ * Feed input in pieces of given size, the first one may be shorter.
+ *
+ */
+static void test_reader_feed(struct bombus_reader *reader, const unsigned char *data, size_t len, size_t first, size_t piece,
+                             struct test_reader_log *log)
+{
+    struct bombus_reader_event event;
+    size_t pos = 0;
+
+    memset(log, 0, sizeof(struct test_reader_log));
+    while (pos < len) {
+        size_t end = pos == 0 && first > 0 ? first : pos + piece;
+        if (end > len)
+            end = len;
+
+        while (pos < end) {
+            pos += bombus_reader_process(reader, &data[pos], end - pos, &event);
+            test_reader_record(log, &event);
+            if (event.type == READER_EVENT_ERROR)
+                return;
+        }
+    }
+}
+
+
+/**
+ * Input split at every byte boundary and fed byte by byte gives the same
+ * events as whole input.
+ *
+ */
+static void test_reader_check(size_t threshold, bool v5, const unsigned char *data, size_t len,
+                              const int *events, unsigned int count, const struct test_reader_log *expected)
+{
+    for (size_t split=0; split<len; split++) {
+        struct bombus_reader *reader = bombus_reader_new(threshold);
+        struct test_reader_log log;
+
+        reader->v5 = v5;
+        if (split == 0)
+            test_reader_feed(reader, data, len, 0, 1, &log);
+        else
+            test_reader_feed(reader, data, len, split, len, &log);
+
+        CU_ASSERT_EQUAL(log.count, count);
+        CU_ASSERT_EQUAL(memcmp(log.events, events, count * sizeof(int)), 0);
+        CU_ASSERT_EQUAL(log.frames_len, expected->frames_len);
+        CU_ASSERT_EQUAL(memcmp(log.frames, expected->frames, expected->frames_len), 0);
+        CU_ASSERT_EQUAL(log.header_len, expected->header_len);
+        CU_ASSERT_EQUAL(memcmp(log.header, expected->header, expected->header_len), 0);
+        CU_ASSERT_EQUAL(log.payload_len, expected->payload_len);
+        CU_ASSERT_EQUAL(memcmp(log.payload, expected->payload, expected->payload_len), 0);
+        CU_ASSERT_EQUAL(reader->state, READER_TYPE);
+
+        bombus_reader_delete(reader);
+    }
+}
+
+
+
+
+static void test_reader_frames(void)
+{
+    const unsigned char data[] = {
+        0x40, 0x02, 0x00, 0x01,             // PUBACK
+        0xD0, 0x00,                         // PINGRESP, empty body
+        0x30, 0x04, 0x00, 0x01, 't', 'x',   // Publish below threshold
+    };
+    const int events[] = { READER_EVENT_FRAME, READER_EVENT_FRAME, READER_EVENT_FRAME };
+    struct test_reader_log expected = {
+        .frames = { 0x00, 0x01, 0x00, 0x01, 't', 'x' },
+        .frames_len = 6,
+    };
+
+    test_reader_check(16, false, data, sizeof(data), events, 3, &expected);
+}
+
+
+static void test_reader_large_publish(void)
+{
+    unsigned char data[3 + 7 + 200 + 2];
+    struct test_reader_log expected;
+    const unsigned char header[] = { 0x00, 0x03, 'a', '/', 'b', 0x00, 0x05 };
+    const int events[] = { READER_EVENT_PUBLISH, READER_EVENT_CHUNK, READER_EVENT_FRAME };
+
+    // QoS 1 publish, remaining length takes two bytes, PINGRESP follows
+    memset(&expected, 0, sizeof(expected));
+    data[0] = 0x32;
+    data[1] = 0x80 | ((sizeof(header) + 200) & 0x7F);
+    data[2] = (sizeof(header) + 200) >> 7;
+    memcpy(&data[3], header, sizeof(header));
+    for (unsigned int i=0; i<200; i++)
+        data[3 + sizeof(header) + i] = expected.payload[i] = (unsigned char)i;
+    data[sizeof(data) - 2] = 0xD0;
+    data[sizeof(data) - 1] = 0x00;
+
+    memcpy(expected.header, header, sizeof(header));
+    expected.header_len = sizeof(header);
+    expected.payload_len = 200;
+
+    test_reader_check(16, false, data, sizeof(data), events, 3, &expected);
+}
+
+
+static void test_reader_large_publish_v5(void)
+{
+    const unsigned char data[] = {
+        0x30, 15,
+        0x00, 0x01, 't',
+        0x03, 0x23, 0x00, 0x07,             // Topic alias property
+        '0', '1', '2', '3', '4', '5', '6', '7',
+    };
+    const int events[] = { READER_EVENT_PUBLISH, READER_EVENT_CHUNK };
+    struct test_reader_log expected = {
+        .header = { 0x00, 0x01, 't', 0x03, 0x23, 0x00, 0x07 },
+        .header_len = 7,
+        .payload = { '0', '1', '2', '3', '4', '5', '6', '7' },
+        .payload_len = 8,
+    };
+
+    test_reader_check(4, true, data, sizeof(data), events, 2, &expected);
+}
+
+
+static void test_reader_malformed(void)
+{
+    const unsigned char suback[] = { 0x90, 0x20 };                      // Only publish may exceed threshold
+    const unsigned char topic[] = { 0x30, 0x20, 0x00, 0x40 };           // Topic longer than packet
+    const unsigned char length[] = { 0x30, 0xFF, 0xFF, 0xFF, 0xFF };    // Remaining length over four bytes
+    const unsigned char *inputs[] = { suback, topic, length };
+    const size_t lens[] = { sizeof(suback), sizeof(topic), sizeof(length) };
+
+    for (unsigned int i=0; i<sizeof(inputs)/sizeof(inputs[0]); i++) {
+        struct bombus_reader *reader = bombus_reader_new(16);
+        struct test_reader_log log;
+
+        test_reader_feed(reader, inputs[i], lens[i], 0, 1, &log);
+        CU_ASSERT_EQUAL(log.count, 1);
+        CU_ASSERT_EQUAL(log.events[0], READER_EVENT_ERROR);
+
+        bombus_reader_delete(reader);
+    }
+}
+
+
+
+
+int test_reader_register(void)
+{
+    CU_pSuite suite = CU_add_suite("reader", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "frames", test_reader_frames) ||
+        !CU_add_test(suite, "large_publish", test_reader_large_publish) ||
+        !CU_add_test(suite, "large_publish_v5", test_reader_large_publish_v5) ||
+        !CU_add_test(suite, "malformed", test_reader_malformed))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
@@ -0,0 +1,225 @@
+
+#include "tests.h"
+
+#include "session.h"
+#include "inflight.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+
+
+
+static void test_session_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/bombus-test-%d.session", (int)getpid());
+    unlink(path);
+}
+
+
+static struct bombus_session* test_session_open(const char *path, struct bombus_inflight *inflight)
+{
+    struct bombus_session *session = bombus_session_open(path, inflight);
+    if (session)
+        inflight->session = session;
+    return session;
+}
+
+
+static void test_session_close(struct bombus_session *session, struct bombus_inflight *inflight)
+{
+    inflight->session = NULL;
+    bombus_session_close(session);
+    bombus_inflight_delete(inflight);
+}
+
+
+/**
+ * Journal state shared by tests: QoS 1 message 1, released QoS 2 message 2,
+ * incoming QoS 2 id 7 and filter s/# with QoS 1.
+ *
+ */
+static void test_session_fill(struct bombus_inflight *inflight, struct bombus_session *session)
+{
+    bombus_inflight_add(inflight, 1, 1, true, "a", "one", 3);
+    bombus_inflight_release(inflight, bombus_inflight_add(inflight, 2, 2, false, "b", "two", 3));
+    bombus_inflight_remove(inflight, bombus_inflight_add(inflight, 3, 1, false, "c", "three", 5));
+    bombus_inflight_mark_received(inflight, 7);
+    bombus_inflight_mark_received(inflight, 8);
+    bombus_inflight_release_received(inflight, 8);
+
+    bombus_session_subscribe(session, "s/#", 1);
+    bombus_session_subscribe(session, "t", 0);
+    bombus_session_unsubscribe(session, "t");
+}
+
+
+static void test_session_check(struct bombus_inflight *inflight, struct bombus_session *session)
+{
+    CU_ASSERT_EQUAL(inflight->count, 2);
+
+    struct bombus_inflight_msg *msg = bombus_inflight_find(inflight, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
+    CU_ASSERT_EQUAL(msg->state, INFLIGHT_PUBLISHED);
+    CU_ASSERT_EQUAL(msg->qos, 1);
+    CU_ASSERT_TRUE(msg->retain);
+    CU_ASSERT_STRING_EQUAL(msg->topic, "a");
+    CU_ASSERT_EQUAL(msg->payload_len, 3);
+    CU_ASSERT_EQUAL(memcmp(msg->payload, "one", 3), 0);
+
+    msg = bombus_inflight_find(inflight, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(msg);
+    CU_ASSERT_EQUAL(msg->state, INFLIGHT_RELEASED);
+    CU_ASSERT_EQUAL(msg->payload_len, 0);
+
+    CU_ASSERT_PTR_NULL(bombus_inflight_find(inflight, 3));
+
+    // Id already marked is reported as duplicate
+    CU_ASSERT_FALSE(bombus_inflight_mark_received(inflight, 7));
+    CU_ASSERT_TRUE(bombus_inflight_mark_received(inflight, 8));
+
+    const struct bombus_session_subscription *subscription = bombus_session_find_subscription(session, "s/#");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(subscription);
+    CU_ASSERT_EQUAL(subscription->qos, 1);
+    CU_ASSERT_PTR_NULL(bombus_session_find_subscription(session, "t"));
+}
+
+
+
+
+static void test_session_load(void)
+{
+    char path[64];
+    test_session_path(path, sizeof(path));
+
+    struct bombus_inflight *inflight = bombus_inflight_new(8, 1000);
+    struct bombus_session *session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    test_session_fill(inflight, session);
+    test_session_close(session, inflight);
+
+    inflight = bombus_inflight_new(8, 1000);
+    session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    test_session_check(inflight, session);
+    test_session_close(session, inflight);
+
+    unlink(path);
+}
+
+
+static void test_session_torn_tail(void)
+{
+    char path[64];
+    test_session_path(path, sizeof(path));
+
+    struct bombus_inflight *inflight = bombus_inflight_new(8, 1000);
+    struct bombus_session *session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    test_session_fill(inflight, session);
+    test_session_close(session, inflight);
+
+    // Record announcing longer body than written, as after crash mid write
+    const unsigned char torn[] = { SESSION_ADD, 0x01, 0x00, 0x09, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 'x' };
+    int fd = open(path, O_WRONLY | O_APPEND);
+    CU_ASSERT_FATAL(fd >= 0);
+    CU_ASSERT_EQUAL(write(fd, torn, sizeof(torn)), (ssize_t)sizeof(torn));
+    close(fd);
+
+    inflight = bombus_inflight_new(8, 1000);
+    session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    test_session_check(inflight, session);
+    CU_ASSERT_PTR_NULL(bombus_inflight_find(inflight, 9));
+    test_session_close(session, inflight);
+
+    unlink(path);
+}
+
+
+static void test_session_compact(void)
+{
+    char path[64];
+    struct stat st;
+    test_session_path(path, sizeof(path));
+
+    struct bombus_inflight *inflight = bombus_inflight_new(8, 1000);
+    struct bombus_session *session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+
+    // Acknowledged messages only grow journal
+    for (unsigned short id=10; id<100; id++)
+        bombus_inflight_remove(inflight, bombus_inflight_add(inflight, id, 1, false, "old", "payload", 7));
+    test_session_fill(inflight, session);
+
+    CU_ASSERT_EQUAL(stat(path, &st), 0);
+    off_t journal_size = st.st_size;
+    CU_ASSERT_EQUAL((size_t)journal_size, session->size);
+
+    bombus_session_compact(session, inflight);
+    CU_ASSERT_EQUAL(stat(path, &st), 0);
+    CU_ASSERT_TRUE(st.st_size < journal_size);
+    CU_ASSERT_EQUAL((size_t)st.st_size, session->size);
+
+    // Journal goes on after snapshot
+    bombus_inflight_remove(inflight, bombus_inflight_add(inflight, 3, 1, false, "c", "three", 5));
+    test_session_close(session, inflight);
+
+    inflight = bombus_inflight_new(8, 1000);
+    session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    test_session_check(inflight, session);
+    test_session_close(session, inflight);
+
+    unlink(path);
+}
+
+
+static void test_session_overflow(void)
+{
+    char path[64];
+    test_session_path(path, sizeof(path));
+
+    struct bombus_inflight *inflight = bombus_inflight_new(8, 1000);
+    struct bombus_session *session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    for (unsigned short id=1; id<=4; id++)
+        bombus_inflight_add(inflight, id, 1, false, "a", "x", 1);
+    test_session_close(session, inflight);
+
+    // Stored messages do not fit smaller window, journal is kept
+    inflight = bombus_inflight_new(2, 1000);
+    CU_ASSERT_PTR_NULL(bombus_session_open(path, inflight));
+    CU_ASSERT_EQUAL(inflight->count, 0);
+    bombus_inflight_delete(inflight);
+
+    inflight = bombus_inflight_new(8, 1000);
+    session = test_session_open(path, inflight);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(session);
+    CU_ASSERT_EQUAL(inflight->count, 4);
+    test_session_close(session, inflight);
+
+    unlink(path);
+}
+
+
+
+
+int test_session_register(void)
+{
+    CU_pSuite suite = CU_add_suite("session", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "load", test_session_load) ||
+        !CU_add_test(suite, "torn_tail", test_session_torn_tail) ||
+        !CU_add_test(suite, "compact", test_session_compact) ||
+        !CU_add_test(suite, "overflow", test_session_overflow))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
@@ -0,0 +1,173 @@
+
+#include "tests.h"
+
+#include "timer_wheel.h"
+
+
+
+
+struct fired
+{
+    unsigned int count;
+    uint64_t at;                // Wheel time when callback ran
+    struct timer_wheel *wheel;
+};
+
+
+static void test_timer_cb(void *arg)
+{
+    struct fired *fired = arg;
+    fired->count++;
+    fired->at = fired->wheel->now - 1;
+}
+
+
+static struct fired rearmed;
+static struct timer_entry rearmed_timer;
+
+static void test_timer_rearm_cb(void *arg)
+{
+    struct timer_wheel *wheel = arg;
+    rearmed.count++;
+    if (rearmed.count < 3)
+        timer_wheel_schedule(wheel, &rearmed_timer, wheel->now + 10);
+}
+
+
+
+
+static void test_timer_wheel_level0(void)
+{
+    struct timer_wheel wheel;
+    struct timer_entry timer;
+    struct fired fired = { 0, 0, &wheel };
+
+    timer_wheel_init(&wheel, 1000);
+    timer_entry_init(&timer, test_timer_cb, &fired);
+    timer_wheel_schedule(&wheel, &timer, 1010);
+    CU_ASSERT_TRUE(timer_entry_is_pending(&timer));
+    CU_ASSERT_EQUAL(timer_wheel_next_expiry(&wheel), 1010);
+
+    timer_wheel_advance(&wheel, 1009);
+    CU_ASSERT_EQUAL(fired.count, 0);
+    timer_wheel_advance(&wheel, 1010);
+    CU_ASSERT_EQUAL(fired.count, 1);
+    CU_ASSERT_EQUAL(fired.at, 1010);
+    CU_ASSERT_FALSE(timer_entry_is_pending(&timer));
+    CU_ASSERT_EQUAL(timer_wheel_next_expiry(&wheel), 0);
+}
+
+
+static void test_timer_wheel_cascade(void)
+{
+    struct timer_wheel wheel;
+    struct timer_entry timers[3];
+    struct fired fired[3] = { { 0, 0, &wheel }, { 0, 0, &wheel }, { 0, 0, &wheel } };
+    uint64_t expires[3] = { 100, 5000, 300000 };    // Levels 1, 2 and 3
+
+    timer_wheel_init(&wheel, 0);
+    for (unsigned int i=0; i<3; i++) {
+        timer_entry_init(&timers[i], test_timer_cb, &fired[i]);
+        timer_wheel_schedule(&wheel, &timers[i], expires[i]);
+    }
+    CU_ASSERT_EQUAL(timer_wheel_next_expiry(&wheel), 100);
+
+    for (unsigned int i=0; i<3; i++) {
+        timer_wheel_advance(&wheel, expires[i] - 1);
+        CU_ASSERT_EQUAL(fired[i].count, 0);
+        timer_wheel_advance(&wheel, expires[i]);
+        CU_ASSERT_EQUAL(fired[i].count, 1);
+        CU_ASSERT_EQUAL(fired[i].at, expires[i]);
+    }
+    CU_ASSERT_EQUAL(wheel.count, 0);
+}
+
+
+static void test_timer_wheel_wraparound(void)
+{
+    struct timer_wheel wheel;
+    struct timer_entry near, far;
+    struct fired fired_near = { 0, 0, &wheel };
+    struct fired fired_far = { 0, 0, &wheel };
+
+    // Start just before level 0 wraps, first timer lands in next turn
+    timer_wheel_init(&wheel, 4095);
+    timer_entry_init(&near, test_timer_cb, &fired_near);
+    timer_wheel_schedule(&wheel, &near, 4100);
+    timer_wheel_advance(&wheel, 4100);
+    CU_ASSERT_EQUAL(fired_near.count, 1);
+    CU_ASSERT_EQUAL(fired_near.at, 4100);
+
+    // Beyond wheel range, timer is parked in the last level and moved down later
+    uint64_t expires = wheel.now + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) + 123;
+    timer_entry_init(&far, test_timer_cb, &fired_far);
+    timer_wheel_schedule(&wheel, &far, expires);
+    timer_wheel_advance(&wheel, expires - 1);
+    CU_ASSERT_EQUAL(fired_far.count, 0);
+    CU_ASSERT_TRUE(timer_entry_is_pending(&far));
+    timer_wheel_advance(&wheel, expires);
+    CU_ASSERT_EQUAL(fired_far.count, 1);
+    CU_ASSERT_EQUAL(fired_far.at, expires);
+}
+
+
+static void test_timer_wheel_cancel(void)
+{
+    struct timer_wheel wheel;
+    struct timer_entry first, second;
+    struct fired fired_first = { 0, 0, &wheel };
+    struct fired fired_second = { 0, 0, &wheel };
+
+    timer_wheel_init(&wheel, 0);
+    timer_entry_init(&first, test_timer_cb, &fired_first);
+    timer_entry_init(&second, test_timer_cb, &fired_second);
+    timer_wheel_schedule(&wheel, &first, 70);
+    timer_wheel_schedule(&wheel, &second, 70);
+    timer_wheel_cancel(&wheel, &first);
+    timer_wheel_cancel(&wheel, &first);
+    CU_ASSERT_EQUAL(wheel.count, 1);
+
+    // Rescheduling moves timer instead of adding it twice
+    timer_wheel_schedule(&wheel, &second, 80);
+    CU_ASSERT_EQUAL(wheel.count, 1);
+    CU_ASSERT_EQUAL(timer_wheel_next_expiry(&wheel), 80);
+
+    timer_wheel_advance(&wheel, 100);
+    CU_ASSERT_EQUAL(fired_first.count, 0);
+    CU_ASSERT_EQUAL(fired_second.count, 1);
+    CU_ASSERT_EQUAL(fired_second.at, 80);
+}
+
+
+static void test_timer_wheel_rearm(void)
+{
+    struct timer_wheel wheel;
+
+    rearmed.count = 0;
+    timer_wheel_init(&wheel, 0);
+    timer_entry_init(&rearmed_timer, test_timer_rearm_cb, &wheel);
+    timer_wheel_schedule(&wheel, &rearmed_timer, 10);
+
+    timer_wheel_advance(&wheel, 1000);
+    CU_ASSERT_EQUAL(rearmed.count, 3);
+    CU_ASSERT_EQUAL(wheel.count, 0);
+}
+
+
+
+
+int test_timer_wheel_register(void)
+{
+    CU_pSuite suite = CU_add_suite("timer_wheel", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "level0", test_timer_wheel_level0) ||
+        !CU_add_test(suite, "cascade", test_timer_wheel_cascade) ||
+        !CU_add_test(suite, "wraparound", test_timer_wheel_wraparound) ||
+        !CU_add_test(suite, "cancel", test_timer_wheel_cancel) ||
+        !CU_add_test(suite, "rearm", test_timer_wheel_rearm))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
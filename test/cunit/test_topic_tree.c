@@ -0,0 +1,146 @@
+
+#include "tests.h"
+
+#include "topic_tree.h"
+
+#include <string.h>
+
+
+
+
+static const char *filters[] = {
+    "a/b/c",        // 0
+    "a/+/c",        // 1
+    "a/#",          // 2
+    "+/b/+",        // 3
+    "#",            // 4
+    "a/b",          // 5
+    "a/+",          // 6
+    "$SYS/#",       // 7
+};
+
+#define FILTERS_NUM     (sizeof(filters)/sizeof(filters[0]))
+
+static unsigned int ids[FILTERS_NUM];
+
+
+static void test_topic_collect(void *arg, void *data)
+{
+    unsigned int *matched = arg;
+    *matched |= 1u << *(unsigned int*)data;
+}
+
+
+static unsigned int test_topic_match(struct topic_tree *tree, const char *topic)
+{
+    unsigned int matched = 0;
+    unsigned int count = topic_tree_match(tree, topic, strlen(topic), test_topic_collect, &matched);
+
+    CU_ASSERT_EQUAL(count, (unsigned int)__builtin_popcount(matched));
+    return matched;
+}
+
+
+static struct topic_tree* test_topic_tree_fill(void)
+{
+    struct topic_tree *tree = topic_tree_new();
+    for (unsigned int i=0; i<FILTERS_NUM; i++) {
+        ids[i] = i;
+        topic_tree_insert(tree, filters[i], &ids[i]);
+    }
+    return tree;
+}
+
+
+#define BIT(n)      (1u << (n))
+
+
+
+
+static void test_topic_tree_exact(void)
+{
+    struct topic_tree *tree = test_topic_tree_fill();
+
+    CU_ASSERT_PTR_EQUAL(topic_tree_find(tree, "a/+/c"), &ids[1]);
+    CU_ASSERT_PTR_NULL(topic_tree_find(tree, "a/b/c/d"));
+    CU_ASSERT_EQUAL(tree->size, FILTERS_NUM);
+
+    CU_ASSERT_PTR_EQUAL(topic_tree_remove(tree, "a/b/c"), &ids[0]);
+    CU_ASSERT_PTR_NULL(topic_tree_find(tree, "a/b/c"));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a/b/c"), BIT(1) | BIT(2) | BIT(3) | BIT(4));
+
+    topic_tree_delete(tree, NULL);
+}
+
+
+static void test_topic_tree_single_wildcard(void)
+{
+    struct topic_tree *tree = test_topic_tree_fill();
+
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a/x/c"), BIT(1) | BIT(2) | BIT(4));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "x/b/y"), BIT(3) | BIT(4));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a/x"), BIT(2) | BIT(4) | BIT(6));
+    // Empty level is matched by '+' too
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a//c"), BIT(1) | BIT(2) | BIT(4));
+
+    topic_tree_delete(tree, NULL);
+}
+
+
+static void test_topic_tree_multi_wildcard(void)
+{
+    struct topic_tree *tree = test_topic_tree_fill();
+
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a/b/c"), BIT(0) | BIT(1) | BIT(2) | BIT(3) | BIT(4));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a/b/c/d"), BIT(2) | BIT(4));
+    // Parent level matches 'a/#'
+    CU_ASSERT_EQUAL(test_topic_match(tree, "a"), BIT(2) | BIT(4));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "b"), BIT(4));
+
+    topic_tree_delete(tree, NULL);
+}
+
+
+static void test_topic_tree_system(void)
+{
+    struct topic_tree *tree = test_topic_tree_fill();
+
+    // Wildcards in first level do not match '$' topics
+    CU_ASSERT_EQUAL(test_topic_match(tree, "$SYS/uptime"), BIT(7));
+    CU_ASSERT_EQUAL(test_topic_match(tree, "$SYS/b/x"), BIT(7));
+
+    topic_tree_delete(tree, NULL);
+}
+
+
+static void test_topic_tree_valid_filter(void)
+{
+    CU_ASSERT_TRUE(topic_is_valid_filter("a/+/c"));
+    CU_ASSERT_TRUE(topic_is_valid_filter("+"));
+    CU_ASSERT_TRUE(topic_is_valid_filter("a/#"));
+    CU_ASSERT_TRUE(topic_is_valid_filter("#"));
+
+    CU_ASSERT_FALSE(topic_is_valid_filter(""));
+    CU_ASSERT_FALSE(topic_is_valid_filter("a+/b"));
+    CU_ASSERT_FALSE(topic_is_valid_filter("a/#/c"));
+    CU_ASSERT_FALSE(topic_is_valid_filter("a/b#"));
+}
+
+
+
+
+int test_topic_tree_register(void)
+{
+    CU_pSuite suite = CU_add_suite("topic_tree", NULL, NULL);
+    if (!suite)
+        return CU_get_error();
+
+    if (!CU_add_test(suite, "exact", test_topic_tree_exact) ||
+        !CU_add_test(suite, "single_wildcard", test_topic_tree_single_wildcard) ||
+        !CU_add_test(suite, "multi_wildcard", test_topic_tree_multi_wildcard) ||
+        !CU_add_test(suite, "system", test_topic_tree_system) ||
+        !CU_add_test(suite, "valid_filter", test_topic_tree_valid_filter))
+        return CU_get_error();
+
+    return CUE_SUCCESS;
+}
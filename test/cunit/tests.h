@@ -0,0 +1,18 @@
+
+#ifndef __BOMBUS_TESTS_H_
+#define __BOMBUS_TESTS_H_
+
+#include <CUnit/CUnit.h>
+
+
+
+int test_timer_wheel_register(void);
+int test_topic_tree_register(void);
+int test_packet_register(void);
+int test_alias_register(void);
+int test_inflight_register(void);
+int test_reader_register(void);
+int test_session_register(void);
+
+
+#endif /* __BOMBUS_TESTS_H_ */